@@ -0,0 +1,291 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// Basic Usage Environment: A queue of delayed tasks, implemented as a 4-ary heap.
+// Unlike "DelayQueue" (a sorted list, in which adding or removing an entry takes time proportional to the number of
+// entries), adding an entry takes O(1) time on average (because most new timers are due later than most existing ones),
+// and O(log n) time at worst; removing an entry takes O(log n) time.
+// Entries that are due at the same time are handled in the order that they were added.
+// C++ header
+
+#ifndef _HEAP_DELAY_QUEUE_HH
+#define _HEAP_DELAY_QUEUE_HH
+
+#ifndef _USAGE_ENVIRONMENT_HH
+#include "UsageEnvironment.hh"
+#endif
+
+#if !defined(_WIN32)
+#include <time.h>
+#include <sys/time.h>
+#endif
+
+// The low bits of each "TaskToken" index an entry; the remaining bits hold the entry's 'generation', so that a token
+// for an entry that has since been handled (or removed) is not mistaken for a newer entry that reuses its slot:
+#define HEAP_DELAY_QUEUE_INDEX_BITS 24
+#define HEAP_DELAY_QUEUE_MAX_ENTRIES ((1u<<HEAP_DELAY_QUEUE_INDEX_BITS) - 1)
+
+class HeapDelayQueue {
+public:
+  HeapDelayQueue();
+  ~HeapDelayQueue();
+
+  TaskToken addEntry(int64_t microseconds, TaskFunc* proc, void* clientData);
+      // Returns NULL if the queue is full
+  void removeEntry(TaskToken& token);
+      // Sets "token" to NULL.  Does nothing if the entry has already been handled (or removed).
+  void updateEntry(TaskToken& token, int64_t microseconds, TaskFunc* proc, void* clientData);
+      // Changes the entry's due time (and task), keeping its token.  If the entry has already been handled (or removed),
+      // a new entry is added, and "token" is set to its token.
+
+  int64_t timeToNextAlarm() const;
+      // in microseconds; -1 if the queue is empty
+  void handleAlarm();
+      // Handles every entry that is now due (but not entries that are added while we're doing so)
+
+  unsigned numEntries() const { return fNumHeapEntries; }
+
+  static int64_t timeNow(); // in microseconds, from a monotonic clock
+
+private:
+  struct Entry {
+    int64_t dueTime;
+    u_int64_t sequenceNum; // orders entries with the same "dueTime"
+    TaskFunc* proc;
+    void* clientData;
+    uintptr_t generation;
+    unsigned heapIndex; // our position in "fHeap" (if we're in use), or the next free entry (if we're not)
+  };
+
+  Entry* lookup(TaskToken token) const;
+  Boolean isEarlier(unsigned entryIndex1, unsigned entryIndex2) const {
+    Entry const& e1 = fEntries[entryIndex1];
+    Entry const& e2 = fEntries[entryIndex2];
+    return e1.dueTime < e2.dueTime || (e1.dueTime == e2.dueTime && e1.sequenceNum < e2.sequenceNum);
+  }
+  void placeAt(unsigned heapIndex, unsigned entryIndex) {
+    fHeap[heapIndex] = entryIndex;
+    fEntries[entryIndex].heapIndex = heapIndex;
+  }
+  void siftUp(unsigned heapIndex);
+  void siftDown(unsigned heapIndex);
+  void removeFromHeap(unsigned heapIndex);
+  void freeEntry(unsigned entryIndex);
+  Boolean grow();
+
+private:
+  Entry* fEntries;
+  unsigned* fHeap; // indices into "fEntries"
+  unsigned fCapacity; // of both "fEntries" and "fHeap"
+  unsigned fNumHeapEntries;
+  unsigned fFreeList; // the first free entry, or HEAP_DELAY_QUEUE_NO_ENTRY if none
+  u_int64_t fNextSequenceNum;
+};
+
+
+////////// Implementation //////////
+
+#define HEAP_DELAY_QUEUE_GENERATION_MASK ((~(uintptr_t)0)>>HEAP_DELAY_QUEUE_INDEX_BITS)
+#define HEAP_DELAY_QUEUE_NO_ENTRY (~0u)
+
+inline HeapDelayQueue::HeapDelayQueue()
+  : fEntries(NULL), fHeap(NULL), fCapacity(0), fNumHeapEntries(0),
+    fFreeList(HEAP_DELAY_QUEUE_NO_ENTRY), fNextSequenceNum(0) {
+}
+
+inline HeapDelayQueue::~HeapDelayQueue() {
+  delete[] fEntries;
+  delete[] fHeap;
+}
+
+inline int64_t HeapDelayQueue::timeNow() {
+#if defined(_WIN32)
+  return (int64_t)GetTickCount64()*1000;
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec*1000000 + tv.tv_usec;
+#endif
+}
+
+inline Boolean HeapDelayQueue::grow() {
+  unsigned newCapacity = fCapacity == 0 ? 64 : 2*fCapacity;
+  if (newCapacity > HEAP_DELAY_QUEUE_MAX_ENTRIES) newCapacity = HEAP_DELAY_QUEUE_MAX_ENTRIES;
+  if (newCapacity <= fCapacity) return False;
+
+  Entry* newEntries = new Entry[newCapacity];
+  unsigned* newHeap = new unsigned[newCapacity];
+  for (unsigned i = 0; i < fCapacity; ++i) newEntries[i] = fEntries[i];
+  for (unsigned i = 0; i < fNumHeapEntries; ++i) newHeap[i] = fHeap[i];
+
+  // Add the new entries to the free list:
+  for (unsigned i = fCapacity; i < newCapacity; ++i) {
+    newEntries[i].generation = 1;
+    newEntries[i].heapIndex = i+1 < newCapacity ? i+1 : fFreeList;
+  }
+  fFreeList = fCapacity;
+
+  delete[] fEntries; fEntries = newEntries;
+  delete[] fHeap; fHeap = newHeap;
+  fCapacity = newCapacity;
+  return True;
+}
+
+inline void HeapDelayQueue::freeEntry(unsigned entryIndex) {
+  Entry& entry = fEntries[entryIndex];
+  entry.generation = (entry.generation + 1)&HEAP_DELAY_QUEUE_GENERATION_MASK;
+  if (entry.generation == 0) entry.generation = 1; // so that no token is NULL
+  entry.heapIndex = fFreeList;
+  fFreeList = entryIndex;
+}
+
+inline HeapDelayQueue::Entry* HeapDelayQueue::lookup(TaskToken token) const {
+  uintptr_t t = (uintptr_t)token;
+  unsigned entryIndex = (unsigned)(t&HEAP_DELAY_QUEUE_MAX_ENTRIES);
+  if (entryIndex == 0 || entryIndex > fCapacity) return NULL;
+
+  Entry* entry = &fEntries[entryIndex-1];
+  if (entry->generation != (t>>HEAP_DELAY_QUEUE_INDEX_BITS)) return NULL; // a stale token
+  return entry;
+}
+
+inline void HeapDelayQueue::siftUp(unsigned heapIndex) {
+  unsigned entryIndex = fHeap[heapIndex];
+  while (heapIndex > 0) {
+    unsigned parent = (heapIndex-1)/4;
+    if (!isEarlier(entryIndex, fHeap[parent])) break;
+    placeAt(heapIndex, fHeap[parent]);
+    heapIndex = parent;
+  }
+  placeAt(heapIndex, entryIndex);
+}
+
+inline void HeapDelayQueue::siftDown(unsigned heapIndex) {
+  unsigned entryIndex = fHeap[heapIndex];
+  while (1) {
+    unsigned firstChild = 4*heapIndex + 1;
+    if (firstChild >= fNumHeapEntries) break;
+
+    unsigned lastChild = firstChild + 3;
+    if (lastChild >= fNumHeapEntries) lastChild = fNumHeapEntries - 1;
+    unsigned earliest = firstChild;
+    for (unsigned child = firstChild + 1; child <= lastChild; ++child) {
+      if (isEarlier(fHeap[child], fHeap[earliest])) earliest = child;
+    }
+    if (!isEarlier(fHeap[earliest], entryIndex)) break;
+
+    placeAt(heapIndex, fHeap[earliest]);
+    heapIndex = earliest;
+  }
+  placeAt(heapIndex, entryIndex);
+}
+
+inline void HeapDelayQueue::removeFromHeap(unsigned heapIndex) {
+  --fNumHeapEntries;
+  if (heapIndex == fNumHeapEntries) return; // it was the last entry
+
+  // Move the last entry into the vacated position, then restore the heap order:
+  placeAt(heapIndex, fHeap[fNumHeapEntries]);
+  if (heapIndex > 0 && isEarlier(fHeap[heapIndex], fHeap[(heapIndex-1)/4])) {
+    siftUp(heapIndex);
+  } else {
+    siftDown(heapIndex);
+  }
+}
+
+inline TaskToken HeapDelayQueue::addEntry(int64_t microseconds, TaskFunc* proc, void* clientData) {
+  if (fFreeList == HEAP_DELAY_QUEUE_NO_ENTRY && !grow()) return NULL;
+
+  unsigned entryIndex = fFreeList;
+  Entry& entry = fEntries[entryIndex];
+  fFreeList = entry.heapIndex;
+
+  if (microseconds < 0) microseconds = 0;
+  entry.dueTime = timeNow() + microseconds;
+  entry.sequenceNum = fNextSequenceNum++;
+  entry.proc = proc;
+  entry.clientData = clientData;
+
+  placeAt(fNumHeapEntries, entryIndex);
+  ++fNumHeapEntries;
+  siftUp(fNumHeapEntries-1);
+
+  return (TaskToken)((entry.generation<<HEAP_DELAY_QUEUE_INDEX_BITS) | (entryIndex+1));
+}
+
+inline void HeapDelayQueue::removeEntry(TaskToken& token) {
+  Entry* entry = lookup(token);
+  token = NULL;
+  if (entry == NULL) return;
+
+  unsigned entryIndex = (unsigned)(entry - fEntries);
+  removeFromHeap(entry->heapIndex);
+  freeEntry(entryIndex);
+}
+
+inline void HeapDelayQueue::updateEntry(TaskToken& token, int64_t microseconds, TaskFunc* proc, void* clientData) {
+  Entry* entry = lookup(token);
+  if (entry == NULL) {
+    token = addEntry(microseconds, proc, clientData);
+    return;
+  }
+
+  if (microseconds < 0) microseconds = 0;
+  int64_t oldDueTime = entry->dueTime;
+  entry->dueTime = timeNow() + microseconds;
+  entry->sequenceNum = fNextSequenceNum++;
+  entry->proc = proc;
+  entry->clientData = clientData;
+
+  // A later due time can only move the entry down the heap; an earlier one can only move it up:
+  if (entry->dueTime >= oldDueTime) {
+    siftDown(entry->heapIndex);
+  } else {
+    siftUp(entry->heapIndex);
+  }
+}
+
+inline int64_t HeapDelayQueue::timeToNextAlarm() const {
+  if (fNumHeapEntries == 0) return -1;
+
+  int64_t timeToDelay = fEntries[fHeap[0]].dueTime - timeNow();
+  return timeToDelay < 0 ? 0 : timeToDelay;
+}
+
+inline void HeapDelayQueue::handleAlarm() {
+  int64_t now = timeNow();
+  u_int64_t sequenceNumLimit = fNextSequenceNum;
+
+  while (fNumHeapEntries > 0) {
+    unsigned entryIndex = fHeap[0];
+    Entry& entry = fEntries[entryIndex];
+    if (entry.dueTime > now || entry.sequenceNum >= sequenceNumLimit) break;
+
+    // Remove the entry before calling its task, because the task may add or remove other entries:
+    TaskFunc* proc = entry.proc;
+    void* clientData = entry.clientData;
+    removeFromHeap(0);
+    freeEntry(entryIndex);
+
+    if (proc != NULL) (*proc)(clientData);
+  }
+}
+
+#endif
@@ -0,0 +1,397 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// Basic Usage Environment: A hash table implemented using 'open addressing' (linear probing) in a single array.
+// Unlike "BasicHashTable" (which allocates an entry - and, for string keys, a copy of the key - for each member),
+// each member - including its key, if it's short enough - is stored in the array itself.  Also, when the table grows,
+// its members are moved to the new array a few at a time (by subsequent "Add()" and "Remove()" calls), rather than
+// all at once.
+// C++ header
+
+#ifndef _OPEN_HASH_TABLE_HH
+#define _OPEN_HASH_TABLE_HH
+
+#ifndef _HASH_TABLE_HH
+#include "HashTable.hh"
+#endif
+#ifndef _NET_COMMON_H
+#include <NetCommon.h> // to ensure that "uintptr_t" is defined
+#endif
+#include <string.h>
+
+#define OPEN_HASH_TABLE_INLINE_KEY_SIZE 24 // string keys up to 23 characters long are stored without allocation
+#define OPEN_HASH_TABLE_MIN_SIZE 8
+#define OPEN_HASH_TABLE_MIGRATION_STEP 16 // # of old slots moved (or skipped) by each "Add()" or "Remove()" call
+
+// Note: "HashTable::RemoveNext()", "HashTable::getFirst()" and "HashTable::Iterator::create()" work only with
+// "BasicHashTable"s.  Therefore, refer to an "OpenHashTable" as such (not as a "HashTable"), so that its own
+// versions of these are used.  Also, the key returned by an iterator remains valid only until the table is next changed.
+
+class OpenHashTable: public HashTable {
+private:
+  struct Slot; // forward
+
+public:
+  OpenHashTable(int keyType);
+  static OpenHashTable* create(int keyType) { return new OpenHashTable(keyType); }
+  virtual ~OpenHashTable();
+
+  // Used to iterate through the members of the table:
+  class Iterator: public HashTable::Iterator {
+  public:
+    Iterator(OpenHashTable const& table);
+    static Iterator* create(OpenHashTable const& table) { return new Iterator(table); }
+
+  public: // implementation of inherited pure virtual functions
+    void* next(char const*& key); // returns 0 if none
+
+  private:
+    OpenHashTable const& fTable;
+    Boolean fInOldSlots;
+    unsigned fNextIndex;
+  };
+
+  // Versions of the "HashTable" functions that work for us:
+  void* RemoveNext();
+  void* getFirst();
+
+public: // implementation of inherited pure virtual functions
+  virtual void* Add(char const* key, void* value);
+  // Returns the old value if different, otherwise 0
+  virtual Boolean Remove(char const* key);
+  virtual void* Lookup(char const* key) const;
+  // Returns 0 if not found
+  virtual unsigned numEntries() const { return fNumEntries; }
+
+private:
+  enum { EMPTY = 0, FULL, DELETED };
+  struct Slot {
+    void* value;
+    u_int32_t hash;
+    u_int8_t state;
+    u_int8_t keyIsAllocated;
+    union {
+      char chars[OPEN_HASH_TABLE_INLINE_KEY_SIZE];
+      uintptr_t words[OPEN_HASH_TABLE_INLINE_KEY_SIZE/sizeof (uintptr_t)];
+      char* allocated;
+    } key;
+  };
+
+  static Slot* newSlots(unsigned numSlots);
+  void deleteSlots(Slot* slots, unsigned numSlots);
+
+  u_int32_t hashKey(char const* key) const;
+  char const* slotKey(Slot const& slot) const;
+  Boolean keyMatches(Slot const& slot, char const* key, u_int32_t hash) const;
+  void assignKey(Slot& slot, char const* key);
+  void freeKey(Slot& slot);
+
+  static Slot* findSlot(Slot* slots, unsigned numSlots, OpenHashTable const& table, char const* key, u_int32_t hash);
+  Slot* findSlot(char const* key, u_int32_t hash, Boolean& isInOldSlots) const;
+  Slot& slotForInsertion(u_int32_t hash);
+  void removeSlot(Slot& slot);
+
+  void grow();
+  void migrateSomeSlots();
+
+private:
+  int fKeyType;
+  Slot* fSlots;
+  unsigned fNumSlots; // always a power of 2
+  unsigned fNumUsedSlots; // FULL or DELETED
+  unsigned fNumEntries; // in "fSlots" and "fOldSlots"
+
+  // The previous array, while its members are being moved to "fSlots":
+  Slot* fOldSlots;
+  unsigned fNumOldSlots, fNextOldSlotToMigrate;
+};
+
+
+////////// Implementation //////////
+
+inline OpenHashTable::OpenHashTable(int keyType)
+  : fKeyType(keyType), fNumSlots(OPEN_HASH_TABLE_MIN_SIZE), fNumUsedSlots(0), fNumEntries(0),
+    fOldSlots(NULL), fNumOldSlots(0), fNextOldSlotToMigrate(0) {
+  fSlots = newSlots(fNumSlots);
+}
+
+inline OpenHashTable::~OpenHashTable() {
+  deleteSlots(fSlots, fNumSlots);
+  deleteSlots(fOldSlots, fNumOldSlots);
+}
+
+inline OpenHashTable::Slot* OpenHashTable::newSlots(unsigned numSlots) {
+  Slot* slots = new Slot[numSlots];
+  memset(slots, 0, numSlots*sizeof (Slot)); // sets each slot to EMPTY
+  return slots;
+}
+
+inline void OpenHashTable::deleteSlots(Slot* slots, unsigned numSlots) {
+  if (slots == NULL) return;
+
+  for (unsigned i = 0; i < numSlots; ++i) {
+    if (slots[i].state == FULL) freeKey(slots[i]);
+  }
+  delete[] slots;
+}
+
+inline u_int32_t OpenHashTable::hashKey(char const* key) const {
+  u_int32_t h = 2166136261u;
+  if (fKeyType == STRING_HASH_KEYS) {
+    // FNV-1a:
+    for (u_int8_t const* p = (u_int8_t const*)key; *p != '\0'; ++p) h = (h ^ *p)*16777619u;
+  } else if (fKeyType == ONE_WORD_HASH_KEYS) {
+    u_int64_t word = (u_int64_t)(uintptr_t)key;
+    h = (u_int32_t)word ^ (u_int32_t)(word>>32);
+  } else {
+    uintptr_t const* words = (uintptr_t const*)key;
+    for (int i = 0; i < fKeyType; ++i) {
+      u_int64_t word = (u_int64_t)words[i];
+      h = (h ^ (u_int32_t)word ^ (u_int32_t)(word>>32))*0x9E3779B1u;
+    }
+  }
+
+  // Mix the bits, because we use only the low bits to index the array:
+  h ^= h>>16; h *= 0x85EBCA6Bu; h ^= h>>13; h *= 0xC2B2AE35u; h ^= h>>16;
+  return h;
+}
+
+inline char const* OpenHashTable::slotKey(Slot const& slot) const {
+  if (fKeyType == ONE_WORD_HASH_KEYS) return (char const*)slot.key.words[0];
+  return slot.keyIsAllocated ? slot.key.allocated : slot.key.chars;
+}
+
+inline Boolean OpenHashTable::keyMatches(Slot const& slot, char const* key, u_int32_t hash) const {
+  if (slot.hash != hash) return False;
+
+  if (fKeyType == ONE_WORD_HASH_KEYS) return slot.key.words[0] == (uintptr_t)key;
+  if (fKeyType == STRING_HASH_KEYS) return strcmp(slotKey(slot), key) == 0;
+  return memcmp(slotKey(slot), key, fKeyType*sizeof (uintptr_t)) == 0;
+}
+
+inline void OpenHashTable::assignKey(Slot& slot, char const* key) {
+  if (fKeyType == ONE_WORD_HASH_KEYS) {
+    slot.key.words[0] = (uintptr_t)key;
+    slot.keyIsAllocated = False;
+    return;
+  }
+
+  unsigned keySize = fKeyType == STRING_HASH_KEYS ? strlen(key) + 1 : fKeyType*sizeof (uintptr_t);
+  slot.keyIsAllocated = keySize > OPEN_HASH_TABLE_INLINE_KEY_SIZE;
+  if (slot.keyIsAllocated) {
+    slot.key.allocated = new char[keySize];
+    memmove(slot.key.allocated, key, keySize);
+  } else {
+    memmove(slot.key.chars, key, keySize);
+  }
+}
+
+inline void OpenHashTable::freeKey(Slot& slot) {
+  if (slot.keyIsAllocated) {
+    delete[] slot.key.allocated;
+    slot.keyIsAllocated = False;
+  }
+}
+
+inline OpenHashTable::Slot* OpenHashTable
+::findSlot(Slot* slots, unsigned numSlots, OpenHashTable const& table, char const* key, u_int32_t hash) {
+  // Stop after "numSlots" probes, in case the array has no EMPTY slots left:
+  unsigned mask = numSlots - 1;
+  unsigned i = hash&mask;
+  for (unsigned numProbes = 0; numProbes < numSlots; ++numProbes, i = (i+1)&mask) {
+    Slot& slot = slots[i];
+    if (slot.state == EMPTY) return NULL;
+    if (slot.state == FULL && table.keyMatches(slot, key, hash)) return &slot;
+  }
+  return NULL;
+}
+
+inline OpenHashTable::Slot* OpenHashTable::findSlot(char const* key, u_int32_t hash, Boolean& isInOldSlots) const {
+  Slot* slot = findSlot(fSlots, fNumSlots, *this, key, hash);
+  isInOldSlots = slot == NULL && fOldSlots != NULL;
+  if (isInOldSlots) slot = findSlot(fOldSlots, fNumOldSlots, *this, key, hash);
+  return slot;
+}
+
+inline OpenHashTable::Slot& OpenHashTable::slotForInsertion(u_int32_t hash) {
+  // (The caller has checked that the key isn't already present, so we can reuse a DELETED slot.)
+  unsigned mask = fNumSlots - 1;
+  unsigned i = hash&mask;
+  while (fSlots[i].state == FULL) i = (i+1)&mask;
+
+  if (fSlots[i].state == EMPTY) ++fNumUsedSlots;
+  fSlots[i].state = FULL;
+  fSlots[i].hash = hash;
+  return fSlots[i];
+}
+
+inline void OpenHashTable::removeSlot(Slot& slot) {
+  // Leave a DELETED marker, so that searches for other keys continue past this slot:
+  freeKey(slot);
+  slot.state = DELETED;
+  --fNumEntries;
+}
+
+inline void OpenHashTable::grow() {
+  // The new array is at least twice as large as the number of members - in both the current array and (if we're still
+  // migrating) the old one - so that, usually, we're able to move all of them to it before it, too, becomes too full.
+  // (If it does, "migrateSomeSlots()" grows it again.)  (If many of the current array's slots are just DELETED markers,
+  // the new array might be no larger.)
+  unsigned newNumSlots = OPEN_HASH_TABLE_MIN_SIZE;
+  while (newNumSlots < 2*(fNumEntries+1)) newNumSlots *= 2;
+
+  Slot* newSlotArray = newSlots(newNumSlots);
+  Slot* prevSlots = fSlots;
+  unsigned numPrevSlots = fNumSlots;
+  fSlots = newSlotArray;
+  fNumSlots = newNumSlots;
+  fNumUsedSlots = 0;
+
+  if (fOldSlots != NULL) {
+    // We're growing again before we've finished emptying the previous array, so move everything now:
+    unsigned mask = fNumSlots - 1;
+    Slot* arrays[2] = { fOldSlots, prevSlots };
+    unsigned sizes[2] = { fNumOldSlots, numPrevSlots };
+    for (unsigned a = 0; a < 2; ++a) {
+      for (unsigned i = 0; i < sizes[a]; ++i) {
+	if (arrays[a][i].state != FULL) continue;
+	unsigned j = arrays[a][i].hash&mask;
+	while (fSlots[j].state != EMPTY) j = (j+1)&mask;
+	fSlots[j] = arrays[a][i];
+	++fNumUsedSlots;
+      }
+      delete[] arrays[a]; // the keys now belong to the new array
+    }
+    fOldSlots = NULL;
+    fNumOldSlots = 0;
+  } else {
+    fOldSlots = prevSlots;
+    fNumOldSlots = numPrevSlots;
+    fNextOldSlotToMigrate = 0;
+  }
+}
+
+inline void OpenHashTable::migrateSomeSlots() {
+  if (fOldSlots == NULL) return;
+
+  unsigned end = fNextOldSlotToMigrate + OPEN_HASH_TABLE_MIGRATION_STEP;
+  if (end > fNumOldSlots) end = fNumOldSlots;
+  for (; fNextOldSlotToMigrate < end; ++fNextOldSlotToMigrate) {
+    Slot& oldSlot = fOldSlots[fNextOldSlotToMigrate];
+    if (oldSlot.state != FULL) continue;
+
+    if (4*(fNumUsedSlots+1) > 3*fNumSlots) {
+      // The new array has become too full (with new members, and DELETED markers) before we finished moving the old
+      // array's members to it.  Grow again; this moves all remaining members (including this one) at once:
+      grow();
+      return;
+    }
+
+    Slot& newSlot = slotForInsertion(oldSlot.hash);
+    newSlot = oldSlot; // the key (if allocated) now belongs to the new slot
+    oldSlot.state = DELETED;
+    oldSlot.keyIsAllocated = False;
+  }
+
+  if (fNextOldSlotToMigrate == fNumOldSlots) {
+    delete[] fOldSlots;
+    fOldSlots = NULL;
+    fNumOldSlots = 0;
+  }
+}
+
+inline void* OpenHashTable::Add(char const* key, void* value) {
+  u_int32_t hash = hashKey(key);
+  Boolean isInOldSlots;
+  Slot* slot = findSlot(key, hash, isInOldSlots);
+  if (slot != NULL) {
+    void* oldValue = slot->value;
+    slot->value = value;
+    return oldValue;
+  }
+
+  if (4*(fNumUsedSlots+1) > 3*fNumSlots) grow(); // keep the array no more than 3/4 full
+
+  Slot& newSlot = slotForInsertion(hash);
+  assignKey(newSlot, key);
+  newSlot.value = value;
+  ++fNumEntries;
+
+  migrateSomeSlots();
+  return NULL;
+}
+
+inline Boolean OpenHashTable::Remove(char const* key) {
+  Boolean isInOldSlots;
+  Slot* slot = findSlot(key, hashKey(key), isInOldSlots);
+  if (slot == NULL) return False;
+
+  removeSlot(*slot);
+  migrateSomeSlots();
+  return True;
+}
+
+inline void* OpenHashTable::Lookup(char const* key) const {
+  Boolean isInOldSlots;
+  Slot* slot = findSlot(key, hashKey(key), isInOldSlots);
+  return slot == NULL ? NULL : slot->value;
+}
+
+inline void* OpenHashTable::RemoveNext() {
+  Slot* arrays[2] = { fSlots, fOldSlots };
+  unsigned sizes[2] = { fNumSlots, fNumOldSlots };
+  for (unsigned a = 0; a < 2; ++a) {
+    for (unsigned i = 0; i < sizes[a]; ++i) {
+      if (arrays[a][i].state != FULL) continue;
+
+      void* value = arrays[a][i].value;
+      removeSlot(arrays[a][i]);
+      migrateSomeSlots();
+      return value;
+    }
+  }
+  return NULL;
+}
+
+inline void* OpenHashTable::getFirst() {
+  Iterator iter(*this);
+  char const* key;
+  return iter.next(key);
+}
+
+inline OpenHashTable::Iterator::Iterator(OpenHashTable const& table)
+  : fTable(table), fInOldSlots(False), fNextIndex(0) {
+}
+
+inline void* OpenHashTable::Iterator::next(char const*& key) {
+  while (1) {
+    Slot const* slots = fInOldSlots ? fTable.fOldSlots : fTable.fSlots;
+    unsigned numSlots = fInOldSlots ? fTable.fNumOldSlots : fTable.fNumSlots;
+    while (fNextIndex < numSlots) {
+      Slot const& slot = slots[fNextIndex++];
+      if (slot.state == FULL) {
+	key = fTable.slotKey(slot);
+	return slot.value;
+      }
+    }
+
+    if (fInOldSlots) return NULL; // we're done
+    fInOldSlots = True;
+    fNextIndex = 0;
+  }
+}
+
+#endif
@@ -0,0 +1,638 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// Basic Usage Environment: A task scheduler that uses "epoll()" (Linux) or "kqueue()" (BSD, macOS)
+// rather than "select()", so that it is not limited by FD_SETSIZE.  Delayed tasks are kept in a "HeapDelayQueue".
+// Event triggers are not limited to MAX_NUM_EVENT_TRIGGERS, and every "triggerEvent()" call is delivered.
+// C++ header
+
+#ifndef _SCALABLE_TASK_SCHEDULER_HH
+#define _SCALABLE_TASK_SCHEDULER_HH
+
+#ifndef _BASIC_USAGE_ENVIRONMENT_HH
+#include "BasicUsageEnvironment.hh"
+#endif
+#ifndef _HEAP_DELAY_QUEUE_HH
+#include "HeapDelayQueue.hh"
+#endif
+
+#if defined(__linux__)
+#define SCALABLE_TASK_SCHEDULER_USE_EPOLL 1
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__)
+#define SCALABLE_TASK_SCHEDULER_USE_KQUEUE 1
+#include <sys/event.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(SCALABLE_TASK_SCHEDULER_USE_EPOLL) || defined(SCALABLE_TASK_SCHEDULER_USE_KQUEUE)
+
+#include <stdio.h>
+#include <fcntl.h>
+
+// The maximum number of kernel events that we collect during each call to "SingleStep()":
+#define SCALABLE_TASK_SCHEDULER_MAX_EVENTS 256
+
+// The low bits of each "EventTriggerId" index our table of event triggers; the remaining bits hold the entry's
+// 'generation', so that an event that was posted to a since-deleted trigger is not delivered to a newer one:
+#define SCALABLE_TASK_SCHEDULER_TRIGGER_INDEX_BITS 20
+
+class ScalableTaskScheduler: public BasicTaskScheduler0 {
+public:
+  static ScalableTaskScheduler* createNew(unsigned maxSchedulerGranularity = 10000/*microseconds*/);
+    // A drop-in replacement for "BasicTaskScheduler::createNew()".
+    // Returns NULL if the kernel event queue could not be created.
+    // Unlike "BasicTaskScheduler", socket numbers are not limited by FD_SETSIZE, and the cost of each "SingleStep()"
+    // is proportional to the number of *ready* sockets, rather than the total number of sockets being handled.
+    // Descriptors that the kernel event queue can't wait on - regular files, in particular - are treated (as
+    // "select()" treats them) as always readable and writable: their handlers are called during every "SingleStep()".
+  virtual ~ScalableTaskScheduler();
+
+  unsigned numHandledSockets() const { return fNumHandledSockets; }
+  unsigned numDelayedTasks() const { return fDelayedTasks.numEntries(); }
+
+  void noteSocketHasBufferedData(int socketNum);
+  static void noteSocketHasBufferedData(void* scheduler, int socketNum) {
+    ((ScalableTaskScheduler*)scheduler)->noteSocketHasBufferedData(socketNum);
+  }
+      // Causes the socket's handler to be called (as if the socket were readable) during the next "SingleStep()",
+      // even if the socket itself is not readable.  This is for sockets whose data has already been read (in bulk)
+      // into user-space buffers - e.g., by a "BatchedInputGroupsock".
+
+  // Redefined virtual functions:
+  virtual EventTriggerId createEventTrigger(TaskFunc* eventHandlerProc);
+  virtual void deleteEventTrigger(EventTriggerId eventTriggerId);
+  virtual void triggerEvent(EventTriggerId eventTriggerId, void* clientData = NULL);
+      // Unlike "BasicTaskScheduler", there's no fixed limit on the number of event triggers, and events are not
+      // coalesced: each "triggerEvent()" call - which may be made from any thread - results in one call to the
+      // trigger's handler, with that call's "clientData".  (Calls are delivered in the order in which they were made.)
+      // Posting an event is lock-free; the event loop is woken up using an "eventfd()" (Linux) or a pipe.
+
+protected:
+  ScalableTaskScheduler(int pollFd, int wakeupReadFd, int wakeupWriteFd, unsigned maxSchedulerGranularity);
+      // called only by "createNew()"
+
+  static void schedulerTickTask(void* clientData);
+  void schedulerTickTask();
+
+protected:
+  // Redefined virtual functions:
+  virtual void SingleStep(unsigned maxDelayTime);
+
+  virtual TaskToken scheduleDelayedTask(int64_t microseconds, TaskFunc* proc, void* clientData);
+  virtual void unscheduleDelayedTask(TaskToken& prevTask);
+  virtual void rescheduleDelayedTask(TaskToken& task, int64_t microseconds, TaskFunc* proc, void* clientData);
+
+  virtual void setBackgroundHandling(int socketNum, int conditionSet, BackgroundHandlerProc* handlerProc, void* clientData);
+  virtual void moveSocketHandling(int oldSocketNum, int newSocketNum);
+
+private:
+  // Socket handlers are stored in a table indexed directly by socket number, so lookups are O(1):
+  struct SocketHandler {
+    int conditionSet;
+    BackgroundHandlerProc* handlerProc;
+    void* clientData;
+    Boolean isAlwaysReady; // if True, the descriptor is in "fAlwaysReadySockets", rather than the kernel's event queue
+  };
+
+  Boolean ensureHandlerTableSize(int socketNum);
+  Boolean updateKernelInterest(int socketNum, int oldConditionSet, int newConditionSet);
+  void addAlwaysReadySocket(int socketNum);
+  void removeAlwaysReadySocket(int socketNum);
+  void compactAlwaysReadySockets();
+  void handleReadySocket(int socketNum, int resultConditionSet);
+
+  struct EventTrigger {
+    TaskFunc* handlerProc; // NULL if this entry is unused
+    EventTriggerId generation;
+    unsigned nextFree;
+  };
+  struct PostedEvent {
+    EventTriggerId eventTriggerId;
+    void* clientData;
+    PostedEvent* next;
+  };
+  EventTrigger* lookupEventTrigger(EventTriggerId eventTriggerId);
+  static void wakeupHandler(void* clientData, int mask);
+  void handlePostedEvents();
+
+private:
+  unsigned fMaxSchedulerGranularity;
+  HeapDelayQueue fDelayedTasks; // used instead of "BasicTaskScheduler0"s "fDelayQueue"
+  int fPollFd;
+  SocketHandler* fSocketHandlers;
+  unsigned fSocketHandlersSize;
+  unsigned fNumHandledSockets;
+  int* fSocketsWithBufferedData;
+  unsigned fNumSocketsWithBufferedData, fSocketsWithBufferedDataSize;
+  int* fAlwaysReadySockets; // removed entries are set to -1, until "compactAlwaysReadySockets()" is called
+  unsigned fNumAlwaysReadySockets, fAlwaysReadySocketsSize;
+  EventTrigger* fEventTriggers;
+  unsigned fEventTriggersSize, fFreeEventTrigger;
+  PostedEvent* fPostedEvents; // a lock-free stack (most recent first); pushed by any thread, emptied by ours
+  int fWakeupReadFd, fWakeupWriteFd; // the same descriptor, if we're using "eventfd()"
+#if defined(SCALABLE_TASK_SCHEDULER_USE_EPOLL)
+  struct epoll_event fReadyEvents[SCALABLE_TASK_SCHEDULER_MAX_EVENTS];
+#else
+  struct kevent fReadyEvents[SCALABLE_TASK_SCHEDULER_MAX_EVENTS];
+#endif
+};
+
+
+////////// Implementation //////////
+
+inline ScalableTaskScheduler* ScalableTaskScheduler::createNew(unsigned maxSchedulerGranularity) {
+#if defined(SCALABLE_TASK_SCHEDULER_USE_EPOLL)
+  int pollFd = epoll_create1(EPOLL_CLOEXEC);
+#else
+  int pollFd = kqueue();
+#endif
+  if (pollFd < 0) return NULL;
+
+  // Create the descriptor that other threads use to wake up our event loop:
+#if defined(SCALABLE_TASK_SCHEDULER_USE_EPOLL)
+  int wakeupReadFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+  int wakeupWriteFd = wakeupReadFd;
+  if (wakeupReadFd < 0) {
+    close(pollFd);
+    return NULL;
+  }
+#else
+  int wakeupFds[2];
+  if (pipe(wakeupFds) != 0) {
+    close(pollFd);
+    return NULL;
+  }
+  for (unsigned i = 0; i < 2; ++i) {
+    fcntl(wakeupFds[i], F_SETFL, fcntl(wakeupFds[i], F_GETFL, 0)|O_NONBLOCK);
+    fcntl(wakeupFds[i], F_SETFD, FD_CLOEXEC);
+  }
+  int wakeupReadFd = wakeupFds[0];
+  int wakeupWriteFd = wakeupFds[1];
+#endif
+
+  return new ScalableTaskScheduler(pollFd, wakeupReadFd, wakeupWriteFd, maxSchedulerGranularity);
+}
+
+inline ScalableTaskScheduler
+::ScalableTaskScheduler(int pollFd, int wakeupReadFd, int wakeupWriteFd, unsigned maxSchedulerGranularity)
+  : fMaxSchedulerGranularity(maxSchedulerGranularity), fPollFd(pollFd),
+    fSocketHandlers(NULL), fSocketHandlersSize(0), fNumHandledSockets(0),
+    fSocketsWithBufferedData(NULL), fNumSocketsWithBufferedData(0), fSocketsWithBufferedDataSize(0),
+    fAlwaysReadySockets(NULL), fNumAlwaysReadySockets(0), fAlwaysReadySocketsSize(0),
+    fEventTriggers(NULL), fEventTriggersSize(0), fFreeEventTrigger(0), fPostedEvents(NULL),
+    fWakeupReadFd(wakeupReadFd), fWakeupWriteFd(wakeupWriteFd) {
+  setBackgroundHandling(fWakeupReadFd, SOCKET_READABLE, wakeupHandler, this);
+  --fNumHandledSockets; // we don't count our own wakeup descriptor
+
+  if (maxSchedulerGranularity > 0) schedulerTickTask(); // ensures that we handle events frequently
+}
+
+inline ScalableTaskScheduler::~ScalableTaskScheduler() {
+  PostedEvent* postedEvent = __atomic_exchange_n(&fPostedEvents, (PostedEvent*)NULL, __ATOMIC_ACQUIRE);
+  while (postedEvent != NULL) {
+    PostedEvent* next = postedEvent->next;
+    delete postedEvent;
+    postedEvent = next;
+  }
+  delete[] fEventTriggers;
+
+  close(fWakeupReadFd);
+  if (fWakeupWriteFd != fWakeupReadFd) close(fWakeupWriteFd);
+  delete[] fSocketHandlers;
+  delete[] fSocketsWithBufferedData;
+  delete[] fAlwaysReadySockets;
+  close(fPollFd);
+}
+
+inline void ScalableTaskScheduler::schedulerTickTask(void* clientData) {
+  ((ScalableTaskScheduler*)clientData)->schedulerTickTask();
+}
+
+inline void ScalableTaskScheduler::schedulerTickTask() {
+  scheduleDelayedTask(fMaxSchedulerGranularity, schedulerTickTask, this);
+}
+
+inline TaskToken ScalableTaskScheduler::scheduleDelayedTask(int64_t microseconds, TaskFunc* proc, void* clientData) {
+  TaskToken token = fDelayedTasks.addEntry(microseconds, proc, clientData);
+  if (token == NULL) internalError(); // too many delayed tasks
+  return token;
+}
+
+inline void ScalableTaskScheduler::unscheduleDelayedTask(TaskToken& prevTask) {
+  fDelayedTasks.removeEntry(prevTask);
+}
+
+inline void ScalableTaskScheduler
+::rescheduleDelayedTask(TaskToken& task, int64_t microseconds, TaskFunc* proc, void* clientData) {
+  fDelayedTasks.updateEntry(task, microseconds, proc, clientData);
+}
+
+inline Boolean ScalableTaskScheduler::ensureHandlerTableSize(int socketNum) {
+  if ((unsigned)socketNum < fSocketHandlersSize) return True;
+
+  unsigned newSize = fSocketHandlersSize == 0 ? 64 : fSocketHandlersSize;
+  while (newSize <= (unsigned)socketNum) newSize *= 2;
+
+  SocketHandler* newHandlers = new SocketHandler[newSize];
+  if (newHandlers == NULL) return False;
+  for (unsigned i = 0; i < newSize; ++i) {
+    if (i < fSocketHandlersSize) {
+      newHandlers[i] = fSocketHandlers[i];
+    } else {
+      newHandlers[i].conditionSet = 0;
+      newHandlers[i].handlerProc = NULL;
+      newHandlers[i].clientData = NULL;
+      newHandlers[i].isAlwaysReady = False;
+    }
+  }
+
+  delete[] fSocketHandlers;
+  fSocketHandlers = newHandlers;
+  fSocketHandlersSize = newSize;
+  return True;
+}
+
+inline Boolean ScalableTaskScheduler
+::updateKernelInterest(int socketNum, int oldConditionSet, int newConditionSet) {
+#if defined(SCALABLE_TASK_SCHEDULER_USE_EPOLL)
+  struct epoll_event ev;
+  ev.events = 0;
+  if (newConditionSet&SOCKET_READABLE) ev.events |= EPOLLIN;
+  if (newConditionSet&SOCKET_WRITABLE) ev.events |= EPOLLOUT;
+  if (newConditionSet&SOCKET_EXCEPTION) ev.events |= EPOLLPRI;
+  ev.data.fd = socketNum;
+
+  if (newConditionSet == 0) {
+    return epoll_ctl(fPollFd, EPOLL_CTL_DEL, socketNum, &ev) == 0 || errno == EBADF || errno == ENOENT;
+      // (A socket that has already been closed is removed from the "epoll" set automatically.)
+  }
+
+  // If the socket was closed (without its handler being cleared), and its number has since been reused, the
+  // "epoll" set no longer contains it, even though our table still has an entry for it; so we fall back to adding it:
+  int op = oldConditionSet == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+  if (epoll_ctl(fPollFd, op, socketNum, &ev) == 0) return True;
+  if (op == EPOLL_CTL_MOD && errno == ENOENT) return epoll_ctl(fPollFd, EPOLL_CTL_ADD, socketNum, &ev) == 0;
+  if (op == EPOLL_CTL_ADD && errno == EEXIST) return epoll_ctl(fPollFd, EPOLL_CTL_MOD, socketNum, &ev) == 0;
+  return False;
+#else
+  // "kqueue()" uses a separate filter for reading and writing.  We implement 'exception' handling
+  // using the read filter; errors on the socket are then reported as an EV_EOF condition.
+  struct kevent changes[2];
+  int numChanges = 0;
+  Boolean oldWantsRead = (oldConditionSet&(SOCKET_READABLE|SOCKET_EXCEPTION)) != 0;
+  Boolean newWantsRead = (newConditionSet&(SOCKET_READABLE|SOCKET_EXCEPTION)) != 0;
+  Boolean oldWantsWrite = (oldConditionSet&SOCKET_WRITABLE) != 0;
+  Boolean newWantsWrite = (newConditionSet&SOCKET_WRITABLE) != 0;
+
+  // Wanted filters are always (re)added - which is harmless if they're already present - because if the socket
+  // was closed (without its handler being cleared), and its number has since been reused, the "kqueue" no longer
+  // has them:
+  if (newWantsRead) {
+    EV_SET(&changes[numChanges++], socketNum, EVFILT_READ, EV_ADD, 0, 0, NULL);
+  }
+  if (newWantsWrite) {
+    EV_SET(&changes[numChanges++], socketNum, EVFILT_WRITE, EV_ADD, 0, 0, NULL);
+  }
+  if (numChanges > 0 && kevent(fPollFd, changes, numChanges, NULL, 0, NULL) != 0) return False;
+
+  // Then delete the filters that are no longer wanted:
+  numChanges = 0;
+  if (oldWantsRead && !newWantsRead) {
+    EV_SET(&changes[numChanges++], socketNum, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+  }
+  if (oldWantsWrite && !newWantsWrite) {
+    EV_SET(&changes[numChanges++], socketNum, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+  }
+  return numChanges == 0 || kevent(fPollFd, changes, numChanges, NULL, 0, NULL) == 0
+    || errno == EBADF || errno == ENOENT;
+      // (A socket that has already been closed is removed from the "kqueue" automatically.)
+#endif
+}
+
+inline void ScalableTaskScheduler
+::setBackgroundHandling(int socketNum, int conditionSet, BackgroundHandlerProc* handlerProc, void* clientData) {
+  if (socketNum < 0) return;
+  if (handlerProc == NULL) conditionSet = 0;
+  if (conditionSet == 0 && (unsigned)socketNum >= fSocketHandlersSize) return; // nothing to clear
+
+  if (!ensureHandlerTableSize(socketNum)) {
+    internalError();
+    return;
+  }
+
+  SocketHandler& handler = fSocketHandlers[socketNum];
+  int oldConditionSet = handler.conditionSet;
+  Boolean wasAlwaysReady = oldConditionSet != 0 && handler.isAlwaysReady;
+  Boolean isAlwaysReady = wasAlwaysReady && conditionSet != 0; // (an always-ready descriptor stays so until cleared)
+
+  if (!wasAlwaysReady && (conditionSet != 0 || oldConditionSet != 0)) {
+#if defined(SCALABLE_TASK_SCHEDULER_USE_KQUEUE)
+    // "kqueue()" accepts regular files (and other 'vnodes'), but then reports them readable only until their
+    // current end, rather than always (as "select()" does), so we don't give them to the kernel at all:
+    struct stat sb;
+    if (oldConditionSet == 0 && conditionSet != 0 && fstat(socketNum, &sb) == 0
+        && (S_ISREG(sb.st_mode) || S_ISDIR(sb.st_mode) || S_ISBLK(sb.st_mode))) {
+      isAlwaysReady = True;
+    }
+#endif
+    // Note that we update the kernel's interest even if the condition set is unchanged, in case the socket number
+    // has been reused (see "updateKernelInterest()"):
+    if (!isAlwaysReady && !updateKernelInterest(socketNum, oldConditionSet, conditionSet) && conditionSet != 0) {
+      if (errno == EPERM) {
+        // The descriptor can't be waited on by "epoll()" - e.g., because it's a regular file (such as the one
+        // read by a "ByteStreamFileSource").  Handle it as "select()" would: as always readable and writable:
+        isAlwaysReady = True;
+      } else {
+        // We can't handle this socket (e.g., it's not a valid socket, or the kernel is out of memory).  As with
+        // other unrecoverable scheduler errors, treat this as fatal:
+        internalError();
+        return;
+      }
+    }
+  }
+
+  if (isAlwaysReady && !wasAlwaysReady) addAlwaysReadySocket(socketNum);
+  else if (wasAlwaysReady && !isAlwaysReady) removeAlwaysReadySocket(socketNum);
+
+  if (oldConditionSet == 0 && conditionSet != 0) ++fNumHandledSockets;
+  else if (oldConditionSet != 0 && conditionSet == 0) --fNumHandledSockets;
+
+  handler.isAlwaysReady = isAlwaysReady;
+  handler.conditionSet = conditionSet;
+  handler.handlerProc = conditionSet == 0 ? NULL : handlerProc;
+  handler.clientData = conditionSet == 0 ? NULL : clientData;
+}
+
+inline void ScalableTaskScheduler::moveSocketHandling(int oldSocketNum, int newSocketNum) {
+  if (oldSocketNum < 0 || newSocketNum < 0 || (unsigned)oldSocketNum >= fSocketHandlersSize) return; // sanity check
+  if (fSocketHandlers[oldSocketNum].conditionSet == 0) return;
+
+  SocketHandler handler = fSocketHandlers[oldSocketNum];
+  setBackgroundHandling(oldSocketNum, 0, NULL, NULL);
+  setBackgroundHandling(newSocketNum, handler.conditionSet, handler.handlerProc, handler.clientData);
+}
+
+inline void ScalableTaskScheduler::addAlwaysReadySocket(int socketNum) {
+  if (fNumAlwaysReadySockets == fAlwaysReadySocketsSize) {
+    unsigned newSize = fAlwaysReadySocketsSize == 0 ? 16 : 2*fAlwaysReadySocketsSize;
+    int* newArray = new int[newSize];
+    for (unsigned i = 0; i < fNumAlwaysReadySockets; ++i) newArray[i] = fAlwaysReadySockets[i];
+    delete[] fAlwaysReadySockets;
+    fAlwaysReadySockets = newArray;
+    fAlwaysReadySocketsSize = newSize;
+  }
+  fAlwaysReadySockets[fNumAlwaysReadySockets++] = socketNum;
+}
+
+inline void ScalableTaskScheduler::removeAlwaysReadySocket(int socketNum) {
+  // Don't move the other entries now, because we might be called (by a handler) while "SingleStep()" is
+  // iterating over them:
+  for (unsigned i = 0; i < fNumAlwaysReadySockets; ++i) {
+    if (fAlwaysReadySockets[i] == socketNum) {
+      fAlwaysReadySockets[i] = -1;
+      return;
+    }
+  }
+}
+
+inline void ScalableTaskScheduler::compactAlwaysReadySockets() {
+  unsigned j = 0;
+  for (unsigned i = 0; i < fNumAlwaysReadySockets; ++i) {
+    if (fAlwaysReadySockets[i] >= 0) fAlwaysReadySockets[j++] = fAlwaysReadySockets[i];
+  }
+  fNumAlwaysReadySockets = j;
+}
+
+inline void ScalableTaskScheduler::noteSocketHasBufferedData(int socketNum) {
+  for (unsigned i = 0; i < fNumSocketsWithBufferedData; ++i) {
+    if (fSocketsWithBufferedData[i] == socketNum) return; // already noted
+  }
+
+  if (fNumSocketsWithBufferedData == fSocketsWithBufferedDataSize) {
+    unsigned newSize = fSocketsWithBufferedDataSize == 0 ? 16 : 2*fSocketsWithBufferedDataSize;
+    int* newArray = new int[newSize];
+    for (unsigned i = 0; i < fNumSocketsWithBufferedData; ++i) newArray[i] = fSocketsWithBufferedData[i];
+    delete[] fSocketsWithBufferedData;
+    fSocketsWithBufferedData = newArray;
+    fSocketsWithBufferedDataSize = newSize;
+  }
+  fSocketsWithBufferedData[fNumSocketsWithBufferedData++] = socketNum;
+}
+
+inline void ScalableTaskScheduler::handleReadySocket(int socketNum, int resultConditionSet) {
+  // Look up the handler again (rather than remembering it from before we waited), because an earlier
+  // handler (during this same "SingleStep()") may have changed or removed it:
+  if (socketNum < 0 || (unsigned)socketNum >= fSocketHandlersSize) return;
+  SocketHandler& handler = fSocketHandlers[socketNum];
+
+  resultConditionSet &= handler.conditionSet;
+  if (resultConditionSet == 0 || handler.handlerProc == NULL) return;
+
+  fLastHandledSocketNum = socketNum;
+  (*handler.handlerProc)(handler.clientData, resultConditionSet);
+}
+
+inline EventTriggerId ScalableTaskScheduler::createEventTrigger(TaskFunc* eventHandlerProc) {
+  if (eventHandlerProc == NULL) return 0;
+
+  if (fFreeEventTrigger == fEventTriggersSize) {
+    // Our table is full; double its size:
+    unsigned newSize = fEventTriggersSize == 0 ? 32 : 2*fEventTriggersSize;
+    if (newSize >= (1u<<SCALABLE_TASK_SCHEDULER_TRIGGER_INDEX_BITS)) return 0;
+
+    EventTrigger* newEventTriggers = new EventTrigger[newSize];
+    for (unsigned i = 0; i < fEventTriggersSize; ++i) newEventTriggers[i] = fEventTriggers[i];
+    for (unsigned i = fEventTriggersSize; i < newSize; ++i) {
+      newEventTriggers[i].handlerProc = NULL;
+      newEventTriggers[i].generation = 1;
+      newEventTriggers[i].nextFree = i+1;
+    }
+    delete[] fEventTriggers;
+    fEventTriggers = newEventTriggers;
+    fEventTriggersSize = newSize;
+  }
+
+  unsigned index = fFreeEventTrigger;
+  EventTrigger& eventTrigger = fEventTriggers[index];
+  fFreeEventTrigger = eventTrigger.nextFree;
+  eventTrigger.handlerProc = eventHandlerProc;
+
+  return (eventTrigger.generation<<SCALABLE_TASK_SCHEDULER_TRIGGER_INDEX_BITS) | (index+1);
+}
+
+inline ScalableTaskScheduler::EventTrigger* ScalableTaskScheduler::lookupEventTrigger(EventTriggerId eventTriggerId) {
+  unsigned index = (eventTriggerId&((1u<<SCALABLE_TASK_SCHEDULER_TRIGGER_INDEX_BITS)-1)) - 1;
+  if (index >= fEventTriggersSize) return NULL;
+
+  EventTrigger* eventTrigger = &fEventTriggers[index];
+  if (eventTrigger->handlerProc == NULL
+      || eventTrigger->generation != eventTriggerId>>SCALABLE_TASK_SCHEDULER_TRIGGER_INDEX_BITS) return NULL;
+  return eventTrigger;
+}
+
+inline void ScalableTaskScheduler::deleteEventTrigger(EventTriggerId eventTriggerId) {
+  EventTrigger* eventTrigger = lookupEventTrigger(eventTriggerId);
+  if (eventTrigger == NULL) return;
+
+  // Events that were posted to this trigger, but not yet handled, will be ignored:
+  eventTrigger->handlerProc = NULL;
+  eventTrigger->generation = (eventTrigger->generation + 1)&((1u<<(32-SCALABLE_TASK_SCHEDULER_TRIGGER_INDEX_BITS))-1);
+  if (eventTrigger->generation == 0) eventTrigger->generation = 1;
+  eventTrigger->nextFree = fFreeEventTrigger;
+  fFreeEventTrigger = (unsigned)(eventTrigger - fEventTriggers);
+}
+
+inline void ScalableTaskScheduler::triggerEvent(EventTriggerId eventTriggerId, void* clientData) {
+  // Note: This may be called from any thread, so we mustn't access our trigger table here.
+  PostedEvent* postedEvent = new PostedEvent;
+  postedEvent->eventTriggerId = eventTriggerId;
+  postedEvent->clientData = clientData;
+
+  PostedEvent* head = __atomic_load_n(&fPostedEvents, __ATOMIC_RELAXED);
+  do {
+    postedEvent->next = head;
+  } while (!__atomic_compare_exchange_n(&fPostedEvents, &head, postedEvent, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  if (head == NULL) {
+    // The stack was empty, so the event loop might be waiting; wake it up:
+#if defined(SCALABLE_TASK_SCHEDULER_USE_EPOLL)
+    u_int64_t one = 1;
+    ssize_t unused = write(fWakeupWriteFd, &one, sizeof one);
+#else
+    char one = 1;
+    ssize_t unused = write(fWakeupWriteFd, &one, 1); // if the pipe is full, a wakeup is already pending
+#endif
+    (void)unused;
+  }
+}
+
+inline void ScalableTaskScheduler::wakeupHandler(void* clientData, int /*mask*/) {
+  ((ScalableTaskScheduler*)clientData)->handlePostedEvents();
+}
+
+inline void ScalableTaskScheduler::handlePostedEvents() {
+  // Reset the wakeup descriptor *before* taking the posted events, so that an event that's posted after we take them
+  // will wake us up again:
+#if defined(SCALABLE_TASK_SCHEDULER_USE_EPOLL)
+  u_int64_t count;
+  ssize_t unused = read(fWakeupReadFd, &count, sizeof count);
+  (void)unused;
+#else
+  char buf[64];
+  while (read(fWakeupReadFd, buf, sizeof buf) > 0) {}
+#endif
+
+  // Take all of the posted events, then reverse them, so that we handle them in the order in which they were posted:
+  PostedEvent* postedEvent = __atomic_exchange_n(&fPostedEvents, (PostedEvent*)NULL, __ATOMIC_ACQUIRE);
+  PostedEvent* inOrder = NULL;
+  while (postedEvent != NULL) {
+    PostedEvent* next = postedEvent->next;
+    postedEvent->next = inOrder;
+    inOrder = postedEvent;
+    postedEvent = next;
+  }
+
+  while (inOrder != NULL) {
+    PostedEvent* next = inOrder->next;
+    // Look up the trigger each time, because an earlier handler may have deleted (or created) triggers:
+    EventTrigger* eventTrigger = lookupEventTrigger(inOrder->eventTriggerId);
+    if (eventTrigger != NULL) (*eventTrigger->handlerProc)(inOrder->clientData);
+    delete inOrder;
+    inOrder = next;
+  }
+}
+
+inline void ScalableTaskScheduler::SingleStep(unsigned maxDelayTime) {
+  long long delayUSecs = fDelayedTasks.timeToNextAlarm();
+
+  // Don't wait any longer than 1 million seconds (11.5 days):
+  long long const maxDelayUSecs = 1000000LL*1000000;
+  if (delayUSecs < 0 || delayUSecs > maxDelayUSecs) delayUSecs = maxDelayUSecs;
+  // Also check our "maxDelayTime" parameter (if it's > 0):
+  if (maxDelayTime > 0 && delayUSecs > (long long)maxDelayTime) delayUSecs = maxDelayTime;
+  // Don't wait at all if some socket(s) already have buffered data to be handled, or are always ready:
+  compactAlwaysReadySockets();
+  if (fNumSocketsWithBufferedData > 0 || fNumAlwaysReadySockets > 0) delayUSecs = 0;
+
+#if defined(SCALABLE_TASK_SCHEDULER_USE_EPOLL)
+  int timeoutMSecs = (int)((delayUSecs + 999)/1000); // round up, so that we don't spin before an alarm is due
+  int numReady = epoll_wait(fPollFd, fReadyEvents, SCALABLE_TASK_SCHEDULER_MAX_EVENTS, timeoutMSecs);
+#else
+  struct timespec timeout;
+  timeout.tv_sec = (time_t)(delayUSecs/1000000);
+  timeout.tv_nsec = (long)(delayUSecs%1000000)*1000;
+  int numReady = kevent(fPollFd, NULL, 0, fReadyEvents, SCALABLE_TASK_SCHEDULER_MAX_EVENTS, &timeout);
+#endif
+  if (numReady < 0) {
+    if (errno != EINTR && errno != EAGAIN) {
+      // Unexpected error - treat this as fatal:
+      perror("ScalableTaskScheduler::SingleStep(): kernel event wait fails");
+      internalError();
+    }
+    numReady = 0;
+  }
+
+  // Call the handler for each ready socket:
+  for (int i = 0; i < numReady; ++i) {
+#if defined(SCALABLE_TASK_SCHEDULER_USE_EPOLL)
+    uint32_t events = fReadyEvents[i].events;
+    int resultConditionSet = 0;
+    // ("epoll" always reports hang-ups and errors, whatever we asked for, so we report them in every condition.
+    //  Otherwise, a handler that's waiting only to write would never be called - and we'd be woken up forever.)
+    if (events&(EPOLLIN|EPOLLHUP|EPOLLERR)) resultConditionSet |= SOCKET_READABLE;
+    if (events&(EPOLLOUT|EPOLLHUP|EPOLLERR)) resultConditionSet |= SOCKET_WRITABLE;
+    if (events&(EPOLLPRI|EPOLLHUP|EPOLLERR)) resultConditionSet |= SOCKET_EXCEPTION;
+    handleReadySocket(fReadyEvents[i].data.fd, resultConditionSet);
+#else
+    struct kevent const& ev = fReadyEvents[i];
+    int resultConditionSet = ev.filter == EVFILT_WRITE ? SOCKET_WRITABLE : SOCKET_READABLE;
+    if ((ev.flags&EV_ERROR) != 0 || ((ev.flags&EV_EOF) != 0 && ev.fflags != 0)) resultConditionSet |= SOCKET_EXCEPTION;
+    handleReadySocket((int)ev.ident, resultConditionSet);
+#endif
+  }
+
+  // Then call the handler for each socket that has buffered data.  (A handler may note its socket again, for the
+  // next "SingleStep()", so we handle only the sockets that were noted before now.)
+  unsigned numSocketsWithBufferedData = fNumSocketsWithBufferedData;
+  for (unsigned i = 0; i < numSocketsWithBufferedData; ++i) {
+    int socketNum = fSocketsWithBufferedData[i];
+    fSocketsWithBufferedData[i] = -1; // so that the handler can note the socket again
+    handleReadySocket(socketNum, SOCKET_READABLE);
+  }
+  fNumSocketsWithBufferedData -= numSocketsWithBufferedData;
+  for (unsigned i = 0; i < fNumSocketsWithBufferedData; ++i) {
+    fSocketsWithBufferedData[i] = fSocketsWithBufferedData[numSocketsWithBufferedData + i];
+  }
+
+  // Then call the handler for each always-ready descriptor.  (Again, we handle only those that were present before
+  // now; a handler may remove - or add - descriptors while we're doing this.)
+  unsigned numAlwaysReadySockets = fNumAlwaysReadySockets;
+  for (unsigned i = 0; i < numAlwaysReadySockets; ++i) {
+    int socketNum = fAlwaysReadySockets[i];
+    if (socketNum >= 0) handleReadySocket(socketNum, SOCKET_READABLE|SOCKET_WRITABLE);
+  }
+
+  // (Triggered events are handled along with the other ready sockets, when our wakeup descriptor becomes readable.)
+
+  // Also handle any delayed events that may have come due.
+  fDelayedTasks.handleAlarm();
+}
+
+#endif
+
+#endif
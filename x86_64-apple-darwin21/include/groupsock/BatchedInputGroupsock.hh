@@ -0,0 +1,338 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "mTunnel" multicast access service
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A 'groupsock' that drains its socket several datagrams at a time ("recvmmsg()", optionally with UDP generic
+// receive offload, on Linux), into a preallocated buffer.  Each subsequent "handleRead()" call then returns the
+// next buffered datagram, without a system call.
+// C++ header
+
+#ifndef _BATCHED_INPUT_GROUPSOCK_HH
+#define _BATCHED_INPUT_GROUPSOCK_HH
+
+#ifndef _GROUPSOCK_HH
+#include "Groupsock.hh"
+#endif
+
+#if defined(__linux__)
+#include <sys/uio.h>
+#include <netinet/udp.h>
+#if defined(UDP_GRO)
+#define BATCHED_INPUT_GROUPSOCK_HAVE_GRO 1
+#endif
+#endif
+
+// A function that is called (from "handleRead()") whenever datagrams remain buffered after a read.
+// It should arrange for the socket's read handler to be called again (soon), even though the socket itself may
+// no longer be readable.  (For example, "ScalableTaskScheduler::noteSocketHasBufferedData" can be used here.)
+typedef void bufferedDataNotificationFunc(void* clientData, int socketNum);
+
+class BatchedInputStats {
+public:
+  BatchedInputStats() : numPacketsReceived(0), numBytesReceived(0), numReceiveCalls(0), numCoalescedReads(0) {}
+
+  float packetsPerReceiveCall() const { return numReceiveCalls == 0 ? 0.0f : (float)numPacketsReceived/numReceiveCalls; }
+
+public:
+  u_int64_t numPacketsReceived;
+  u_int64_t numBytesReceived;
+  u_int64_t numReceiveCalls;
+  u_int64_t numCoalescedReads; // reads that returned several (GRO-coalesced) datagrams
+};
+
+class BatchedInputGroupsock: public Groupsock {
+public:
+  BatchedInputGroupsock(UsageEnvironment& env, struct sockaddr_storage const& groupAddr,
+			Port port, u_int8_t ttl,
+			unsigned maxPacketsPerRead = 32, unsigned maxPacketSize = 2048);
+      // used for a 'source-independent multicast' group (or unicast)
+  BatchedInputGroupsock(UsageEnvironment& env, struct sockaddr_storage const& groupAddr,
+			struct sockaddr_storage const& sourceFilterAddr, Port port,
+			unsigned maxPacketsPerRead = 32, unsigned maxPacketSize = 2048);
+      // used for a 'source-specific multicast' group
+  virtual ~BatchedInputGroupsock();
+
+  void setBufferedDataNotificationFunc(bufferedDataNotificationFunc* func, void* clientData);
+      // Until this is called (with a non-NULL "func"), we read only one datagram at a time (like "Groupsock"),
+      // because nothing would otherwise cause buffered datagrams to be handled promptly.
+
+  Boolean enableGRO();
+      // (Attempts to) enable UDP generic receive offload.  Returns True iff successful.
+
+  unsigned numBufferedPackets() const { return fNumEntries - fNextEntry; }
+  BatchedInputStats const& stats() const { return fStats; }
+
+public: // redefined virtual functions
+  virtual Boolean handleRead(unsigned char* buffer, unsigned bufferMaxSize,
+			     unsigned& bytesRead,
+			     struct sockaddr_storage& fromAddressAndPort);
+
+private:
+  void init(unsigned maxPacketsPerRead, unsigned maxPacketSize);
+  void allocateBuffers();
+  void freeBuffers();
+  Boolean readBatch();
+  Boolean isAcceptableSource(struct sockaddr_storage const& fromAddress) const;
+
+private:
+  struct Entry {
+    unsigned offset; // in "fSlab"
+    unsigned size;
+    unsigned slot; // index into "fFromAddresses"
+  };
+
+  unsigned fNumSlots; // the maximum number of datagrams (or GRO-coalesced datagram groups) read in one call
+  unsigned fSlotSize;
+  unsigned char* fSlab;
+  struct sockaddr_storage* fFromAddresses;
+  Entry* fEntries;
+  unsigned fMaxEntries, fNumEntries, fNextEntry;
+  Boolean fGROIsEnabled;
+#if defined(__linux__)
+  struct mmsghdr* fMsgs;
+  struct iovec* fIovs;
+  unsigned char* fControlBufs;
+#endif
+
+  bufferedDataNotificationFunc* fNotificationFunc;
+  void* fNotificationClientData;
+  BatchedInputStats fStats;
+};
+
+
+////////// Implementation //////////
+
+#define BATCHED_INPUT_GROUPSOCK_CONTROL_SIZE 64
+#define BATCHED_INPUT_GROUPSOCK_GRO_SLOT_SIZE 65536
+#define BATCHED_INPUT_GROUPSOCK_MAX_GRO_SLOTS 8
+
+inline BatchedInputGroupsock
+::BatchedInputGroupsock(UsageEnvironment& env, struct sockaddr_storage const& groupAddr,
+			Port port, u_int8_t ttl,
+			unsigned maxPacketsPerRead, unsigned maxPacketSize)
+  : Groupsock(env, groupAddr, port, ttl) {
+  init(maxPacketsPerRead, maxPacketSize);
+}
+
+inline BatchedInputGroupsock
+::BatchedInputGroupsock(UsageEnvironment& env, struct sockaddr_storage const& groupAddr,
+			struct sockaddr_storage const& sourceFilterAddr, Port port,
+			unsigned maxPacketsPerRead, unsigned maxPacketSize)
+  : Groupsock(env, groupAddr, sourceFilterAddr, port) {
+  init(maxPacketsPerRead, maxPacketSize);
+}
+
+inline void BatchedInputGroupsock::init(unsigned maxPacketsPerRead, unsigned maxPacketSize) {
+  fNumSlots = maxPacketsPerRead == 0 ? 1 : maxPacketsPerRead;
+  fSlotSize = maxPacketSize == 0 ? 2048 : maxPacketSize;
+  fSlab = NULL; fFromAddresses = NULL; fEntries = NULL;
+  fMaxEntries = fNumEntries = fNextEntry = 0;
+  fGROIsEnabled = False;
+#if defined(__linux__)
+  fMsgs = NULL; fIovs = NULL; fControlBufs = NULL;
+#endif
+  fNotificationFunc = NULL; fNotificationClientData = NULL;
+
+  allocateBuffers();
+}
+
+inline BatchedInputGroupsock::~BatchedInputGroupsock() {
+  freeBuffers();
+}
+
+inline void BatchedInputGroupsock::allocateBuffers() {
+  fSlab = new unsigned char[fNumSlots*fSlotSize];
+  fFromAddresses = new struct sockaddr_storage[fNumSlots];
+  fMaxEntries = fGROIsEnabled ? fNumSlots*(fSlotSize/64) : fNumSlots; // (a GRO segment is at least 64 bytes here)
+  fEntries = new Entry[fMaxEntries];
+#if defined(__linux__)
+  fMsgs = new struct mmsghdr[fNumSlots];
+  fIovs = new struct iovec[fNumSlots];
+  fControlBufs = new unsigned char[fNumSlots*BATCHED_INPUT_GROUPSOCK_CONTROL_SIZE];
+#endif
+}
+
+inline void BatchedInputGroupsock::freeBuffers() {
+  delete[] fSlab; fSlab = NULL;
+  delete[] fFromAddresses; fFromAddresses = NULL;
+  delete[] fEntries; fEntries = NULL;
+#if defined(__linux__)
+  delete[] fMsgs; fMsgs = NULL;
+  delete[] fIovs; fIovs = NULL;
+  delete[] fControlBufs; fControlBufs = NULL;
+#endif
+  fNumEntries = fNextEntry = 0;
+}
+
+inline void BatchedInputGroupsock
+::setBufferedDataNotificationFunc(bufferedDataNotificationFunc* func, void* clientData) {
+  fNotificationFunc = func;
+  fNotificationClientData = clientData;
+}
+
+inline Boolean BatchedInputGroupsock::enableGRO() {
+#if defined(BATCHED_INPUT_GROUPSOCK_HAVE_GRO)
+  if (fGROIsEnabled) return True;
+  if (numBufferedPackets() > 0) return False; // don't discard datagrams that we haven't yet handled
+
+  int one = 1;
+  if (setsockopt(socketNum(), SOL_UDP, UDP_GRO, &one, sizeof one) != 0) return False;
+
+  // Coalesced datagram groups can be up to 64 KBytes in size, so use fewer, larger slots:
+  freeBuffers();
+  fGROIsEnabled = True;
+  if (fNumSlots > BATCHED_INPUT_GROUPSOCK_MAX_GRO_SLOTS) fNumSlots = BATCHED_INPUT_GROUPSOCK_MAX_GRO_SLOTS;
+  fSlotSize = BATCHED_INPUT_GROUPSOCK_GRO_SLOT_SIZE;
+  allocateBuffers();
+  return True;
+#else
+  return False;
+#endif
+}
+
+inline Boolean BatchedInputGroupsock::isAcceptableSource(struct sockaddr_storage const& fromAddress) const {
+  // If we're a SSM group, make sure the source address matches:
+  if (!isSSM()) return True;
+
+  struct sockaddr_storage const& filterAddress = sourceFilterAddress();
+  if (fromAddress.ss_family != filterAddress.ss_family) return False;
+  if (fromAddress.ss_family == AF_INET) {
+    return ((struct sockaddr_in const&)fromAddress).sin_addr.s_addr
+      == ((struct sockaddr_in const&)filterAddress).sin_addr.s_addr;
+  } else if (fromAddress.ss_family == AF_INET6) {
+    return memcmp(&((struct sockaddr_in6 const&)fromAddress).sin6_addr,
+		  &((struct sockaddr_in6 const&)filterAddress).sin6_addr, sizeof (struct in6_addr)) == 0;
+  }
+  return False;
+}
+
+inline Boolean BatchedInputGroupsock::readBatch() {
+  fNumEntries = fNextEntry = 0;
+
+  // If nothing will cause us to be called again while datagrams remain buffered, read just one at a time:
+  unsigned numSlotsToRead = fNotificationFunc == NULL ? 1 : fNumSlots;
+
+#if defined(__linux__)
+  for (unsigned i = 0; i < numSlotsToRead; ++i) {
+    fIovs[i].iov_base = &fSlab[i*fSlotSize];
+    fIovs[i].iov_len = fSlotSize;
+    struct msghdr& msg = fMsgs[i].msg_hdr;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_name = &fFromAddresses[i];
+    msg.msg_namelen = sizeof fFromAddresses[i];
+    msg.msg_iov = &fIovs[i];
+    msg.msg_iovlen = 1;
+    if (fGROIsEnabled) {
+      msg.msg_control = &fControlBufs[i*BATCHED_INPUT_GROUPSOCK_CONTROL_SIZE];
+      msg.msg_controllen = BATCHED_INPUT_GROUPSOCK_CONTROL_SIZE;
+    }
+    fMsgs[i].msg_len = 0;
+  }
+
+  int numRead = recvmmsg(socketNum(), fMsgs, numSlotsToRead, MSG_DONTWAIT, NULL);
+  ++fStats.numReceiveCalls;
+  if (numRead < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return True; // nothing to read right now
+    env().setResultErrMsg("recvmmsg() error: ");
+    return False;
+  }
+
+  for (int i = 0; i < numRead; ++i) {
+    unsigned msgSize = fMsgs[i].msg_len;
+    unsigned segmentSize = msgSize;
+#if defined(BATCHED_INPUT_GROUPSOCK_HAVE_GRO)
+    if (fGROIsEnabled) {
+      for (struct cmsghdr* cm = CMSG_FIRSTHDR(&fMsgs[i].msg_hdr); cm != NULL; cm = CMSG_NXTHDR(&fMsgs[i].msg_hdr, cm)) {
+	if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+	  int groSize;
+	  memmove(&groSize, CMSG_DATA(cm), sizeof groSize);
+	  if (groSize > 0) segmentSize = (unsigned)groSize;
+	}
+      }
+      if (segmentSize < msgSize) ++fStats.numCoalescedReads;
+    }
+#endif
+    // Split the message into its (possibly several) datagrams:
+    for (unsigned offset = 0; offset < msgSize && fNumEntries < fMaxEntries; offset += segmentSize) {
+      Entry& entry = fEntries[fNumEntries++];
+      entry.offset = i*fSlotSize + offset;
+      entry.size = msgSize - offset < segmentSize ? msgSize - offset : segmentSize;
+      entry.slot = i;
+    }
+    if (msgSize == 0 && fNumEntries < fMaxEntries) { // an empty datagram
+      Entry& entry = fEntries[fNumEntries++];
+      entry.offset = i*fSlotSize; entry.size = 0; entry.slot = i;
+    }
+  }
+#else
+  // No batched receive call is available; read a single datagram:
+  (void)numSlotsToRead;
+  SOCKLEN_T addressSize = sizeof fFromAddresses[0];
+  int numBytes = recvfrom(socketNum(), (char*)fSlab, fSlotSize, 0,
+			  (struct sockaddr*)&fFromAddresses[0], &addressSize);
+  ++fStats.numReceiveCalls;
+  if (numBytes < 0) {
+    int err = env().getErrno();
+    if (err == EAGAIN || err == EWOULDBLOCK || err == EINTR) return True;
+    env().setResultErrMsg("recvfrom() error: ");
+    return False;
+  }
+  fEntries[0].offset = 0; fEntries[0].size = (unsigned)numBytes; fEntries[0].slot = 0;
+  fNumEntries = 1;
+#endif
+
+  return True;
+}
+
+inline Boolean BatchedInputGroupsock
+::handleRead(unsigned char* buffer, unsigned bufferMaxSize,
+	     unsigned& bytesRead, struct sockaddr_storage& fromAddressAndPort) {
+  bytesRead = 0;
+
+  while (1) {
+    if (fNextEntry == fNumEntries) {
+      if (!readBatch()) return False;
+      if (fNumEntries == 0) return True; // no data was available
+    }
+
+    Entry const& entry = fEntries[fNextEntry++];
+    struct sockaddr_storage const& fromAddress = fFromAddresses[entry.slot];
+    if (!isAcceptableSource(fromAddress)) {
+      if (fNextEntry < fNumEntries) continue;
+      return True; // ignore this datagram
+    }
+
+    unsigned numBytes = entry.size < bufferMaxSize ? entry.size : bufferMaxSize;
+    memmove(buffer, &fSlab[entry.offset], numBytes);
+    bytesRead = numBytes;
+    fromAddressAndPort = fromAddress;
+
+    ++fStats.numPacketsReceived;
+    fStats.numBytesReceived += numBytes;
+    if (!wasLoopedBackFromUs(env(), fromAddressAndPort)) {
+      statsIncoming.countPacket(numBytes);
+      statsGroupIncoming.countPacket(numBytes);
+    }
+    break;
+  }
+
+  if (fNextEntry < fNumEntries && fNotificationFunc != NULL) {
+    (*fNotificationFunc)(fNotificationClientData, socketNum());
+  }
+  return True;
+}
+
+#endif
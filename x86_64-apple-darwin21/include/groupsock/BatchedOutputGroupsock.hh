@@ -0,0 +1,354 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "mTunnel" multicast access service
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A 'groupsock' that batches outgoing packets, and sends each batch using as few system calls as possible
+// ("sendmmsg()", optionally with UDP generic segmentation offload, on Linux).  Batches are flushed at the end of
+// each RTP frame (i.e., on a packet with the RTP 'M' bit set), when full, or after a (short) maximum delay.
+// Flushed packets can optionally be paced, so that large frames are not sent as a single burst.
+// C++ header
+
+#ifndef _BATCHED_OUTPUT_GROUPSOCK_HH
+#define _BATCHED_OUTPUT_GROUPSOCK_HH
+
+#ifndef _GROUPSOCK_HH
+#include "Groupsock.hh"
+#endif
+
+#if defined(__linux__)
+#include <sys/uio.h>
+#include <netinet/udp.h>
+#if defined(UDP_SEGMENT)
+#define BATCHED_OUTPUT_GROUPSOCK_HAVE_GSO 1
+#endif
+#endif
+
+#define BATCHED_OUTPUT_GROUPSOCK_MAX_PACKETS 128
+
+// Statistics about our use of system calls:
+class BatchedOutputStats {
+public:
+  BatchedOutputStats() : numPacketsSent(0), numBytesSent(0), numSendCalls(0), numFlushes(0), numSendErrors(0) {}
+
+  float packetsPerSendCall() const { return numSendCalls == 0 ? 0.0f : (float)numPacketsSent/numSendCalls; }
+
+public:
+  u_int64_t numPacketsSent; // counts each packet once for each destination
+  u_int64_t numBytesSent;
+  u_int64_t numSendCalls;
+  u_int64_t numFlushes;
+  u_int64_t numSendErrors;
+};
+
+class BatchedOutputGroupsock: public Groupsock {
+public:
+  BatchedOutputGroupsock(UsageEnvironment& env, struct sockaddr_storage const& groupAddr,
+			 Port port, u_int8_t ttl,
+			 unsigned maxPacketSize = 1500, unsigned maxBatchDelayUSecs = 2000);
+      // "maxBatchDelayUSecs" is the longest time that a packet will wait (for the rest of its frame) before being sent.
+      // (This constructor has the same first parameters as the "Groupsock" constructor that is used by
+      //  "OnDemandServerMediaSubsession::createGroupsock()", so a subclass can redefine that virtual function to
+      //  return one of these instead.)
+  virtual ~BatchedOutputGroupsock();
+
+  void setPacing(unsigned maxBytesPerSecond, unsigned maxPacketsPerBurst = 16);
+      // If "maxBytesPerSecond" > 0, then a flushed batch is sent in bursts of at most "maxPacketsPerBurst" packets,
+      // spaced so that the average rate does not exceed "maxBytesPerSecond".  (By default, there is no pacing.)
+  void setUseGSO(Boolean useGSO) { fUseGSO = useGSO; }
+      // Whether to use UDP generic segmentation offload (where available).  (Default: True)
+
+  void flush();
+      // Sends (or starts sending, if we're pacing) all packets that are currently batched.
+
+  BatchedOutputStats const& stats() const { return fStats; }
+
+public: // redefined virtual functions
+  virtual Boolean output(UsageEnvironment& env, unsigned char* buffer, unsigned bufferSize);
+
+private:
+  static void flushTask(void* clientData);
+  static void sendBurstTask(void* clientData);
+  void sendBurst();
+  void sendAllNow();
+  void sendPackets(unsigned firstPacket, unsigned numPackets);
+  void sendPacketsTo(struct sockaddr_storage const& dest, u_int8_t ttl, unsigned firstPacket, unsigned numPackets);
+  void setMulticastTTLIfNecessary(struct sockaddr_storage const& dest, u_int8_t ttl);
+  void resetBatch();
+
+private:
+  unsigned char* fBatchBuffer; // packets are stored contiguously, in the order that they're sent
+  unsigned fBatchBufferSize;
+  unsigned fMaxPacketSize;
+  unsigned fPacketOffsets[BATCHED_OUTPUT_GROUPSOCK_MAX_PACKETS];
+  unsigned fPacketSizes[BATCHED_OUTPUT_GROUPSOCK_MAX_PACKETS];
+  unsigned fNumPackets, fNumBytes;
+  unsigned fNextPacketToSend; // when pacing
+
+  unsigned fMaxBatchDelayUSecs;
+  TaskToken fFlushTask;
+  unsigned fMaxBytesPerSecond, fMaxPacketsPerBurst;
+  TaskToken fBurstTask;
+  Boolean fUseGSO;
+  int fLastMulticastTTL;
+
+  BatchedOutputStats fStats;
+};
+
+
+////////// Implementation //////////
+
+inline BatchedOutputGroupsock
+::BatchedOutputGroupsock(UsageEnvironment& env, struct sockaddr_storage const& groupAddr,
+			 Port port, u_int8_t ttl,
+			 unsigned maxPacketSize, unsigned maxBatchDelayUSecs)
+  : Groupsock(env, groupAddr, port, ttl),
+    fBatchBufferSize(maxPacketSize*BATCHED_OUTPUT_GROUPSOCK_MAX_PACKETS), fMaxPacketSize(maxPacketSize),
+    fNumPackets(0), fNumBytes(0), fNextPacketToSend(0),
+    fMaxBatchDelayUSecs(maxBatchDelayUSecs), fFlushTask(NULL),
+    fMaxBytesPerSecond(0), fMaxPacketsPerBurst(BATCHED_OUTPUT_GROUPSOCK_MAX_PACKETS), fBurstTask(NULL),
+    fUseGSO(True), fLastMulticastTTL(-1) {
+  fBatchBuffer = new unsigned char[fBatchBufferSize];
+}
+
+inline BatchedOutputGroupsock::~BatchedOutputGroupsock() {
+  sendAllNow();
+  delete[] fBatchBuffer;
+}
+
+inline void BatchedOutputGroupsock::setPacing(unsigned maxBytesPerSecond, unsigned maxPacketsPerBurst) {
+  fMaxBytesPerSecond = maxBytesPerSecond;
+  if (maxPacketsPerBurst == 0) maxPacketsPerBurst = 1;
+  fMaxPacketsPerBurst = maxPacketsPerBurst;
+}
+
+inline Boolean BatchedOutputGroupsock::output(UsageEnvironment& env, unsigned char* buffer, unsigned bufferSize) {
+  if (bufferSize > fMaxPacketSize) {
+    // This packet is too big to be batched; send it (after any earlier packets) the normal way:
+    sendAllNow();
+    return Groupsock::output(env, buffer, bufferSize);
+  }
+
+  if (fNumPackets == BATCHED_OUTPUT_GROUPSOCK_MAX_PACKETS || fNumBytes + bufferSize > fBatchBufferSize) {
+    sendAllNow(); // we're full (even if we were pacing)
+  }
+
+  // Copy the packet into our batch, because the caller will reuse its buffer:
+  memmove(&fBatchBuffer[fNumBytes], buffer, bufferSize);
+  fPacketOffsets[fNumPackets] = fNumBytes;
+  fPacketSizes[fNumPackets] = bufferSize;
+  ++fNumPackets;
+  fNumBytes += bufferSize;
+  statsOutgoing.countPacket(bufferSize);
+  statsGroupOutgoing.countPacket(bufferSize);
+
+  if (fBurstTask != NULL) return True; // we're already pacing out a batch; this packet will be sent at the end of it
+
+  Boolean isEndOfRTPFrame = bufferSize >= 12 && (buffer[0]&0xC0) == 0x80 && (buffer[1]&0x80) != 0;
+  if (isEndOfRTPFrame) {
+    flush();
+  } else if (fFlushTask == NULL) {
+    fFlushTask = env.taskScheduler().scheduleDelayedTask(fMaxBatchDelayUSecs, flushTask, this);
+  }
+
+  return True;
+}
+
+inline void BatchedOutputGroupsock::flush() {
+  env().taskScheduler().unscheduleDelayedTask(fFlushTask);
+  if (fBurstTask != NULL) return; // we're already sending
+
+  ++fStats.numFlushes;
+  sendBurst();
+}
+
+inline void BatchedOutputGroupsock::flushTask(void* clientData) {
+  BatchedOutputGroupsock* gs = (BatchedOutputGroupsock*)clientData;
+  gs->fFlushTask = NULL;
+  gs->flush();
+}
+
+inline void BatchedOutputGroupsock::sendBurstTask(void* clientData) {
+  BatchedOutputGroupsock* gs = (BatchedOutputGroupsock*)clientData;
+  gs->fBurstTask = NULL;
+  gs->sendBurst();
+}
+
+inline void BatchedOutputGroupsock::sendBurst() {
+  unsigned numPacketsRemaining = fNumPackets - fNextPacketToSend;
+  if (numPacketsRemaining == 0) {
+    resetBatch();
+    return;
+  }
+
+  unsigned numPacketsToSend = numPacketsRemaining;
+  if (fMaxBytesPerSecond > 0 && numPacketsToSend > fMaxPacketsPerBurst) numPacketsToSend = fMaxPacketsPerBurst;
+
+  unsigned firstPacket = fNextPacketToSend;
+  unsigned numBytesToSend = 0;
+  for (unsigned i = 0; i < numPacketsToSend; ++i) numBytesToSend += fPacketSizes[firstPacket + i];
+  sendPackets(firstPacket, numPacketsToSend);
+  fNextPacketToSend += numPacketsToSend;
+
+  if (fNextPacketToSend == fNumPackets) {
+    resetBatch();
+  } else {
+    // Wait long enough for this burst to drain at our maximum rate, before sending the next one:
+    int64_t uSecondsToGo = (int64_t)numBytesToSend*1000000/fMaxBytesPerSecond;
+    fBurstTask = env().taskScheduler().scheduleDelayedTask(uSecondsToGo, sendBurstTask, this);
+  }
+}
+
+inline void BatchedOutputGroupsock::sendAllNow() {
+  env().taskScheduler().unscheduleDelayedTask(fFlushTask);
+  env().taskScheduler().unscheduleDelayedTask(fBurstTask);
+
+  if (fNextPacketToSend < fNumPackets) {
+    ++fStats.numFlushes;
+    sendPackets(fNextPacketToSend, fNumPackets - fNextPacketToSend);
+  }
+  resetBatch();
+}
+
+inline void BatchedOutputGroupsock::resetBatch() {
+  fNumPackets = fNumBytes = fNextPacketToSend = 0;
+}
+
+inline void BatchedOutputGroupsock::sendPackets(unsigned firstPacket, unsigned numPackets) {
+  for (destRecord* dests = fDests; dests != NULL; dests = dests->fNext) {
+    sendPacketsTo(dests->fGroupEId.groupAddress(), dests->fGroupEId.ttl(), firstPacket, numPackets);
+  }
+}
+
+inline void BatchedOutputGroupsock::setMulticastTTLIfNecessary(struct sockaddr_storage const& dest, u_int8_t ttl) {
+  if (!IsMulticastAddress(dest) || fLastMulticastTTL == (int)ttl) return;
+
+  if (dest.ss_family == AF_INET) {
+#if defined(__WIN32__) || defined(_WIN32)
+    DWORD ttlArg = ttl;
+#else
+    u_int8_t ttlArg = ttl;
+#endif
+    setsockopt(socketNum(), IPPROTO_IP, IP_MULTICAST_TTL, (const char*)&ttlArg, sizeof ttlArg);
+  } else if (dest.ss_family == AF_INET6) {
+    int hopsArg = ttl;
+    setsockopt(socketNum(), IPPROTO_IPV6, IPV6_MULTICAST_HOPS, (const char*)&hopsArg, sizeof hopsArg);
+  }
+  fLastMulticastTTL = ttl;
+}
+
+inline void BatchedOutputGroupsock
+::sendPacketsTo(struct sockaddr_storage const& dest, u_int8_t ttl, unsigned firstPacket, unsigned numPackets) {
+  setMulticastTTLIfNecessary(dest, ttl);
+  SOCKLEN_T destLen = dest.ss_family == AF_INET6 ? sizeof (struct sockaddr_in6) : sizeof (struct sockaddr_in);
+
+#if defined(__linux__)
+  struct mmsghdr msgs[BATCHED_OUTPUT_GROUPSOCK_MAX_PACKETS];
+  struct iovec iovs[BATCHED_OUTPUT_GROUPSOCK_MAX_PACKETS];
+#if defined(BATCHED_OUTPUT_GROUPSOCK_HAVE_GSO)
+  union { char buf[CMSG_SPACE(sizeof (u_int16_t))]; struct cmsghdr align; }
+    cmsgBufs[BATCHED_OUTPUT_GROUPSOCK_MAX_PACKETS];
+#endif
+  unsigned msgFirstPacket[BATCHED_OUTPUT_GROUPSOCK_MAX_PACKETS];
+  unsigned msgNumPackets[BATCHED_OUTPUT_GROUPSOCK_MAX_PACKETS];
+  unsigned numMsgs = 0;
+
+  unsigned i = firstPacket, limit = firstPacket + numPackets;
+  while (i < limit) {
+    // Each message is either a single packet, or (with GSO) a run of equal-sized packets (the last of which may be
+    // shorter), which the kernel splits into separate datagrams:
+    unsigned numSegments = 1;
+    unsigned segmentSize = fPacketSizes[i];
+    unsigned msgSize = segmentSize;
+#if defined(BATCHED_OUTPUT_GROUPSOCK_HAVE_GSO)
+    if (fUseGSO) {
+      while (i + numSegments < limit && numSegments < 64
+	     && fPacketSizes[i + numSegments] <= segmentSize && msgSize + fPacketSizes[i + numSegments] <= 65000) {
+	msgSize += fPacketSizes[i + numSegments];
+	++numSegments;
+	if (fPacketSizes[i + numSegments - 1] < segmentSize) break; // a shorter segment must be the last one
+      }
+    }
+#endif
+
+    struct msghdr& msg = msgs[numMsgs].msg_hdr;
+    memset(&msg, 0, sizeof msg);
+    iovs[numMsgs].iov_base = &fBatchBuffer[fPacketOffsets[i]];
+    iovs[numMsgs].iov_len = msgSize;
+    msg.msg_name = (void*)&dest;
+    msg.msg_namelen = destLen;
+    msg.msg_iov = &iovs[numMsgs];
+    msg.msg_iovlen = 1;
+#if defined(BATCHED_OUTPUT_GROUPSOCK_HAVE_GSO)
+    if (numSegments > 1) {
+      msg.msg_control = cmsgBufs[numMsgs].buf;
+      msg.msg_controllen = sizeof cmsgBufs[numMsgs].buf;
+      struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+      cm->cmsg_level = SOL_UDP;
+      cm->cmsg_type = UDP_SEGMENT;
+      cm->cmsg_len = CMSG_LEN(sizeof (u_int16_t));
+      u_int16_t gsoSize = (u_int16_t)segmentSize;
+      memmove(CMSG_DATA(cm), &gsoSize, sizeof gsoSize);
+    }
+#endif
+    msgs[numMsgs].msg_len = 0;
+    msgFirstPacket[numMsgs] = i;
+    msgNumPackets[numMsgs] = numSegments;
+    ++numMsgs;
+    i += numSegments;
+  }
+
+  unsigned numMsgsSent = 0;
+  while (numMsgsSent < numMsgs) {
+    int result = sendmmsg(socketNum(), &msgs[numMsgsSent], numMsgs - numMsgsSent, 0);
+    ++fStats.numSendCalls;
+    if (result <= 0) {
+      if (result < 0 && errno == EINTR) continue;
+#if defined(BATCHED_OUTPUT_GROUPSOCK_HAVE_GSO)
+      if (fUseGSO && result < 0 && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+	// GSO isn't supported for this socket/interface; stop using it, and resend the remaining packets without it:
+	fUseGSO = False;
+	sendPacketsTo(dest, ttl, msgFirstPacket[numMsgsSent], limit - msgFirstPacket[numMsgsSent]);
+	return;
+      }
+#endif
+      ++fStats.numSendErrors;
+      env().setResultErrMsg("BatchedOutputGroupsock: sendmmsg() failed: ");
+      return;
+    }
+    for (int m = 0; m < result; ++m) {
+      fStats.numPacketsSent += msgNumPackets[numMsgsSent + m];
+      fStats.numBytesSent += msgs[numMsgsSent + m].msg_len;
+    }
+    numMsgsSent += result;
+  }
+#else
+  // No batched send call is available; send each packet individually (but still with batching and pacing):
+  for (unsigned i = firstPacket; i < firstPacket + numPackets; ++i) {
+    int result = sendto(socketNum(), (char const*)&fBatchBuffer[fPacketOffsets[i]], fPacketSizes[i], 0,
+			(struct sockaddr const*)&dest, destLen);
+    ++fStats.numSendCalls;
+    if (result < 0) {
+      ++fStats.numSendErrors;
+      env().setResultErrMsg("BatchedOutputGroupsock: sendto() failed: ");
+      return;
+    }
+    ++fStats.numPacketsSent;
+    fStats.numBytesSent += fPacketSizes[i];
+  }
+#endif
+}
+
+#endif
@@ -0,0 +1,1001 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// An object that takes - as input - a H.264 video stream (e.g., from a "H264VideoStreamFramer") and/or an AAC audio
+// stream (e.g., from a "ADTSAudioFileSource"), and produces low-latency HLS ("LL-HLS") output: a CMAF (fragmented MP4)
+// initialization segment, plus a series of media segments, each made up of 'partial segments'.
+// Unlike "HLSSegmenter", the output is kept in memory, to be served (e.g., by a HTTP server) using "generatePlaylist()"
+// and "getResource()".  "whenAvailable()" implements 'blocking playlist reload' and 'preload hint' requests.
+// C++ header
+
+#ifndef _LL_HLS_SEGMENTER_HH
+#define _LL_HLS_SEGMENTER_HH
+
+#ifndef _MEDIA_SINK_HH
+#include "MediaSink.hh"
+#endif
+
+class LLHLSSegmenter; // forward
+
+// A simple growable byte buffer, used to build MP4 boxes and playlists:
+class LLHLSBuffer {
+public:
+  LLHLSBuffer() : fData(NULL), fSize(0), fCapacity(0) {}
+  ~LLHLSBuffer() { delete[] fData; }
+
+  unsigned char* data() const { return fData; }
+  unsigned size() const { return fSize; }
+  void reset() { fSize = 0; }
+  unsigned char* takeData(); // caller now owns the data (and must delete[] it)
+
+  void addBytes(void const* bytes, unsigned numBytes);
+  void addString(char const* str) { addBytes(str, strlen(str)); }
+  void addU8(u_int8_t v) { addBytes(&v, 1); }
+  void addU16(u_int16_t v) { u_int8_t b[2] = { (u_int8_t)(v>>8), (u_int8_t)v }; addBytes(b, 2); }
+  void addU24(u_int32_t v) { u_int8_t b[3] = { (u_int8_t)(v>>16), (u_int8_t)(v>>8), (u_int8_t)v }; addBytes(b, 3); }
+  void addU32(u_int32_t v) { addU16((u_int16_t)(v>>16)); addU16((u_int16_t)v); }
+  void addU64(u_int64_t v) { addU32((u_int32_t)(v>>32)); addU32((u_int32_t)v); }
+  void addZeros(unsigned numBytes) { while (numBytes-- > 0) addU8(0); }
+  void setU32(unsigned offset, u_int32_t v);
+
+  // MP4 box construction.  Each "begin...()" call returns an offset that must later be passed to "endBox()":
+  unsigned beginBox(char const* type) { unsigned offset = fSize; addU32(0); addBytes(type, 4); return offset; }
+  unsigned beginFullBox(char const* type, u_int8_t version, u_int32_t flags) {
+    unsigned offset = beginBox(type); addU8(version); addU24(flags); return offset;
+  }
+  void endBox(unsigned offset) { setU32(offset, fSize - offset); }
+
+private:
+  void ensureCapacity(unsigned newSize);
+
+private:
+  unsigned char* fData;
+  unsigned fSize, fCapacity;
+};
+
+// A sink that passes each frame that it receives to a "LLHLSSegmenter":
+class LLHLSTrackSink: public MediaSink {
+public:
+  static LLHLSTrackSink* createNew(UsageEnvironment& env, LLHLSSegmenter& segmenter, unsigned trackIndex,
+				   unsigned bufferSize);
+
+protected:
+  LLHLSTrackSink(UsageEnvironment& env, LLHLSSegmenter& segmenter, unsigned trackIndex, unsigned bufferSize);
+    // called only by createNew()
+  virtual ~LLHLSTrackSink();
+
+private: // redefined virtual functions:
+  virtual Boolean continuePlaying();
+
+private:
+  static void afterGettingFrame(void* clientData, unsigned frameSize,
+                                unsigned numTruncatedBytes,
+                                struct timeval presentationTime,
+                                unsigned durationInMicroseconds);
+  static void ourOnSourceClosure(void* clientData);
+
+private:
+  LLHLSSegmenter& fSegmenter;
+  unsigned fTrackIndex;
+  unsigned char* fBuffer;
+  unsigned fBufferSize;
+};
+
+class LLHLSSegmenter: public Medium {
+public:
+  typedef void (onEndOfSegmentFunc)(void* clientData, unsigned mediaSequenceNumber, double segmentDuration);
+  static LLHLSSegmenter* createNew(UsageEnvironment& env,
+				   double segmentDuration, double partTargetDuration, char const* uriPrefix,
+				   unsigned maxSegmentsInPlaylist = 6,
+				   onEndOfSegmentFunc* onEndOfSegmentFunc = NULL,
+				   void* onEndOfSegmentClientData = NULL);
+      // Media segments are (at least) "segmentDuration" seconds long, and start with a key frame.  Partial segments are
+      // (about) "partTargetDuration" seconds long (e.g., 0.333).  Resources are named "<uriPrefix>init.mp4",
+      // "<uriPrefix><msn>.m4s" (a whole media segment) and "<uriPrefix><msn>.<part>.m4s" (a partial segment).
+
+  // Call these before "startPlaying()":
+  Boolean addVideoSource(FramedSource* h264Source, unsigned width, unsigned height, unsigned maxNALUnitSize = 300000);
+      // "h264Source" delivers H.264 NAL units (without start codes), with each access unit's NAL units having the same
+      // presentation time - e.g., a "H264VideoStreamFramer" or "H264VideoStreamDiscreteFramer".
+      // (B-frames are not supported: samples are assumed to be in presentation order.)
+  Boolean addAudioSource(FramedSource* aacSource, unsigned samplingFrequency, unsigned numChannels,
+			 char const* configStr);
+      // "aacSource" delivers raw AAC frames (of 1024 samples each) - e.g., a "ADTSAudioFileSource", whose
+      // "samplingFrequency()", "numChannels()" and "configStr()" can be used for the remaining parameters.
+
+  Boolean startPlaying();
+  void stopPlaying();
+
+  char* generatePlaylist() const;
+      // Returns the current media playlist (or NULL, if no media has been produced yet).  The caller must delete[] it.
+  unsigned char* getResource(char const* resourceName, unsigned& resultSize) const;
+      // Returns a copy of the named resource (relative to "uriPrefix"), or NULL if it doesn't (or no longer) exist(s).
+      // The caller must delete[] the result.
+
+  typedef void (availabilityFunc)(void* clientData, Boolean isAvailable);
+  void whenAvailable(unsigned mediaSequenceNumber, int partIndex,
+		     availabilityFunc* func, void* clientData);
+      // Calls "func" once the playlist contains partial segment "partIndex" of media segment "mediaSequenceNumber" (or,
+      // if "partIndex" < 0, once that media segment is complete).  Use this for a playlist request with "_HLS_msn"
+      // (and "_HLS_part") query parameters, or for a request for the partial segment named in a preload hint.
+      // If the condition is already met, "func" is called immediately.  It's called with "isAvailable" == False if the
+      // request is too far in the future, if the stream ends first, or after 3 target durations.
+  void cancelWhenAvailable(availabilityFunc* func, void* clientData);
+      // Call this if the client of a pending "whenAvailable()" request goes away.
+
+  // Statistics:
+  unsigned numSegmentsProduced() const { return fNumSegments == 0 ? 0 : lastMSN(); } // (media sequence numbers start at 0)
+  unsigned numPartsProduced() const { return fNumPartsProduced; }
+
+protected:
+  LLHLSSegmenter(UsageEnvironment& env, double segmentDuration, double partTargetDuration, char const* uriPrefix,
+		 unsigned maxSegmentsInPlaylist,
+		 onEndOfSegmentFunc* onEndOfSegmentFunc, void* onEndOfSegmentClientData);
+    // called only by createNew()
+  virtual ~LLHLSSegmenter();
+
+private:
+  friend class LLHLSTrackSink;
+  void handleFrame(unsigned trackIndex, unsigned char const* frame, unsigned frameSize,
+		   struct timeval presentationTime);
+  void handleSourceClosure(unsigned trackIndex);
+
+private:
+  enum { VIDEO_TRACK = 0, AUDIO_TRACK = 1, NUM_TRACKS = 2 };
+  struct Track {
+    Boolean isPresent, hasEnded;
+    FramedSource* source;
+    LLHLSTrackSink* sink;
+    unsigned timescale;
+    // Configuration:
+    unsigned width, height; // video
+    unsigned char* sps; unsigned spsSize; // video
+    unsigned char* pps; unsigned ppsSize; // video
+    unsigned samplingFrequency, numChannels; // audio
+    unsigned char* audioSpecificConfig; unsigned audioSpecificConfigSize; // audio
+    // The access unit that's currently being assembled (video only):
+    LLHLSBuffer auData; struct timeval auPresentationTime; Boolean auIsSync; Boolean haveAU;
+    u_int32_t lastSampleDuration;
+    // Timing:
+    Boolean haveStarted;
+    u_int64_t nextDecodeTime, partBaseDecodeTime;
+    // The samples in the current partial segment:
+    LLHLSBuffer partData;
+    LLHLSBuffer partSampleTable; // 'duration', 'size', 'flags' (3 x 32 bits) for each sample
+    unsigned partNumSamples;
+    u_int64_t partDuration; // in "timescale" units
+  };
+  struct Part {
+    unsigned char* data; unsigned size;
+    double duration;
+    Boolean isIndependent;
+  };
+  struct Segment {
+    Part* parts; unsigned numParts, partsArraySize;
+    double duration;
+    Boolean isComplete;
+  };
+  struct PendingRequest {
+    LLHLSSegmenter* segmenter;
+    unsigned msn; int partIndex;
+    availabilityFunc* func; void* clientData;
+    TaskToken timeoutTask;
+    PendingRequest* next;
+  };
+
+  void addSample(unsigned trackIndex, unsigned char const* data, unsigned size,
+		 u_int32_t duration, struct timeval presentationTime, Boolean isSync);
+  void flushVideoAU(u_int32_t duration);
+  Boolean configurationIsReady() const;
+  void buildInitSegment();
+  void closePart();
+  void closeSegment();
+  void startNewSegment();
+  Segment* segmentFor(unsigned msn) const; // returns NULL if we don't (or no longer) have it
+  unsigned lastMSN() const { return fFirstMSN + fNumSegments - 1; }
+  Boolean isAvailable(unsigned msn, int partIndex) const;
+  void completePendingRequests();
+  static void pendingRequestTimeout(void* clientData);
+  unsigned primaryTrack() const { return fTracks[VIDEO_TRACK].isPresent ? VIDEO_TRACK : AUDIO_TRACK; }
+  double partDurationInSeconds(Track const& track) const { return (double)track.partDuration/track.timescale; }
+
+private:
+  double fSegmentDuration, fPartTargetDuration;
+  char* fURIPrefix;
+  unsigned fMaxSegmentsInPlaylist;
+  onEndOfSegmentFunc* fOnEndOfSegmentFunc;
+  void* fOnEndOfSegmentClientData;
+  Track fTracks[NUM_TRACKS];
+  Boolean fIsPlaying, fHaveTimeOrigin, fHasEnded;
+  struct timeval fTimeOrigin;
+  LLHLSBuffer fInitSegment;
+  u_int32_t fFragmentSequenceNumber;
+  double fCurrentSegmentDuration, fMaxSegmentDurationSoFar;
+  // The segments that we currently hold (the last of which is being produced) are in a circular array:
+  Segment** fSegments;
+  unsigned fSegmentsArraySize, fSegmentsHead, fNumSegments, fFirstMSN;
+  unsigned fNumPartsProduced;
+  PendingRequest* fPendingRequests;
+};
+
+
+////////// Implementation //////////
+
+////////// LLHLSBuffer //////////
+
+inline unsigned char* LLHLSBuffer::takeData() {
+  unsigned char* result = fData;
+  fData = NULL; fSize = fCapacity = 0;
+  return result;
+}
+
+inline void LLHLSBuffer::ensureCapacity(unsigned newSize) {
+  if (newSize <= fCapacity) return;
+
+  unsigned newCapacity = fCapacity < 256 ? 256 : fCapacity;
+  while (newCapacity < newSize) newCapacity *= 2;
+  unsigned char* newData = new unsigned char[newCapacity];
+  if (fSize > 0) memmove(newData, fData, fSize);
+  delete[] fData;
+  fData = newData; fCapacity = newCapacity;
+}
+
+inline void LLHLSBuffer::addBytes(void const* bytes, unsigned numBytes) {
+  ensureCapacity(fSize + numBytes);
+  memmove(&fData[fSize], bytes, numBytes);
+  fSize += numBytes;
+}
+
+inline void LLHLSBuffer::setU32(unsigned offset, u_int32_t v) {
+  fData[offset] = (u_int8_t)(v>>24); fData[offset+1] = (u_int8_t)(v>>16);
+  fData[offset+2] = (u_int8_t)(v>>8); fData[offset+3] = (u_int8_t)v;
+}
+
+////////// LLHLSTrackSink //////////
+
+inline LLHLSTrackSink* LLHLSTrackSink
+::createNew(UsageEnvironment& env, LLHLSSegmenter& segmenter, unsigned trackIndex, unsigned bufferSize) {
+  return new LLHLSTrackSink(env, segmenter, trackIndex, bufferSize);
+}
+
+inline LLHLSTrackSink
+::LLHLSTrackSink(UsageEnvironment& env, LLHLSSegmenter& segmenter, unsigned trackIndex, unsigned bufferSize)
+  : MediaSink(env), fSegmenter(segmenter), fTrackIndex(trackIndex),
+    fBuffer(new unsigned char[bufferSize]), fBufferSize(bufferSize) {
+}
+
+inline LLHLSTrackSink::~LLHLSTrackSink() {
+  delete[] fBuffer;
+}
+
+inline Boolean LLHLSTrackSink::continuePlaying() {
+  if (fSource == NULL) return False;
+
+  fSource->getNextFrame(fBuffer, fBufferSize, afterGettingFrame, this, ourOnSourceClosure, this);
+  return True;
+}
+
+inline void LLHLSTrackSink::afterGettingFrame(void* clientData, unsigned frameSize,
+					      unsigned numTruncatedBytes,
+					      struct timeval presentationTime,
+					      unsigned /*durationInMicroseconds*/) {
+  LLHLSTrackSink* sink = (LLHLSTrackSink*)clientData;
+  if (numTruncatedBytes > 0) {
+    sink->envir() << "LLHLSTrackSink::afterGettingFrame(): The input frame data was too large for our buffer size ("
+		  << sink->fBufferSize << ").  "
+		  << numTruncatedBytes << " bytes of trailing data was dropped!\n";
+  }
+  sink->fSegmenter.handleFrame(sink->fTrackIndex, sink->fBuffer, frameSize, presentationTime);
+  sink->continuePlaying();
+}
+
+inline void LLHLSTrackSink::ourOnSourceClosure(void* clientData) {
+  LLHLSTrackSink* sink = (LLHLSTrackSink*)clientData;
+  sink->fSegmenter.handleSourceClosure(sink->fTrackIndex);
+  sink->onSourceClosure();
+}
+
+////////// LLHLSSegmenter //////////
+
+inline LLHLSSegmenter* LLHLSSegmenter
+::createNew(UsageEnvironment& env, double segmentDuration, double partTargetDuration, char const* uriPrefix,
+	    unsigned maxSegmentsInPlaylist,
+	    onEndOfSegmentFunc* onEndOfSegmentFunc, void* onEndOfSegmentClientData) {
+  if (segmentDuration <= 0.0 || partTargetDuration <= 0.0 || partTargetDuration > segmentDuration) {
+    env.setResultMsg("LLHLSSegmenter: bad segment or partial segment duration");
+    return NULL;
+  }
+
+  return new LLHLSSegmenter(env, segmentDuration, partTargetDuration, uriPrefix,
+			    maxSegmentsInPlaylist == 0 ? 1 : maxSegmentsInPlaylist,
+			    onEndOfSegmentFunc, onEndOfSegmentClientData);
+}
+
+inline LLHLSSegmenter
+::LLHLSSegmenter(UsageEnvironment& env, double segmentDuration, double partTargetDuration, char const* uriPrefix,
+		 unsigned maxSegmentsInPlaylist,
+		 onEndOfSegmentFunc* onEndOfSegmentFunc, void* onEndOfSegmentClientData)
+  : Medium(env), fSegmentDuration(segmentDuration), fPartTargetDuration(partTargetDuration),
+    fURIPrefix(strDup(uriPrefix == NULL ? "" : uriPrefix)), fMaxSegmentsInPlaylist(maxSegmentsInPlaylist),
+    fOnEndOfSegmentFunc(onEndOfSegmentFunc), fOnEndOfSegmentClientData(onEndOfSegmentClientData),
+    fIsPlaying(False), fHaveTimeOrigin(False), fHasEnded(False),
+    fFragmentSequenceNumber(1), fCurrentSegmentDuration(0.0), fMaxSegmentDurationSoFar(0.0),
+    fSegmentsHead(0), fNumSegments(0), fFirstMSN(0), fNumPartsProduced(0),
+    fPendingRequests(NULL) {
+  for (unsigned i = 0; i < NUM_TRACKS; ++i) {
+    Track& track = fTracks[i];
+    track.isPresent = track.hasEnded = False;
+    track.source = NULL; track.sink = NULL;
+    track.timescale = 0;
+    track.width = track.height = 0;
+    track.sps = track.pps = NULL; track.spsSize = track.ppsSize = 0;
+    track.samplingFrequency = track.numChannels = 0;
+    track.audioSpecificConfig = NULL; track.audioSpecificConfigSize = 0;
+    track.auPresentationTime.tv_sec = track.auPresentationTime.tv_usec = 0;
+    track.auIsSync = track.haveAU = False;
+    track.lastSampleDuration = 0;
+    track.haveStarted = False;
+    track.nextDecodeTime = track.partBaseDecodeTime = 0;
+    track.partNumSamples = 0;
+    track.partDuration = 0;
+  }
+  fTimeOrigin.tv_sec = fTimeOrigin.tv_usec = 0;
+
+  // We hold the segments in our playlist, the segment that's being produced, and a couple of older segments
+  // (for clients that fetch them just after they've left the playlist):
+  fSegmentsArraySize = fMaxSegmentsInPlaylist + 3;
+  fSegments = new Segment*[fSegmentsArraySize];
+}
+
+inline LLHLSSegmenter::~LLHLSSegmenter() {
+  stopPlaying();
+
+  while (fPendingRequests != NULL) {
+    PendingRequest* request = fPendingRequests;
+    fPendingRequests = request->next;
+    envir().taskScheduler().unscheduleDelayedTask(request->timeoutTask);
+    (*request->func)(request->clientData, False);
+    delete request;
+  }
+
+  for (unsigned i = 0; i < fNumSegments; ++i) {
+    Segment* segment = fSegments[(fSegmentsHead + i)%fSegmentsArraySize];
+    for (unsigned j = 0; j < segment->numParts; ++j) delete[] segment->parts[j].data;
+    delete[] segment->parts;
+    delete segment;
+  }
+  delete[] fSegments;
+
+  for (unsigned i = 0; i < NUM_TRACKS; ++i) {
+    Medium::close(fTracks[i].sink);
+    delete[] fTracks[i].sps; delete[] fTracks[i].pps; delete[] fTracks[i].audioSpecificConfig;
+  }
+  delete[] fURIPrefix;
+}
+
+inline Boolean LLHLSSegmenter
+::addVideoSource(FramedSource* h264Source, unsigned width, unsigned height, unsigned maxNALUnitSize) {
+  Track& track = fTracks[VIDEO_TRACK];
+  if (fIsPlaying || track.isPresent || h264Source == NULL) return False;
+
+  track.sink = LLHLSTrackSink::createNew(envir(), *this, VIDEO_TRACK, maxNALUnitSize);
+  track.source = h264Source;
+  track.timescale = 90000;
+  track.width = width; track.height = height;
+  track.isPresent = True;
+  return True;
+}
+
+inline Boolean LLHLSSegmenter
+::addAudioSource(FramedSource* aacSource, unsigned samplingFrequency, unsigned numChannels, char const* configStr) {
+  Track& track = fTracks[AUDIO_TRACK];
+  if (fIsPlaying || track.isPresent || aacSource == NULL || samplingFrequency == 0 || configStr == NULL) return False;
+
+  // Convert "configStr" (hexadecimal) to binary:
+  unsigned configSize = strlen(configStr)/2;
+  if (configSize == 0) return False;
+  unsigned char* config = new unsigned char[configSize];
+  for (unsigned i = 0; i < configSize; ++i) {
+    unsigned byte;
+    if (sscanf(&configStr[2*i], "%02x", &byte) != 1) {
+      delete[] config;
+      return False;
+    }
+    config[i] = (unsigned char)byte;
+  }
+
+  track.sink = LLHLSTrackSink::createNew(envir(), *this, AUDIO_TRACK, 8192);
+  track.source = aacSource;
+  track.timescale = samplingFrequency;
+  track.samplingFrequency = samplingFrequency; track.numChannels = numChannels;
+  track.audioSpecificConfig = config; track.audioSpecificConfigSize = configSize;
+  track.isPresent = True;
+  return True;
+}
+
+inline Boolean LLHLSSegmenter::startPlaying() {
+  if (fIsPlaying) return True;
+  if (!fTracks[VIDEO_TRACK].isPresent && !fTracks[AUDIO_TRACK].isPresent) {
+    envir().setResultMsg("LLHLSSegmenter: no input sources were added");
+    return False;
+  }
+
+  fIsPlaying = True;
+  for (unsigned i = 0; i < NUM_TRACKS; ++i) {
+    Track& track = fTracks[i];
+    if (track.isPresent && !track.sink->startPlaying(*track.source, NULL, NULL)) {
+      stopPlaying();
+      return False;
+    }
+  }
+
+  return True;
+}
+
+inline void LLHLSSegmenter::stopPlaying() {
+  if (!fIsPlaying) return;
+  fIsPlaying = False;
+
+  for (unsigned i = 0; i < NUM_TRACKS; ++i) {
+    if (fTracks[i].sink != NULL) fTracks[i].sink->stopPlaying();
+  }
+}
+
+inline void LLHLSSegmenter
+::handleFrame(unsigned trackIndex, unsigned char const* frame, unsigned frameSize, struct timeval presentationTime) {
+  if (trackIndex == AUDIO_TRACK) {
+    addSample(AUDIO_TRACK, frame, frameSize, 1024, presentationTime, True);
+    return;
+  }
+
+  // Video: Each frame is a NAL unit.  Assemble the NAL units of each access unit into a single sample
+  // (in which each NAL unit is preceded by a 4-byte length):
+  Track& track = fTracks[VIDEO_TRACK];
+  if (frameSize == 0) return;
+
+  if (track.haveAU
+      && (presentationTime.tv_sec != track.auPresentationTime.tv_sec
+	  || presentationTime.tv_usec != track.auPresentationTime.tv_usec)) {
+    // This NAL unit begins a new access unit; this tells us the duration of the previous one:
+    int64_t uSecs = (int64_t)(presentationTime.tv_sec - track.auPresentationTime.tv_sec)*1000000
+      + (presentationTime.tv_usec - track.auPresentationTime.tv_usec);
+    u_int32_t duration = uSecs > 0 ? (u_int32_t)((uSecs*track.timescale + 500000)/1000000) : track.lastSampleDuration;
+    flushVideoAU(duration == 0 ? 3000 : duration);
+  }
+
+  u_int8_t nal_unit_type = frame[0]&0x1F;
+  switch (nal_unit_type) {
+    case 7: { // SPS
+      delete[] track.sps;
+      track.sps = new unsigned char[frameSize];
+      memmove(track.sps, frame, frameSize); track.spsSize = frameSize;
+      return;
+    }
+    case 8: { // PPS
+      delete[] track.pps;
+      track.pps = new unsigned char[frameSize];
+      memmove(track.pps, frame, frameSize); track.ppsSize = frameSize;
+      return;
+    }
+    case 9: case 12: { // access unit delimiter, or filler data: not needed
+      return;
+    }
+    default: {
+      break;
+    }
+  }
+
+  if (!track.haveAU) {
+    track.auPresentationTime = presentationTime;
+    track.auIsSync = False;
+    track.haveAU = True;
+  }
+  if (nal_unit_type == 5) track.auIsSync = True; // IDR
+  track.auData.addU32(frameSize);
+  track.auData.addBytes(frame, frameSize);
+}
+
+inline void LLHLSSegmenter::flushVideoAU(u_int32_t duration) {
+  Track& track = fTracks[VIDEO_TRACK];
+  if (!track.haveAU) return;
+
+  addSample(VIDEO_TRACK, track.auData.data(), track.auData.size(), duration, track.auPresentationTime, track.auIsSync);
+  track.lastSampleDuration = duration;
+  track.auData.reset();
+  track.haveAU = False;
+}
+
+inline void LLHLSSegmenter::handleSourceClosure(unsigned trackIndex) {
+  Track& track = fTracks[trackIndex];
+  if (track.hasEnded) return;
+  track.hasEnded = True;
+  if (trackIndex == VIDEO_TRACK) flushVideoAU(track.lastSampleDuration == 0 ? 3000 : track.lastSampleDuration);
+
+  for (unsigned i = 0; i < NUM_TRACKS; ++i) {
+    if (fTracks[i].isPresent && !fTracks[i].hasEnded) return; // some input is still running
+  }
+
+  // All of our inputs have ended:
+  if (fTracks[primaryTrack()].partNumSamples > 0) closePart();
+  if (fNumSegments > 0 && fSegments[(fSegmentsHead + fNumSegments - 1)%fSegmentsArraySize]->numParts > 0) {
+    closeSegment();
+  }
+  fHasEnded = True;
+  completePendingRequests();
+}
+
+inline Boolean LLHLSSegmenter::configurationIsReady() const {
+  Track const& video = fTracks[VIDEO_TRACK];
+  return !video.isPresent || (video.sps != NULL && video.pps != NULL && video.spsSize >= 4);
+}
+
+inline void LLHLSSegmenter::addSample(unsigned trackIndex, unsigned char const* data, unsigned size,
+				      u_int32_t duration, struct timeval presentationTime, Boolean isSync) {
+  Track& track = fTracks[trackIndex];
+  unsigned primary = primaryTrack();
+
+  if (fInitSegment.size() == 0) {
+    // We don't output anything until we know the stream's configuration, and can start with a key frame:
+    if (trackIndex != primary || !isSync || !configurationIsReady()) return;
+    buildInitSegment();
+    fTimeOrigin = presentationTime;
+    fHaveTimeOrigin = True;
+    startNewSegment();
+  }
+
+  if (!track.haveStarted) {
+    // Set this track's initial decode time from its first sample's presentation time (relative to our time origin),
+    // so that the tracks are in sync:
+    if (trackIndex != primary && !fTracks[primary].haveStarted) return;
+    int64_t uSecs = (int64_t)(presentationTime.tv_sec - fTimeOrigin.tv_sec)*1000000
+      + (presentationTime.tv_usec - fTimeOrigin.tv_usec);
+    if (uSecs < 0) return; // this sample precedes our first (key) frame
+    track.nextDecodeTime = track.partBaseDecodeTime = (u_int64_t)((uSecs*track.timescale)/1000000);
+    track.haveStarted = True;
+  }
+
+  if (trackIndex == primary && track.partNumSamples > 0) {
+    // Check whether this sample starts a new partial segment (and perhaps a new media segment):
+    // (We allow a media segment to end up to 10 ms early, to allow for rounding in frame durations.)
+    // A partial segment must not be longer than PART-TARGET, so we end it before a sample that would make it so.
+    // (We allow 1 microsecond for rounding.)
+    double partDuration = partDurationInSeconds(track);
+    double sampleDuration = (double)duration/track.timescale;
+    if (isSync && fCurrentSegmentDuration + partDuration + 0.010 >= fSegmentDuration) {
+      closePart();
+      closeSegment();
+    } else if (partDuration + sampleDuration > fPartTargetDuration + 0.000001) {
+      closePart();
+    }
+  }
+
+  track.partData.addBytes(data, size);
+  track.partSampleTable.addU32(duration);
+  track.partSampleTable.addU32(size);
+  track.partSampleTable.addU32(isSync ? 0x02000000 : 0x01010000); // sample_depends_on, sample_is_non_sync_sample
+  ++track.partNumSamples;
+  track.partDuration += duration;
+  track.nextDecodeTime += duration;
+}
+
+inline void LLHLSSegmenter::buildInitSegment() {
+  LLHLSBuffer& b = fInitSegment;
+  static u_int32_t const matrix[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+
+  unsigned ftyp = b.beginBox("ftyp");
+  b.addBytes("iso6", 4); b.addU32(0); b.addBytes("iso6", 4); b.addBytes("cmfc", 4);
+  b.endBox(ftyp);
+
+  unsigned moov = b.beginBox("moov");
+  unsigned mvhd = b.beginFullBox("mvhd", 0, 0);
+  b.addU32(0); b.addU32(0); b.addU32(1000); b.addU32(0); // creation_time, modification_time, timescale, duration
+  b.addU32(0x00010000); b.addU16(0x0100); b.addZeros(10); // rate, volume, reserved
+  for (unsigned i = 0; i < 9; ++i) b.addU32(matrix[i]);
+  b.addZeros(24); // pre_defined
+  b.addU32(NUM_TRACKS + 1); // next_track_ID
+  b.endBox(mvhd);
+
+  for (unsigned i = 0; i < NUM_TRACKS; ++i) {
+    Track& track = fTracks[i];
+    if (!track.isPresent) continue;
+    Boolean isVideo = i == VIDEO_TRACK;
+
+    unsigned trak = b.beginBox("trak");
+    unsigned tkhd = b.beginFullBox("tkhd", 0, 0x000007); // enabled, in movie, in preview
+    b.addU32(0); b.addU32(0); b.addU32(i + 1); b.addU32(0); b.addU32(0); // ..., track_ID, reserved, duration
+    b.addZeros(8); b.addU16(0); b.addU16(0); // reserved, layer, alternate_group
+    b.addU16(isVideo ? 0 : 0x0100); b.addU16(0); // volume, reserved
+    for (unsigned j = 0; j < 9; ++j) b.addU32(matrix[j]);
+    b.addU32(track.width<<16); b.addU32(track.height<<16);
+    b.endBox(tkhd);
+
+    unsigned mdia = b.beginBox("mdia");
+    unsigned mdhd = b.beginFullBox("mdhd", 0, 0);
+    b.addU32(0); b.addU32(0); b.addU32(track.timescale); b.addU32(0);
+    b.addU16(0x55C4); b.addU16(0); // language ("und"), pre_defined
+    b.endBox(mdhd);
+    unsigned hdlr = b.beginFullBox("hdlr", 0, 0);
+    b.addU32(0); b.addBytes(isVideo ? "vide" : "soun", 4); b.addZeros(12);
+    b.addString(isVideo ? "VideoHandler" : "SoundHandler"); b.addU8(0);
+    b.endBox(hdlr);
+
+    unsigned minf = b.beginBox("minf");
+    if (isVideo) {
+      unsigned vmhd = b.beginFullBox("vmhd", 0, 1);
+      b.addZeros(8); // graphicsmode, opcolor
+      b.endBox(vmhd);
+    } else {
+      unsigned smhd = b.beginFullBox("smhd", 0, 0);
+      b.addZeros(4); // balance, reserved
+      b.endBox(smhd);
+    }
+    unsigned dinf = b.beginBox("dinf");
+    unsigned dref = b.beginFullBox("dref", 0, 0);
+    b.addU32(1);
+    unsigned url = b.beginFullBox("url ", 0, 1); // the media data is in the same file
+    b.endBox(url);
+    b.endBox(dref);
+    b.endBox(dinf);
+
+    unsigned stbl = b.beginBox("stbl");
+    unsigned stsd = b.beginFullBox("stsd", 0, 0);
+    b.addU32(1);
+    if (isVideo) {
+      unsigned avc1 = b.beginBox("avc1");
+      b.addZeros(6); b.addU16(1); // reserved, data_reference_index
+      b.addZeros(16); // pre_defined, reserved, pre_defined
+      b.addU16(track.width); b.addU16(track.height);
+      b.addU32(0x00480000); b.addU32(0x00480000); b.addU32(0); b.addU16(1); // resolution, reserved, frame_count
+      b.addZeros(32); // compressorname
+      b.addU16(0x0018); b.addU16(0xFFFF); // depth, pre_defined
+      unsigned avcC = b.beginBox("avcC");
+      b.addU8(1); b.addU8(track.sps[1]); b.addU8(track.sps[2]); b.addU8(track.sps[3]);
+      b.addU8(0xFF); // lengthSizeMinusOne == 3
+      b.addU8(0xE1); b.addU16(track.spsSize); b.addBytes(track.sps, track.spsSize);
+      b.addU8(1); b.addU16(track.ppsSize); b.addBytes(track.pps, track.ppsSize);
+      b.endBox(avcC);
+      b.endBox(avc1);
+    } else {
+      unsigned mp4a = b.beginBox("mp4a");
+      b.addZeros(6); b.addU16(1); // reserved, data_reference_index
+      b.addZeros(8); b.addU16(track.numChannels); b.addU16(16); b.addZeros(4);
+      b.addU32(track.samplingFrequency < 65536 ? track.samplingFrequency<<16 : 0);
+      unsigned esds = b.beginFullBox("esds", 0, 0);
+      unsigned decoderConfigLength = 13 + 2 + track.audioSpecificConfigSize;
+      b.addU8(0x03); b.addU8(3 + 2 + decoderConfigLength + 3); // ES_Descriptor
+      b.addU16(i + 1); b.addU8(0);
+      b.addU8(0x04); b.addU8(decoderConfigLength); // DecoderConfigDescriptor
+      b.addU8(0x40); b.addU8(0x15); b.addU24(0); b.addU32(0); b.addU32(0); // MPEG-4 audio
+      b.addU8(0x05); b.addU8(track.audioSpecificConfigSize); // DecoderSpecificInfo
+      b.addBytes(track.audioSpecificConfig, track.audioSpecificConfigSize);
+      b.addU8(0x06); b.addU8(1); b.addU8(0x02); // SLConfigDescriptor
+      b.endBox(esds);
+      b.endBox(mp4a);
+    }
+    b.endBox(stsd);
+    char const* const emptyTables[4] = { "stts", "stsc", "stsz", "stco" };
+    for (unsigned j = 0; j < 4; ++j) {
+      unsigned table = b.beginFullBox(emptyTables[j], 0, 0);
+      if (j == 2) b.addU32(0); // sample_size
+      b.addU32(0); // entry_count
+      b.endBox(table);
+    }
+    b.endBox(stbl);
+    b.endBox(minf);
+    b.endBox(mdia);
+    b.endBox(trak);
+  }
+
+  unsigned mvex = b.beginBox("mvex");
+  for (unsigned i = 0; i < NUM_TRACKS; ++i) {
+    if (!fTracks[i].isPresent) continue;
+    unsigned trex = b.beginFullBox("trex", 0, 0);
+    b.addU32(i + 1); b.addU32(1); b.addU32(0); b.addU32(0); b.addU32(0);
+    b.endBox(trex);
+  }
+  b.endBox(mvex);
+  b.endBox(moov);
+}
+
+inline void LLHLSSegmenter::closePart() {
+  if (fNumSegments == 0) return;
+  Segment* segment = fSegments[(fSegmentsHead + fNumSegments - 1)%fSegmentsArraySize];
+
+  // Build a 'moof' box (with a 'traf' for each track that has samples), followed by a 'mdat' box:
+  LLHLSBuffer b;
+  unsigned dataOffsetFields[NUM_TRACKS];
+  unsigned moof = b.beginBox("moof");
+  unsigned mfhd = b.beginFullBox("mfhd", 0, 0);
+  b.addU32(fFragmentSequenceNumber++);
+  b.endBox(mfhd);
+  for (unsigned i = 0; i < NUM_TRACKS; ++i) {
+    Track& track = fTracks[i];
+    if (track.partNumSamples == 0) continue;
+
+    unsigned traf = b.beginBox("traf");
+    unsigned tfhd = b.beginFullBox("tfhd", 0, 0x020000); // default-base-is-moof
+    b.addU32(i + 1);
+    b.endBox(tfhd);
+    unsigned tfdt = b.beginFullBox("tfdt", 1, 0);
+    b.addU64(track.partBaseDecodeTime);
+    b.endBox(tfdt);
+    unsigned trun = b.beginFullBox("trun", 0, 0x000701); // data-offset, sample-duration, -size, -flags present
+    b.addU32(track.partNumSamples);
+    dataOffsetFields[i] = b.size();
+    b.addU32(0); // data_offset; filled in below
+    b.addBytes(track.partSampleTable.data(), track.partSampleTable.size());
+    b.endBox(trun);
+    b.endBox(traf);
+  }
+  b.endBox(moof);
+
+  unsigned mdat = b.beginBox("mdat");
+  Boolean isIndependent = False;
+  for (unsigned i = 0; i < NUM_TRACKS; ++i) {
+    Track& track = fTracks[i];
+    if (track.partNumSamples == 0) continue;
+
+    b.setU32(dataOffsetFields[i], b.size() - moof);
+    b.addBytes(track.partData.data(), track.partData.size());
+    if (i == primaryTrack()) {
+      isIndependent = track.partSampleTable.data()[8] == 0x02; // the first sample is a sync sample
+    }
+  }
+  b.endBox(mdat);
+
+  // Add the new partial segment to the current media segment:
+  if (segment->numParts == segment->partsArraySize) {
+    unsigned newArraySize = segment->partsArraySize == 0 ? 16 : 2*segment->partsArraySize;
+    Part* newParts = new Part[newArraySize];
+    for (unsigned i = 0; i < segment->numParts; ++i) newParts[i] = segment->parts[i];
+    delete[] segment->parts;
+    segment->parts = newParts; segment->partsArraySize = newArraySize;
+  }
+  Part& part = segment->parts[segment->numParts++];
+  part.size = b.size();
+  part.data = b.takeData();
+  part.duration = partDurationInSeconds(fTracks[primaryTrack()]);
+  part.isIndependent = isIndependent;
+  fCurrentSegmentDuration += part.duration;
+  ++fNumPartsProduced;
+
+  for (unsigned i = 0; i < NUM_TRACKS; ++i) {
+    Track& track = fTracks[i];
+    track.partData.reset();
+    track.partSampleTable.reset();
+    track.partNumSamples = 0;
+    track.partDuration = 0;
+    track.partBaseDecodeTime = track.nextDecodeTime;
+  }
+
+  completePendingRequests();
+}
+
+inline void LLHLSSegmenter::closeSegment() {
+  if (fNumSegments == 0) return;
+  Segment* segment = fSegments[(fSegmentsHead + fNumSegments - 1)%fSegmentsArraySize];
+  segment->isComplete = True;
+  segment->duration = fCurrentSegmentDuration;
+  if (segment->duration > fMaxSegmentDurationSoFar) fMaxSegmentDurationSoFar = segment->duration;
+  fCurrentSegmentDuration = 0.0;
+
+  if (fOnEndOfSegmentFunc != NULL) (*fOnEndOfSegmentFunc)(fOnEndOfSegmentClientData, lastMSN(), segment->duration);
+  startNewSegment();
+  completePendingRequests();
+}
+
+inline void LLHLSSegmenter::startNewSegment() {
+  if (fNumSegments == fSegmentsArraySize) {
+    // Discard our oldest segment:
+    Segment* oldest = fSegments[fSegmentsHead];
+    for (unsigned i = 0; i < oldest->numParts; ++i) delete[] oldest->parts[i].data;
+    delete[] oldest->parts;
+    delete oldest;
+    fSegmentsHead = (fSegmentsHead + 1)%fSegmentsArraySize;
+    --fNumSegments;
+    ++fFirstMSN;
+  }
+
+  Segment* segment = new Segment;
+  segment->parts = NULL; segment->numParts = segment->partsArraySize = 0;
+  segment->duration = 0.0;
+  segment->isComplete = False;
+  fSegments[(fSegmentsHead + fNumSegments)%fSegmentsArraySize] = segment;
+  ++fNumSegments;
+}
+
+inline LLHLSSegmenter::Segment* LLHLSSegmenter::segmentFor(unsigned msn) const {
+  if (fNumSegments == 0 || msn < fFirstMSN || msn > lastMSN()) return NULL;
+  return fSegments[(fSegmentsHead + (msn - fFirstMSN))%fSegmentsArraySize];
+}
+
+inline char* LLHLSSegmenter::generatePlaylist() const {
+  if (fNumSegments == 0) return NULL;
+
+  // List (up to) "fMaxSegmentsInPlaylist" complete segments, followed by the segment that's being produced:
+  unsigned numComplete = fNumSegments - 1;
+  unsigned firstListed = numComplete > fMaxSegmentsInPlaylist ? numComplete - fMaxSegmentsInPlaylist : 0;
+  double targetDuration = fMaxSegmentDurationSoFar > fSegmentDuration ? fMaxSegmentDurationSoFar : fSegmentDuration;
+
+  LLHLSBuffer b;
+  char line[300];
+  b.addString("#EXTM3U\n#EXT-X-VERSION:9\n#EXT-X-INDEPENDENT-SEGMENTS\n");
+  sprintf(line, "#EXT-X-TARGETDURATION:%u\n", (unsigned)(targetDuration + 0.999)); b.addString(line);
+  sprintf(line, "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.3f\n", 3*fPartTargetDuration);
+  b.addString(line);
+  sprintf(line, "#EXT-X-PART-INF:PART-TARGET=%.3f\n", fPartTargetDuration); b.addString(line);
+  sprintf(line, "#EXT-X-MEDIA-SEQUENCE:%u\n", fFirstMSN + firstListed); b.addString(line);
+  sprintf(line, "#EXT-X-MAP:URI=\"%.200sinit.mp4\"\n", fURIPrefix); b.addString(line);
+
+  for (unsigned i = firstListed; i < fNumSegments; ++i) {
+    unsigned msn = fFirstMSN + i;
+    Segment const* segment = fSegments[(fSegmentsHead + i)%fSegmentsArraySize];
+
+    // Partial segments are listed only for the last few segments:
+    if (i + 3 >= fNumSegments) {
+      for (unsigned j = 0; j < segment->numParts; ++j) {
+	sprintf(line, "#EXT-X-PART:DURATION=%.3f,URI=\"%.200s%u.%u.m4s\"%s\n",
+		segment->parts[j].duration, fURIPrefix, msn, j,
+		segment->parts[j].isIndependent ? ",INDEPENDENT=YES" : "");
+	b.addString(line);
+      }
+    }
+    if (segment->isComplete) {
+      sprintf(line, "#EXTINF:%.3f,\n%.200s%u.m4s\n", segment->duration, fURIPrefix, msn); b.addString(line);
+    } else if (!fHasEnded) {
+      sprintf(line, "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"%.200s%u.%u.m4s\"\n", fURIPrefix, msn, segment->numParts);
+      b.addString(line);
+    }
+  }
+  if (fHasEnded) b.addString("#EXT-X-ENDLIST\n");
+  b.addU8('\0');
+
+  return (char*)b.takeData();
+}
+
+inline unsigned char* LLHLSSegmenter::getResource(char const* resourceName, unsigned& resultSize) const {
+  resultSize = 0;
+  size_t prefixLen = strlen(fURIPrefix);
+  if (resourceName == NULL || strncmp(resourceName, fURIPrefix, prefixLen) != 0) return NULL;
+  char const* name = &resourceName[prefixLen];
+
+  unsigned char* result = NULL;
+  if (strcmp(name, "init.mp4") == 0) {
+    if (fInitSegment.size() == 0) return NULL;
+    resultSize = fInitSegment.size();
+    result = new unsigned char[resultSize];
+    memmove(result, fInitSegment.data(), resultSize);
+    return result;
+  }
+
+  unsigned msn, partIndex;
+  int partNameLen = 0, segmentNameLen = 0;
+  if (sscanf(name, "%u.%u.m4s%n", &msn, &partIndex, &partNameLen) == 2 && partNameLen > 0
+      && name[partNameLen] == '\0') {
+    // A partial segment:
+    Segment const* segment = segmentFor(msn);
+    if (segment == NULL || partIndex >= segment->numParts) return NULL;
+    resultSize = segment->parts[partIndex].size;
+    result = new unsigned char[resultSize];
+    memmove(result, segment->parts[partIndex].data, resultSize);
+  } else if (sscanf(name, "%u.m4s%n", &msn, &segmentNameLen) == 1 && segmentNameLen > 0
+	     && name[segmentNameLen] == '\0') {
+    // A whole media segment (the concatenation of its partial segments):
+    Segment const* segment = segmentFor(msn);
+    if (segment == NULL || !segment->isComplete) return NULL;
+    for (unsigned i = 0; i < segment->numParts; ++i) resultSize += segment->parts[i].size;
+    result = new unsigned char[resultSize];
+    unsigned offset = 0;
+    for (unsigned i = 0; i < segment->numParts; ++i) {
+      memmove(&result[offset], segment->parts[i].data, segment->parts[i].size);
+      offset += segment->parts[i].size;
+    }
+  }
+
+  return result;
+}
+
+inline Boolean LLHLSSegmenter::isAvailable(unsigned msn, int partIndex) const {
+  if (fNumSegments == 0) return False;
+
+  unsigned currentMSN = lastMSN();
+  if (msn < currentMSN) return True;
+  if (msn > currentMSN) return False;
+
+  Segment const* current = fSegments[(fSegmentsHead + fNumSegments - 1)%fSegmentsArraySize];
+  return partIndex >= 0 && (unsigned)partIndex < current->numParts;
+}
+
+inline void LLHLSSegmenter::whenAvailable(unsigned mediaSequenceNumber, int partIndex,
+					  availabilityFunc* func, void* clientData) {
+  if (func == NULL) return;
+  if (isAvailable(mediaSequenceNumber, partIndex)) {
+    (*func)(clientData, True);
+    return;
+  }
+
+  // A request more than two segments in the future (or for a stream that has already ended) can't be satisfied:
+  unsigned currentMSN = fNumSegments == 0 ? fFirstMSN : lastMSN();
+  if (fHasEnded || mediaSequenceNumber > currentMSN + 2) {
+    (*func)(clientData, False);
+    return;
+  }
+
+  PendingRequest* request = new PendingRequest;
+  request->segmenter = this;
+  request->msn = mediaSequenceNumber; request->partIndex = partIndex;
+  request->func = func; request->clientData = clientData;
+  double targetDuration = fMaxSegmentDurationSoFar > fSegmentDuration ? fMaxSegmentDurationSoFar : fSegmentDuration;
+  request->timeoutTask
+    = envir().taskScheduler().scheduleDelayedTask((int64_t)(3*targetDuration*1000000), pendingRequestTimeout, request);
+  request->next = fPendingRequests;
+  fPendingRequests = request;
+}
+
+inline void LLHLSSegmenter::cancelWhenAvailable(availabilityFunc* func, void* clientData) {
+  PendingRequest** ptr = &fPendingRequests;
+  while (*ptr != NULL) {
+    PendingRequest* request = *ptr;
+    if (request->func == func && request->clientData == clientData) {
+      *ptr = request->next;
+      envir().taskScheduler().unscheduleDelayedTask(request->timeoutTask);
+      delete request;
+    } else {
+      ptr = &request->next;
+    }
+  }
+}
+
+inline void LLHLSSegmenter::completePendingRequests() {
+  // First, remove the requests that can now be answered (so that their handlers may safely make new requests):
+  PendingRequest* completed = NULL;
+  PendingRequest** ptr = &fPendingRequests;
+  while (*ptr != NULL) {
+    PendingRequest* request = *ptr;
+    if (fHasEnded || isAvailable(request->msn, request->partIndex)) {
+      *ptr = request->next;
+      request->next = completed;
+      completed = request;
+    } else {
+      ptr = &request->next;
+    }
+  }
+
+  while (completed != NULL) {
+    PendingRequest* request = completed;
+    completed = request->next;
+    envir().taskScheduler().unscheduleDelayedTask(request->timeoutTask);
+    (*request->func)(request->clientData, isAvailable(request->msn, request->partIndex));
+    delete request;
+  }
+}
+
+inline void LLHLSSegmenter::pendingRequestTimeout(void* clientData) {
+  PendingRequest* request = (PendingRequest*)clientData;
+  LLHLSSegmenter* segmenter = request->segmenter;
+
+  for (PendingRequest** ptr = &segmenter->fPendingRequests; *ptr != NULL; ptr = &(*ptr)->next) {
+    if (*ptr == request) {
+      *ptr = request->next;
+      break;
+    }
+  }
+  (*request->func)(request->clientData, False);
+  delete request;
+}
+
+#endif
@@ -0,0 +1,721 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A filter for multiplexing Elementary Streams - in one or more 'programs' - into a (multi-program) MPEG-2
+// Transport Stream.  Packets are written directly into the reader's buffer (in groups of 7 - i.e., one UDP
+// packet's worth - when there's room), with PCRs at regular intervals, and (optionally) null packets added to
+// make the output constant-bitrate.  If an input is late (i.e., its next frame hasn't arrived by the time our next
+// packet is due, in real time), we keep sending PATs, PMTs, PCRs and (if constant-bitrate) null packets on schedule.
+// C++ header
+
+#ifndef _MPEG2_TRANSPORT_STREAM_MULTI_PROGRAM_MULTIPLEXOR_HH
+#define _MPEG2_TRANSPORT_STREAM_MULTI_PROGRAM_MULTIPLEXOR_HH
+
+#ifndef _FRAMED_SOURCE_HH
+#include "FramedSource.hh"
+#endif
+#ifndef _GROUPSOCK_HELPER_HH
+#include "GroupsockHelper.hh"
+#endif
+
+#ifndef TRANSPORT_PACKET_SIZE
+#define TRANSPORT_PACKET_SIZE 188
+#endif
+#define TRANSPORT_PACKETS_PER_BATCH 7 // 7*188 == 1316 bytes: the usual UDP payload
+#define MPTS_PSI_INTERVAL_US 100000 // how often each PAT and PMT is sent
+#define MPTS_PCR_INTERVAL_US 30000 // how often each program's PCR is sent (ISO/IEC 13818-1 requires <= 100 ms)
+#define MPTS_DEFAULT_MUX_DELAY_US 300000 // how far (at most) ahead of its time each frame is sent
+#define MPTS_DEFAULT_MAX_INPUT_FRAME_SIZE 300000
+
+// The CRC calculation function that Transport Streams use.  This gives the same result as "calculateCRC()" (in
+// "MPEG2TransportStreamMultiplexor.hh"), but looks at 8 bytes at a time:
+u_int32_t calculateCRCSliceBy8(u_int8_t const* data, unsigned dataLength, u_int32_t initialValue = 0xFFFFFFFF);
+
+class MPEG2TransportStreamMultiProgramMultiplexor: public FramedSource {
+public:
+  static MPEG2TransportStreamMultiProgramMultiplexor* createNew(UsageEnvironment& env, unsigned muxRate = 0,
+								 u_int16_t transportStreamId = 1,
+								 unsigned muxDelayUS = MPTS_DEFAULT_MUX_DELAY_US,
+								 unsigned maxInputFrameSize = MPTS_DEFAULT_MAX_INPUT_FRAME_SIZE);
+      // "muxRate" is the output bitrate (in bits-per-second), which is kept constant by adding null packets.
+      // If "muxRate" is 0, then no null packets are added (i.e., the output is variable-bitrate).
+
+  Boolean addProgram(u_int16_t programNumber, u_int16_t pmtPID);
+  Boolean addElementaryStream(u_int16_t programNumber, FramedSource* inputSource, u_int8_t streamType,
+			      u_int16_t PID, Boolean carriesPCR = False);
+      // "streamType" is the PMT 'stream_type' (e.g., 0x02 for MPEG-2 video, 0x1B for H.264 video, 0x24 for H.265
+      // video, 0x0F for AAC (ADTS) audio, 0x03 or 0x04 for MPEG audio, 0x81 for AC-3 audio).
+      // Each frame from "inputSource" becomes one PES packet, with the frame's presentation time as its PTS.  For H.264
+      // and H.265, each frame is assumed to be a NAL unit without a start code (as delivered by our 'framer' classes).
+      // If no stream in a program is marked as carrying its PCR, then its first stream does.
+      // These return False (and set the result message) if the program or PID is invalid, or already used, or if the
+      // program's PMT (or the PAT) would no longer fit in one Transport Stream packet.
+
+protected:
+  MPEG2TransportStreamMultiProgramMultiplexor(UsageEnvironment& env, unsigned muxRate, u_int16_t transportStreamId,
+					     unsigned muxDelayUS, unsigned maxInputFrameSize);
+      // called only by createNew()
+  virtual ~MPEG2TransportStreamMultiProgramMultiplexor();
+
+private:
+  // Redefined virtual functions:
+  virtual void doGetNextFrame();
+  virtual void doStopGettingFrames();
+
+private:
+  struct Program;
+  struct ElementaryStream {
+    MPEG2TransportStreamMultiProgramMultiplexor* fOurMux;
+    Program* fProgram;
+    FramedSource* fSource;
+    u_int16_t fPID;
+    u_int8_t fStreamType, fStreamId;
+    u_int8_t fContinuityCounter;
+    unsigned char* fBuffer;
+    unsigned fFrameSize;
+    int64_t fFrameTime; // on our timeline (see "timelineTime()")
+    Boolean fHaveFrame, fReadPending, fIsClosed;
+    u_int8_t fPESHeader[4+19]; // (for H.264 and H.265, followed by a start code)
+    unsigned fPESHeaderSize;
+    unsigned fBytesSent; // of the PES header and frame
+  };
+  struct Program {
+    u_int16_t fProgramNumber, fPMTPID, fPCRPID;
+    u_int8_t fPMTContinuityCounter;
+    ElementaryStream** fStreams;
+    unsigned fNumStreams;
+    Boolean fHaveSentPCR;
+    double fLastPCRTime;
+  };
+
+  Program* lookupProgram(u_int16_t programNumber) const;
+  Boolean PIDIsUsed(u_int16_t PID) const;
+
+  void requestFrame(ElementaryStream& stream);
+  static void afterGettingFrame(void* clientData, unsigned frameSize, unsigned numTruncatedBytes,
+				struct timeval presentationTime, unsigned durationInMicroseconds);
+  void afterGettingFrame(ElementaryStream& stream, unsigned frameSize, struct timeval presentationTime);
+  static void onSourceClosure(void* clientData);
+  void onSourceClosure(ElementaryStream& stream);
+
+  int64_t timelineTime(struct timeval const& presentationTime);
+  static double realTimeNow(); // us, from "gettimeofday()"
+  double realTimeSTC() const { return realTimeNow() - fRealTimeOffset; } // the time (on our timeline) that it is now
+  double nextScheduledPacketTime() const; // when (on our timeline) our next packet is due, even if an input is late
+  static void lateInputCheck(void* clientData);
+  void deliver(Boolean isCallback);
+
+  // Routines that write one Transport Stream packet at "to":
+  void writePATPacket(u_int8_t* to);
+  void writePMTPacket(u_int8_t* to, Program& program);
+  void writeSectionPacket(u_int8_t* to, u_int16_t PID, u_int8_t& continuityCounter,
+			  u_int8_t tableId, u_int16_t tableIdExtension, u_int8_t const* body, unsigned bodySize);
+  void writePCRPacket(u_int8_t* to, Program& program);
+  void writePESPacket(u_int8_t* to, ElementaryStream& stream);
+  static void writeNullPacket(u_int8_t* to);
+
+private:
+  unsigned fMuxRate;
+  u_int16_t fTransportStreamId;
+  int64_t fMuxDelay; // us
+  double fPacketDuration; // us; used only if fMuxRate > 0
+  unsigned fMaxInputFrameSize;
+
+  Program** fPrograms;
+  unsigned fNumPrograms;
+  ElementaryStream** fStreams;
+  unsigned fNumStreams;
+
+  u_int8_t fPATContinuityCounter;
+  u_int8_t fVersionNumber; // of the PAT and PMTs; incremented whenever they change
+  Boolean fHaveTimeBase;
+  struct timeval fTimeBase; // the presentation time that's at "MPTS_TIMELINE_OFFSET" on our timeline
+
+  Boolean fClockHasStarted;
+  double fSTC; // our System Time Clock: the time (on our timeline) of the next output packet
+  double fRealTimeOffset; // us; the real time (from "gettimeofday()") minus "fSTC", when the clock started
+  int64_t fTimeOfLastDelivery; // (rounded) "fSTC" at the end of the previous delivery
+  Boolean fHaveSentPSI;
+  double fLastPSITime;
+  unsigned fNextPSIPacket; // 0: nothing pending; 1: PAT; 2..: PMT of program "fNextPSIPacket"-2
+
+  Boolean fIsDelivering, fAwaitingInput;
+  unsigned fNumPacketsInBuffer; // packets already written to "fTo" (while waiting for input)
+  TaskToken fLateInputTask; // while waiting for input: when our next packet is due
+};
+
+
+////////// Implementation //////////
+
+#define MPTS_TIMELINE_OFFSET 1000000 // us; so that our timeline (and PTSs) starts at 1 second
+#define MPTS_NULL_PID 0x1FFF
+
+// calculateCRCSliceBy8() //
+
+class TransportStreamCRCTables {
+public:
+  TransportStreamCRCTables() {
+    for (unsigned i = 0; i < 256; ++i) {
+      u_int32_t crc = i << 24;
+      for (unsigned j = 0; j < 8; ++j) crc = (crc&0x80000000) != 0 ? (crc<<1)^0x04C11DB7 : crc<<1;
+      table[0][i] = crc;
+    }
+    for (unsigned i = 0; i < 256; ++i) {
+      for (unsigned k = 1; k < 8; ++k) table[k][i] = (table[k-1][i]<<8)^table[0][table[k-1][i]>>24];
+    }
+  }
+
+  u_int32_t table[8][256];
+      // "table[k][i]" is the CRC contribution of byte value "i", followed by "k" zero bytes
+};
+
+inline u_int32_t calculateCRCSliceBy8(u_int8_t const* data, unsigned dataLength, u_int32_t initialValue) {
+  static TransportStreamCRCTables const tables;
+  u_int32_t const (*t)[256] = tables.table;
+  u_int32_t crc = initialValue;
+
+  while (dataLength >= 8) {
+    u_int32_t hi = crc ^ ((data[0]<<24)|(data[1]<<16)|(data[2]<<8)|data[3]);
+    crc = t[7][hi>>24] ^ t[6][(hi>>16)&0xFF] ^ t[5][(hi>>8)&0xFF] ^ t[4][hi&0xFF]
+      ^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+    data += 8; dataLength -= 8;
+  }
+  while (dataLength-- > 0) crc = (crc<<8) ^ t[0][(crc>>24)^*data++];
+
+  return crc;
+}
+
+// MPEG2TransportStreamMultiProgramMultiplexor //
+
+inline MPEG2TransportStreamMultiProgramMultiplexor*
+MPEG2TransportStreamMultiProgramMultiplexor::createNew(UsageEnvironment& env, unsigned muxRate,
+						       u_int16_t transportStreamId, unsigned muxDelayUS,
+						       unsigned maxInputFrameSize) {
+  return new MPEG2TransportStreamMultiProgramMultiplexor(env, muxRate, transportStreamId, muxDelayUS, maxInputFrameSize);
+}
+
+inline MPEG2TransportStreamMultiProgramMultiplexor
+::MPEG2TransportStreamMultiProgramMultiplexor(UsageEnvironment& env, unsigned muxRate, u_int16_t transportStreamId,
+					      unsigned muxDelayUS, unsigned maxInputFrameSize)
+  : FramedSource(env), fMuxRate(muxRate), fTransportStreamId(transportStreamId), fMuxDelay(muxDelayUS),
+    fPacketDuration(muxRate > 0 ? (TRANSPORT_PACKET_SIZE*8*1000000.0)/muxRate : 0.0),
+    fMaxInputFrameSize(maxInputFrameSize),
+    fPrograms(NULL), fNumPrograms(0), fStreams(NULL), fNumStreams(0),
+    fPATContinuityCounter(0), fVersionNumber(0), fHaveTimeBase(False),
+    fClockHasStarted(False), fSTC(0.0), fRealTimeOffset(0.0), fTimeOfLastDelivery(0), fHaveSentPSI(False),
+    fLastPSITime(0.0), fNextPSIPacket(0), fIsDelivering(False), fAwaitingInput(False), fNumPacketsInBuffer(0),
+    fLateInputTask(NULL) {
+}
+
+inline MPEG2TransportStreamMultiProgramMultiplexor::~MPEG2TransportStreamMultiProgramMultiplexor() {
+  envir().taskScheduler().unscheduleDelayedTask(fLateInputTask);
+  for (unsigned i = 0; i < fNumStreams; ++i) {
+    Medium::close(fStreams[i]->fSource);
+    delete[] fStreams[i]->fBuffer;
+    delete fStreams[i];
+  }
+  delete[] fStreams;
+
+  for (unsigned i = 0; i < fNumPrograms; ++i) {
+    delete[] fPrograms[i]->fStreams;
+    delete fPrograms[i];
+  }
+  delete[] fPrograms;
+}
+
+inline MPEG2TransportStreamMultiProgramMultiplexor::Program*
+MPEG2TransportStreamMultiProgramMultiplexor::lookupProgram(u_int16_t programNumber) const {
+  for (unsigned i = 0; i < fNumPrograms; ++i) {
+    if (fPrograms[i]->fProgramNumber == programNumber) return fPrograms[i];
+  }
+  return NULL;
+}
+
+inline Boolean MPEG2TransportStreamMultiProgramMultiplexor::PIDIsUsed(u_int16_t PID) const {
+  for (unsigned i = 0; i < fNumPrograms; ++i) {
+    if (fPrograms[i]->fPMTPID == PID) return True;
+  }
+  for (unsigned i = 0; i < fNumStreams; ++i) {
+    if (fStreams[i]->fPID == PID) return True;
+  }
+  return False;
+}
+
+inline Boolean MPEG2TransportStreamMultiProgramMultiplexor::addProgram(u_int16_t programNumber, u_int16_t pmtPID) {
+  if (programNumber == 0 || lookupProgram(programNumber) != NULL) {
+    envir().setResultMsg("Invalid or duplicate program number");
+    return False;
+  }
+  if (pmtPID < 0x0010 || pmtPID >= MPTS_NULL_PID || PIDIsUsed(pmtPID)) {
+    envir().setResultMsg("Invalid or duplicate PMT PID");
+    return False;
+  }
+  // The PAT (with 4 bytes per program) must fit in one packet: 1 (pointer) + 8 (header) + 4*N + 4 (CRC) <= 184
+  if (1 + 8 + 4*(fNumPrograms+1) + 4 > TRANSPORT_PACKET_SIZE-4) {
+    envir().setResultMsg("Too many programs");
+    return False;
+  }
+
+  Program* program = new Program;
+  program->fProgramNumber = programNumber;
+  program->fPMTPID = pmtPID;
+  program->fPCRPID = MPTS_NULL_PID;
+  program->fPMTContinuityCounter = 0;
+  program->fStreams = NULL;
+  program->fNumStreams = 0;
+  program->fHaveSentPCR = False;
+  program->fLastPCRTime = 0.0;
+
+  Program** newPrograms = new Program*[fNumPrograms+1];
+  for (unsigned i = 0; i < fNumPrograms; ++i) newPrograms[i] = fPrograms[i];
+  newPrograms[fNumPrograms++] = program;
+  delete[] fPrograms; fPrograms = newPrograms;
+
+  fVersionNumber = (fVersionNumber+1)&0x1F;
+  return True;
+}
+
+inline Boolean MPEG2TransportStreamMultiProgramMultiplexor
+::addElementaryStream(u_int16_t programNumber, FramedSource* inputSource, u_int8_t streamType,
+		      u_int16_t PID, Boolean carriesPCR) {
+  Program* program = lookupProgram(programNumber);
+  if (program == NULL || inputSource == NULL) {
+    envir().setResultMsg("Unknown program number, or no input source");
+    return False;
+  }
+  if (PID < 0x0010 || PID >= MPTS_NULL_PID || PIDIsUsed(PID)) {
+    envir().setResultMsg("Invalid or duplicate PID");
+    return False;
+  }
+  // The PMT (with 5 bytes per stream) must fit in one packet: 1 (pointer) + 12 (header) + 5*N + 4 (CRC) <= 184
+  if (1 + 12 + 5*(program->fNumStreams+1) + 4 > TRANSPORT_PACKET_SIZE-4) {
+    envir().setResultMsg("Too many streams in this program");
+    return False;
+  }
+
+  ElementaryStream* stream = new ElementaryStream;
+  memset(stream, 0, sizeof *stream);
+  stream->fOurMux = this;
+  stream->fProgram = program;
+  stream->fSource = inputSource;
+  stream->fPID = PID;
+  stream->fStreamType = streamType;
+  stream->fBuffer = new unsigned char[fMaxInputFrameSize];
+
+  // Choose a PES 'stream_id' (unique within the program) for the stream's type:
+  unsigned numVideo = 0, numAudio = 0;
+  for (unsigned i = 0; i < program->fNumStreams; ++i) {
+    u_int8_t id = program->fStreams[i]->fStreamId;
+    if ((id&0xF0) == 0xE0) ++numVideo; else if ((id&0xE0) == 0xC0) ++numAudio;
+  }
+  switch (streamType) {
+    case 0x01: case 0x02: case 0x10: case 0x1B: case 0x24: { stream->fStreamId = 0xE0|(numVideo&0x0F); break; }
+    case 0x03: case 0x04: case 0x0F: case 0x11: { stream->fStreamId = 0xC0|(numAudio&0x1F); break; }
+    default: { stream->fStreamId = 0xBD; break; } // private_stream_1 (e.g., for AC-3)
+  }
+
+  ElementaryStream** newProgramStreams = new ElementaryStream*[program->fNumStreams+1];
+  for (unsigned i = 0; i < program->fNumStreams; ++i) newProgramStreams[i] = program->fStreams[i];
+  newProgramStreams[program->fNumStreams++] = stream;
+  delete[] program->fStreams; program->fStreams = newProgramStreams;
+  if (carriesPCR || program->fPCRPID == MPTS_NULL_PID) program->fPCRPID = PID;
+
+  ElementaryStream** newStreams = new ElementaryStream*[fNumStreams+1];
+  for (unsigned i = 0; i < fNumStreams; ++i) newStreams[i] = fStreams[i];
+  newStreams[fNumStreams++] = stream;
+  delete[] fStreams; fStreams = newStreams;
+
+  fVersionNumber = (fVersionNumber+1)&0x1F;
+  return True;
+}
+
+inline void MPEG2TransportStreamMultiProgramMultiplexor::doStopGettingFrames() {
+  for (unsigned i = 0; i < fNumStreams; ++i) {
+    fStreams[i]->fSource->stopGettingFrames();
+    fStreams[i]->fReadPending = False;
+  }
+  envir().taskScheduler().unscheduleDelayedTask(fLateInputTask);
+  fAwaitingInput = False;
+  fNumPacketsInBuffer = 0;
+}
+
+inline void MPEG2TransportStreamMultiProgramMultiplexor::requestFrame(ElementaryStream& stream) {
+  if (stream.fHaveFrame || stream.fReadPending || stream.fIsClosed) return;
+
+  stream.fReadPending = True;
+  stream.fSource->getNextFrame(stream.fBuffer, fMaxInputFrameSize,
+			       afterGettingFrame, &stream, onSourceClosure, &stream);
+}
+
+inline void MPEG2TransportStreamMultiProgramMultiplexor
+::afterGettingFrame(void* clientData, unsigned frameSize, unsigned /*numTruncatedBytes*/,
+		    struct timeval presentationTime, unsigned /*durationInMicroseconds*/) {
+  ElementaryStream* stream = (ElementaryStream*)clientData;
+  stream->fOurMux->afterGettingFrame(*stream, frameSize, presentationTime);
+}
+
+inline int64_t MPEG2TransportStreamMultiProgramMultiplexor::timelineTime(struct timeval const& presentationTime) {
+  if (!fHaveTimeBase) {
+    fTimeBase = presentationTime;
+    fHaveTimeBase = True;
+  }
+  return (int64_t)(presentationTime.tv_sec - fTimeBase.tv_sec)*1000000
+    + (presentationTime.tv_usec - fTimeBase.tv_usec) + MPTS_TIMELINE_OFFSET;
+}
+
+inline double MPEG2TransportStreamMultiProgramMultiplexor::realTimeNow() {
+  struct timeval timeNow;
+  gettimeofday(&timeNow, NULL);
+  return (double)timeNow.tv_sec*1000000 + timeNow.tv_usec;
+}
+
+inline double MPEG2TransportStreamMultiProgramMultiplexor::nextScheduledPacketTime() const {
+  // If constant-bitrate, a packet (if only a null packet) is always due at "fSTC":
+  if (fMuxRate > 0) return fSTC;
+
+  // Otherwise, the next PAT or PCR is due:
+  double result = fLastPSITime + MPTS_PSI_INTERVAL_US;
+  for (unsigned i = 0; i < fNumPrograms; ++i) {
+    Program& program = *fPrograms[i];
+    if (program.fPCRPID == MPTS_NULL_PID) continue;
+    double pcrTime = program.fHaveSentPCR ? program.fLastPCRTime + MPTS_PCR_INTERVAL_US : fSTC;
+    if (pcrTime < result) result = pcrTime;
+  }
+  return result;
+}
+
+inline void MPEG2TransportStreamMultiProgramMultiplexor::lateInputCheck(void* clientData) {
+  MPEG2TransportStreamMultiProgramMultiplexor* mux = (MPEG2TransportStreamMultiProgramMultiplexor*)clientData;
+  mux->fLateInputTask = NULL;
+  if (mux->fAwaitingInput && !mux->fIsDelivering && mux->isCurrentlyAwaitingData()) mux->deliver(True);
+}
+
+inline void MPEG2TransportStreamMultiProgramMultiplexor
+::afterGettingFrame(ElementaryStream& stream, unsigned frameSize, struct timeval presentationTime) {
+  stream.fReadPending = False;
+  stream.fHaveFrame = True;
+  stream.fFrameSize = frameSize;
+  stream.fFrameTime = timelineTime(presentationTime);
+  stream.fBytesSent = 0;
+
+  // Set up the PES header (with a PTS):
+  Boolean isNALUnitStream = stream.fStreamType == 0x1B || stream.fStreamType == 0x24;
+  unsigned startCodeSize = isNALUnitStream ? 4 : 0;
+  u_int8_t* h = stream.fPESHeader;
+  h[0] = 0x00; h[1] = 0x00; h[2] = 0x01; h[3] = stream.fStreamId;
+  unsigned pesPacketLength = 3 + 5 + startCodeSize + frameSize; // the bytes that follow the 'PES_packet_length' field
+  if (pesPacketLength > 0xFFFF) pesPacketLength = 0; // allowed only for video
+  h[4] = pesPacketLength>>8; h[5] = pesPacketLength;
+  h[6] = 0x80; // '10', no scrambling, no priority, not aligned, no copyright, not original
+  h[7] = 0x80; // PTS only
+  h[8] = 5; // PES_header_data_length
+  u_int64_t pts = ((u_int64_t)stream.fFrameTime*9/100)&0x1FFFFFFFFULL; // 90 kHz
+  h[9] = 0x21|(u_int8_t)((pts>>29)&0x0E);
+  h[10] = (u_int8_t)(pts>>22);
+  h[11] = 0x01|(u_int8_t)((pts>>14)&0xFE);
+  h[12] = (u_int8_t)(pts>>7);
+  h[13] = 0x01|(u_int8_t)((pts<<1)&0xFE);
+  stream.fPESHeaderSize = 14;
+  if (isNALUnitStream) {
+    h[14] = 0x00; h[15] = 0x00; h[16] = 0x00; h[17] = 0x01;
+    stream.fPESHeaderSize += 4;
+  }
+
+  if (fAwaitingInput && !fIsDelivering && isCurrentlyAwaitingData()) deliver(True);
+}
+
+inline void MPEG2TransportStreamMultiProgramMultiplexor::onSourceClosure(void* clientData) {
+  ElementaryStream* stream = (ElementaryStream*)clientData;
+  stream->fOurMux->onSourceClosure(*stream);
+}
+
+inline void MPEG2TransportStreamMultiProgramMultiplexor::onSourceClosure(ElementaryStream& stream) {
+  stream.fReadPending = False;
+  stream.fIsClosed = True;
+
+  if (fAwaitingInput && !fIsDelivering && isCurrentlyAwaitingData()) deliver(True);
+}
+
+inline void MPEG2TransportStreamMultiProgramMultiplexor::doGetNextFrame() {
+  deliver(False);
+}
+
+inline void MPEG2TransportStreamMultiProgramMultiplexor::deliver(Boolean isCallback) {
+  fIsDelivering = True;
+  fAwaitingInput = False;
+  envir().taskScheduler().unscheduleDelayedTask(fLateInputTask);
+
+  // If our output has fallen behind real time by more than the mux delay (e.g., because our reader isn't paced in
+  // real time), then re-anchor our clock to real time, so that we don't treat every pending input read as late:
+  if (fClockHasStarted && realTimeSTC() - fSTC > fMuxDelay) fRealTimeOffset = realTimeNow() - fSTC;
+
+  // Fill as many whole groups of 7 packets as will fit (or, if that's none, as many packets as will fit):
+  unsigned maxNumPackets = fMaxSize/TRANSPORT_PACKET_SIZE;
+  if (maxNumPackets >= TRANSPORT_PACKETS_PER_BATCH) maxNumPackets -= maxNumPackets%TRANSPORT_PACKETS_PER_BATCH;
+
+  unsigned numPackets = fNumPacketsInBuffer; // if we've already written packets, while waiting for input
+  Boolean allInputsHaveClosed = False;
+  while (numPackets < maxNumPackets) {
+    u_int8_t* to = &fTo[numPackets*TRANSPORT_PACKET_SIZE];
+
+    // We need a frame (or closure) from every input, so that we can send the earliest one first:
+    Boolean inputsAreReady = True;
+    ElementaryStream* earliest = NULL;
+    for (unsigned i = 0; i < fNumStreams; ++i) {
+      ElementaryStream& stream = *fStreams[i];
+      if (stream.fHaveFrame) {
+	if (earliest == NULL || stream.fFrameTime < earliest->fFrameTime) earliest = &stream;
+      } else if (!stream.fIsClosed) {
+	inputsAreReady = False;
+	requestFrame(stream);
+      }
+    }
+    Boolean inputIsLate = False;
+    if (!inputsAreReady) {
+      // Wait for the input - unless it's late (i.e., our next packet is already due), in which case we keep sending
+      // PSI, PCRs and (if constant-bitrate) null packets on schedule:
+      if (!fClockHasStarted) break;
+      double timeNow = realTimeSTC();
+      if (timeNow < nextScheduledPacketTime()) break;
+      inputIsLate = True;
+      if (fMuxRate == 0 && timeNow > fSTC) fSTC = timeNow; // variable-bitrate: our clock follows real time
+    } else if (earliest == NULL) {
+      allInputsHaveClosed = True;
+      break;
+    }
+
+    if (!fClockHasStarted) {
+      fSTC = (double)(earliest->fFrameTime - fMuxDelay);
+      fTimeOfLastDelivery = (int64_t)fSTC;
+      fClockHasStarted = True;
+      fRealTimeOffset = realTimeNow() - fSTC;
+    } else if (fMuxRate == 0 && !inputIsLate && earliest->fFrameTime - fMuxDelay > fSTC) {
+      // Variable-bitrate: our clock just follows the input:
+      fSTC = (double)(earliest->fFrameTime - fMuxDelay);
+    }
+
+    // Decide which packet to send next: a PAT or PMT (if due), a PCR (if due), or the earliest input frame:
+    if (fNextPSIPacket == 0 && (!fHaveSentPSI || fSTC - fLastPSITime >= MPTS_PSI_INTERVAL_US)) {
+      fHaveSentPSI = True;
+      fLastPSITime = fSTC;
+      fNextPSIPacket = 1;
+    }
+    Program* pcrProgram = NULL;
+    for (unsigned i = 0; i < fNumPrograms; ++i) {
+      Program& program = *fPrograms[i];
+      if (program.fPCRPID != MPTS_NULL_PID
+	  && (!program.fHaveSentPCR || fSTC - program.fLastPCRTime >= MPTS_PCR_INTERVAL_US)) {
+	pcrProgram = &program;
+	break;
+      }
+    }
+
+    if (fNextPSIPacket == 1) {
+      writePATPacket(to);
+      fNextPSIPacket = fNumPrograms > 0 ? 2 : 0;
+    } else if (fNextPSIPacket >= 2) {
+      writePMTPacket(to, *fPrograms[fNextPSIPacket-2]);
+      if (++fNextPSIPacket - 2 >= fNumPrograms) fNextPSIPacket = 0;
+    } else if (pcrProgram != NULL) {
+      writePCRPacket(to, *pcrProgram);
+    } else if (earliest != NULL && earliest->fFrameTime - fMuxDelay <= fSTC) {
+      writePESPacket(to, *earliest);
+      if (earliest->fBytesSent == earliest->fPESHeaderSize + earliest->fFrameSize) {
+	earliest->fHaveFrame = False;
+	requestFrame(*earliest);
+      }
+    } else if (fMuxRate > 0) {
+      // Constant-bitrate, and it's not yet time to send any frame:
+      writeNullPacket(to);
+    } else {
+      // Variable-bitrate, and an input is late: there's nothing more to send yet
+      break;
+    }
+
+    ++numPackets;
+    if (fMuxRate > 0) fSTC += fPacketDuration;
+  }
+
+  fIsDelivering = False;
+  if (numPackets == 0 && allInputsHaveClosed) {
+    handleClosure();
+    return;
+  }
+  if (numPackets < maxNumPackets && !allInputsHaveClosed
+      && (numPackets == 0 || numPackets%TRANSPORT_PACKETS_PER_BATCH != 0)) {
+    // Keep what we've written so far (so that we deliver only whole groups of 7 packets), and wait for more input:
+    fNumPacketsInBuffer = numPackets;
+    fAwaitingInput = True; // we'll be called again when an input frame arrives, or when our next packet is due
+    if (fClockHasStarted) {
+      double delay = nextScheduledPacketTime() - realTimeSTC();
+      fLateInputTask = envir().taskScheduler().scheduleDelayedTask(delay < 0.0 ? 0 : (int64_t)delay,
+								    lateInputCheck, this);
+    }
+    return;
+  }
+  fNumPacketsInBuffer = 0;
+
+  fFrameSize = numPackets*TRANSPORT_PACKET_SIZE;
+  fNumTruncatedBytes = 0;
+  int64_t timeNow = (int64_t)fSTC;
+  fDurationInMicroseconds = (unsigned)(timeNow - fTimeOfLastDelivery);
+  int64_t presentationTimeUS = (int64_t)fTimeBase.tv_sec*1000000 + fTimeBase.tv_usec
+    + fTimeOfLastDelivery - MPTS_TIMELINE_OFFSET;
+  fPresentationTime.tv_sec = (long)(presentationTimeUS/1000000);
+  fPresentationTime.tv_usec = (long)(presentationTimeUS%1000000);
+  fTimeOfLastDelivery = timeNow;
+
+  if (isCallback) {
+    FramedSource::afterGetting(this);
+  } else {
+    nextTask() = envir().taskScheduler().scheduleDelayedTask(0, (TaskFunc*)FramedSource::afterGetting, this);
+  }
+}
+
+inline void MPEG2TransportStreamMultiProgramMultiplexor
+::writeSectionPacket(u_int8_t* to, u_int16_t PID, u_int8_t& continuityCounter,
+		     u_int8_t tableId, u_int16_t tableIdExtension, u_int8_t const* body, unsigned bodySize) {
+  to[0] = 0x47;
+  to[1] = 0x40|(PID>>8); // payload_unit_start_indicator
+  to[2] = (u_int8_t)PID;
+  to[3] = 0x10|continuityCounter; // payload only
+  continuityCounter = (continuityCounter+1)&0x0F;
+  to[4] = 0; // pointer_field
+
+  u_int8_t* section = &to[5];
+  unsigned sectionLength = 5 + bodySize + 4; // the bytes after the 'section_length' field, including the CRC
+  section[0] = tableId;
+  section[1] = 0xB0|(sectionLength>>8); // section_syntax_indicator, '0', reserved
+  section[2] = (u_int8_t)sectionLength;
+  section[3] = tableIdExtension>>8; section[4] = (u_int8_t)tableIdExtension;
+  section[5] = 0xC1|(fVersionNumber<<1); // reserved, version_number, current_next_indicator
+  section[6] = 0; // section_number
+  section[7] = 0; // last_section_number
+  memmove(&section[8], body, bodySize);
+  u_int32_t crc = calculateCRCSliceBy8(section, 8 + bodySize);
+  u_int8_t* p = &section[8 + bodySize];
+  *p++ = crc>>24; *p++ = crc>>16; *p++ = crc>>8; *p++ = crc;
+
+  memset(p, 0xFF, &to[TRANSPORT_PACKET_SIZE] - p);
+}
+
+inline void MPEG2TransportStreamMultiProgramMultiplexor::writePATPacket(u_int8_t* to) {
+  u_int8_t body[TRANSPORT_PACKET_SIZE];
+  unsigned bodySize = 0;
+  for (unsigned i = 0; i < fNumPrograms; ++i) {
+    Program& program = *fPrograms[i];
+    body[bodySize++] = program.fProgramNumber>>8; body[bodySize++] = (u_int8_t)program.fProgramNumber;
+    body[bodySize++] = 0xE0|(program.fPMTPID>>8); body[bodySize++] = (u_int8_t)program.fPMTPID;
+  }
+  writeSectionPacket(to, 0x0000, fPATContinuityCounter, 0x00, fTransportStreamId, body, bodySize);
+}
+
+inline void MPEG2TransportStreamMultiProgramMultiplexor::writePMTPacket(u_int8_t* to, Program& program) {
+  u_int8_t body[TRANSPORT_PACKET_SIZE];
+  unsigned bodySize = 0;
+  body[bodySize++] = 0xE0|(program.fPCRPID>>8); body[bodySize++] = (u_int8_t)program.fPCRPID;
+  body[bodySize++] = 0xF0; body[bodySize++] = 0x00; // program_info_length: 0
+  for (unsigned i = 0; i < program.fNumStreams; ++i) {
+    ElementaryStream& stream = *program.fStreams[i];
+    body[bodySize++] = stream.fStreamType;
+    body[bodySize++] = 0xE0|(stream.fPID>>8); body[bodySize++] = (u_int8_t)stream.fPID;
+    body[bodySize++] = 0xF0; body[bodySize++] = 0x00; // ES_info_length: 0
+  }
+  writeSectionPacket(to, program.fPMTPID, program.fPMTContinuityCounter, 0x02, program.fProgramNumber, body, bodySize);
+}
+
+inline void MPEG2TransportStreamMultiProgramMultiplexor::writePCRPacket(u_int8_t* to, Program& program) {
+  // A packet containing just an adaptation field, with the PCR.  (Its continuity_counter is not incremented.)
+  u_int8_t continuityCounter = 0;
+  for (unsigned i = 0; i < program.fNumStreams; ++i) {
+    if (program.fStreams[i]->fPID == program.fPCRPID) {
+      continuityCounter = (program.fStreams[i]->fContinuityCounter-1)&0x0F;
+      break;
+    }
+  }
+  to[0] = 0x47;
+  to[1] = program.fPCRPID>>8;
+  to[2] = (u_int8_t)program.fPCRPID;
+  to[3] = 0x20|continuityCounter; // adaptation field only
+  to[4] = TRANSPORT_PACKET_SIZE-5; // adaptation_field_length
+  to[5] = 0x10; // PCR_flag
+
+  u_int64_t pcr27MHz = (u_int64_t)(fSTC*27.0);
+  u_int64_t pcrBase = (pcr27MHz/300)&0x1FFFFFFFFULL;
+  unsigned pcrExtension = (unsigned)(pcr27MHz%300);
+  to[6] = (u_int8_t)(pcrBase>>25);
+  to[7] = (u_int8_t)(pcrBase>>17);
+  to[8] = (u_int8_t)(pcrBase>>9);
+  to[9] = (u_int8_t)(pcrBase>>1);
+  to[10] = (u_int8_t)(((pcrBase&0x01)<<7)|0x7E|(pcrExtension>>8));
+  to[11] = (u_int8_t)pcrExtension;
+  memset(&to[12], 0xFF, TRANSPORT_PACKET_SIZE-12);
+
+  program.fHaveSentPCR = True;
+  program.fLastPCRTime = fSTC;
+}
+
+inline void MPEG2TransportStreamMultiProgramMultiplexor::writePESPacket(u_int8_t* to, ElementaryStream& stream) {
+  unsigned totalSize = stream.fPESHeaderSize + stream.fFrameSize;
+  unsigned numRemaining = totalSize - stream.fBytesSent;
+  unsigned numPayloadBytes = numRemaining < TRANSPORT_PACKET_SIZE-4 ? numRemaining : TRANSPORT_PACKET_SIZE-4;
+
+  to[0] = 0x47;
+  to[1] = (stream.fBytesSent == 0 ? 0x40 : 0x00)|(stream.fPID>>8);
+  to[2] = (u_int8_t)stream.fPID;
+  u_int8_t* p = &to[4];
+  if (numPayloadBytes < TRANSPORT_PACKET_SIZE-4) {
+    // Fill the rest of the packet with an adaptation field:
+    to[3] = 0x30|stream.fContinuityCounter; // adaptation field and payload
+    unsigned adaptationFieldLength = TRANSPORT_PACKET_SIZE-4 - numPayloadBytes - 1;
+    *p++ = adaptationFieldLength;
+    if (adaptationFieldLength > 0) {
+      *p++ = 0x00; // no flags
+      memset(p, 0xFF, adaptationFieldLength-1);
+      p += adaptationFieldLength-1;
+    }
+  } else {
+    to[3] = 0x10|stream.fContinuityCounter; // payload only
+  }
+  stream.fContinuityCounter = (stream.fContinuityCounter+1)&0x0F;
+
+  // Copy the remaining PES header (if any), then frame data:
+  while (numPayloadBytes > 0) {
+    unsigned n;
+    if (stream.fBytesSent < stream.fPESHeaderSize) {
+      n = stream.fPESHeaderSize - stream.fBytesSent;
+      if (n > numPayloadBytes) n = numPayloadBytes;
+      memmove(p, &stream.fPESHeader[stream.fBytesSent], n);
+    } else {
+      n = numPayloadBytes;
+      memmove(p, &stream.fBuffer[stream.fBytesSent - stream.fPESHeaderSize], n);
+    }
+    p += n;
+    stream.fBytesSent += n;
+    numPayloadBytes -= n;
+  }
+}
+
+inline void MPEG2TransportStreamMultiProgramMultiplexor::writeNullPacket(u_int8_t* to) {
+  to[0] = 0x47;
+  to[1] = MPTS_NULL_PID>>8;
+  to[2] = MPTS_NULL_PID&0xFF;
+  to[3] = 0x10;
+  memset(&to[4], 0xFF, TRANSPORT_PACKET_SIZE-4);
+}
+
+#endif
@@ -0,0 +1,172 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A read-only, memory-mapped file, with routines for giving the kernel 'readahead' hints about
+// the parts of the file that we're about to access.
+// C++ header
+
+#ifndef _MAPPED_FILE_HH
+#define _MAPPED_FILE_HH
+
+#ifndef _NET_COMMON_H
+#include "NetCommon.h"
+#endif
+#include <UsageEnvironment.hh>
+
+#if !defined(__WIN32__) && !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+class MappedFile {
+public:
+  enum AccessPattern { NORMAL_ACCESS, SEQUENTIAL_ACCESS, RANDOM_ACCESS };
+
+  static MappedFile* createNew(UsageEnvironment& env, char const* fileName,
+			       AccessPattern accessPattern = NORMAL_ACCESS);
+      // Returns NULL (and sets "env"s result message) if the file can't be opened or mapped.
+      // (An empty file is mapped successfully, with "data()" == NULL.)
+  ~MappedFile();
+
+  unsigned char const* data() const { return fData; }
+  u_int64_t size() const { return fSize; }
+
+  Boolean refresh();
+      // Checks the file's current size, and - if it has changed (e.g., because the file is a recording that's still being
+      // written) - remaps it.  Returns True iff the size changed.  Because "data()" can then change, this must not be called
+      // while any other thread might be reading the mapping, and pointers obtained from "data()" earlier must be discarded.
+      // Note: The mapping is "MAP_SHARED", so if the file gets truncated while it is mapped (by another process, or by
+      // "refresh()" not having been called yet), any access to a page beyond the new end of file raises SIGBUS.  Therefore,
+      // only serve files that are appended to (or left alone) while they're being served - never truncated or rewritten.
+
+  void willNeed(u_int64_t offset, u_int64_t length) const;
+      // Tells the kernel that we'll soon access this part of the file, so that it can start reading it in
+  void dontNeed(u_int64_t offset, u_int64_t length) const;
+      // Tells the kernel that we've finished with this part of the file (for now), so its pages can be reclaimed first
+  void setAccessPattern(AccessPattern accessPattern);
+
+private:
+  MappedFile(int fd, unsigned char* data, u_int64_t size);
+
+  void advise(u_int64_t offset, u_int64_t length, int advice) const;
+
+private:
+  int fFd;
+  unsigned char* fData;
+  u_int64_t fSize;
+  AccessPattern fAccessPattern; // reapplied to the new mapping by "refresh()"
+};
+
+
+////////// Implementation //////////
+
+inline MappedFile* MappedFile::createNew(UsageEnvironment& env, char const* fileName, AccessPattern accessPattern) {
+  int fd = open(fileName, O_RDONLY);
+  if (fd < 0) {
+    env.setResultMsg("unable to open file \"", fileName, "\"");
+    return NULL;
+  }
+
+  struct stat sb;
+  if (fstat(fd, &sb) != 0) {
+    env.setResultErrMsg("unable to stat file: ");
+    close(fd);
+    return NULL;
+  }
+
+  unsigned char* data = NULL;
+  u_int64_t size = (u_int64_t)sb.st_size;
+  if (size > 0) {
+    void* mapping = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+      env.setResultErrMsg("unable to mmap() file: ");
+      close(fd);
+      return NULL;
+    }
+    data = (unsigned char*)mapping;
+  }
+
+  MappedFile* mappedFile = new MappedFile(fd, data, size);
+  mappedFile->setAccessPattern(accessPattern);
+  return mappedFile;
+}
+
+inline MappedFile::MappedFile(int fd, unsigned char* data, u_int64_t size)
+  : fFd(fd), fData(data), fSize(size), fAccessPattern(NORMAL_ACCESS) {
+}
+
+inline MappedFile::~MappedFile() {
+  if (fData != NULL) munmap(fData, (size_t)fSize);
+  close(fFd);
+}
+
+inline Boolean MappedFile::refresh() {
+  struct stat sb;
+  if (fstat(fFd, &sb) != 0) return False;
+
+  u_int64_t newSize = (u_int64_t)sb.st_size;
+  if (newSize == fSize) return False;
+
+  // Map the new size before unmapping the old, so that we keep a usable mapping if this fails:
+  unsigned char* newData = NULL;
+  if (newSize > 0) {
+    void* mapping = mmap(NULL, (size_t)newSize, PROT_READ, MAP_SHARED, fFd, 0);
+    if (mapping == MAP_FAILED) return False;
+    newData = (unsigned char*)mapping;
+  }
+
+  if (fData != NULL) munmap(fData, (size_t)fSize);
+  fData = newData;
+  fSize = newSize;
+  setAccessPattern(fAccessPattern);
+  return True;
+}
+
+inline void MappedFile::advise(u_int64_t offset, u_int64_t length, int advice) const {
+  if (fData == NULL || offset >= fSize) return;
+  if (length > fSize - offset) length = fSize - offset;
+
+  // "madvise()" requires a page-aligned start address:
+  static long const pageSize = sysconf(_SC_PAGESIZE);
+  u_int64_t alignedOffset = offset - offset%pageSize;
+  madvise(fData + alignedOffset, (size_t)(length + (offset - alignedOffset)), advice);
+}
+
+inline void MappedFile::willNeed(u_int64_t offset, u_int64_t length) const {
+  advise(offset, length, MADV_WILLNEED);
+}
+
+inline void MappedFile::dontNeed(u_int64_t offset, u_int64_t length) const {
+#if defined(__linux__)
+  // For a read-only shared mapping, Linux's MADV_DONTNEED just drops our page table entries (the data stays cached):
+  posix_fadvise(fFd, (off_t)offset, (off_t)length, POSIX_FADV_DONTNEED);
+#else
+  advise(offset, length, MADV_DONTNEED);
+#endif
+}
+
+inline void MappedFile::setAccessPattern(AccessPattern accessPattern) {
+  fAccessPattern = accessPattern;
+  int advice = accessPattern == SEQUENTIAL_ACCESS ? MADV_SEQUENTIAL
+    : accessPattern == RANDOM_ACCESS ? MADV_RANDOM : MADV_NORMAL;
+  advise(0, fSize, advice);
+}
+
+#endif
+
+#endif
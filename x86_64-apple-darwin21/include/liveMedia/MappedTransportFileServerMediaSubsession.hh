@@ -0,0 +1,354 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A 'ServerMediaSubsession' object that creates new, unicast, "RTPSink"s
+// on demand, from a MPEG-2 Transport Stream file - like "MPEG2TransportFileServerMediaSubsession", except that
+// the Transport Stream file and its index file are memory-mapped (and shared by all clients), so that seeking and
+// 'trick play' don't have to wait for random reads.
+// C++ header
+
+#ifndef _MAPPED_TRANSPORT_FILE_SERVER_MEDIA_SUBSESSION_HH
+#define _MAPPED_TRANSPORT_FILE_SERVER_MEDIA_SUBSESSION_HH
+
+#ifndef _FILE_SERVER_MEDIA_SUBSESSION_HH
+#include "FileServerMediaSubsession.hh"
+#endif
+#ifndef _MPEG2_TRANSPORT_STREAM_FRAMER_HH
+#include "MPEG2TransportStreamFramer.hh"
+#endif
+#ifndef _MPEG2_TRANSPORT_STREAM_FROM_ES_SOURCE_HH
+#include "MPEG2TransportStreamFromESSource.hh"
+#endif
+#ifndef _SIMPLE_RTP_SINK_HH
+#include "SimpleRTPSink.hh"
+#endif
+#ifndef _MAPPED_TRANSPORT_STREAM_FILE_SOURCE_HH
+#include "MappedTransportStreamFileSource.hh"
+#endif
+#ifndef _MAPPED_TRANSPORT_STREAM_TRICK_MODE_SOURCE_HH
+#include "MappedTransportStreamTrickModeSource.hh"
+#endif
+
+#if !defined(__WIN32__) && !defined(_WIN32)
+
+// The source of each client's Transport Stream (read by its "MPEG2TransportStreamFramer").  It delivers either the
+// original Transport Stream (for normal play), or a new Transport Stream made from the original's I-frames (for 'trick
+// play').  A seek or change of scale is applied the next time that a frame is requested, so that it never happens
+// while a read from the current source is in progress.
+
+class MappedTransportStreamTrickPlaySource: public FramedSource {
+public:
+  static MappedTransportStreamTrickPlaySource*
+  createNew(UsageEnvironment& env, MappedFile* tsFile, MappedTransportStreamIndex* index);
+      // "index" may be NULL (in which case only normal play - from the start of the file - is supported).
+      // Neither "tsFile" nor "index" is deleted when this source is.
+
+  void seek(double& seekNPT, double streamDuration, u_int64_t& numBytes);
+      // "seekNPT" is changed to the time of the clean point at or before it
+  void setScale(int scale);
+
+protected:
+  MappedTransportStreamTrickPlaySource(UsageEnvironment& env, MappedFile* tsFile, MappedTransportStreamIndex* index,
+				       MappedTransportStreamFileSource* fileSource);
+      // called only by createNew()
+  virtual ~MappedTransportStreamTrickPlaySource();
+
+private:
+  // redefined virtual functions:
+  virtual void doGetNextFrame();
+  virtual void doStopGettingFrames();
+
+private:
+  unsigned long currentIndexRecordNum() const;
+  void applyPendingChange();
+  void closeTrickPlaySource();
+
+  static void afterGettingFrame(void* clientData, unsigned frameSize,
+				unsigned numTruncatedBytes,
+				struct timeval presentationTime,
+				unsigned durationInMicroseconds);
+
+private:
+  MappedFile* fTSFile;
+  MappedTransportStreamIndex* fIndex;
+  MappedTransportStreamFileSource* fFileSource;
+  MappedTransportStreamTrickModeSource* fTrickModeSource; // used iff "fTrickPlaySource" != NULL
+  MPEG2TransportStreamFromESSource* fTrickPlaySource; // non-NULL iff we're doing 'trick play'
+  int fScale;
+
+  // A change (seek and/or scale) that's waiting to be applied:
+  Boolean fHavePendingChange;
+  int fPendingScale;
+  unsigned long fPendingIndexRecordNum; // used if "fPendingScale" != 1
+  unsigned long fPendingTSPacketNum, fPendingNumTSPackets; // used if "fPendingScale" == 1
+};
+
+
+class MappedTransportFileServerMediaSubsession: public FileServerMediaSubsession {
+public:
+  static MappedTransportFileServerMediaSubsession*
+  createNew(UsageEnvironment& env,
+	    char const* dataFileName, char const* indexFileName,
+	    Boolean reuseFirstSource);
+      // Returns NULL if "dataFileName" can't be mapped.  If "indexFileName" is NULL (or can't be mapped), neither seeking
+      // nor 'trick play' is supported.
+
+protected:
+  MappedTransportFileServerMediaSubsession(UsageEnvironment& env, char const* fileName,
+					   MappedFile* tsFile, MappedTransportStreamIndex* index,
+					   Boolean reuseFirstSource);
+      // called only by createNew();
+  virtual ~MappedTransportFileServerMediaSubsession();
+
+protected: // redefined virtual functions
+  virtual void seekStreamSource(FramedSource* inputSource, double& seekNPT, double streamDuration, u_int64_t& numBytes);
+  virtual void setStreamSourceScale(FramedSource* inputSource, float scale);
+  virtual FramedSource* createNewStreamSource(unsigned clientSessionId,
+					      unsigned& estBitrate);
+  virtual RTPSink* createNewRTPSink(Groupsock* rtpGroupsock,
+                                    unsigned char rtpPayloadTypeIfDynamic,
+				    FramedSource* inputSource);
+  virtual void testScaleFactor(float& scale);
+  virtual float duration() const;
+
+private:
+  MappedFile* fTSFile;
+  MappedTransportStreamIndex* fIndex;
+  float fDuration;
+};
+
+
+////////// Implementation //////////
+
+// MappedTransportStreamTrickPlaySource //
+
+inline MappedTransportStreamTrickPlaySource*
+MappedTransportStreamTrickPlaySource::createNew(UsageEnvironment& env, MappedFile* tsFile, MappedTransportStreamIndex* index) {
+  MappedTransportStreamFileSource* fileSource = MappedTransportStreamFileSource::createNew(env, tsFile);
+  if (fileSource == NULL) return NULL;
+
+  return new MappedTransportStreamTrickPlaySource(env, tsFile, index, fileSource);
+}
+
+inline MappedTransportStreamTrickPlaySource
+::MappedTransportStreamTrickPlaySource(UsageEnvironment& env, MappedFile* tsFile, MappedTransportStreamIndex* index,
+				       MappedTransportStreamFileSource* fileSource)
+  : FramedSource(env), fTSFile(tsFile), fIndex(index), fFileSource(fileSource),
+    fTrickModeSource(NULL), fTrickPlaySource(NULL), fScale(1),
+    fHavePendingChange(False), fPendingScale(1), fPendingIndexRecordNum(0), fPendingTSPacketNum(0), fPendingNumTSPackets(0) {
+}
+
+inline MappedTransportStreamTrickPlaySource::~MappedTransportStreamTrickPlaySource() {
+  closeTrickPlaySource();
+  Medium::close(fFileSource);
+}
+
+inline void MappedTransportStreamTrickPlaySource::closeTrickPlaySource() {
+  Medium::close(fTrickPlaySource); // this also closes "fTrickModeSource"
+  fTrickPlaySource = NULL;
+  fTrickModeSource = NULL;
+}
+
+inline unsigned long MappedTransportStreamTrickPlaySource::currentIndexRecordNum() const {
+  // The index record at which the stream would now continue:
+  if (fHavePendingChange) {
+    if (fPendingScale != 1) return fPendingIndexRecordNum;
+
+    float pcr; unsigned long tsPacketNum = fPendingTSPacketNum, indexRecordNum;
+    fIndex->lookupPCRFromTSPacketNum(tsPacketNum, True, pcr, indexRecordNum);
+    return indexRecordNum;
+  }
+
+  if (fTrickModeSource != NULL) return fTrickModeSource->currentIndexRecordNum();
+
+  float pcr; unsigned long tsPacketNum = fFileSource->nextTSPacketNum(), indexRecordNum;
+  fIndex->lookupPCRFromTSPacketNum(tsPacketNum, True, pcr, indexRecordNum);
+  return indexRecordNum;
+}
+
+inline void MappedTransportStreamTrickPlaySource::seek(double& seekNPT, double streamDuration, u_int64_t& numBytes) {
+  numBytes = 0;
+  if (fIndex == NULL) {
+    seekNPT = 0.0;
+    return;
+  }
+
+  float npt = (float)seekNPT;
+  unsigned long tsPacketNum, indexRecordNum;
+  fIndex->lookupTSPacketNumFromNPT(npt, tsPacketNum, indexRecordNum);
+  seekNPT = npt;
+
+  int scale = fHavePendingChange ? fPendingScale : fScale;
+  fHavePendingChange = True;
+  fPendingScale = scale;
+  fPendingIndexRecordNum = indexRecordNum;
+  fPendingTSPacketNum = tsPacketNum;
+  fPendingNumTSPackets = 0;
+
+  if (scale == 1 && streamDuration > 0.0) {
+    // Limit the stream to "streamDuration" seconds:
+    float endNPT = npt + (float)streamDuration;
+    unsigned long endTSPacketNum, endIndexRecordNum;
+    fIndex->lookupTSPacketNumFromNPT(endNPT, endTSPacketNum, endIndexRecordNum);
+    if (endTSPacketNum > tsPacketNum) {
+      fPendingNumTSPackets = endTSPacketNum - tsPacketNum;
+      numBytes = (u_int64_t)fPendingNumTSPackets*TRANSPORT_PACKET_SIZE;
+    }
+  }
+}
+
+inline void MappedTransportStreamTrickPlaySource::setScale(int scale) {
+  if (fIndex == NULL || scale == 0) return;
+
+  int currentScale = fHavePendingChange ? fPendingScale : fScale;
+  if (scale == currentScale) return;
+
+  // Continue from the clean point at (or before) where we are now:
+  unsigned long indexRecordNum = currentIndexRecordNum();
+  fHavePendingChange = True;
+  fPendingScale = scale;
+  fPendingIndexRecordNum = indexRecordNum;
+  fPendingTSPacketNum = indexRecordNum < fIndex->numIndexRecords()
+    ? MappedTransportStreamIndex::tsPacketNum(fIndex->record(indexRecordNum)) : 0;
+  fPendingNumTSPackets = 0;
+}
+
+inline void MappedTransportStreamTrickPlaySource::applyPendingChange() {
+  fHavePendingChange = False;
+  fScale = fPendingScale;
+  closeTrickPlaySource();
+
+  if (fScale == 1) {
+    fFileSource->seekToTSPacket(fPendingTSPacketNum, fPendingNumTSPackets);
+    return;
+  }
+
+  fTrickModeSource = MappedTransportStreamTrickModeSource::createNew(envir(), fTSFile, fIndex, fScale, fPendingIndexRecordNum);
+  if (fTrickModeSource == NULL) return;
+  fTrickPlaySource = MPEG2TransportStreamFromESSource::createNew(envir());
+  fTrickPlaySource->addNewVideoSource(fTrickModeSource, fIndex->mpegVersion());
+}
+
+inline void MappedTransportStreamTrickPlaySource::doGetNextFrame() {
+  if (fHavePendingChange) applyPendingChange();
+
+  FramedSource* source = fTrickPlaySource != NULL ? (FramedSource*)fTrickPlaySource : (FramedSource*)fFileSource;
+  source->getNextFrame(fTo, fMaxSize, afterGettingFrame, this, FramedSource::handleClosure, this);
+}
+
+inline void MappedTransportStreamTrickPlaySource::doStopGettingFrames() {
+  if (fTrickPlaySource != NULL) fTrickPlaySource->stopGettingFrames();
+  fFileSource->stopGettingFrames();
+}
+
+inline void MappedTransportStreamTrickPlaySource
+::afterGettingFrame(void* clientData, unsigned frameSize, unsigned numTruncatedBytes,
+		    struct timeval presentationTime, unsigned durationInMicroseconds) {
+  MappedTransportStreamTrickPlaySource* source = (MappedTransportStreamTrickPlaySource*)clientData;
+  source->fFrameSize = frameSize;
+  source->fNumTruncatedBytes = numTruncatedBytes;
+  source->fPresentationTime = presentationTime;
+  source->fDurationInMicroseconds = durationInMicroseconds;
+  FramedSource::afterGetting(source);
+}
+
+
+// MappedTransportFileServerMediaSubsession //
+
+inline MappedTransportFileServerMediaSubsession*
+MappedTransportFileServerMediaSubsession::createNew(UsageEnvironment& env,
+						    char const* dataFileName, char const* indexFileName,
+						    Boolean reuseFirstSource) {
+  MappedFile* tsFile = MappedFile::createNew(env, dataFileName, MappedFile::RANDOM_ACCESS);
+  if (tsFile == NULL) return NULL;
+
+  MappedTransportStreamIndex* index = MappedTransportStreamIndex::createNew(env, indexFileName);
+  if (index != NULL && index->numIndexRecords() == 0) {
+    Medium::close(index);
+    index = NULL;
+  }
+
+  return new MappedTransportFileServerMediaSubsession(env, dataFileName, tsFile, index, reuseFirstSource);
+}
+
+inline MappedTransportFileServerMediaSubsession
+::MappedTransportFileServerMediaSubsession(UsageEnvironment& env, char const* fileName,
+					   MappedFile* tsFile, MappedTransportStreamIndex* index,
+					   Boolean reuseFirstSource)
+  : FileServerMediaSubsession(env, fileName, reuseFirstSource),
+    fTSFile(tsFile), fIndex(index), fDuration(0.0) {
+  fFileSize = tsFile->size();
+  if (fIndex != NULL) fDuration = fIndex->getPlayingDuration();
+}
+
+inline MappedTransportFileServerMediaSubsession::~MappedTransportFileServerMediaSubsession() {
+  Medium::close(fIndex);
+  delete fTSFile;
+}
+
+inline void MappedTransportFileServerMediaSubsession
+::seekStreamSource(FramedSource* inputSource, double& seekNPT, double streamDuration, u_int64_t& numBytes) {
+  MPEG2TransportStreamFramer* framer = (MPEG2TransportStreamFramer*)inputSource;
+  MappedTransportStreamTrickPlaySource* source = (MappedTransportStreamTrickPlaySource*)(framer->inputSource());
+
+  source->seek(seekNPT, streamDuration, numBytes);
+  framer->clearPIDStatusTable();
+}
+
+inline void MappedTransportFileServerMediaSubsession::setStreamSourceScale(FramedSource* inputSource, float scale) {
+  MPEG2TransportStreamFramer* framer = (MPEG2TransportStreamFramer*)inputSource;
+  MappedTransportStreamTrickPlaySource* source = (MappedTransportStreamTrickPlaySource*)(framer->inputSource());
+
+  source->setScale((int)scale); // "testScaleFactor()" has already made "scale" an integer
+  framer->clearPIDStatusTable();
+}
+
+inline FramedSource* MappedTransportFileServerMediaSubsession
+::createNewStreamSource(unsigned /*clientSessionId*/, unsigned& estBitrate) {
+  estBitrate = 5000; // kbps, estimate
+
+  MappedTransportStreamTrickPlaySource* source = MappedTransportStreamTrickPlaySource::createNew(envir(), fTSFile, fIndex);
+  if (source == NULL) return NULL;
+
+  return MPEG2TransportStreamFramer::createNew(envir(), source);
+}
+
+inline RTPSink* MappedTransportFileServerMediaSubsession
+::createNewRTPSink(Groupsock* rtpGroupsock, unsigned char /*rtpPayloadTypeIfDynamic*/, FramedSource* /*inputSource*/) {
+  return SimpleRTPSink::createNew(envir(), rtpGroupsock,
+				  33, 90000, "video", "MP2T",
+				  1, True, False /*no 'M' bit*/);
+}
+
+inline void MappedTransportFileServerMediaSubsession::testScaleFactor(float& scale) {
+  if (fIndex != NULL && fDuration > 0.0) {
+    // We support any integral scale, other than 0
+    int iScale = scale < 0.0 ? (int)(scale - 0.5f) : (int)(scale + 0.5f); // round
+    if (iScale == 0) iScale = 1;
+    scale = (float)iScale;
+  } else {
+    scale = 1.0f;
+  }
+}
+
+inline float MappedTransportFileServerMediaSubsession::duration() const {
+  return fDuration;
+}
+
+#endif
+
+#endif
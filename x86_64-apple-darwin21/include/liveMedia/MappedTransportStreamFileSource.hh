@@ -0,0 +1,205 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A source that reads Transport Stream packets from a memory-mapped file.
+// (Unlike "ByteStreamFileSource", seeking is free, and we give the kernel 'readahead' hints for the data that we're about
+// to deliver, so that delivery doesn't stall (the event loop) on disk reads.)
+// C++ header
+
+#ifndef _MAPPED_TRANSPORT_STREAM_FILE_SOURCE_HH
+#define _MAPPED_TRANSPORT_STREAM_FILE_SOURCE_HH
+
+#ifndef _FRAMED_SOURCE_HH
+#include "FramedSource.hh"
+#endif
+#ifndef _MAPPED_FILE_HH
+#include "MappedFile.hh"
+#endif
+
+#if !defined(__WIN32__) && !defined(_WIN32)
+
+#ifndef TRANSPORT_PACKET_SIZE
+#define TRANSPORT_PACKET_SIZE 188
+#endif
+
+#define MAPPED_TRANSPORT_STREAM_DEFAULT_READAHEAD (4*1024*1024)
+
+class MappedTransportStreamFileSource: public FramedSource {
+public:
+  static MappedTransportStreamFileSource* createNew(UsageEnvironment& env, char const* fileName,
+						    unsigned preferredFrameSize = 0,
+						    u_int64_t readaheadSize = MAPPED_TRANSPORT_STREAM_DEFAULT_READAHEAD,
+						    Boolean dropBehind = False);
+  static MappedTransportStreamFileSource* createNew(UsageEnvironment& env, MappedFile* file,
+						    unsigned preferredFrameSize = 0,
+						    u_int64_t readaheadSize = MAPPED_TRANSPORT_STREAM_DEFAULT_READAHEAD,
+						    Boolean dropBehind = False);
+      // an alternative version of "createNew()" that's used if you already have a mapped file (e.g., one that's shared
+      // by several sources).  The file is not deleted when this source is.
+  // "preferredFrameSize" == 0 means 'as much as fits' (rounded down to a whole number of Transport packets).
+  // "readaheadSize" is the number of bytes (ahead of the data being delivered) that we ask the kernel to read in.
+  // If "dropBehind" is True, we also tell the kernel that data already delivered won't be needed again.  (Don't set this
+  // if other sources - e.g., for other clients - are likely to be reading the same file, because it affects them too.)
+
+  u_int64_t fileSize() const { return fFile->size(); }
+  unsigned long numTSPackets() const { return (unsigned long)(fFile->size()/TRANSPORT_PACKET_SIZE); }
+  unsigned long nextTSPacketNum() const { return (unsigned long)(fCurOffset/TRANSPORT_PACKET_SIZE); }
+  MappedFile* mappedFile() const { return fFile; }
+
+  void seekToTSPacket(unsigned long tsPacketNum, unsigned long numTSPacketsToStream = 0);
+    // if "numTSPacketsToStream" is >0, then we limit the stream to that number of packets, before treating it as EOF
+  void seekToByteAbsolute(u_int64_t byteNumber, u_int64_t numBytesToStream = 0);
+
+protected:
+  MappedTransportStreamFileSource(UsageEnvironment& env, MappedFile* file, Boolean ownsFile,
+				  unsigned preferredFrameSize, u_int64_t readaheadSize, Boolean dropBehind);
+	// called only by createNew()
+  virtual ~MappedTransportStreamFileSource();
+
+private:
+  // redefined virtual functions:
+  virtual void doGetNextFrame();
+  virtual void doStopGettingFrames();
+
+private:
+  void updateReadahead();
+
+private:
+  MappedFile* fFile;
+  Boolean fOwnsFile;
+  unsigned fPreferredFrameSize;
+  u_int64_t fReadaheadSize;
+  Boolean fDropBehind;
+  u_int64_t fCurOffset;
+  u_int64_t fEndOffset; // we treat this as EOF
+  u_int64_t fReadaheadStart, fReadaheadEnd; // the part of the file that we've most recently asked the kernel to read in
+};
+
+
+////////// Implementation //////////
+
+inline MappedTransportStreamFileSource*
+MappedTransportStreamFileSource::createNew(UsageEnvironment& env, char const* fileName,
+					   unsigned preferredFrameSize, u_int64_t readaheadSize, Boolean dropBehind) {
+  // We do our own readahead, so we don't also want the kernel's (which would read past the end of a seek range):
+  MappedFile* file = MappedFile::createNew(env, fileName, MappedFile::RANDOM_ACCESS);
+  if (file == NULL) return NULL;
+
+  return new MappedTransportStreamFileSource(env, file, True, preferredFrameSize, readaheadSize, dropBehind);
+}
+
+inline MappedTransportStreamFileSource*
+MappedTransportStreamFileSource::createNew(UsageEnvironment& env, MappedFile* file,
+					   unsigned preferredFrameSize, u_int64_t readaheadSize, Boolean dropBehind) {
+  if (file == NULL) return NULL;
+
+  return new MappedTransportStreamFileSource(env, file, False, preferredFrameSize, readaheadSize, dropBehind);
+}
+
+inline MappedTransportStreamFileSource
+::MappedTransportStreamFileSource(UsageEnvironment& env, MappedFile* file, Boolean ownsFile,
+				  unsigned preferredFrameSize, u_int64_t readaheadSize, Boolean dropBehind)
+  : FramedSource(env), fFile(file), fOwnsFile(ownsFile),
+    fPreferredFrameSize(preferredFrameSize), fReadaheadSize(readaheadSize), fDropBehind(dropBehind),
+    fCurOffset(0), fEndOffset(file->size() - file->size()%TRANSPORT_PACKET_SIZE),
+    fReadaheadStart(0), fReadaheadEnd(0) {
+}
+
+inline MappedTransportStreamFileSource::~MappedTransportStreamFileSource() {
+  if (fOwnsFile) delete fFile;
+}
+
+inline void MappedTransportStreamFileSource::seekToTSPacket(unsigned long tsPacketNum, unsigned long numTSPacketsToStream) {
+  seekToByteAbsolute((u_int64_t)tsPacketNum*TRANSPORT_PACKET_SIZE, (u_int64_t)numTSPacketsToStream*TRANSPORT_PACKET_SIZE);
+}
+
+inline void MappedTransportStreamFileSource::seekToByteAbsolute(u_int64_t byteNumber, u_int64_t numBytesToStream) {
+  u_int64_t fileEnd = fFile->size() - fFile->size()%TRANSPORT_PACKET_SIZE;
+
+  fCurOffset = byteNumber < fileEnd ? byteNumber : fileEnd;
+  fEndOffset = numBytesToStream > 0 && numBytesToStream < fileEnd - fCurOffset ? fCurOffset + numBytesToStream : fileEnd;
+
+  // Start reading in the new position's data now, rather than when it's first requested:
+  fReadaheadStart = fReadaheadEnd = fCurOffset;
+  updateReadahead();
+}
+
+inline void MappedTransportStreamFileSource::updateReadahead() {
+  if (fReadaheadSize == 0) return;
+
+  // Ask for the next "fReadaheadSize" bytes once we're half way through the previous request, so that (at any constant
+  // delivery rate) the kernel is always at least half a window ahead of us:
+  if (fCurOffset + fReadaheadSize/2 < fReadaheadEnd && fCurOffset >= fReadaheadStart) return;
+
+  u_int64_t start = fCurOffset > fReadaheadEnd || fCurOffset < fReadaheadStart ? fCurOffset : fReadaheadEnd;
+  if (start >= fEndOffset) return;
+  u_int64_t end = fCurOffset + fReadaheadSize;
+  if (end > fEndOffset) end = fEndOffset;
+  if (end <= start) return;
+
+  fFile->willNeed(start, end - start);
+  if (fDropBehind && fReadaheadStart < fCurOffset && fCurOffset <= fReadaheadEnd) {
+    fFile->dontNeed(fReadaheadStart, fCurOffset - fReadaheadStart);
+  }
+  fReadaheadStart = fCurOffset;
+  fReadaheadEnd = end;
+}
+
+inline void MappedTransportStreamFileSource::doGetNextFrame() {
+  u_int64_t fileEnd = fFile->size() - fFile->size()%TRANSPORT_PACKET_SIZE;
+  if (fEndOffset > fileEnd) fEndOffset = fileEnd; // the file was remapped smaller (by another source that shares it)
+  if (fCurOffset >= fEndOffset) {
+    // If we've reached the end of the file (rather than the end of a seek range), then check whether the file has grown
+    // (e.g., because it's a recording that's still being written) before treating this as EOF:
+    if (fEndOffset == fileEnd && fFile->refresh()) {
+      fileEnd = fFile->size() - fFile->size()%TRANSPORT_PACKET_SIZE;
+      fEndOffset = fileEnd;
+      fReadaheadStart = fReadaheadEnd = fCurOffset;
+    }
+    if (fCurOffset >= fEndOffset) {
+      handleClosure();
+      return;
+    }
+  }
+
+  // Deliver as many whole Transport packets as we can (but at least part of one):
+  u_int64_t numBytesAvailable = fEndOffset - fCurOffset;
+  unsigned frameSize = fMaxSize;
+  if (fPreferredFrameSize > 0 && fPreferredFrameSize < frameSize) frameSize = fPreferredFrameSize;
+  if (frameSize > numBytesAvailable) frameSize = (unsigned)numBytesAvailable;
+  if (frameSize >= TRANSPORT_PACKET_SIZE) frameSize -= frameSize%TRANSPORT_PACKET_SIZE;
+
+  updateReadahead();
+  memmove(fTo, &fFile->data()[fCurOffset], frameSize);
+  fCurOffset += frameSize;
+
+  fFrameSize = frameSize;
+  fNumTruncatedBytes = 0;
+  gettimeofday(&fPresentationTime, NULL);
+  fDurationInMicroseconds = 0; // "MPEG2TransportStreamFramer" works out the duration from the PCRs
+
+  // Because we didn't wait for the data, complete delivery via the event loop, to avoid unbounded recursion:
+  nextTask() = envir().taskScheduler().scheduleDelayedTask(0, (TaskFunc*)FramedSource::afterGetting, this);
+}
+
+inline void MappedTransportStreamFileSource::doStopGettingFrames() {
+  envir().taskScheduler().unscheduleDelayedTask(nextTask());
+}
+
+#endif
+
+#endif
@@ -0,0 +1,246 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A memory-mapped MPEG-2 Transport Stream 'index file' (in the format written by "MPEG2IFrameIndexFromTransportStream",
+// and read by "MPEG2TransportStreamIndexFile").  Because index records have a fixed size, and are in Transport packet
+// order, lookups are done by binary search within the mapped file, rather than by seeking and reading.
+// C++ header
+
+#ifndef _MAPPED_TRANSPORT_STREAM_INDEX_HH
+#define _MAPPED_TRANSPORT_STREAM_INDEX_HH
+
+#ifndef _MEDIA_HH
+#include "Media.hh"
+#endif
+#ifndef _MAPPED_FILE_HH
+#include "MappedFile.hh"
+#endif
+
+#if !defined(__WIN32__) && !defined(_WIN32)
+
+#ifndef INDEX_RECORD_SIZE
+#define INDEX_RECORD_SIZE 11
+#endif
+
+// Index record types (as written by "MPEG2IFrameIndexFromTransportStream"), in the low 7 bits of each record's first byte.
+// The high bit is set in the first record of each frame.
+#define TS_INDEX_RECORD_VSH 1 // MPEG-1 or 2 Video Sequence Header
+#define TS_INDEX_RECORD_PIC_IFRAME 4
+#define TS_INDEX_RECORD_NAL_H264_SPS 5
+#define TS_INDEX_RECORD_NAL_H264_IFRAME 9
+#define TS_INDEX_RECORD_NAL_H265_VPS 11
+#define TS_INDEX_RECORD_NAL_H265_IFRAME 15
+#define TS_INDEX_RECORD_JUNK 17
+
+class MappedTransportStreamIndex: public Medium {
+public:
+  static MappedTransportStreamIndex* createNew(UsageEnvironment& env, char const* indexFileName);
+
+  // These functions behave like those of the same name in "MPEG2TransportStreamIndexFile":
+  void lookupTSPacketNumFromNPT(float& npt, unsigned long& tsPacketNumber,
+				unsigned long& indexRecordNumber) const;
+  void lookupPCRFromTSPacketNum(unsigned long& tsPacketNumber, Boolean reverseToPreviousCleanPoint,
+				float& pcr, unsigned long& indexRecordNumber) const;
+  Boolean readIndexRecordValues(unsigned long indexRecordNum,
+				unsigned long& transportPacketNum, u_int8_t& offset,
+				u_int8_t& size, float& pcr, u_int8_t& recordType) const;
+  float getPlayingDuration() const;
+  int mpegVersion() const;
+
+  unsigned long numIndexRecords() const { return fNumIndexRecords; }
+
+  // Direct (in place) access to index records:
+  unsigned char const* record(unsigned long indexRecordNum) const { return &fFile->data()[indexRecordNum*INDEX_RECORD_SIZE]; }
+  static u_int8_t recordType(unsigned char const* rec) { return rec[0]; }
+  static u_int8_t offset(unsigned char const* rec) { return rec[1]; }
+  static u_int8_t size(unsigned char const* rec) { return rec[2]; }
+  static float pcr(unsigned char const* rec) { return ((rec[5]<<16)|(rec[4]<<8)|rec[3]) + rec[6]/256.0f; }
+  static unsigned long tsPacketNum(unsigned char const* rec) {
+    return ((unsigned long)rec[10]<<24)|(rec[9]<<16)|(rec[8]<<8)|rec[7];
+  }
+  static Boolean isCleanPoint(unsigned char const* rec);
+      // True iff this record begins a frame from which decoding can start (a MPEG VSH, H.264 SPS, or H.265 VPS)
+
+  Boolean findCleanPoint(unsigned long& indexRecordNum, int direction) const;
+      // Starting at "indexRecordNum", and moving forwards (if "direction" > 0) or backwards (otherwise),
+      // finds the nearest clean point.  Returns False if there's none.
+  void prefetch(unsigned long firstIndexRecordNum, unsigned long numIndexRecords) const;
+      // Asks the kernel to read in these index records (e.g., before a fast-forward or reverse play)
+
+  // Binary searches.  (Each returns 0 if no record qualifies.)
+  unsigned long lastRecordWithPCRAtMost(float pcr) const;
+  unsigned long lastRecordWithTSPacketNumAtMost(unsigned long tsPacketNumber) const;
+
+protected:
+  MappedTransportStreamIndex(UsageEnvironment& env, MappedFile* file);
+      // called only by createNew()
+  virtual ~MappedTransportStreamIndex();
+
+private:
+  MappedFile* fFile;
+  unsigned long fNumIndexRecords;
+};
+
+
+////////// Implementation //////////
+
+inline MappedTransportStreamIndex* MappedTransportStreamIndex::createNew(UsageEnvironment& env, char const* indexFileName) {
+  if (indexFileName == NULL) return NULL;
+
+  // Index lookups jump around the file, so we don't want the kernel's sequential readahead:
+  MappedFile* file = MappedFile::createNew(env, indexFileName, MappedFile::RANDOM_ACCESS);
+  if (file == NULL) return NULL;
+
+  return new MappedTransportStreamIndex(env, file);
+}
+
+inline MappedTransportStreamIndex::MappedTransportStreamIndex(UsageEnvironment& env, MappedFile* file)
+  : Medium(env), fFile(file), fNumIndexRecords((unsigned long)(file->size()/INDEX_RECORD_SIZE)) {
+}
+
+inline MappedTransportStreamIndex::~MappedTransportStreamIndex() {
+  delete fFile;
+}
+
+inline Boolean MappedTransportStreamIndex::isCleanPoint(unsigned char const* rec) {
+  u_int8_t type = recordType(rec);
+  if ((type&0x80) == 0) return False; // not the start of a frame
+  type &= 0x7F;
+  return type == TS_INDEX_RECORD_VSH || type == TS_INDEX_RECORD_NAL_H264_SPS || type == TS_INDEX_RECORD_NAL_H265_VPS;
+}
+
+inline unsigned long MappedTransportStreamIndex::lastRecordWithPCRAtMost(float pcrLimit) const {
+  // (PCRs in an index file are non-decreasing.)
+  unsigned long lo = 0, hi = fNumIndexRecords; // the answer is in [lo, hi)
+  while (hi - lo > 1) {
+    unsigned long mid = lo + (hi - lo)/2;
+    if (pcr(record(mid)) <= pcrLimit) lo = mid; else hi = mid;
+  }
+  return lo;
+}
+
+inline unsigned long MappedTransportStreamIndex::lastRecordWithTSPacketNumAtMost(unsigned long tsPacketNumber) const {
+  unsigned long lo = 0, hi = fNumIndexRecords;
+  while (hi - lo > 1) {
+    unsigned long mid = lo + (hi - lo)/2;
+    if (tsPacketNum(record(mid)) <= tsPacketNumber) lo = mid; else hi = mid;
+  }
+  return lo;
+}
+
+inline Boolean MappedTransportStreamIndex::findCleanPoint(unsigned long& indexRecordNum, int direction) const {
+  if (indexRecordNum >= fNumIndexRecords) {
+    if (direction > 0 || fNumIndexRecords == 0) return False;
+    indexRecordNum = fNumIndexRecords - 1;
+  }
+
+  unsigned long ix = indexRecordNum;
+  while (1) {
+    if (isCleanPoint(record(ix))) {
+      indexRecordNum = ix;
+      return True;
+    }
+    if (direction > 0) {
+      if (++ix >= fNumIndexRecords) return False;
+    } else {
+      if (ix-- == 0) return False;
+    }
+  }
+}
+
+inline void MappedTransportStreamIndex::lookupTSPacketNumFromNPT(float& npt, unsigned long& tsPacketNumber,
+								 unsigned long& indexRecordNumber) const {
+  if (npt <= 0.0 || fNumIndexRecords == 0) { // Fast-track a common case:
+    npt = 0.0f;
+    tsPacketNumber = indexRecordNumber = 0;
+    return;
+  }
+
+  unsigned char const* lastRecord = record(fNumIndexRecords - 1);
+  if (npt >= pcr(lastRecord)) {
+    // The requested time is at (or past) the end of the stream:
+    npt = pcr(lastRecord);
+    tsPacketNumber = tsPacketNum(lastRecord) + 1;
+    indexRecordNumber = fNumIndexRecords;
+    return;
+  }
+
+  // Find the last record at or before "npt", then back up to a clean point:
+  unsigned long ix = lastRecordWithPCRAtMost(npt);
+  if (!findCleanPoint(ix, -1)) ix = 0;
+
+  npt = pcr(record(ix));
+  tsPacketNumber = tsPacketNum(record(ix));
+  indexRecordNumber = ix;
+}
+
+inline void MappedTransportStreamIndex::lookupPCRFromTSPacketNum(unsigned long& tsPacketNumber,
+								 Boolean reverseToPreviousCleanPoint,
+								 float& pcrResult, unsigned long& indexRecordNumber) const {
+  if (tsPacketNumber == 0 || fNumIndexRecords == 0) { // Fast-track a common case:
+    pcrResult = 0.0f;
+    indexRecordNumber = 0;
+    return;
+  }
+
+  unsigned long ix = lastRecordWithTSPacketNumAtMost(tsPacketNumber);
+  if (reverseToPreviousCleanPoint) {
+    if (!findCleanPoint(ix, -1)) ix = 0;
+    tsPacketNumber = tsPacketNum(record(ix));
+  }
+
+  pcrResult = pcr(record(ix));
+  indexRecordNumber = ix;
+}
+
+inline Boolean MappedTransportStreamIndex
+::readIndexRecordValues(unsigned long indexRecordNum,
+			unsigned long& transportPacketNum, u_int8_t& offsetResult,
+			u_int8_t& sizeResult, float& pcrResult, u_int8_t& recordTypeResult) const {
+  if (indexRecordNum >= fNumIndexRecords) return False;
+
+  unsigned char const* rec = record(indexRecordNum);
+  transportPacketNum = tsPacketNum(rec);
+  offsetResult = offset(rec);
+  sizeResult = size(rec);
+  pcrResult = pcr(rec);
+  recordTypeResult = recordType(rec);
+  return True;
+}
+
+inline float MappedTransportStreamIndex::getPlayingDuration() const {
+  return fNumIndexRecords == 0 ? 0.0f : pcr(record(fNumIndexRecords - 1));
+}
+
+inline int MappedTransportStreamIndex::mpegVersion() const {
+  // Guess from the first record whose type identifies the video codec:
+  for (unsigned long ix = 0; ix < fNumIndexRecords; ++ix) {
+    u_int8_t type = recordType(record(ix))&0x7F;
+    if (type >= 1 && type <= 4) return 2; // MPEG-1 or 2
+    if (type >= 5 && type <= 10) return 5; // H.264
+    if (type >= 11 && type < TS_INDEX_RECORD_JUNK) return 6; // H.265
+  }
+  return 0;
+}
+
+inline void MappedTransportStreamIndex::prefetch(unsigned long firstIndexRecordNum, unsigned long numRecords) const {
+  fFile->willNeed((u_int64_t)firstIndexRecordNum*INDEX_RECORD_SIZE, (u_int64_t)numRecords*INDEX_RECORD_SIZE);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,216 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A source that implements 'trick mode' play (fast forward, or forward or reverse play at any speed) on a memory-mapped
+// Transport Stream file, using its (memory-mapped) index file.  Like "MPEG2TransportStreamTrickModeFilter", we deliver
+// the video 'I-frames' as elementary stream frames (to be fed into a "MPEG2TransportStreamFromESSource"), but we pick
+// each frame by binary search on the index, and copy its data directly from the mapped Transport Stream file, rather than
+// reading the index and Transport Stream files record-by-record, and packet-by-packet.
+// C++ header
+
+#ifndef _MAPPED_TRANSPORT_STREAM_TRICK_MODE_SOURCE_HH
+#define _MAPPED_TRANSPORT_STREAM_TRICK_MODE_SOURCE_HH
+
+#ifndef _FRAMED_SOURCE_HH
+#include "FramedSource.hh"
+#endif
+#ifndef _MAPPED_TRANSPORT_STREAM_INDEX_HH
+#include "MappedTransportStreamIndex.hh"
+#endif
+
+#if !defined(__WIN32__) && !defined(_WIN32)
+
+#ifndef TRANSPORT_PACKET_SIZE
+#define TRANSPORT_PACKET_SIZE 188
+#endif
+
+class MappedTransportStreamTrickModeSource: public FramedSource {
+public:
+  static MappedTransportStreamTrickModeSource*
+  createNew(UsageEnvironment& env, MappedFile* tsFile, MappedTransportStreamIndex* index,
+	    int scale, unsigned long indexRecordNum, float outputFrameInterval = 0.25f);
+      // Starts at the clean point at (or before) "indexRecordNum".  A negative "scale" means reverse play.
+      // "outputFrameInterval" (in seconds) is the minimum play time of each delivered frame; at higher speeds, we skip
+      // I-frames so that each delivered frame plays for at least this long.
+      // Neither "tsFile" nor "index" is deleted when this source is.
+
+  unsigned long currentIndexRecordNum() const { return fFrameStart; }
+      // the first index record of the frame most recently delivered (at which normal play can resume)
+
+protected:
+  MappedTransportStreamTrickModeSource(UsageEnvironment& env, MappedFile* tsFile, MappedTransportStreamIndex* index,
+				       int scale, unsigned long indexRecordNum, float outputFrameInterval);
+      // called only by createNew()
+  virtual ~MappedTransportStreamTrickModeSource();
+
+private:
+  // redefined virtual functions:
+  virtual void doGetNextFrame();
+  virtual void doStopGettingFrames();
+
+private:
+  unsigned long frameEnd(unsigned long frameStart) const;
+  Boolean findNextFrame(unsigned long& nextFrameStart) const;
+  unsigned copyFrameData(unsigned long frameStart, unsigned long frameEnd);
+  void prefetchFrame(unsigned long frameStart, unsigned long frameEnd) const;
+
+private:
+  MappedFile* fTSFile;
+  MappedTransportStreamIndex* fIndex;
+  int fScale; // absolute value
+  int fDirection; // 1 => forward; -1 => reverse
+  float fOutputFrameInterval;
+  Boolean fHaveNextFrame;
+  unsigned long fNextFrameStart;
+  unsigned long fFrameStart; // of the frame most recently delivered
+  Boolean fHaveStarted;
+  unsigned fFrameDuration; // of the frame most recently delivered, in microseconds
+};
+
+
+////////// Implementation //////////
+
+inline MappedTransportStreamTrickModeSource*
+MappedTransportStreamTrickModeSource::createNew(UsageEnvironment& env, MappedFile* tsFile, MappedTransportStreamIndex* index,
+						int scale, unsigned long indexRecordNum, float outputFrameInterval) {
+  if (tsFile == NULL || index == NULL || scale == 0) return NULL;
+
+  return new MappedTransportStreamTrickModeSource(env, tsFile, index, scale, indexRecordNum, outputFrameInterval);
+}
+
+inline MappedTransportStreamTrickModeSource
+::MappedTransportStreamTrickModeSource(UsageEnvironment& env, MappedFile* tsFile, MappedTransportStreamIndex* index,
+				       int scale, unsigned long indexRecordNum, float outputFrameInterval)
+  : FramedSource(env), fTSFile(tsFile), fIndex(index),
+    fScale(scale < 0 ? -scale : scale), fDirection(scale < 0 ? -1 : 1),
+    fOutputFrameInterval(outputFrameInterval > 0.0f ? outputFrameInterval : 0.25f),
+    fNextFrameStart(indexRecordNum), fFrameStart(indexRecordNum), fHaveStarted(False), fFrameDuration(0) {
+  // Begin at the clean point at or before "indexRecordNum" (or, if there's none, the first one after it):
+  fHaveNextFrame = fIndex->findCleanPoint(fNextFrameStart, -1) || fIndex->findCleanPoint(fNextFrameStart, 1);
+  if (fHaveNextFrame) prefetchFrame(fNextFrameStart, frameEnd(fNextFrameStart));
+}
+
+inline MappedTransportStreamTrickModeSource::~MappedTransportStreamTrickModeSource() {
+}
+
+inline unsigned long MappedTransportStreamTrickModeSource::frameEnd(unsigned long frameStart) const {
+  // A frame continues until the next record that begins a frame:
+  unsigned long numRecords = fIndex->numIndexRecords();
+  unsigned long ix = frameStart + 1;
+  while (ix < numRecords && (MappedTransportStreamIndex::recordType(fIndex->record(ix))&0x80) == 0) ++ix;
+  return ix;
+}
+
+inline Boolean MappedTransportStreamTrickModeSource::findNextFrame(unsigned long& nextFrameStart) const {
+  // Jump (by binary search) to where the next frame should be, given our speed, then find the nearest clean point:
+  float pcr = MappedTransportStreamIndex::pcr(fIndex->record(fFrameStart));
+  float targetPCR = pcr + fDirection*fScale*fOutputFrameInterval;
+  unsigned long ix = fIndex->lastRecordWithPCRAtMost(targetPCR);
+
+  if (fDirection > 0) {
+    // Use the last clean point at or before the target, unless that's the frame that we've just delivered:
+    nextFrameStart = ix;
+    if (fIndex->findCleanPoint(nextFrameStart, -1) && nextFrameStart > fFrameStart) return True;
+
+    nextFrameStart = frameEnd(fFrameStart); // make progress, however widely spaced the clean points
+    return fIndex->findCleanPoint(nextFrameStart, 1);
+  } else {
+    if (ix >= fFrameStart) {
+      if (fFrameStart == 0) return False;
+      ix = fFrameStart - 1;
+    }
+    nextFrameStart = ix;
+    return fIndex->findCleanPoint(nextFrameStart, -1);
+  }
+}
+
+inline unsigned MappedTransportStreamTrickModeSource::copyFrameData(unsigned long frameStart, unsigned long frameEnd) {
+  // Each index record identifies a piece of the frame's data within one Transport packet:
+  unsigned char const* tsData = fTSFile->data();
+  u_int64_t tsFileSize = fTSFile->size();
+  unsigned frameSize = 0;
+  fNumTruncatedBytes = 0;
+
+  for (unsigned long ix = frameStart; ix < frameEnd; ++ix) {
+    unsigned char const* rec = fIndex->record(ix);
+    u_int64_t dataOffset = (u_int64_t)MappedTransportStreamIndex::tsPacketNum(rec)*TRANSPORT_PACKET_SIZE
+      + MappedTransportStreamIndex::offset(rec);
+    unsigned dataSize = MappedTransportStreamIndex::size(rec);
+    if (dataOffset + dataSize > tsFileSize) break; // the index doesn't match the file
+
+    unsigned numBytesToCopy = dataSize;
+    if (frameSize + numBytesToCopy > fMaxSize) numBytesToCopy = fMaxSize - frameSize;
+    memmove(&fTo[frameSize], &tsData[dataOffset], numBytesToCopy);
+    frameSize += numBytesToCopy;
+    fNumTruncatedBytes += dataSize - numBytesToCopy;
+  }
+
+  return frameSize;
+}
+
+inline void MappedTransportStreamTrickModeSource::prefetchFrame(unsigned long frameStart, unsigned long frameEnd) const {
+  if (frameEnd <= frameStart) return;
+
+  u_int64_t firstPacket = MappedTransportStreamIndex::tsPacketNum(fIndex->record(frameStart));
+  u_int64_t lastPacket = MappedTransportStreamIndex::tsPacketNum(fIndex->record(frameEnd-1));
+  if (lastPacket < firstPacket) return;
+  fTSFile->willNeed(firstPacket*TRANSPORT_PACKET_SIZE, (lastPacket - firstPacket + 1)*TRANSPORT_PACKET_SIZE);
+}
+
+inline void MappedTransportStreamTrickModeSource::doGetNextFrame() {
+  if (!fHaveNextFrame) {
+    handleClosure();
+    return;
+  }
+
+  // Deliver the next frame:
+  fFrameStart = fNextFrameStart;
+  fFrameSize = copyFrameData(fFrameStart, frameEnd(fFrameStart));
+
+  // Find (and start reading in) the frame after this one.  The gap between the two frames' PCRs determines how long
+  // this frame plays for:
+  float pcr = MappedTransportStreamIndex::pcr(fIndex->record(fFrameStart));
+  float duration = fOutputFrameInterval;
+  fHaveNextFrame = findNextFrame(fNextFrameStart);
+  if (fHaveNextFrame) {
+    float nextPCR = MappedTransportStreamIndex::pcr(fIndex->record(fNextFrameStart));
+    float pcrGap = nextPCR > pcr ? nextPCR - pcr : pcr - nextPCR;
+    if (pcrGap > 0.0f) duration = pcrGap/fScale;
+    prefetchFrame(fNextFrameStart, frameEnd(fNextFrameStart));
+  }
+
+  if (!fHaveStarted) {
+    gettimeofday(&fPresentationTime, NULL);
+    fHaveStarted = True;
+  } else {
+    // Advance the presentation time by the previous frame's duration:
+    unsigned uSeconds = fPresentationTime.tv_usec + fFrameDuration;
+    fPresentationTime.tv_sec += uSeconds/1000000;
+    fPresentationTime.tv_usec = uSeconds%1000000;
+  }
+  fDurationInMicroseconds = fFrameDuration = (unsigned)(duration*1000000);
+
+  nextTask() = envir().taskScheduler().scheduleDelayedTask(0, (TaskFunc*)FramedSource::afterGetting, this);
+}
+
+inline void MappedTransportStreamTrickModeSource::doStopGettingFrames() {
+  envir().taskScheduler().unscheduleDelayedTask(nextTask());
+}
+
+#endif
+
+#endif
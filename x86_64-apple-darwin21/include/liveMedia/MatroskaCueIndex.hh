@@ -0,0 +1,528 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// An index - from time to 'Cluster' position - of a Matroska file.  It's built by reading (from a memory-mapped copy
+// of the file) only the file's 'SeekHead', 'Info' and 'Cues'.  If the file has no 'Cues', the index is instead built
+// by reading just the header of each 'Cluster', and is then saved in a 'sidecar' file (named "<fileName>.cues"),
+// so that this needs to be done only once.
+// C++ header
+
+#ifndef _MATROSKA_CUE_INDEX_HH
+#define _MATROSKA_CUE_INDEX_HH
+
+#ifndef _MAPPED_FILE_HH
+#include "MappedFile.hh"
+#endif
+
+#if !defined(__WIN32__) && !defined(_WIN32)
+#include <stdio.h>
+
+class MatroskaCueIndex {
+public:
+  static MatroskaCueIndex* createNew(UsageEnvironment& env, char const* fileName, Boolean useSidecarFile = True);
+      // Returns NULL (and sets "env"s result message) if the file can't be opened, or isn't a Matroska file.
+  static MatroskaCueIndex* createNew(UsageEnvironment& env, MappedFile* mappedFile, char const* fileName,
+				     Boolean useSidecarFile = True);
+      // As above, but uses an existing mapping of the file (which must outlive the index).
+  ~MatroskaCueIndex();
+
+  unsigned timecodeScale() const { return fTimecodeScale; } // in nanoseconds
+  double fileDuration() const { return fDuration; } // in seconds (0 if unknown)
+  u_int64_t tracksOffset() const { return fTracksOffset; } // of the 'Tracks' element (0 if not found)
+  u_int64_t firstClusterOffset() const { return fFirstClusterOffset; }
+  Boolean fileHadCues() const { return fFileHadCues; } // if False, the index came from a sidecar file, or a scan
+
+  unsigned numCuePoints() const { return fNumCuePoints; }
+  double cueTime(unsigned i) const { return fCueTimecodes[i]*(fTimecodeScale/1000000000.0); } // in seconds
+  u_int64_t cueClusterOffset(unsigned i) const { return fCueClusterOffsets[i]; } // from the start of the file
+
+  Boolean lookup(double& time, u_int64_t& clusterOffset) const;
+      // Finds the last cue point at or before "time" (in seconds).  On return, "time" is the cue point's time.
+      // Returns False if there are no cue points.
+  unsigned indexOf(double time) const; // the index of the last cue point at or before "time" (0 if none)
+
+private:
+  MatroskaCueIndex(MappedFile* mappedFile, Boolean ownsMappedFile);
+
+  Boolean parse(UsageEnvironment& env, char const* fileName, Boolean useSidecarFile);
+  Boolean readElementHeader(u_int64_t& pos, u_int64_t limit, u_int32_t& id, u_int64_t& size) const;
+  u_int64_t readUnsigned(u_int64_t pos, u_int64_t size) const;
+  double readFloat(u_int64_t pos, u_int64_t size) const;
+  void parseSeekHead(u_int64_t pos, u_int64_t end, u_int64_t& infoOffset, u_int64_t& cuesOffset);
+  void parseInfo(u_int64_t pos, u_int64_t end);
+  void parseCues(u_int64_t pos, u_int64_t end);
+  void scanClusters();
+  void addCuePoint(u_int64_t timecode, u_int64_t clusterOffset);
+  void sortCuePoints();
+
+  static char* sidecarFileName(char const* fileName);
+  Boolean readSidecarFile(char const* fileName);
+  void writeSidecarFile(char const* fileName) const;
+
+private:
+  MappedFile* fMappedFile;
+  Boolean fOwnsMappedFile;
+  u_int64_t fSegmentDataOffset, fSegmentEnd;
+  unsigned fTimecodeScale;
+  double fDuration;
+  u_int64_t fTracksOffset, fFirstClusterOffset;
+  Boolean fFileHadCues;
+  u_int64_t* fCueTimecodes; // in units of "fTimecodeScale"
+  u_int64_t* fCueClusterOffsets;
+  unsigned fNumCuePoints, fCueArraySize;
+};
+
+
+////////// Implementation //////////
+
+// Matroska (EBML) element ids:
+#define MATROSKA_ID_EBML 0x1A45DFA3
+#define MATROSKA_ID_SEGMENT 0x18538067
+#define MATROSKA_ID_SEEK_HEAD 0x114D9B74
+#define MATROSKA_ID_SEEK 0x4DBB
+#define MATROSKA_ID_SEEK_ID 0x53AB
+#define MATROSKA_ID_SEEK_POSITION 0x53AC
+#define MATROSKA_ID_INFO 0x1549A966
+#define MATROSKA_ID_TIMECODE_SCALE 0x2AD7B1
+#define MATROSKA_ID_DURATION 0x4489
+#define MATROSKA_ID_TRACKS 0x1654AE6B
+#define MATROSKA_ID_CUES 0x1C53BB6B
+#define MATROSKA_ID_CUE_POINT 0xBB
+#define MATROSKA_ID_CUE_TIME 0xB3
+#define MATROSKA_ID_CUE_TRACK_POSITIONS 0xB7
+#define MATROSKA_ID_CUE_CLUSTER_POSITION 0xF1
+#define MATROSKA_ID_CLUSTER 0x1F43B675
+#define MATROSKA_ID_TIMECODE 0xE7
+#define MATROSKA_UNKNOWN_SIZE (~(u_int64_t)0)
+
+#define MATROSKA_SIDECAR_MAGIC "LMKVCUE1"
+
+inline MatroskaCueIndex* MatroskaCueIndex::createNew(UsageEnvironment& env, char const* fileName, Boolean useSidecarFile) {
+  MappedFile* mappedFile = MappedFile::createNew(env, fileName, MappedFile::RANDOM_ACCESS);
+  if (mappedFile == NULL) return NULL;
+
+  MatroskaCueIndex* index = new MatroskaCueIndex(mappedFile, True);
+  if (!index->parse(env, fileName, useSidecarFile)) {
+    delete index;
+    return NULL;
+  }
+  return index;
+}
+
+inline MatroskaCueIndex* MatroskaCueIndex::createNew(UsageEnvironment& env, MappedFile* mappedFile, char const* fileName,
+						     Boolean useSidecarFile) {
+  if (mappedFile == NULL) return NULL;
+
+  MatroskaCueIndex* index = new MatroskaCueIndex(mappedFile, False);
+  if (!index->parse(env, fileName, useSidecarFile)) {
+    delete index;
+    return NULL;
+  }
+  return index;
+}
+
+inline MatroskaCueIndex::MatroskaCueIndex(MappedFile* mappedFile, Boolean ownsMappedFile)
+  : fMappedFile(mappedFile), fOwnsMappedFile(ownsMappedFile), fSegmentDataOffset(0), fSegmentEnd(0),
+    fTimecodeScale(1000000), fDuration(0.0), fTracksOffset(0), fFirstClusterOffset(0), fFileHadCues(False),
+    fCueTimecodes(NULL), fCueClusterOffsets(NULL), fNumCuePoints(0), fCueArraySize(0) {
+}
+
+inline MatroskaCueIndex::~MatroskaCueIndex() {
+  delete[] fCueTimecodes;
+  delete[] fCueClusterOffsets;
+  if (fOwnsMappedFile) delete fMappedFile;
+}
+
+inline Boolean MatroskaCueIndex::readElementHeader(u_int64_t& pos, u_int64_t limit, u_int32_t& id, u_int64_t& size) const {
+  unsigned char const* data = fMappedFile->data();
+  if (limit > fMappedFile->size()) limit = fMappedFile->size();
+
+  // The id (a variable-length integer of 1-4 bytes; we keep its length marker):
+  if (pos >= limit) return False;
+  u_int8_t first = data[pos];
+  unsigned idLength = first >= 0x80 ? 1 : first >= 0x40 ? 2 : first >= 0x20 ? 3 : first >= 0x10 ? 4 : 0;
+  if (idLength == 0 || pos + idLength > limit) return False;
+  id = 0;
+  for (unsigned i = 0; i < idLength; ++i) id = (id<<8)|data[pos+i];
+  pos += idLength;
+
+  // The size (a variable-length integer of 1-8 bytes; we remove its length marker):
+  if (pos >= limit) return False;
+  first = data[pos];
+  unsigned sizeLength = 1;
+  while (sizeLength <= 8 && (first&(0x80>>(sizeLength-1))) == 0) ++sizeLength;
+  if (sizeLength > 8 || pos + sizeLength > limit) return False;
+  size = first&(0xFF>>sizeLength);
+  Boolean allOnes = size == (u_int64_t)(0xFF>>sizeLength);
+  for (unsigned i = 1; i < sizeLength; ++i) {
+    size = (size<<8)|data[pos+i];
+    if (data[pos+i] != 0xFF) allOnes = False;
+  }
+  pos += sizeLength;
+  if (allOnes) size = MATROSKA_UNKNOWN_SIZE;
+
+  return True;
+}
+
+inline u_int64_t MatroskaCueIndex::readUnsigned(u_int64_t pos, u_int64_t size) const {
+  u_int64_t result = 0;
+  if (size > 8 || pos + size > fMappedFile->size()) return 0;
+  for (u_int64_t i = 0; i < size; ++i) result = (result<<8)|fMappedFile->data()[pos+i];
+  return result;
+}
+
+inline double MatroskaCueIndex::readFloat(u_int64_t pos, u_int64_t size) const {
+  u_int64_t bits = readUnsigned(pos, size);
+  if (size == 4) {
+    u_int32_t bits32 = (u_int32_t)bits;
+    float result;
+    memcpy(&result, &bits32, sizeof result);
+    return result;
+  } else if (size == 8) {
+    double result;
+    memcpy(&result, &bits, sizeof result);
+    return result;
+  }
+  return 0.0;
+}
+
+inline Boolean MatroskaCueIndex::parse(UsageEnvironment& env, char const* fileName, Boolean useSidecarFile) {
+  u_int64_t const fileSize = fMappedFile->size();
+  u_int64_t pos = 0;
+  u_int32_t id;
+  u_int64_t size;
+
+  // The 'EBML' header, then the 'Segment':
+  if (!readElementHeader(pos, fileSize, id, size) || id != MATROSKA_ID_EBML || size == MATROSKA_UNKNOWN_SIZE) {
+    env.setResultMsg("not a Matroska file: \"", fileName, "\"");
+    return False;
+  }
+  pos += size;
+  if (!readElementHeader(pos, fileSize, id, size) || id != MATROSKA_ID_SEGMENT) {
+    env.setResultMsg("no 'Segment' in Matroska file: \"", fileName, "\"");
+    return False;
+  }
+  fSegmentDataOffset = pos;
+  fSegmentEnd = size == MATROSKA_UNKNOWN_SIZE || pos + size > fileSize ? fileSize : pos + size;
+
+  // Look at the Segment's top-level elements, until the first 'Cluster'.  (Any that we want but that come after that -
+  // usually 'Cues' - should be listed in the 'SeekHead'.)
+  u_int64_t infoOffset = 0, cuesOffset = 0;
+  while (1) {
+    u_int64_t elementStart = pos;
+    if (!readElementHeader(pos, fSegmentEnd, id, size)) break;
+    if (id == MATROSKA_ID_CLUSTER) { fFirstClusterOffset = elementStart; break; }
+    if (size == MATROSKA_UNKNOWN_SIZE) break;
+    u_int64_t end = pos + size;
+
+    if (id == MATROSKA_ID_SEEK_HEAD) {
+      parseSeekHead(pos, end, infoOffset, cuesOffset);
+    } else if (id == MATROSKA_ID_INFO) {
+      parseInfo(pos, end);
+      infoOffset = 0;
+    } else if (id == MATROSKA_ID_TRACKS) {
+      fTracksOffset = pos;
+    } else if (id == MATROSKA_ID_CUES) {
+      parseCues(pos, end);
+      cuesOffset = 0;
+    }
+    pos = end;
+  }
+
+  // Read the elements that the 'SeekHead' told us about (if we haven't already):
+  u_int64_t p;
+  if (infoOffset != 0) {
+    p = infoOffset;
+    if (readElementHeader(p, fSegmentEnd, id, size) && id == MATROSKA_ID_INFO && size != MATROSKA_UNKNOWN_SIZE) {
+      parseInfo(p, p + size);
+    }
+  }
+  if (cuesOffset != 0 && fNumCuePoints == 0) {
+    p = cuesOffset;
+    if (readElementHeader(p, fSegmentEnd, id, size) && id == MATROSKA_ID_CUES && size != MATROSKA_UNKNOWN_SIZE) {
+      parseCues(p, p + size);
+    }
+  }
+
+  if (fNumCuePoints > 0) {
+    fFileHadCues = True;
+  } else if (!useSidecarFile || !readSidecarFile(fileName)) {
+    scanClusters();
+    if (useSidecarFile && fNumCuePoints > 0) writeSidecarFile(fileName);
+  }
+  sortCuePoints();
+
+  return True;
+}
+
+inline void MatroskaCueIndex::parseSeekHead(u_int64_t pos, u_int64_t end, u_int64_t& infoOffset, u_int64_t& cuesOffset) {
+  u_int32_t id;
+  u_int64_t size;
+  while (readElementHeader(pos, end, id, size) && size != MATROSKA_UNKNOWN_SIZE) {
+    u_int64_t seekEnd = pos + size;
+    if (id == MATROSKA_ID_SEEK) {
+      u_int32_t seekId = 0;
+      u_int64_t seekPosition = 0;
+      Boolean haveSeekPosition = False;
+      u_int32_t childId;
+      u_int64_t childSize;
+      while (readElementHeader(pos, seekEnd, childId, childSize) && childSize != MATROSKA_UNKNOWN_SIZE) {
+	if (childId == MATROSKA_ID_SEEK_ID) {
+	  seekId = (u_int32_t)readUnsigned(pos, childSize);
+	} else if (childId == MATROSKA_ID_SEEK_POSITION) {
+	  seekPosition = readUnsigned(pos, childSize);
+	  haveSeekPosition = True;
+	}
+	pos += childSize;
+      }
+      if (haveSeekPosition) {
+	u_int64_t offset = fSegmentDataOffset + seekPosition; // positions are relative to the Segment's data
+	if (seekId == MATROSKA_ID_INFO) infoOffset = offset;
+	else if (seekId == MATROSKA_ID_CUES) cuesOffset = offset;
+	else if (seekId == MATROSKA_ID_TRACKS && fTracksOffset == 0) fTracksOffset = offset;
+      }
+    }
+    pos = seekEnd;
+  }
+}
+
+inline void MatroskaCueIndex::parseInfo(u_int64_t pos, u_int64_t end) {
+  u_int32_t id;
+  u_int64_t size;
+  double duration = 0.0;
+  while (readElementHeader(pos, end, id, size) && size != MATROSKA_UNKNOWN_SIZE) {
+    if (id == MATROSKA_ID_TIMECODE_SCALE) {
+      unsigned timecodeScale = (unsigned)readUnsigned(pos, size);
+      if (timecodeScale > 0) fTimecodeScale = timecodeScale;
+    } else if (id == MATROSKA_ID_DURATION) {
+      duration = readFloat(pos, size); // in units of the TimecodeScale (which might come later)
+    }
+    pos += size;
+  }
+  fDuration = duration*(fTimecodeScale/1000000000.0);
+}
+
+inline void MatroskaCueIndex::parseCues(u_int64_t pos, u_int64_t end) {
+  u_int32_t id;
+  u_int64_t size;
+  while (readElementHeader(pos, end, id, size) && size != MATROSKA_UNKNOWN_SIZE) {
+    u_int64_t cuePointEnd = pos + size;
+    if (id == MATROSKA_ID_CUE_POINT) {
+      u_int64_t cueTime = 0;
+      u_int32_t childId;
+      u_int64_t childSize;
+      while (readElementHeader(pos, cuePointEnd, childId, childSize) && childSize != MATROSKA_UNKNOWN_SIZE) {
+	if (childId == MATROSKA_ID_CUE_TIME) {
+	  cueTime = readUnsigned(pos, childSize);
+	} else if (childId == MATROSKA_ID_CUE_TRACK_POSITIONS) {
+	  u_int64_t q = pos, positionsEnd = pos + childSize;
+	  u_int32_t positionId;
+	  u_int64_t positionSize;
+	  while (readElementHeader(q, positionsEnd, positionId, positionSize) && positionSize != MATROSKA_UNKNOWN_SIZE) {
+	    if (positionId == MATROSKA_ID_CUE_CLUSTER_POSITION) {
+	      addCuePoint(cueTime, fSegmentDataOffset + readUnsigned(q, positionSize));
+	    }
+	    q += positionSize;
+	  }
+	}
+	pos += childSize;
+      }
+    }
+    pos = cuePointEnd;
+  }
+}
+
+inline void MatroskaCueIndex::scanClusters() {
+  // Read just the 'Timecode' of each Cluster, skipping over the rest:
+  u_int64_t pos = fFirstClusterOffset;
+  u_int32_t id;
+  u_int64_t size;
+  while (pos != 0 && pos < fSegmentEnd) {
+    u_int64_t elementStart = pos;
+    if (!readElementHeader(pos, fSegmentEnd, id, size)) break;
+
+    if (id == MATROSKA_ID_CLUSTER) {
+      u_int64_t clusterEnd = size == MATROSKA_UNKNOWN_SIZE ? fSegmentEnd : pos + size;
+      u_int64_t q = pos;
+      u_int32_t childId;
+      u_int64_t childSize;
+      while (readElementHeader(q, clusterEnd, childId, childSize)) {
+	if (childId == MATROSKA_ID_TIMECODE) {
+	  addCuePoint(readUnsigned(q, childSize), elementStart);
+	  q += childSize;
+	  break;
+	}
+	if (childSize == MATROSKA_UNKNOWN_SIZE) break;
+	q += childSize;
+      }
+      if (size == MATROSKA_UNKNOWN_SIZE) {
+	// We don't know where this Cluster ends, so look at each of its children until we see the next Cluster:
+	pos = q;
+	while (readElementHeader(q, fSegmentEnd, childId, childSize)
+	       && childId != MATROSKA_ID_CLUSTER && childId != MATROSKA_ID_CUES && childSize != MATROSKA_UNKNOWN_SIZE) {
+	  q += childSize;
+	  pos = q;
+	}
+	continue;
+      }
+    } else if (size == MATROSKA_UNKNOWN_SIZE) {
+      break;
+    }
+    pos += size;
+  }
+}
+
+inline void MatroskaCueIndex::addCuePoint(u_int64_t timecode, u_int64_t clusterOffset) {
+  if (fNumCuePoints > 0 && fCueClusterOffsets[fNumCuePoints-1] == clusterOffset) return; // another track's cue
+
+  if (fNumCuePoints == fCueArraySize) {
+    unsigned newSize = fCueArraySize == 0 ? 256 : 2*fCueArraySize;
+    u_int64_t* newTimecodes = new u_int64_t[newSize];
+    u_int64_t* newOffsets = new u_int64_t[newSize];
+    for (unsigned i = 0; i < fNumCuePoints; ++i) {
+      newTimecodes[i] = fCueTimecodes[i];
+      newOffsets[i] = fCueClusterOffsets[i];
+    }
+    delete[] fCueTimecodes; fCueTimecodes = newTimecodes;
+    delete[] fCueClusterOffsets; fCueClusterOffsets = newOffsets;
+    fCueArraySize = newSize;
+  }
+  fCueTimecodes[fNumCuePoints] = timecode;
+  fCueClusterOffsets[fNumCuePoints] = clusterOffset;
+  ++fNumCuePoints;
+}
+
+inline void MatroskaCueIndex::sortCuePoints() {
+  // Cue points are almost always already in order, so an insertion sort is fine:
+  for (unsigned i = 1; i < fNumCuePoints; ++i) {
+    u_int64_t timecode = fCueTimecodes[i], offset = fCueClusterOffsets[i];
+    unsigned j = i;
+    while (j > 0 && (fCueTimecodes[j-1] > timecode
+		     || (fCueTimecodes[j-1] == timecode && fCueClusterOffsets[j-1] > offset))) {
+      fCueTimecodes[j] = fCueTimecodes[j-1];
+      fCueClusterOffsets[j] = fCueClusterOffsets[j-1];
+      --j;
+    }
+    fCueTimecodes[j] = timecode;
+    fCueClusterOffsets[j] = offset;
+  }
+}
+
+inline unsigned MatroskaCueIndex::indexOf(double time) const {
+  if (fNumCuePoints == 0 || time <= 0.0) return 0;
+
+  u_int64_t timecode = (u_int64_t)(time*(1000000000.0/fTimecodeScale));
+  unsigned lo = 0, hi = fNumCuePoints; // the answer is in [lo,hi)
+  while (hi - lo > 1) {
+    unsigned mid = lo + (hi - lo)/2;
+    if (fCueTimecodes[mid] <= timecode) lo = mid; else hi = mid;
+  }
+  return lo;
+}
+
+inline Boolean MatroskaCueIndex::lookup(double& time, u_int64_t& clusterOffset) const {
+  if (fNumCuePoints == 0) return False;
+
+  unsigned i = indexOf(time);
+  time = cueTime(i);
+  clusterOffset = fCueClusterOffsets[i];
+  return True;
+}
+
+inline char* MatroskaCueIndex::sidecarFileName(char const* fileName) {
+  char* result = new char[strlen(fileName) + 5 + 1];
+  sprintf(result, "%s.cues", fileName);
+  return result;
+}
+
+// The sidecar file is: "MATROSKA_SIDECAR_MAGIC", the Matroska file's size and modification time, the TimecodeScale,
+// the number of cue points, then each cue point's timecode and cluster offset.  (All numbers are 8 bytes, big-endian.)
+
+inline void matroskaSidecarPut64(unsigned char* to, u_int64_t value) {
+  for (unsigned i = 0; i < 8; ++i) to[i] = (unsigned char)(value>>(56-8*i));
+}
+
+inline u_int64_t matroskaSidecarGet64(unsigned char const* from) {
+  u_int64_t result = 0;
+  for (unsigned i = 0; i < 8; ++i) result = (result<<8)|from[i];
+  return result;
+}
+
+inline Boolean MatroskaCueIndex::readSidecarFile(char const* fileName) {
+  struct stat sb;
+  if (stat(fileName, &sb) != 0) return False;
+
+  char* sidecarName = sidecarFileName(fileName);
+  FILE* fid = fopen(sidecarName, "rb");
+  delete[] sidecarName;
+  if (fid == NULL) return False;
+
+  Boolean result = False;
+  unsigned char header[8 + 4*8];
+  if (fread(header, 1, sizeof header, fid) == sizeof header
+      && memcmp(header, MATROSKA_SIDECAR_MAGIC, 8) == 0
+      && matroskaSidecarGet64(&header[8]) == (u_int64_t)sb.st_size
+      && matroskaSidecarGet64(&header[16]) == (u_int64_t)sb.st_mtime
+      && matroskaSidecarGet64(&header[24]) == fTimecodeScale) {
+    u_int64_t numCuePoints = matroskaSidecarGet64(&header[32]);
+    unsigned char entry[16];
+    u_int64_t i;
+    for (i = 0; i < numCuePoints && fread(entry, 1, sizeof entry, fid) == sizeof entry; ++i) {
+      addCuePoint(matroskaSidecarGet64(&entry[0]), matroskaSidecarGet64(&entry[8]));
+    }
+    result = i == numCuePoints && numCuePoints > 0;
+    if (!result) fNumCuePoints = 0;
+  }
+  fclose(fid);
+  return result;
+}
+
+inline void MatroskaCueIndex::writeSidecarFile(char const* fileName) const {
+  struct stat sb;
+  if (stat(fileName, &sb) != 0) return;
+
+  // Write to a temporary file, then rename it, so that readers never see a partial index:
+  char* sidecarName = sidecarFileName(fileName);
+  char* tmpName = new char[strlen(sidecarName) + 4 + 1];
+  sprintf(tmpName, "%s.tmp", sidecarName);
+
+  FILE* fid = fopen(tmpName, "wb");
+  if (fid != NULL) {
+    unsigned char header[8 + 4*8];
+    memcpy(header, MATROSKA_SIDECAR_MAGIC, 8);
+    matroskaSidecarPut64(&header[8], (u_int64_t)sb.st_size);
+    matroskaSidecarPut64(&header[16], (u_int64_t)sb.st_mtime);
+    matroskaSidecarPut64(&header[24], fTimecodeScale);
+    matroskaSidecarPut64(&header[32], fNumCuePoints);
+    Boolean ok = fwrite(header, 1, sizeof header, fid) == sizeof header;
+    for (unsigned i = 0; ok && i < fNumCuePoints; ++i) {
+      unsigned char entry[16];
+      matroskaSidecarPut64(&entry[0], fCueTimecodes[i]);
+      matroskaSidecarPut64(&entry[8], fCueClusterOffsets[i]);
+      ok = fwrite(entry, 1, sizeof entry, fid) == sizeof entry;
+    }
+    if (fclose(fid) != 0) ok = False;
+
+    if (!ok || rename(tmpName, sidecarName) != 0) unlink(tmpName);
+  }
+  delete[] tmpName;
+  delete[] sidecarName;
+}
+
+#endif
+
+#endif
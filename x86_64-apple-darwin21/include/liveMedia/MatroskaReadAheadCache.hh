@@ -0,0 +1,324 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A 'read-ahead cache' for a Matroska file, shared by all of the file's readers (e.g., demultiplexors for different
+// clients).  Each reader has a 'cursor' (its current play time); the 'Clusters' for the next few seconds after each
+// cursor are read in (in the background, by the kernel) before the reader gets to them.  Because the data is read into
+// the (shared) page cache, readers of the same part of the file don't cause extra disk reads.
+// There's one cache per file for each "UsageEnvironment" (so each event loop thread uses only its own caches).
+// Also, a filter that moves a cursor along as frames pass through it.
+// C++ header
+
+#ifndef _MATROSKA_READ_AHEAD_CACHE_HH
+#define _MATROSKA_READ_AHEAD_CACHE_HH
+
+#ifndef _MATROSKA_CUE_INDEX_HH
+#include "MatroskaCueIndex.hh"
+#endif
+#ifndef _FRAMED_FILTER_HH
+#include "FramedFilter.hh"
+#endif
+#ifndef _HASH_TABLE_HH
+#include "HashTable.hh"
+#endif
+
+#if !defined(__WIN32__) && !defined(_WIN32)
+#include <pthread.h>
+
+#define MATROSKA_DEFAULT_READ_AHEAD_SECONDS 10
+
+class MatroskaReadAheadCache: public Medium {
+public:
+  static MatroskaReadAheadCache* lookupOrCreate(UsageEnvironment& env, char const* fileName,
+						unsigned readAheadSeconds = MATROSKA_DEFAULT_READ_AHEAD_SECONDS);
+      // Returns the cache for "fileName" (in "env") - creating it, if necessary - or NULL (and sets "env"s result message) if the
+      // file can't be opened, or isn't a Matroska file.  Each successful call must be balanced by a call to "release()".
+  void release();
+
+  MatroskaCueIndex const& cueIndex() const { return *fCueIndex; }
+
+  class Cursor; // opaque
+  Cursor* newCursor(double npt = 0.0);
+  void deleteCursor(Cursor* cursor);
+  void seekCursor(Cursor* cursor, double npt); // e.g., after a seek
+  void advanceCursor(Cursor* cursor, double npt); // as play proceeds
+  unsigned numCursors() const { return fNumCursors; }
+
+  u_int64_t numBytesPrefetched() const { return fNumBytesPrefetched; }
+
+protected:
+  MatroskaReadAheadCache(UsageEnvironment& env, char const* key, MappedFile* mappedFile,
+			 MatroskaCueIndex* cueIndex, unsigned readAheadSeconds);
+      // called only by lookupOrCreate()
+  virtual ~MatroskaReadAheadCache();
+
+private:
+  static HashTable*& ourCaches(); // maps "cacheKey()"s to "MatroskaReadAheadCache"s; used only with "ourCachesLock()"
+  static pthread_mutex_t& ourCachesLock();
+  static char* cacheKey(UsageEnvironment& env, char const* fileName); // result must be delete[]d
+  void prefetch(Cursor& cursor);
+
+private:
+  char* fKey;
+  MappedFile* fMappedFile;
+  MatroskaCueIndex* fCueIndex;
+  unsigned fReadAheadSeconds;
+  unsigned fReferenceCount;
+  unsigned fNumCursors;
+  u_int64_t fNumBytesPrefetched;
+};
+
+// A filter - placed in front of a track that's being read from a Matroska file - that moves a read-ahead cache
+// cursor along (based on the frames' presentation times):
+
+class MatroskaReadAheadFilter: public FramedFilter {
+public:
+  static MatroskaReadAheadFilter* createNew(UsageEnvironment& env, FramedSource* inputSource, char const* fileName,
+					    double startNPT = 0.0,
+					    unsigned readAheadSeconds = MATROSKA_DEFAULT_READ_AHEAD_SECONDS);
+      // If the file can't be cached, frames are still passed through (but without any read-ahead).
+
+  void noteSeek(double npt);
+      // Should be called whenever the input source is seeked (e.g., from a "ServerMediaSubsession"s
+      // "seekStreamSource()").
+
+protected:
+  MatroskaReadAheadFilter(UsageEnvironment& env, FramedSource* inputSource, MatroskaReadAheadCache* cache,
+			  double startNPT);
+      // called only by createNew()
+  virtual ~MatroskaReadAheadFilter();
+
+private:
+  // Redefined virtual functions:
+  virtual void doGetNextFrame();
+
+private:
+  static void afterGettingFrame(void* clientData, unsigned frameSize, unsigned numTruncatedBytes,
+				struct timeval presentationTime, unsigned durationInMicroseconds);
+  void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes,
+			 struct timeval presentationTime, unsigned durationInMicroseconds);
+
+private:
+  MatroskaReadAheadCache* fCache;
+  MatroskaReadAheadCache::Cursor* fCursor;
+  double fBaseNPT, fLastNotedNPT;
+  Boolean fHaveBasePresentationTime;
+  struct timeval fBasePresentationTime;
+};
+
+
+////////// Implementation //////////
+
+class MatroskaReadAheadCache::Cursor {
+public:
+  Cursor() : fNPT(0.0), fPrefetchedTo(0) {}
+
+  double fNPT;
+  u_int64_t fPrefetchedTo; // the file offset up to which we've already prefetched (for this cursor)
+};
+
+inline HashTable*& MatroskaReadAheadCache::ourCaches() {
+  static HashTable* caches = NULL;
+  return caches;
+}
+
+inline pthread_mutex_t& MatroskaReadAheadCache::ourCachesLock() {
+  static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  return lock;
+}
+
+inline char* MatroskaReadAheadCache::cacheKey(UsageEnvironment& env, char const* fileName) {
+  unsigned keySize = 2*sizeof (void*) + 3 + strlen(fileName) + 1;
+  char* key = new char[keySize];
+  snprintf(key, keySize, "%p:%s", (void*)&env, fileName);
+  return key;
+}
+
+inline MatroskaReadAheadCache* MatroskaReadAheadCache::lookupOrCreate(UsageEnvironment& env, char const* fileName,
+								       unsigned readAheadSeconds) {
+  if (fileName == NULL) return NULL;
+  char* key = cacheKey(env, fileName);
+
+  // Only "env"s thread creates or deletes caches for "env", so we need the lock only while using the table itself:
+  pthread_mutex_lock(&ourCachesLock());
+  HashTable*& caches = ourCaches();
+  MatroskaReadAheadCache* cache = caches == NULL ? NULL : (MatroskaReadAheadCache*)caches->Lookup(key);
+  pthread_mutex_unlock(&ourCachesLock());
+
+  if (cache == NULL) {
+    MappedFile* mappedFile = MappedFile::createNew(env, fileName, MappedFile::SEQUENTIAL_ACCESS);
+    MatroskaCueIndex* cueIndex
+      = mappedFile == NULL ? NULL : MatroskaCueIndex::createNew(env, mappedFile, fileName);
+    if (cueIndex == NULL) {
+      delete mappedFile;
+      delete[] key;
+      return NULL;
+    }
+
+    cache = new MatroskaReadAheadCache(env, key, mappedFile, cueIndex, readAheadSeconds);
+    pthread_mutex_lock(&ourCachesLock());
+    if (caches == NULL) caches = HashTable::create(STRING_HASH_KEYS);
+    caches->Add(cache->fKey, cache);
+    pthread_mutex_unlock(&ourCachesLock());
+  }
+  delete[] key;
+
+  ++cache->fReferenceCount;
+  return cache;
+}
+
+inline void MatroskaReadAheadCache::release() {
+  if (fReferenceCount > 0 && --fReferenceCount == 0) Medium::close(this);
+}
+
+inline MatroskaReadAheadCache::MatroskaReadAheadCache(UsageEnvironment& env, char const* key, MappedFile* mappedFile,
+						       MatroskaCueIndex* cueIndex, unsigned readAheadSeconds)
+  : Medium(env), fKey(strDup(key)), fMappedFile(mappedFile), fCueIndex(cueIndex),
+    fReadAheadSeconds(readAheadSeconds), fReferenceCount(0), fNumCursors(0), fNumBytesPrefetched(0) {
+}
+
+inline MatroskaReadAheadCache::~MatroskaReadAheadCache() {
+  pthread_mutex_lock(&ourCachesLock());
+  HashTable*& caches = ourCaches();
+  if (caches != NULL) {
+    caches->Remove(fKey);
+    if (caches->IsEmpty()) {
+      delete caches;
+      caches = NULL;
+    }
+  }
+  pthread_mutex_unlock(&ourCachesLock());
+
+  delete fCueIndex;
+  delete fMappedFile;
+  delete[] fKey;
+}
+
+inline MatroskaReadAheadCache::Cursor* MatroskaReadAheadCache::newCursor(double npt) {
+  Cursor* cursor = new Cursor;
+  ++fNumCursors;
+  seekCursor(cursor, npt);
+  return cursor;
+}
+
+inline void MatroskaReadAheadCache::deleteCursor(Cursor* cursor) {
+  if (cursor == NULL) return;
+  --fNumCursors;
+  delete cursor;
+}
+
+inline void MatroskaReadAheadCache::seekCursor(Cursor* cursor, double npt) {
+  cursor->fNPT = npt;
+  cursor->fPrefetchedTo = 0;
+  prefetch(*cursor);
+}
+
+inline void MatroskaReadAheadCache::advanceCursor(Cursor* cursor, double npt) {
+  if (npt < cursor->fNPT) {
+    seekCursor(cursor, npt);
+  } else {
+    cursor->fNPT = npt;
+    prefetch(*cursor);
+  }
+}
+
+inline void MatroskaReadAheadCache::prefetch(Cursor& cursor) {
+  MatroskaCueIndex const& index = *fCueIndex;
+  unsigned numCuePoints = index.numCuePoints();
+  if (numCuePoints == 0) return;
+
+  // Prefetch from the start of the Cluster that contains "npt", to the end of the Cluster that contains
+  // "npt" + "fReadAheadSeconds":
+  u_int64_t start = index.cueClusterOffset(index.indexOf(cursor.fNPT));
+  unsigned last = index.indexOf(cursor.fNPT + fReadAheadSeconds);
+  u_int64_t end = last + 1 < numCuePoints ? index.cueClusterOffset(last + 1) : fMappedFile->size();
+
+  if (start < cursor.fPrefetchedTo) start = cursor.fPrefetchedTo; // we've already asked for this data
+  if (start >= end) return;
+
+  fMappedFile->willNeed(start, end - start);
+  fNumBytesPrefetched += end - start;
+  cursor.fPrefetchedTo = end;
+}
+
+// MatroskaReadAheadFilter //
+
+#define MATROSKA_READ_AHEAD_UPDATE_INTERVAL 0.5 // seconds of play time between cursor updates
+
+inline MatroskaReadAheadFilter* MatroskaReadAheadFilter::createNew(UsageEnvironment& env, FramedSource* inputSource,
+								   char const* fileName, double startNPT,
+								   unsigned readAheadSeconds) {
+  MatroskaReadAheadCache* cache = MatroskaReadAheadCache::lookupOrCreate(env, fileName, readAheadSeconds);
+  return new MatroskaReadAheadFilter(env, inputSource, cache, startNPT);
+}
+
+inline MatroskaReadAheadFilter::MatroskaReadAheadFilter(UsageEnvironment& env, FramedSource* inputSource,
+							 MatroskaReadAheadCache* cache, double startNPT)
+  : FramedFilter(env, inputSource), fCache(cache), fCursor(NULL),
+    fBaseNPT(startNPT), fLastNotedNPT(startNPT), fHaveBasePresentationTime(False) {
+  if (fCache != NULL) fCursor = fCache->newCursor(startNPT);
+}
+
+inline MatroskaReadAheadFilter::~MatroskaReadAheadFilter() {
+  if (fCache != NULL) {
+    fCache->deleteCursor(fCursor);
+    fCache->release();
+  }
+}
+
+inline void MatroskaReadAheadFilter::noteSeek(double npt) {
+  fBaseNPT = fLastNotedNPT = npt;
+  fHaveBasePresentationTime = False;
+  if (fCache != NULL) fCache->seekCursor(fCursor, npt);
+}
+
+inline void MatroskaReadAheadFilter::doGetNextFrame() {
+  // Have the input source deliver directly into our reader's buffer:
+  fInputSource->getNextFrame(fTo, fMaxSize, afterGettingFrame, this, FramedSource::handleClosure, this);
+}
+
+inline void MatroskaReadAheadFilter::afterGettingFrame(void* clientData, unsigned frameSize, unsigned numTruncatedBytes,
+							struct timeval presentationTime, unsigned durationInMicroseconds) {
+  ((MatroskaReadAheadFilter*)clientData)->afterGettingFrame(frameSize, numTruncatedBytes,
+							    presentationTime, durationInMicroseconds);
+}
+
+inline void MatroskaReadAheadFilter::afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes,
+						       struct timeval presentationTime, unsigned durationInMicroseconds) {
+  if (fCache != NULL) {
+    if (!fHaveBasePresentationTime) {
+      fBasePresentationTime = presentationTime;
+      fHaveBasePresentationTime = True;
+    }
+    double npt = fBaseNPT + (presentationTime.tv_sec - fBasePresentationTime.tv_sec)
+      + (presentationTime.tv_usec - fBasePresentationTime.tv_usec)/1000000.0;
+    if (npt >= fLastNotedNPT + MATROSKA_READ_AHEAD_UPDATE_INTERVAL) {
+      fCache->advanceCursor(fCursor, npt);
+      fLastNotedNPT = npt;
+    }
+  }
+
+  fFrameSize = frameSize;
+  fNumTruncatedBytes = numTruncatedBytes;
+  fPresentationTime = presentationTime;
+  fDurationInMicroseconds = durationInMicroseconds;
+  afterGetting(this);
+}
+
+#endif
+
+#endif
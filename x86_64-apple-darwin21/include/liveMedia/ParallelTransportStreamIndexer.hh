@@ -0,0 +1,468 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// Generates the 'index file' for a (large) MPEG-2 Transport Stream file using several threads at once.
+// The (memory-mapped) Transport Stream file is split into chunks; each thread runs a "MPEG2IFrameIndexFromTransportStream"
+// - in its own "UsageEnvironment" - over one chunk (preceded by a copy of the stream's PAT and PMT).  The chunks' index
+// records are then rebased (to whole-file Transport packet numbers and PCRs) and joined at clean points (which both
+// neighbouring chunks see), giving the same index records (apart from PCR rounding) as a single indexer would have.
+// C++ header
+
+#ifndef _PARALLEL_TRANSPORT_STREAM_INDEXER_HH
+#define _PARALLEL_TRANSPORT_STREAM_INDEXER_HH
+
+#ifndef _MPEG2_IFRAME_INDEX_FROM_TRANSPORT_STREAM_HH
+#include "MPEG2IndexFromTransportStream.hh"
+#endif
+#ifndef _MEDIA_SINK_HH
+#include "MediaSink.hh"
+#endif
+#ifndef _OUTPUT_FILE_HH
+#include "OutputFile.hh"
+#endif
+#ifndef _MAPPED_TRANSPORT_STREAM_INDEX_HH
+#include "MappedTransportStreamIndex.hh"
+#endif
+#include "BasicUsageEnvironment.hh"
+
+#if !defined(__WIN32__) && !defined(_WIN32)
+#include <pthread.h>
+
+// Chunks smaller than this aren't worth a thread of their own:
+#define PARALLEL_INDEXER_MIN_CHUNK_PACKETS ((64*1024*1024)/TRANSPORT_PACKET_SIZE)
+
+class ParallelTransportStreamIndexer {
+public:
+  static Boolean generateIndex(UsageEnvironment& env, char const* tsFileName, char const* indexFileName,
+			       unsigned numThreads = 0);
+      // Blocks until the index file has been written.  "numThreads" == 0 means 'one per CPU'.
+      // Returns False (and sets "env"s result message) on failure.
+      // If the chunks can't be joined consistently (e.g., because the stream's PCR wraps around, or is discontinuous),
+      // the index is generated by a single thread instead.
+
+private:
+  struct Chunk {
+    MappedFile* tsFile;
+    unsigned char const* prefix; // Transport packets delivered before the chunk's own (NULL for the first chunk)
+    unsigned numPrefixPackets;
+    unsigned long startPacket, endPacket; // the chunk's own packets; we read past "endPacket", to the next clean point
+    Boolean isLastChunk;
+    float pcrOffset; // added to the chunk's (chunk-relative) PCRs
+
+    // Results:
+    unsigned char* records; // rebased
+    unsigned long numRecords, maxNumRecords;
+    pthread_t thread;
+  };
+
+  static Boolean indexInParallel(UsageEnvironment& env, MappedFile* tsFile, FILE* fid, unsigned numChunks);
+  static Boolean indexInOneChunk(MappedFile* tsFile, FILE* fid);
+  static void* chunkThreadMain(void* chunkPtr);
+  static void indexChunk(Chunk& chunk);
+  static Boolean findFirstPCR(MappedFile* tsFile, unsigned long startPacket, float& pcr);
+  static Boolean findPATAndPMT(MappedFile* tsFile, unsigned char* prefix);
+  static Boolean firstCleanPoint(Chunk const& chunk, unsigned long& recordNum);
+  static Boolean findCleanPointAtPacket(Chunk const& chunk, unsigned long tsPacketNum, unsigned long& recordNum);
+};
+
+
+// The source and sink used by each thread (within the implementation of "ParallelTransportStreamIndexer"):
+
+class TransportStreamChunkSource: public FramedSource {
+public:
+  TransportStreamChunkSource(UsageEnvironment& env, MappedFile* tsFile,
+			     unsigned char const* prefix, unsigned numPrefixPackets, unsigned long startPacket);
+
+private:
+  // redefined virtual functions:
+  virtual void doGetNextFrame();
+  virtual void doStopGettingFrames();
+
+private:
+  MappedFile* fTSFile;
+  unsigned char const* fPrefix;
+  unsigned fNumPrefixPackets;
+  unsigned long fNumPacketsDelivered;
+  unsigned long fNextPacket, fNumPackets;
+};
+
+class TransportStreamIndexCollector: public MediaSink {
+public:
+  TransportStreamIndexCollector(UsageEnvironment& env, unsigned char*& records,
+				unsigned long& numRecords, unsigned long& maxNumRecords,
+				long tsPacketNumOffset, float pcrOffset, unsigned long stopPacket, char& stopFlag);
+      // "stopPacket" == 0 means 'don't stop until the input ends'
+
+private:
+  // redefined virtual functions:
+  virtual Boolean continuePlaying();
+
+private:
+  static void afterGettingFrame(void* clientData, unsigned frameSize,
+				unsigned numTruncatedBytes,
+				struct timeval presentationTime,
+				unsigned durationInMicroseconds);
+  void afterGettingFrame1(unsigned frameSize);
+  static void onSourceClosure(void* clientData);
+
+private:
+  unsigned char fBuffer[INDEX_RECORD_SIZE];
+  unsigned char*& fRecords;
+  unsigned long& fNumRecords;
+  unsigned long& fMaxNumRecords;
+  long fTSPacketNumOffset;
+  float fPCROffset;
+  unsigned long fStopPacket;
+  unsigned fNumCleanPointsPastStop;
+  char& fStopFlag;
+};
+
+
+////////// Implementation //////////
+
+inline Boolean ParallelTransportStreamIndexer::generateIndex(UsageEnvironment& env, char const* tsFileName,
+							     char const* indexFileName, unsigned numThreads) {
+  MappedFile* tsFile = MappedFile::createNew(env, tsFileName, MappedFile::SEQUENTIAL_ACCESS);
+  if (tsFile == NULL) return False;
+
+  FILE* fid = OpenOutputFile(env, indexFileName);
+  if (fid == NULL) {
+    delete tsFile;
+    return False;
+  }
+
+  if (numThreads == 0) {
+    long numCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+    numThreads = numCPUs > 0 ? (unsigned)numCPUs : 1;
+  }
+  unsigned long numPackets = (unsigned long)(tsFile->size()/TRANSPORT_PACKET_SIZE);
+  unsigned long maxNumChunks = numPackets/PARALLEL_INDEXER_MIN_CHUNK_PACKETS;
+  unsigned numChunks = maxNumChunks < numThreads ? (unsigned)maxNumChunks : numThreads;
+
+  Boolean success = (numChunks > 1 && indexInParallel(env, tsFile, fid, numChunks)) || indexInOneChunk(tsFile, fid);
+  if (!success) env.setResultMsg("failed to write index file \"", indexFileName, "\"");
+
+  CloseOutputFile(fid);
+  delete tsFile;
+  return success;
+}
+
+inline Boolean ParallelTransportStreamIndexer::indexInOneChunk(MappedFile* tsFile, FILE* fid) {
+  Chunk chunk;
+  chunk.tsFile = tsFile;
+  chunk.prefix = NULL; chunk.numPrefixPackets = 0;
+  chunk.startPacket = 0; chunk.endPacket = (unsigned long)(tsFile->size()/TRANSPORT_PACKET_SIZE);
+  chunk.isLastChunk = True;
+  chunk.pcrOffset = 0.0f;
+  chunk.records = NULL; chunk.numRecords = chunk.maxNumRecords = 0;
+
+  indexChunk(chunk); // in this thread
+
+  Boolean success = fwrite(chunk.records, INDEX_RECORD_SIZE, chunk.numRecords, fid) == chunk.numRecords;
+  delete[] chunk.records;
+  return success;
+}
+
+inline Boolean ParallelTransportStreamIndexer::indexInParallel(UsageEnvironment& env, MappedFile* tsFile, FILE* fid,
+							       unsigned numChunks) {
+  // Each chunk (other than the first) needs the stream's PAT and PMT, so that its indexer can find the video PID:
+  unsigned char prefix[2*TRANSPORT_PACKET_SIZE];
+  if (!findPATAndPMT(tsFile, prefix)) return False;
+
+  unsigned long numPackets = (unsigned long)(tsFile->size()/TRANSPORT_PACKET_SIZE);
+  Chunk* chunks = new Chunk[numChunks];
+  float firstPCR = 0.0f;
+  Boolean success = True;
+  for (unsigned i = 0; i < numChunks; ++i) {
+    Chunk& chunk = chunks[i];
+    chunk.tsFile = tsFile;
+    chunk.prefix = i == 0 ? NULL : prefix;
+    chunk.numPrefixPackets = i == 0 ? 0 : 2;
+    chunk.startPacket = (unsigned long)((u_int64_t)numPackets*i/numChunks);
+    chunk.endPacket = (unsigned long)((u_int64_t)numPackets*(i+1)/numChunks);
+    chunk.isLastChunk = i == numChunks - 1;
+    chunk.records = NULL; chunk.numRecords = chunk.maxNumRecords = 0;
+
+    // Each chunk's indexer measures PCRs from the first PCR that it sees, so we rebase them by the difference between
+    // this and the first PCR in the whole stream.  This works only if PCRs increase from chunk to chunk:
+    float chunkFirstPCR;
+    if (!findFirstPCR(tsFile, chunk.startPacket, chunkFirstPCR)) { success = False; break; }
+    if (i == 0) firstPCR = chunkFirstPCR;
+    chunk.pcrOffset = chunkFirstPCR - firstPCR;
+    if (i > 0 && chunk.pcrOffset < chunks[i-1].pcrOffset) { success = False; break; }
+  }
+
+  unsigned numThreadsStarted = 0;
+  if (success) {
+    for (; numThreadsStarted < numChunks; ++numThreadsStarted) {
+      if (pthread_create(&chunks[numThreadsStarted].thread, NULL, chunkThreadMain, &chunks[numThreadsStarted]) != 0) {
+	env.setResultErrMsg("pthread_create() failed: ");
+	success = False;
+	break;
+      }
+    }
+  }
+  for (unsigned i = 0; i < numThreadsStarted; ++i) pthread_join(chunks[i].thread, NULL);
+
+  // Join the chunks' records.  Each chunk (other than the first) begins at its first clean point; the previous chunk
+  // must also have seen a clean point at the same Transport packet, and ends just before it:
+  unsigned long* firstRecord = new unsigned long[numChunks];
+  unsigned long* endRecord = new unsigned long[numChunks];
+  for (unsigned i = 0; success && i < numChunks; ++i) {
+    firstRecord[i] = 0;
+    endRecord[i] = chunks[i].numRecords;
+    if (i > 0 && !firstCleanPoint(chunks[i], firstRecord[i])) success = False;
+  }
+  for (unsigned i = 0; success && i + 1 < numChunks; ++i) {
+    unsigned long joinPacket
+      = MappedTransportStreamIndex::tsPacketNum(&chunks[i+1].records[firstRecord[i+1]*INDEX_RECORD_SIZE]);
+    if (!findCleanPointAtPacket(chunks[i], joinPacket, endRecord[i])) success = False;
+  }
+  for (unsigned i = 0; success && i < numChunks; ++i) {
+    unsigned long numRecordsToWrite = endRecord[i] - firstRecord[i];
+    if (fwrite(&chunks[i].records[firstRecord[i]*INDEX_RECORD_SIZE], INDEX_RECORD_SIZE, numRecordsToWrite, fid)
+	!= numRecordsToWrite) {
+      success = False;
+    }
+  }
+  if (!success) {
+    // Discard anything that we've written, so that we can start again with a single chunk:
+    fflush(fid);
+    if (ftruncate(fileno(fid), 0) != 0) success = False;
+    rewind(fid);
+  }
+
+  delete[] firstRecord; delete[] endRecord;
+  for (unsigned i = 0; i < numChunks; ++i) delete[] chunks[i].records;
+  delete[] chunks;
+  return success;
+}
+
+inline void* ParallelTransportStreamIndexer::chunkThreadMain(void* chunkPtr) {
+  indexChunk(*(Chunk*)chunkPtr);
+  return NULL;
+}
+
+inline void ParallelTransportStreamIndexer::indexChunk(Chunk& chunk) {
+  // Each chunk is indexed within its own "UsageEnvironment":
+  TaskScheduler* scheduler = BasicTaskScheduler::createNew();
+  UsageEnvironment* env = BasicUsageEnvironment::createNew(*scheduler);
+
+  FramedSource* source
+    = new TransportStreamChunkSource(*env, chunk.tsFile, chunk.prefix, chunk.numPrefixPackets, chunk.startPacket);
+  FramedSource* indexer = MPEG2IFrameIndexFromTransportStream::createNew(*env, source);
+
+  char stopFlag = 0;
+  MediaSink* collector
+    = new TransportStreamIndexCollector(*env, chunk.records, chunk.numRecords, chunk.maxNumRecords,
+					(long)chunk.startPacket - (long)chunk.numPrefixPackets, chunk.pcrOffset,
+					chunk.isLastChunk ? 0 : chunk.endPacket, stopFlag);
+  collector->startPlaying(*indexer, NULL, NULL);
+  env->taskScheduler().doEventLoop(&stopFlag);
+
+  Medium::close(collector);
+  Medium::close(indexer); // this also closes "source"
+  env->reclaim();
+  delete scheduler;
+}
+
+inline Boolean ParallelTransportStreamIndexer::findFirstPCR(MappedFile* tsFile, unsigned long startPacket, float& pcr) {
+  unsigned long numPackets = (unsigned long)(tsFile->size()/TRANSPORT_PACKET_SIZE);
+  for (unsigned long i = startPacket; i < numPackets; ++i) {
+    unsigned char const* pkt = &tsFile->data()[(u_int64_t)i*TRANSPORT_PACKET_SIZE];
+    if (pkt[0] != 0x47) continue;
+
+    // Look for a PCR in the adaptation field (just as "MPEG2IFrameIndexFromTransportStream" does):
+    u_int8_t adaptation_field_control = (pkt[3]&0x30)>>4;
+    if (adaptation_field_control != 2 && adaptation_field_control != 3) continue;
+    u_int8_t adaptation_field_length = pkt[4];
+    if (adaptation_field_length == 0 || (pkt[5]&0x10) == 0) continue;
+
+    u_int32_t pcrBaseHigh = (pkt[6]<<24)|(pkt[7]<<16)|(pkt[8]<<8)|pkt[9];
+    float clock = pcrBaseHigh/45000.0f;
+    if ((pkt[10]&0x80) != 0) clock += 1/90000.0f; // add in low-bit (if set)
+    unsigned short pcrExt = ((pkt[10]&0x01)<<8) | pkt[11];
+    clock += pcrExt/27000000.0f;
+
+    pcr = clock;
+    return True;
+  }
+  return False;
+}
+
+inline Boolean ParallelTransportStreamIndexer::findPATAndPMT(MappedFile* tsFile, unsigned char* prefix) {
+  // Look for the PAT (and, from it, the PMT PID) near the start of the stream, then for the PMT:
+  unsigned long numPackets = (unsigned long)(tsFile->size()/TRANSPORT_PACKET_SIZE);
+  if (numPackets > 100000) numPackets = 100000;
+  int pmtPID = -1;
+  for (unsigned long i = 0; i < numPackets; ++i) {
+    unsigned char const* pkt = &tsFile->data()[(u_int64_t)i*TRANSPORT_PACKET_SIZE];
+    if (pkt[0] != 0x47 || (pkt[1]&0x40) == 0) continue; // we want packets that begin a section
+    u_int16_t PID = ((pkt[1]&0x1F)<<8) | pkt[2];
+    if ((pkt[3]&0x30) != 0x10) continue; // for simplicity, we handle only packets with no adaptation field
+
+    if (pmtPID < 0 && PID == 0x0000) {
+      // The PAT's first program (section data begins after the pointer field):
+      unsigned char const* section = &pkt[5 + pkt[4]];
+      if (section + 12 > pkt + TRANSPORT_PACKET_SIZE) continue;
+      unsigned char const* program = &section[8];
+      if (((program[0]<<8)|program[1]) == 0) program += 4; // skip the 'network PID' entry
+      if (program + 4 > pkt + TRANSPORT_PACKET_SIZE) continue;
+      pmtPID = ((program[2]&0x1F)<<8) | program[3];
+      memmove(prefix, pkt, TRANSPORT_PACKET_SIZE);
+    } else if (pmtPID >= 0 && PID == pmtPID) {
+      memmove(&prefix[TRANSPORT_PACKET_SIZE], pkt, TRANSPORT_PACKET_SIZE);
+      return True;
+    }
+  }
+  return False;
+}
+
+inline Boolean ParallelTransportStreamIndexer::firstCleanPoint(Chunk const& chunk, unsigned long& recordNum) {
+  for (unsigned long i = 0; i < chunk.numRecords; ++i) {
+    if (MappedTransportStreamIndex::isCleanPoint(&chunk.records[i*INDEX_RECORD_SIZE])) {
+      recordNum = i;
+      return True;
+    }
+  }
+  return False;
+}
+
+inline Boolean ParallelTransportStreamIndexer
+::findCleanPointAtPacket(Chunk const& chunk, unsigned long tsPacketNum, unsigned long& recordNum) {
+  for (unsigned long i = chunk.numRecords; i-- > 0; ) {
+    unsigned char const* rec = &chunk.records[i*INDEX_RECORD_SIZE];
+    unsigned long recPacketNum = MappedTransportStreamIndex::tsPacketNum(rec);
+    if (recPacketNum < tsPacketNum) break;
+    if (recPacketNum == tsPacketNum && MappedTransportStreamIndex::isCleanPoint(rec)) {
+      recordNum = i;
+      return True;
+    }
+  }
+  return False;
+}
+
+
+// TransportStreamChunkSource //
+
+inline TransportStreamChunkSource
+::TransportStreamChunkSource(UsageEnvironment& env, MappedFile* tsFile,
+			     unsigned char const* prefix, unsigned numPrefixPackets, unsigned long startPacket)
+  : FramedSource(env), fTSFile(tsFile), fPrefix(prefix), fNumPrefixPackets(numPrefixPackets),
+    fNumPacketsDelivered(0), fNextPacket(startPacket), fNumPackets((unsigned long)(tsFile->size()/TRANSPORT_PACKET_SIZE)) {
+}
+
+inline void TransportStreamChunkSource::doGetNextFrame() {
+  unsigned char const* pkt;
+  if (fNumPacketsDelivered < fNumPrefixPackets) {
+    pkt = &fPrefix[fNumPacketsDelivered*TRANSPORT_PACKET_SIZE];
+  } else if (fNextPacket < fNumPackets) {
+    pkt = &fTSFile->data()[(u_int64_t)fNextPacket*TRANSPORT_PACKET_SIZE];
+    ++fNextPacket;
+    if (fNextPacket%4096 == 0) {
+      fTSFile->willNeed((u_int64_t)fNextPacket*TRANSPORT_PACKET_SIZE, 4096*TRANSPORT_PACKET_SIZE);
+    }
+  } else {
+    handleClosure();
+    return;
+  }
+
+  fFrameSize = fMaxSize < TRANSPORT_PACKET_SIZE ? fMaxSize : TRANSPORT_PACKET_SIZE;
+  fNumTruncatedBytes = TRANSPORT_PACKET_SIZE - fFrameSize;
+  memmove(fTo, pkt, fFrameSize);
+  ++fNumPacketsDelivered;
+
+  // Deliver most packets immediately, but (to bound the recursion) return to the event loop every so often:
+  if (fNumPacketsDelivered%64 != 0) {
+    FramedSource::afterGetting(this);
+  } else {
+    nextTask() = envir().taskScheduler().scheduleDelayedTask(0, (TaskFunc*)FramedSource::afterGetting, this);
+  }
+}
+
+inline void TransportStreamChunkSource::doStopGettingFrames() {
+  envir().taskScheduler().unscheduleDelayedTask(nextTask());
+}
+
+
+// TransportStreamIndexCollector //
+
+inline TransportStreamIndexCollector
+::TransportStreamIndexCollector(UsageEnvironment& env, unsigned char*& records,
+				unsigned long& numRecords, unsigned long& maxNumRecords,
+				long tsPacketNumOffset, float pcrOffset, unsigned long stopPacket, char& stopFlag)
+  : MediaSink(env), fRecords(records), fNumRecords(numRecords), fMaxNumRecords(maxNumRecords),
+    fTSPacketNumOffset(tsPacketNumOffset), fPCROffset(pcrOffset), fStopPacket(stopPacket),
+    fNumCleanPointsPastStop(0), fStopFlag(stopFlag) {
+}
+
+inline Boolean TransportStreamIndexCollector::continuePlaying() {
+  if (fSource == NULL) return False;
+
+  fSource->getNextFrame(fBuffer, sizeof fBuffer, afterGettingFrame, this, onSourceClosure, this);
+  return True;
+}
+
+inline void TransportStreamIndexCollector
+::afterGettingFrame(void* clientData, unsigned frameSize, unsigned /*numTruncatedBytes*/,
+		    struct timeval /*presentationTime*/, unsigned /*durationInMicroseconds*/) {
+  ((TransportStreamIndexCollector*)clientData)->afterGettingFrame1(frameSize);
+}
+
+inline void TransportStreamIndexCollector::afterGettingFrame1(unsigned frameSize) {
+  if (frameSize == INDEX_RECORD_SIZE) {
+    if (fNumRecords == fMaxNumRecords) {
+      fMaxNumRecords = fMaxNumRecords == 0 ? 65536 : 2*fMaxNumRecords;
+      unsigned char* newRecords = new unsigned char[fMaxNumRecords*INDEX_RECORD_SIZE];
+      if (fRecords != NULL) memmove(newRecords, fRecords, fNumRecords*INDEX_RECORD_SIZE);
+      delete[] fRecords; fRecords = newRecords;
+    }
+
+    // Rebase the record's Transport packet number and PCR:
+    unsigned char* rec = &fRecords[fNumRecords*INDEX_RECORD_SIZE];
+    memmove(rec, fBuffer, INDEX_RECORD_SIZE);
+    unsigned long tsPacketNum = (unsigned long)((long)MappedTransportStreamIndex::tsPacketNum(rec) + fTSPacketNumOffset);
+    rec[7] = tsPacketNum; rec[8] = tsPacketNum>>8; rec[9] = tsPacketNum>>16; rec[10] = tsPacketNum>>24;
+    if (fPCROffset > 0.0f) {
+      float pcr = MappedTransportStreamIndex::pcr(rec) + fPCROffset;
+      unsigned pcr_int = (unsigned)pcr;
+      u_int8_t pcr_frac = (u_int8_t)(256*(pcr-pcr_int));
+      rec[3] = (unsigned char)(pcr_int); rec[4] = (unsigned char)(pcr_int>>8); rec[5] = (unsigned char)(pcr_int>>16);
+      rec[6] = (unsigned char)pcr_frac;
+    }
+    ++fNumRecords;
+
+    // Once we've passed the end of our chunk, we need only read as far as the next chunk's first clean point.  (We go one
+    // clean point further, in case the next chunk's indexer wasn't yet in sync at the first one.)
+    if (fStopPacket > 0 && tsPacketNum >= fStopPacket && MappedTransportStreamIndex::isCleanPoint(rec)
+	&& ++fNumCleanPointsPastStop == 2) {
+      fStopFlag = 1;
+      return;
+    }
+  }
+
+  continuePlaying();
+}
+
+inline void TransportStreamIndexCollector::onSourceClosure(void* clientData) {
+  TransportStreamIndexCollector* collector = (TransportStreamIndexCollector*)clientData;
+  collector->fStopFlag = 1;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,278 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A "BufferedPacketFactory" whose packet objects and data buffers come from a preallocated per-thread pool, shared by
+// all "MultiFramedRTPSource"s (in that thread) that use it.  Data buffers are 'size-classed', so that a packet that's
+// being held (e.g., in a reordering buffer) uses a buffer that's just big enough for the expected datagram size.
+// C++ header
+
+#ifndef _POOLED_BUFFERED_PACKET_HH
+#define _POOLED_BUFFERED_PACKET_HH
+
+#ifndef _MULTI_FRAMED_RTP_SOURCE_HH
+#include "MultiFramedRTPSource.hh"
+#endif
+
+#if !defined(__WIN32__) && !defined(_WIN32)
+#include <pthread.h>
+#include <new>
+
+#define BUFFERED_PACKET_POOL_NUM_SIZE_CLASSES 4
+#define BUFFERED_PACKET_POOL_NUM_OBJECT_SIZES 4
+
+class BufferedPacketPool {
+public:
+  static BufferedPacketPool& instance();
+      // Returns the calling thread's pool, which is shared by all sources (i.e., all "UsageEnvironment"s) in that thread,
+      // and so needs no locking.  It is deleted when the thread exits.
+
+  static unsigned sizeClassFor(unsigned maxPacketSize); // returns an index into our size classes
+  static unsigned sizeOfClass(unsigned sizeClass) { return 2048u<<(2*sizeClass); } // 2K, 8K, 32K, 128K
+
+  unsigned char* takeBuffer(unsigned sizeClass);
+  void returnBuffer(unsigned char* buffer, unsigned sizeClass);
+  void* takeObjectMemory(size_t size);
+  void returnObjectMemory(void* memory, size_t size);
+      // Object memory is kept in a separate free list for each object size (so that a subclass of a different size
+      // never gets a block that's too small).  Blocks of a size for which we have no list are simply deleted.
+
+  void preallocate(unsigned numPackets, unsigned maxPacketSize);
+      // Fills (the calling thread's) pool in advance, so that packets can later be created without allocating memory.
+  void setMaxFreeBuffersPerClass(unsigned maxFreeBuffers) { fMaxFreeBuffersPerClass = maxFreeBuffers; }
+      // Buffers (or object memory blocks) returned to a size class (or object size) that already has this many free
+      // blocks are deleted instead. (Default: 4096)
+
+  // Statistics:
+  unsigned numBuffersInUse(unsigned sizeClass) const { return fNumInUse[sizeClass]; }
+  unsigned numFreeBuffers(unsigned sizeClass) const { return fNumFree[sizeClass]; }
+
+private:
+  BufferedPacketPool();
+  ~BufferedPacketPool();
+
+  static pthread_key_t& poolKey();
+  static void createPoolKey();
+  static void deletePool(void* pool);
+
+private:
+  // Free buffers (and free object memory) are kept in singly-linked lists, linked through their first bytes:
+  struct FreeBlock { FreeBlock* next; };
+
+  FreeBlock* fFreeBuffers[BUFFERED_PACKET_POOL_NUM_SIZE_CLASSES];
+  unsigned fNumFree[BUFFERED_PACKET_POOL_NUM_SIZE_CLASSES];
+  unsigned fNumInUse[BUFFERED_PACKET_POOL_NUM_SIZE_CLASSES];
+  struct ObjectFreeList { size_t objectSize; FreeBlock* head; unsigned numFree; };
+  ObjectFreeList* objectFreeListFor(size_t size, Boolean create);
+  ObjectFreeList fFreeObjects[BUFFERED_PACKET_POOL_NUM_OBJECT_SIZES]; // unused lists have "objectSize" 0
+  unsigned fMaxFreeBuffersPerClass;
+};
+
+class PooledBufferedPacket: public BufferedPacket {
+public:
+  PooledBufferedPacket(unsigned sizeClass);
+  virtual ~PooledBufferedPacket();
+
+  static void* operator new(size_t size) { return BufferedPacketPool::instance().takeObjectMemory(size); }
+  static void operator delete(void* memory, size_t size) { BufferedPacketPool::instance().returnObjectMemory(memory, size); }
+      // ("size" is the size of the object's dynamic type, because our destructor is virtual.)
+
+private:
+  unsigned fSizeClass;
+};
+
+class PooledBufferedPacketFactory: public BufferedPacketFactory {
+public:
+  PooledBufferedPacketFactory(unsigned maxPacketSize = 1500);
+      // "maxPacketSize" is the largest RTP packet that we expect; larger packets are truncated.
+  virtual ~PooledBufferedPacketFactory();
+
+private: // redefined virtual functions
+  virtual BufferedPacket* createNewPacket(MultiFramedRTPSource* ourSource);
+
+private:
+  unsigned fSizeClass;
+};
+
+
+////////// Implementation //////////
+
+inline pthread_key_t& BufferedPacketPool::poolKey() {
+  static pthread_key_t key;
+  return key;
+}
+
+inline void BufferedPacketPool::createPoolKey() {
+  pthread_key_create(&poolKey(), deletePool);
+}
+
+inline void BufferedPacketPool::deletePool(void* pool) {
+  delete (BufferedPacketPool*)pool;
+}
+
+inline BufferedPacketPool& BufferedPacketPool::instance() {
+  static pthread_once_t poolKeyOnce = PTHREAD_ONCE_INIT;
+  pthread_once(&poolKeyOnce, createPoolKey);
+
+  BufferedPacketPool* pool = (BufferedPacketPool*)pthread_getspecific(poolKey());
+  if (pool == NULL) {
+    pool = new BufferedPacketPool;
+    pthread_setspecific(poolKey(), pool);
+  }
+  return *pool;
+}
+
+inline BufferedPacketPool::BufferedPacketPool()
+  : fMaxFreeBuffersPerClass(4096) {
+  for (unsigned i = 0; i < BUFFERED_PACKET_POOL_NUM_SIZE_CLASSES; ++i) {
+    fFreeBuffers[i] = NULL;
+    fNumFree[i] = fNumInUse[i] = 0;
+  }
+  for (unsigned i = 0; i < BUFFERED_PACKET_POOL_NUM_OBJECT_SIZES; ++i) {
+    fFreeObjects[i].objectSize = 0;
+    fFreeObjects[i].head = NULL;
+    fFreeObjects[i].numFree = 0;
+  }
+}
+
+inline BufferedPacketPool::~BufferedPacketPool() {
+  for (unsigned i = 0; i < BUFFERED_PACKET_POOL_NUM_SIZE_CLASSES; ++i) {
+    while (fFreeBuffers[i] != NULL) {
+      FreeBlock* block = fFreeBuffers[i];
+      fFreeBuffers[i] = block->next;
+      delete[] (unsigned char*)block;
+    }
+  }
+  for (unsigned i = 0; i < BUFFERED_PACKET_POOL_NUM_OBJECT_SIZES; ++i) {
+    while (fFreeObjects[i].head != NULL) {
+      FreeBlock* block = fFreeObjects[i].head;
+      fFreeObjects[i].head = block->next;
+      ::operator delete(block);
+    }
+  }
+}
+
+inline unsigned BufferedPacketPool::sizeClassFor(unsigned maxPacketSize) {
+  unsigned sizeClass = 0;
+  while (sizeClass < BUFFERED_PACKET_POOL_NUM_SIZE_CLASSES-1 && sizeOfClass(sizeClass) < maxPacketSize) ++sizeClass;
+  return sizeClass;
+}
+
+inline unsigned char* BufferedPacketPool::takeBuffer(unsigned sizeClass) {
+  ++fNumInUse[sizeClass];
+  FreeBlock* block = fFreeBuffers[sizeClass];
+  if (block == NULL) return new unsigned char[sizeOfClass(sizeClass)];
+
+  fFreeBuffers[sizeClass] = block->next;
+  --fNumFree[sizeClass];
+  return (unsigned char*)block;
+}
+
+inline void BufferedPacketPool::returnBuffer(unsigned char* buffer, unsigned sizeClass) {
+  if (buffer == NULL) return;
+
+  --fNumInUse[sizeClass];
+  if (fNumFree[sizeClass] >= fMaxFreeBuffersPerClass) {
+    delete[] buffer;
+    return;
+  }
+
+  FreeBlock* block = (FreeBlock*)buffer;
+  block->next = fFreeBuffers[sizeClass];
+  fFreeBuffers[sizeClass] = block;
+  ++fNumFree[sizeClass];
+}
+
+inline BufferedPacketPool::ObjectFreeList* BufferedPacketPool::objectFreeListFor(size_t size, Boolean create) {
+  ObjectFreeList* unusedList = NULL;
+  for (unsigned i = 0; i < BUFFERED_PACKET_POOL_NUM_OBJECT_SIZES; ++i) {
+    if (fFreeObjects[i].objectSize == size) return &fFreeObjects[i];
+    if (fFreeObjects[i].objectSize == 0 && unusedList == NULL) unusedList = &fFreeObjects[i];
+  }
+  if (!create || unusedList == NULL) return NULL;
+
+  unusedList->objectSize = size;
+  return unusedList;
+}
+
+inline void* BufferedPacketPool::takeObjectMemory(size_t size) {
+  if (size < sizeof (FreeBlock)) size = sizeof (FreeBlock);
+
+  ObjectFreeList* list = objectFreeListFor(size, True);
+  if (list == NULL || list->head == NULL) return ::operator new(size);
+
+  FreeBlock* block = list->head;
+  list->head = block->next;
+  --list->numFree;
+  return block;
+}
+
+inline void BufferedPacketPool::returnObjectMemory(void* memory, size_t size) {
+  if (memory == NULL) return;
+  if (size < sizeof (FreeBlock)) size = sizeof (FreeBlock);
+
+  ObjectFreeList* list = objectFreeListFor(size, False);
+  if (list == NULL || list->numFree >= fMaxFreeBuffersPerClass) {
+    ::operator delete(memory);
+    return;
+  }
+
+  FreeBlock* block = (FreeBlock*)memory;
+  block->next = list->head;
+  list->head = block;
+  ++list->numFree;
+}
+
+inline void BufferedPacketPool::preallocate(unsigned numPackets, unsigned maxPacketSize) {
+  unsigned sizeClass = sizeClassFor(maxPacketSize);
+  unsigned char** buffers = new unsigned char*[numPackets];
+  for (unsigned i = 0; i < numPackets; ++i) buffers[i] = takeBuffer(sizeClass);
+  for (unsigned i = 0; i < numPackets; ++i) returnBuffer(buffers[i], sizeClass);
+  delete[] buffers;
+
+  void** objects = new void*[numPackets];
+  for (unsigned i = 0; i < numPackets; ++i) objects[i] = takeObjectMemory(sizeof (PooledBufferedPacket));
+  for (unsigned i = 0; i < numPackets; ++i) returnObjectMemory(objects[i], sizeof (PooledBufferedPacket));
+  delete[] objects;
+}
+
+inline PooledBufferedPacket::PooledBufferedPacket(unsigned sizeClass)
+  : fSizeClass(sizeClass) {
+  // Replace the (maximum-size) buffer that our base class allocated with one from the pool:
+  delete[] fBuf;
+  fBuf = BufferedPacketPool::instance().takeBuffer(sizeClass);
+  fPacketSize = BufferedPacketPool::sizeOfClass(sizeClass);
+}
+
+inline PooledBufferedPacket::~PooledBufferedPacket() {
+  BufferedPacketPool::instance().returnBuffer(fBuf, fSizeClass);
+  fBuf = NULL; // so that our base class destructor doesn't delete it
+}
+
+inline PooledBufferedPacketFactory::PooledBufferedPacketFactory(unsigned maxPacketSize)
+  : fSizeClass(BufferedPacketPool::sizeClassFor(maxPacketSize)) {
+}
+
+inline PooledBufferedPacketFactory::~PooledBufferedPacketFactory() {
+}
+
+inline BufferedPacket* PooledBufferedPacketFactory::createNewPacket(MultiFramedRTPSource* /*ourSource*/) {
+  return new PooledBufferedPacket(fSizeClass);
+}
+
+#endif
+
+#endif
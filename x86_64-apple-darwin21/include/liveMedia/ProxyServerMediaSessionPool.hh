@@ -0,0 +1,504 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A manager for a large number of "ProxyServerMediaSession"s (i.e., proxied back-end streams), that:
+//   - optionally limits the number of back-end streams that are being started (i.e., 'DESCRIBE'd) at the same time on
+//     each back-end host (by default, there's no limit);
+//   - keeps 'warm' (i.e., SETUP and PLAYing on the back end, even when no front-end client is receiving it) each
+//     stream that has had a front-end client recently (or that we've been told to keep warm);
+//   - measures how long each front-end client waits for its first RTP packet, separately for clients that found the
+//     stream warm and those that didn't.
+// C++ header
+
+#ifndef _PROXY_SERVER_MEDIA_SESSION_POOL_HH
+#define _PROXY_SERVER_MEDIA_SESSION_POOL_HH
+
+#ifndef _PROXY_SERVER_MEDIA_SESSION_HH
+#include "ProxyServerMediaSession.hh"
+#endif
+#ifndef _GENERIC_MEDIA_SERVER_HH
+#include "GenericMediaServer.hh"
+#endif
+#ifndef _GROUPSOCK_HELPER_HH
+#include "GroupsockHelper.hh"
+#endif
+
+#define PROXY_POOL_DEFAULT_MAX_STARTS_PER_HOST 0 // i.e., no limit
+#define PROXY_POOL_DEFAULT_START_TIMEOUT 10 // seconds; after this, a back-end stream no longer counts as 'starting'
+#define PROXY_POOL_DEFAULT_KEEP_WARM_PERIOD 300 // seconds
+
+class ProxyServerMediaSessionPool; // forward
+
+// How long front-end clients waited (in microseconds) for their first RTP packet:
+class ProxyStartupStats {
+public:
+  ProxyStartupStats() : numSamples(0), totalMicroseconds(0), minMicroseconds(0), maxMicroseconds(0) {}
+  void addSample(unsigned microseconds);
+  unsigned averageMicroseconds() const { return numSamples == 0 ? 0 : (unsigned)(totalMicroseconds/numSamples); }
+
+  unsigned numSamples;
+  u_int64_t totalMicroseconds;
+  unsigned minMicroseconds, maxMicroseconds;
+};
+
+// The "ProxyServerMediaSession"s that the pool creates:
+
+class PooledProxyServerMediaSession: public ProxyServerMediaSession {
+public:
+  Boolean isWarm() const { return fPrewarmStreamTokens != NULL; }
+  Boolean& keepWarm() { return fKeepWarm; } // if True, we stay warm, even if we have no front-end clients
+
+protected:
+  PooledProxyServerMediaSession(UsageEnvironment& env, ProxyServerMediaSessionPool* pool,
+				GenericMediaServer* ourMediaServer, char const* inputStreamURL, char const* streamName,
+				char const* username, char const* password,
+				portNumBits tunnelOverHTTPPortNum, int verbosityLevel, char const* hostName);
+      // called only by "ProxyServerMediaSessionPool"
+  virtual ~PooledProxyServerMediaSession();
+
+protected: // redefined virtual functions
+  virtual Groupsock* createGroupsock(struct sockaddr_storage const& addr, Port port);
+
+private:
+  friend class ProxyServerMediaSessionPool;
+  friend class ProxyStartupTimingGroupsock;
+  void prewarm();
+  void cool();
+  void noteFirstPacketDelay(unsigned microseconds, Boolean streamWasWarm);
+
+private:
+  ProxyServerMediaSessionPool* fPool;
+  PooledProxyServerMediaSession* fNextInPool;
+  char* fHostName;
+  Boolean fIsStarting; // i.e., counts against our back-end host's limit
+  struct timeval fStartTime, fLastUsedTime;
+  Boolean fKeepWarm;
+  unsigned fPrewarmClientSessionId;
+  void** fPrewarmStreamTokens; // one per subsession, if we're warm
+  Boolean fCreatingGroupsocksForPrewarm;
+};
+
+// A "Groupsock" (for front-end RTP) that times how long the first packet, after the stream is created or a client is
+// added, takes to be sent.  Whether the session was warm is noted when the client is added:
+
+class ProxyStartupTimingGroupsock: public Groupsock {
+public:
+  ProxyStartupTimingGroupsock(UsageEnvironment& env, struct sockaddr_storage const& addr, Port port,
+			      PooledProxyServerMediaSession* session, Boolean isForPrewarm);
+
+protected: // redefined virtual functions
+  virtual void addDestination(struct sockaddr_storage const& addr, Port const& port, unsigned sessionId);
+  virtual Boolean output(UsageEnvironment& env, unsigned char* buffer, unsigned bufferSize);
+
+private:
+  PooledProxyServerMediaSession* fSession;
+  Boolean fStreamWasWarm; // for the wait that we're currently timing
+  struct timeval fWaitStartTime; // tv_sec == 0 means: we're not timing
+};
+
+class ProxyServerMediaSessionPool: public Medium {
+public:
+  static ProxyServerMediaSessionPool* createNew(UsageEnvironment& env, GenericMediaServer* ourMediaServer,
+						unsigned maxConcurrentStartsPerHost = PROXY_POOL_DEFAULT_MAX_STARTS_PER_HOST,
+						unsigned keepWarmPeriod = PROXY_POOL_DEFAULT_KEEP_WARM_PERIOD,
+						unsigned startTimeout = PROXY_POOL_DEFAULT_START_TIMEOUT);
+      // "maxConcurrentStartsPerHost" 0 means: no limit.
+      // "keepWarmPeriod" (in seconds) is how long a stream stays warm after its last front-end client has gone.
+      // (0 means: only streams whose "keepWarm()" is True are kept warm.)
+
+  void addProxyStream(char const* inputStreamURL, char const* streamName,
+		      char const* username = NULL, char const* password = NULL,
+		      portNumBits tunnelOverHTTPPortNum = 0, int verbosityLevel = 0,
+		      Boolean keepWarm = False);
+      // Creates a "PooledProxyServerMediaSession" - and adds it to our server - as soon as its back-end host has
+      // fewer than "maxConcurrentStartsPerHost" (if non-zero) streams starting.  (Until then, the request is queued.)
+
+  unsigned numQueuedStreams() const { return fNumQueuedStreams; }
+  unsigned numStartingStreams() const { return fNumStartingStreams; }
+  unsigned numWarmStreams() const;
+
+  ProxyStartupStats const& coldStartStats() const { return fColdStartStats; }
+      // For each stream that a front-end client started: from its creation (i.e., the first "SETUP") until its first
+      // packet; and for each front-end client that joined a stream that wasn't warm: from its joining (i.e., its "PLAY")
+      // until the next packet
+  ProxyStartupStats const& warmStartStats() const { return fWarmStartStats; }
+      // For each front-end client that joined a stream that was warm at the time: from its joining until the next packet
+
+protected:
+  ProxyServerMediaSessionPool(UsageEnvironment& env, GenericMediaServer* ourMediaServer,
+			      unsigned maxConcurrentStartsPerHost, unsigned keepWarmPeriod, unsigned startTimeout);
+      // called only by createNew()
+  virtual ~ProxyServerMediaSessionPool();
+
+private:
+  friend class PooledProxyServerMediaSession;
+  struct QueuedStream {
+    QueuedStream* fNext;
+    char* fURL; char* fStreamName; char* fUsername; char* fPassword;
+    portNumBits fTunnelOverHTTPPortNum;
+    int fVerbosityLevel;
+    Boolean fKeepWarm;
+    char* fHostName;
+  };
+  struct HostState {
+    unsigned fNumStarting;
+    QueuedStream *fQueueHead, *fQueueTail;
+  };
+
+  static char* hostNameFromURL(char const* url); // "host[:port]"; result must be delete[]d
+  HostState* hostState(char const* hostName);
+  Boolean canStart(HostState const* host) const;
+  void startStream(QueuedStream* stream);
+  static void deleteQueuedStream(QueuedStream* stream);
+  void noteStartFinished(PooledProxyServerMediaSession* session);
+  void removeSession(PooledProxyServerMediaSession* session);
+
+  void scheduleCheck();
+  static void checkSessions(void* clientData);
+  void checkSessions();
+
+private:
+  GenericMediaServer* fOurMediaServer;
+  unsigned fMaxConcurrentStartsPerHost, fKeepWarmPeriod, fStartTimeout;
+  HashTable* fHostStates; // maps host names to "HostState"s
+  PooledProxyServerMediaSession* fSessions;
+  unsigned fNumQueuedStreams, fNumStartingStreams;
+  TaskToken fCheckTask;
+  ProxyStartupStats fColdStartStats, fWarmStartStats;
+};
+
+
+////////// Implementation //////////
+
+// ProxyStartupStats //
+
+inline void ProxyStartupStats::addSample(unsigned microseconds) {
+  if (numSamples == 0 || microseconds < minMicroseconds) minMicroseconds = microseconds;
+  if (microseconds > maxMicroseconds) maxMicroseconds = microseconds;
+  totalMicroseconds += microseconds;
+  ++numSamples;
+}
+
+// PooledProxyServerMediaSession //
+
+inline PooledProxyServerMediaSession
+::PooledProxyServerMediaSession(UsageEnvironment& env, ProxyServerMediaSessionPool* pool,
+				GenericMediaServer* ourMediaServer, char const* inputStreamURL, char const* streamName,
+				char const* username, char const* password,
+				portNumBits tunnelOverHTTPPortNum, int verbosityLevel, char const* hostName)
+  : ProxyServerMediaSession(env, ourMediaServer, inputStreamURL, streamName, username, password,
+			    tunnelOverHTTPPortNum, verbosityLevel, -1, NULL),
+    fPool(pool), fNextInPool(NULL), fHostName(strDup(hostName)), fIsStarting(True),
+    fKeepWarm(False), fPrewarmClientSessionId(0), fPrewarmStreamTokens(NULL), fCreatingGroupsocksForPrewarm(False) {
+  gettimeofday(&fStartTime, NULL);
+  fLastUsedTime = fStartTime;
+}
+
+inline PooledProxyServerMediaSession::~PooledProxyServerMediaSession() {
+  cool();
+  if (fPool != NULL) fPool->removeSession(this);
+  delete[] fHostName;
+}
+
+inline Groupsock* PooledProxyServerMediaSession::createGroupsock(struct sockaddr_storage const& addr, Port port) {
+  // We time only RTP (i.e., even-numbered) ports:
+  if ((ntohs(port.num())&1) != 0) return ProxyServerMediaSession::createGroupsock(addr, port);
+
+  return new ProxyStartupTimingGroupsock(envir(), addr, port, this, fCreatingGroupsocksForPrewarm);
+}
+
+inline void PooledProxyServerMediaSession::prewarm() {
+  if (isWarm() || !describeCompletedSuccessfully() || numSubsessions() == 0) return;
+
+  // Act like a (UDP) front-end client that has done "SETUP" (but never "PLAY") on each track.  This makes the back-end
+  // stream start (and keeps it running, because the streams are shared between clients), without sending anything:
+  struct sockaddr_storage loopback;
+  memset(&loopback, 0, sizeof loopback);
+  struct sockaddr_in& loopback4 = (struct sockaddr_in&)loopback;
+  loopback4.sin_family = AF_INET;
+  loopback4.sin_addr.s_addr = htonl(0x7F000001);
+
+  fPrewarmClientSessionId = our_random32();
+  fPrewarmStreamTokens = new void*[numSubsessions()];
+  fCreatingGroupsocksForPrewarm = True;
+  ServerMediaSubsessionIterator iter(*this);
+  ServerMediaSubsession* subsession;
+  for (unsigned i = 0; (subsession = iter.next()) != NULL && i < numSubsessions(); ++i) {
+    struct sockaddr_storage destinationAddress;
+    memset(&destinationAddress, 0, sizeof destinationAddress);
+    u_int8_t destinationTTL = 255;
+    Boolean isMulticast;
+    Port serverRTPPort(0), serverRTCPPort(0);
+    fPrewarmStreamTokens[i] = NULL;
+    subsession->getStreamParameters(fPrewarmClientSessionId, loopback, Port(0), Port(0), -1, 0, 0, NULL,
+				    destinationAddress, destinationTTL, isMulticast, serverRTPPort, serverRTCPPort,
+				    fPrewarmStreamTokens[i]);
+  }
+  fCreatingGroupsocksForPrewarm = False;
+}
+
+inline void PooledProxyServerMediaSession::cool() {
+  if (!isWarm()) return;
+
+  ServerMediaSubsessionIterator iter(*this);
+  ServerMediaSubsession* subsession;
+  for (unsigned i = 0; (subsession = iter.next()) != NULL && i < numSubsessions(); ++i) {
+    if (fPrewarmStreamTokens[i] != NULL) subsession->deleteStream(fPrewarmClientSessionId, fPrewarmStreamTokens[i]);
+  }
+  delete[] fPrewarmStreamTokens; fPrewarmStreamTokens = NULL;
+}
+
+inline void PooledProxyServerMediaSession::noteFirstPacketDelay(unsigned microseconds, Boolean streamWasWarm) {
+  if (fPool == NULL) return;
+
+  if (streamWasWarm) {
+    fPool->fWarmStartStats.addSample(microseconds);
+  } else {
+    fPool->fColdStartStats.addSample(microseconds);
+  }
+}
+
+// ProxyStartupTimingGroupsock //
+
+inline ProxyStartupTimingGroupsock
+::ProxyStartupTimingGroupsock(UsageEnvironment& env, struct sockaddr_storage const& addr, Port port,
+			      PooledProxyServerMediaSession* session, Boolean isForPrewarm)
+  : Groupsock(env, addr, port, 255), fSession(session), fStreamWasWarm(False) {
+  // A stream that's created by a front-end client's "SETUP" is a 'cold start'; we time it from now.  (A stream that's
+  // created to make it warm is instead timed from when a front-end client is added.)
+  fWaitStartTime.tv_sec = fWaitStartTime.tv_usec = 0;
+  if (!isForPrewarm) gettimeofday(&fWaitStartTime, NULL);
+}
+
+inline void ProxyStartupTimingGroupsock::addDestination(struct sockaddr_storage const& addr, Port const& port,
+							 unsigned sessionId) {
+  Groupsock::addDestination(addr, port, sessionId);
+  if (fWaitStartTime.tv_sec == 0) {
+    fStreamWasWarm = fSession->isWarm();
+    gettimeofday(&fWaitStartTime, NULL);
+  }
+}
+
+inline Boolean ProxyStartupTimingGroupsock::output(UsageEnvironment& env, unsigned char* buffer, unsigned bufferSize) {
+  if (fWaitStartTime.tv_sec != 0) {
+    struct timeval timeNow;
+    gettimeofday(&timeNow, NULL);
+    int64_t delay = (int64_t)(timeNow.tv_sec - fWaitStartTime.tv_sec)*1000000 + (timeNow.tv_usec - fWaitStartTime.tv_usec);
+    fSession->noteFirstPacketDelay(delay < 0 ? 0 : (unsigned)delay, fStreamWasWarm);
+    fWaitStartTime.tv_sec = 0;
+  }
+
+  return Groupsock::output(env, buffer, bufferSize);
+}
+
+// ProxyServerMediaSessionPool //
+
+inline ProxyServerMediaSessionPool*
+ProxyServerMediaSessionPool::createNew(UsageEnvironment& env, GenericMediaServer* ourMediaServer,
+				       unsigned maxConcurrentStartsPerHost, unsigned keepWarmPeriod, unsigned startTimeout) {
+  if (ourMediaServer == NULL) return NULL;
+
+  return new ProxyServerMediaSessionPool(env, ourMediaServer, maxConcurrentStartsPerHost, keepWarmPeriod, startTimeout);
+}
+
+inline ProxyServerMediaSessionPool
+::ProxyServerMediaSessionPool(UsageEnvironment& env, GenericMediaServer* ourMediaServer,
+			      unsigned maxConcurrentStartsPerHost, unsigned keepWarmPeriod, unsigned startTimeout)
+  : Medium(env), fOurMediaServer(ourMediaServer),
+    fMaxConcurrentStartsPerHost(maxConcurrentStartsPerHost),
+    fKeepWarmPeriod(keepWarmPeriod), fStartTimeout(startTimeout),
+    fHostStates(HashTable::create(STRING_HASH_KEYS)), fSessions(NULL),
+    fNumQueuedStreams(0), fNumStartingStreams(0), fCheckTask(NULL) {
+}
+
+inline ProxyServerMediaSessionPool::~ProxyServerMediaSessionPool() {
+  envir().taskScheduler().unscheduleDelayedTask(fCheckTask);
+
+  // The sessions belong to the server, so we just forget about them:
+  for (PooledProxyServerMediaSession* session = fSessions; session != NULL; session = session->fNextInPool) {
+    session->fPool = NULL;
+  }
+
+  HostState* host;
+  while ((host = (HostState*)fHostStates->RemoveNext()) != NULL) {
+    while (host->fQueueHead != NULL) {
+      QueuedStream* next = host->fQueueHead->fNext;
+      deleteQueuedStream(host->fQueueHead);
+      host->fQueueHead = next;
+    }
+    delete host;
+  }
+  delete fHostStates;
+}
+
+inline char* ProxyServerMediaSessionPool::hostNameFromURL(char const* url) {
+  // Skip past "rtsp://" and any "username:password@", and stop at the next '/':
+  char const* from = url;
+  char const* p = strstr(url, "://");
+  if (p != NULL) from = p + 3;
+  char const* to = from;
+  while (*to != '\0' && *to != '/') ++to;
+  for (p = from; p < to; ++p) {
+    if (*p == '@') from = p + 1;
+  }
+
+  char* result = new char[to - from + 1];
+  memmove(result, from, to - from);
+  result[to - from] = '\0';
+  return result;
+}
+
+inline ProxyServerMediaSessionPool::HostState* ProxyServerMediaSessionPool::hostState(char const* hostName) {
+  HostState* host = (HostState*)fHostStates->Lookup(hostName);
+  if (host == NULL) {
+    host = new HostState;
+    host->fNumStarting = 0;
+    host->fQueueHead = host->fQueueTail = NULL;
+    fHostStates->Add(hostName, host);
+  }
+  return host;
+}
+
+inline Boolean ProxyServerMediaSessionPool::canStart(HostState const* host) const {
+  return fMaxConcurrentStartsPerHost == 0 || host->fNumStarting < fMaxConcurrentStartsPerHost;
+}
+
+inline void ProxyServerMediaSessionPool::deleteQueuedStream(QueuedStream* stream) {
+  delete[] stream->fURL; delete[] stream->fStreamName; delete[] stream->fUsername; delete[] stream->fPassword;
+  delete[] stream->fHostName;
+  delete stream;
+}
+
+inline void ProxyServerMediaSessionPool::addProxyStream(char const* inputStreamURL, char const* streamName,
+							char const* username, char const* password,
+							portNumBits tunnelOverHTTPPortNum, int verbosityLevel,
+							Boolean keepWarm) {
+  QueuedStream* stream = new QueuedStream;
+  stream->fNext = NULL;
+  stream->fURL = strDup(inputStreamURL); stream->fStreamName = strDup(streamName);
+  stream->fUsername = strDup(username); stream->fPassword = strDup(password);
+  stream->fTunnelOverHTTPPortNum = tunnelOverHTTPPortNum;
+  stream->fVerbosityLevel = verbosityLevel;
+  stream->fKeepWarm = keepWarm;
+  stream->fHostName = hostNameFromURL(inputStreamURL);
+
+  HostState* host = hostState(stream->fHostName);
+  if (canStart(host)) {
+    startStream(stream);
+  } else {
+    if (host->fQueueTail == NULL) host->fQueueHead = stream; else host->fQueueTail->fNext = stream;
+    host->fQueueTail = stream;
+    ++fNumQueuedStreams;
+  }
+}
+
+inline void ProxyServerMediaSessionPool::startStream(QueuedStream* stream) {
+  // (Creating the session sends the back-end "DESCRIBE".)
+  PooledProxyServerMediaSession* session
+    = new PooledProxyServerMediaSession(envir(), this, fOurMediaServer, stream->fURL, stream->fStreamName,
+					stream->fUsername, stream->fPassword, stream->fTunnelOverHTTPPortNum,
+					stream->fVerbosityLevel, stream->fHostName);
+  session->keepWarm() = stream->fKeepWarm;
+  session->fNextInPool = fSessions;
+  fSessions = session;
+  ++hostState(stream->fHostName)->fNumStarting;
+  ++fNumStartingStreams;
+  deleteQueuedStream(stream);
+
+  fOurMediaServer->addServerMediaSession(session);
+  scheduleCheck();
+}
+
+inline void ProxyServerMediaSessionPool::noteStartFinished(PooledProxyServerMediaSession* session) {
+  if (!session->fIsStarting) return;
+  session->fIsStarting = False;
+  --fNumStartingStreams;
+
+  // Let the next queued stream (if any) for this host start:
+  HostState* host = hostState(session->fHostName);
+  if (host->fNumStarting > 0) --host->fNumStarting;
+  if (host->fQueueHead != NULL && canStart(host)) {
+    QueuedStream* stream = host->fQueueHead;
+    host->fQueueHead = stream->fNext;
+    if (host->fQueueHead == NULL) host->fQueueTail = NULL;
+    --fNumQueuedStreams;
+    startStream(stream);
+  }
+}
+
+inline void ProxyServerMediaSessionPool::removeSession(PooledProxyServerMediaSession* session) {
+  // (called when "session" is being deleted, e.g., by the server)
+  PooledProxyServerMediaSession** prevPtr = &fSessions;
+  while (*prevPtr != NULL && *prevPtr != session) prevPtr = &(*prevPtr)->fNextInPool;
+  if (*prevPtr != NULL) *prevPtr = session->fNextInPool;
+
+  noteStartFinished(session);
+  session->fPool = NULL;
+}
+
+inline unsigned ProxyServerMediaSessionPool::numWarmStreams() const {
+  unsigned result = 0;
+  for (PooledProxyServerMediaSession* session = fSessions; session != NULL; session = session->fNextInPool) {
+    if (session->isWarm()) ++result;
+  }
+  return result;
+}
+
+inline void ProxyServerMediaSessionPool::scheduleCheck() {
+  if (fCheckTask != NULL) return;
+
+  // Check often while streams are starting (because each start may let a queued stream start); otherwise, once a second:
+  int64_t delay = fNumStartingStreams > 0 ? 100000 : 1000000;
+  fCheckTask = envir().taskScheduler().scheduleDelayedTask(delay, checkSessions, this);
+}
+
+inline void ProxyServerMediaSessionPool::checkSessions(void* clientData) {
+  ((ProxyServerMediaSessionPool*)clientData)->checkSessions();
+}
+
+inline void ProxyServerMediaSessionPool::checkSessions() {
+  fCheckTask = NULL;
+  struct timeval timeNow;
+  gettimeofday(&timeNow, NULL);
+
+  PooledProxyServerMediaSession* nextSession;
+  for (PooledProxyServerMediaSession* session = fSessions; session != NULL; session = nextSession) {
+    nextSession = session->fNextInPool; // in case "noteStartFinished()" adds sessions (at the head of the list)
+
+    if (session->fIsStarting
+	&& (session->describeCompletedFlag != 0
+	    || (unsigned)(timeNow.tv_sec - session->fStartTime.tv_sec) >= fStartTimeout)) {
+      noteStartFinished(session);
+    }
+
+    // A stream is 'popular' while it has front-end clients, and stays so for "fKeepWarmPeriod" seconds afterwards:
+    if (session->referenceCount() > 0) session->fLastUsedTime = timeNow;
+    Boolean shouldBeWarm = session->fKeepWarm
+      || (fKeepWarmPeriod > 0 && session->referenceCount() > 0)
+      || (fKeepWarmPeriod > 0 && session->isWarm()
+	  && (unsigned)(timeNow.tv_sec - session->fLastUsedTime.tv_sec) < fKeepWarmPeriod);
+    if (shouldBeWarm) {
+      session->prewarm();
+    } else {
+      session->cool();
+    }
+  }
+
+  if (fSessions != NULL || fNumQueuedStreams > 0) scheduleCheck();
+}
+
+#endif
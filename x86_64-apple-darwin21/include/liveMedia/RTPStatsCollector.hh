@@ -0,0 +1,612 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// Periodically collects the RTP/RTCP statistics (reception: packets, loss, jitter and bitrate; transmission: what
+// receivers report in RTCP "RR"s, including round-trip delay) of many streams into an immutable 'snapshot'.
+// Snapshots are built (a few streams at a time) within the event loop, but can be read - and exported (e.g., as
+// Prometheus text) - from any thread, without locking.
+// C++ header
+
+#ifndef _RTP_STATS_COLLECTOR_HH
+#define _RTP_STATS_COLLECTOR_HH
+
+#ifndef _RTP_SOURCE_HH
+#include "RTPSource.hh"
+#endif
+#ifndef _RTP_SINK_HH
+#include "RTPSink.hh"
+#endif
+#ifndef _RTCP_HH
+#include "RTCP.hh"
+#endif
+#include <stdio.h>
+#include <stdarg.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define RTP_STATS_ATOMIC_INCREMENT(var) ((unsigned)_InterlockedIncrement((long volatile*)&(var)))
+#define RTP_STATS_ATOMIC_DECREMENT(var) ((unsigned)_InterlockedDecrement((long volatile*)&(var)))
+#define RTP_STATS_ATOMIC_LOAD_PTR(var) _InterlockedCompareExchangePointer((void* volatile*)&(var), NULL, NULL)
+#define RTP_STATS_ATOMIC_EXCHANGE_PTR(var, p) _InterlockedExchangePointer((void* volatile*)&(var), (p))
+#define RTP_STATS_ATOMIC_LOAD(var) ((unsigned)_InterlockedOr((long volatile*)&(var), 0))
+#else
+#define RTP_STATS_ATOMIC_INCREMENT(var) __atomic_add_fetch(&(var), 1, __ATOMIC_SEQ_CST)
+#define RTP_STATS_ATOMIC_DECREMENT(var) __atomic_sub_fetch(&(var), 1, __ATOMIC_SEQ_CST)
+#define RTP_STATS_ATOMIC_LOAD_PTR(var) __atomic_load_n(&(var), __ATOMIC_SEQ_CST)
+#define RTP_STATS_ATOMIC_EXCHANGE_PTR(var, p) __atomic_exchange_n(&(var), (p), __ATOMIC_SEQ_CST)
+#define RTP_STATS_ATOMIC_LOAD(var) __atomic_load_n(&(var), __ATOMIC_SEQ_CST)
+#endif
+
+#define RTP_STATS_NUM_JITTER_BUCKETS 10
+#define RTP_STATS_NUM_LOSS_BUCKETS 9
+#define RTP_STATS_NUM_RTT_BUCKETS 9
+
+// A distribution (over all streams, at the time of a snapshot) of some value:
+class RTPStatsHistogram {
+public:
+  RTPStatsHistogram(double const* upperBounds, unsigned numBuckets);
+  ~RTPStatsHistogram();
+
+  void addSample(double value);
+
+  unsigned numBuckets() const { return fNumBuckets; }
+  double upperBound(unsigned i) const { return fUpperBounds[i]; } // the last bucket also counts values above this
+  unsigned count(unsigned i) const { return fCounts[i]; } // not cumulative
+  unsigned numSamples() const { return fNumSamples; }
+  double sum() const { return fSum; }
+
+private:
+  double const* fUpperBounds;
+  unsigned fNumBuckets;
+  unsigned* fCounts;
+  unsigned fNumSamples;
+  double fSum;
+};
+
+class RTPStreamStats {
+public:
+  char* label;
+  unsigned numRTCPMembers;
+
+  // Reception (if the stream has a "RTPSource"):
+  unsigned numSSRCs; // that we're receiving from
+  unsigned totNumPacketsReceived, totNumPacketsLost;
+  double totNumKBytesReceived;
+  unsigned receiveBitrate; // bps, since the previous snapshot
+  double lossFraction; // since the previous snapshot
+  unsigned jitterUS; // the highest, over all SSRCs
+
+  // Transmission (if the stream has a "RTPSink"):
+  unsigned numReceivers;
+  unsigned roundTripDelayUS; // the highest, over all receivers
+  double receiverLossFraction; // the highest, over all receivers (from their most recent "RR")
+  unsigned receiverJitterUS; // the highest, over all receivers
+};
+
+class RTPStatsSnapshot {
+public:
+  void reference();
+  void release(); // deletes the snapshot, once its last reference has been released
+
+  struct timeval const& timeCreated() const { return fTimeCreated; }
+  unsigned snapshotNumber() const { return fSnapshotNumber; }
+
+  unsigned numStreams() const { return fNumStreams; }
+  RTPStreamStats const& stream(unsigned i) const { return fStreams[i]; }
+
+  // Aggregate stats:
+  unsigned totNumPacketsReceived() const { return fTotNumPacketsReceived; }
+  unsigned totNumPacketsLost() const { return fTotNumPacketsLost; }
+  double totNumKBytesReceived() const { return fTotNumKBytesReceived; }
+  double totReceiveBitrate() const { return fTotReceiveBitrate; } // bps
+  RTPStatsHistogram const& jitterHistogram() const { return fJitterHistogram; } // seconds
+  RTPStatsHistogram const& lossHistogram() const { return fLossHistogram; } // fraction lost (reception)
+  RTPStatsHistogram const& roundTripDelayHistogram() const { return fRTTHistogram; } // seconds (transmission)
+
+  char* prometheusText(Boolean includePerStreamMetrics = False, char const* metricNamePrefix = "live555") const;
+      // Returns the snapshot in the Prometheus text exposition format; the result must be delete[]d.
+      // The histograms are distributions over the streams at the time of the snapshot.
+      // (For very large numbers of streams, "includePerStreamMetrics" is best left False.)
+
+private:
+  friend class RTPStatsCollector;
+  RTPStatsSnapshot(unsigned snapshotNumber, unsigned streamsArraySize);
+  ~RTPStatsSnapshot();
+  RTPStreamStats& addStream();
+
+private:
+  unsigned fReferenceCount;
+  RTPStatsSnapshot* fNextRetired;
+  struct timeval fTimeCreated;
+  unsigned fSnapshotNumber;
+  RTPStreamStats* fStreams;
+  unsigned fNumStreams, fStreamsArraySize;
+  unsigned fTotNumPacketsReceived, fTotNumPacketsLost;
+  double fTotNumKBytesReceived, fTotReceiveBitrate;
+  RTPStatsHistogram fJitterHistogram, fLossHistogram, fRTTHistogram;
+};
+
+class RTPStatsCollector: public Medium {
+public:
+  static RTPStatsCollector* createNew(UsageEnvironment& env, unsigned snapshotIntervalMS = 1000,
+				      unsigned numStreamsPerStep = 500);
+      // Every "snapshotIntervalMS" milliseconds, we start building a new snapshot; looking at up to "numStreamsPerStep"
+      // streams each time the event loop runs us.
+
+  class Stream; // opaque
+  Stream* addStream(char const* label, RTPSource* source, RTPSink* sink = NULL, RTCPInstance* rtcpInstance = NULL);
+      // "source" and/or "sink" may be NULL.  "removeStream()" must be called before any of them is deleted.
+  void removeStream(Stream* stream);
+  unsigned numStreams() const { return fNumStreams; }
+
+  // The following may be called from any thread:
+  RTPStatsSnapshot* acquireSnapshot();
+      // Returns the most recent (complete) snapshot (or NULL, if none has been built yet).
+      // The caller must call "release()" on it when done.
+
+protected:
+  RTPStatsCollector(UsageEnvironment& env, unsigned snapshotIntervalMS, unsigned numStreamsPerStep);
+      // called only by createNew()
+  virtual ~RTPStatsCollector();
+
+private:
+  void moveStream(unsigned from, unsigned to);
+  void collectStream(Stream& stream, RTPStatsSnapshot& snapshot, struct timeval const& timeNow);
+  void publish(RTPStatsSnapshot* snapshot);
+  void freeRetiredSnapshots();
+
+  static void buildStep(void* clientData);
+  void buildStep();
+
+private:
+  unsigned fSnapshotIntervalMS, fNumStreamsPerStep;
+  Stream** fStreams;
+  unsigned fNumStreams, fStreamsArraySize;
+
+  RTPStatsSnapshot* fBuilding; // the snapshot that we're building (if any)
+  unsigned fBuildPosition; // the streams at indices < this have been collected into "fBuilding"
+  unsigned fNextSnapshotNumber;
+  struct timeval fLastBuildStartTime;
+  TaskToken fBuildTask;
+
+  RTPStatsSnapshot* fCurrentSnapshot; // read by other threads
+  unsigned fNumReaders; // the number of other threads that are currently in "acquireSnapshot()"
+  RTPStatsSnapshot* fRetiredSnapshots; // replaced snapshots that a reader might not yet have referenced
+};
+
+
+////////// Implementation //////////
+
+static double const rtpStatsJitterBuckets[RTP_STATS_NUM_JITTER_BUCKETS]
+  = { 0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1.0 };
+static double const rtpStatsLossBuckets[RTP_STATS_NUM_LOSS_BUCKETS]
+  = { 0.0, 0.001, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5 };
+static double const rtpStatsRTTBuckets[RTP_STATS_NUM_RTT_BUCKETS]
+  = { 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1.0, 2.0 };
+
+// RTPStatsHistogram //
+
+inline RTPStatsHistogram::RTPStatsHistogram(double const* upperBounds, unsigned numBuckets)
+  : fUpperBounds(upperBounds), fNumBuckets(numBuckets), fCounts(new unsigned[numBuckets+1]),
+    fNumSamples(0), fSum(0.0) {
+  for (unsigned i = 0; i <= numBuckets; ++i) fCounts[i] = 0;
+}
+
+inline RTPStatsHistogram::~RTPStatsHistogram() {
+  delete[] fCounts;
+}
+
+inline void RTPStatsHistogram::addSample(double value) {
+  unsigned i = 0;
+  while (i < fNumBuckets && value > fUpperBounds[i]) ++i;
+  ++fCounts[i]; // (fCounts[fNumBuckets] counts the values above the highest bound)
+  ++fNumSamples;
+  fSum += value;
+}
+
+// RTPStatsSnapshot //
+
+inline RTPStatsSnapshot::RTPStatsSnapshot(unsigned snapshotNumber, unsigned streamsArraySize)
+  : fReferenceCount(1), fNextRetired(NULL), fSnapshotNumber(snapshotNumber),
+    fStreams(new RTPStreamStats[streamsArraySize == 0 ? 1 : streamsArraySize]),
+    fNumStreams(0), fStreamsArraySize(streamsArraySize == 0 ? 1 : streamsArraySize),
+    fTotNumPacketsReceived(0), fTotNumPacketsLost(0), fTotNumKBytesReceived(0.0), fTotReceiveBitrate(0.0),
+    fJitterHistogram(rtpStatsJitterBuckets, RTP_STATS_NUM_JITTER_BUCKETS),
+    fLossHistogram(rtpStatsLossBuckets, RTP_STATS_NUM_LOSS_BUCKETS),
+    fRTTHistogram(rtpStatsRTTBuckets, RTP_STATS_NUM_RTT_BUCKETS) {
+  gettimeofday(&fTimeCreated, NULL);
+}
+
+inline RTPStatsSnapshot::~RTPStatsSnapshot() {
+  for (unsigned i = 0; i < fNumStreams; ++i) delete[] fStreams[i].label;
+  delete[] fStreams;
+}
+
+inline void RTPStatsSnapshot::reference() {
+  RTP_STATS_ATOMIC_INCREMENT(fReferenceCount);
+}
+
+inline void RTPStatsSnapshot::release() {
+  if (RTP_STATS_ATOMIC_DECREMENT(fReferenceCount) == 0) delete this;
+}
+
+inline RTPStreamStats& RTPStatsSnapshot::addStream() {
+  if (fNumStreams == fStreamsArraySize) {
+    RTPStreamStats* newStreams = new RTPStreamStats[2*fStreamsArraySize];
+    memmove(newStreams, fStreams, fNumStreams*sizeof (RTPStreamStats));
+    delete[] fStreams; fStreams = newStreams;
+    fStreamsArraySize *= 2;
+  }
+
+  RTPStreamStats& result = fStreams[fNumStreams++];
+  memset(&result, 0, sizeof result);
+  return result;
+}
+
+// A growable output buffer, used by "prometheusText()":
+class RTPStatsTextBuffer {
+public:
+  RTPStatsTextBuffer() : fSize(4096), fLength(0) { fBuffer = new char[fSize]; fBuffer[0] = '\0'; }
+  ~RTPStatsTextBuffer() { delete[] fBuffer; }
+
+  void append(char const* format, ...)
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+  {
+    while (1) {
+      va_list args;
+      va_start(args, format);
+      int n = vsnprintf(&fBuffer[fLength], fSize - fLength, format, args);
+      va_end(args);
+      if (n < 0) return;
+      if (fLength + n < fSize) { fLength += n; return; }
+
+      // Grow the buffer, and try again:
+      unsigned newSize = 2*fSize;
+      while (fLength + n >= newSize) newSize *= 2;
+      char* newBuffer = new char[newSize];
+      memmove(newBuffer, fBuffer, fLength + 1);
+      delete[] fBuffer; fBuffer = newBuffer; fSize = newSize;
+    }
+  }
+
+  void appendLabelValue(char const* s) { // with the escaping required by Prometheus
+    for (; s != NULL && *s != '\0'; ++s) {
+      if (*s == '\\') append("\\\\");
+      else if (*s == '"') append("\\\"");
+      else if (*s == '\n') append("\\n");
+      else append("%c", *s);
+    }
+  }
+
+  char* takeResult() { char* result = fBuffer; fBuffer = NULL; return result; }
+
+private:
+  char* fBuffer;
+  unsigned fSize, fLength;
+};
+
+inline void rtpStatsAppendHistogram(RTPStatsTextBuffer& out, char const* prefix, char const* name, char const* help,
+				    RTPStatsHistogram const& histogram) {
+  out.append("# HELP %s_%s %s\n# TYPE %s_%s histogram\n", prefix, name, help, prefix, name);
+  unsigned cumulativeCount = 0;
+  for (unsigned i = 0; i < histogram.numBuckets(); ++i) {
+    cumulativeCount += histogram.count(i);
+    out.append("%s_%s_bucket{le=\"%g\"} %u\n", prefix, name, histogram.upperBound(i), cumulativeCount);
+  }
+  out.append("%s_%s_bucket{le=\"+Inf\"} %u\n", prefix, name, histogram.numSamples());
+  out.append("%s_%s_sum %g\n%s_%s_count %u\n", prefix, name, histogram.sum(), prefix, name, histogram.numSamples());
+}
+
+inline char* RTPStatsSnapshot::prometheusText(Boolean includePerStreamMetrics, char const* prefix) const {
+  RTPStatsTextBuffer out;
+
+  out.append("# HELP %s_rtp_streams Number of RTP streams being monitored\n# TYPE %s_rtp_streams gauge\n%s_rtp_streams %u\n",
+	     prefix, prefix, prefix, fNumStreams);
+  out.append("# HELP %s_rtp_received_packets_total RTP packets received\n# TYPE %s_rtp_received_packets_total counter\n"
+	     "%s_rtp_received_packets_total %u\n", prefix, prefix, prefix, fTotNumPacketsReceived);
+  out.append("# HELP %s_rtp_lost_packets_total RTP packets lost\n# TYPE %s_rtp_lost_packets_total counter\n"
+	     "%s_rtp_lost_packets_total %u\n", prefix, prefix, prefix, fTotNumPacketsLost);
+  out.append("# HELP %s_rtp_received_bytes_total RTP payload bytes received\n# TYPE %s_rtp_received_bytes_total counter\n"
+	     "%s_rtp_received_bytes_total %.0f\n", prefix, prefix, prefix, fTotNumKBytesReceived*1000.0);
+  out.append("# HELP %s_rtp_receive_bitrate_bps RTP payload bitrate received\n# TYPE %s_rtp_receive_bitrate_bps gauge\n"
+	     "%s_rtp_receive_bitrate_bps %.0f\n", prefix, prefix, prefix, fTotReceiveBitrate);
+  rtpStatsAppendHistogram(out, prefix, "rtp_jitter_seconds", "Interarrival jitter of received RTP streams",
+			  fJitterHistogram);
+  rtpStatsAppendHistogram(out, prefix, "rtp_loss_ratio", "Fraction of RTP packets lost since the previous snapshot",
+			  fLossHistogram);
+  rtpStatsAppendHistogram(out, prefix, "rtcp_round_trip_seconds", "Round-trip delay to receivers of transmitted RTP streams",
+			  fRTTHistogram);
+
+  if (includePerStreamMetrics) {
+    static char const* const perStreamMetrics[] = {
+      "rtp_stream_received_packets_total", "counter",
+      "rtp_stream_lost_packets_total", "counter",
+      "rtp_stream_receive_bitrate_bps", "gauge",
+      "rtp_stream_loss_ratio", "gauge",
+      "rtp_stream_jitter_seconds", "gauge",
+      "rtp_stream_receivers", "gauge",
+      "rtp_stream_receiver_loss_ratio", "gauge",
+      "rtp_stream_receiver_jitter_seconds", "gauge",
+      "rtcp_stream_round_trip_seconds", "gauge",
+      "rtcp_stream_members", "gauge"
+    };
+    unsigned const numPerStreamMetrics = sizeof perStreamMetrics/(2*sizeof perStreamMetrics[0]);
+
+    for (unsigned m = 0; m < numPerStreamMetrics; ++m) {
+      char const* name = perStreamMetrics[2*m];
+      out.append("# TYPE %s_%s %s\n", prefix, name, perStreamMetrics[2*m+1]);
+      for (unsigned i = 0; i < fNumStreams; ++i) {
+	RTPStreamStats const& s = fStreams[i];
+	out.append("%s_%s{stream=\"", prefix, name);
+	out.appendLabelValue(s.label);
+	out.append("\"} ");
+	switch (m) {
+	  case 0: out.append("%u\n", s.totNumPacketsReceived); break;
+	  case 1: out.append("%u\n", s.totNumPacketsLost); break;
+	  case 2: out.append("%u\n", s.receiveBitrate); break;
+	  case 3: out.append("%g\n", s.lossFraction); break;
+	  case 4: out.append("%g\n", s.jitterUS/1000000.0); break;
+	  case 5: out.append("%u\n", s.numReceivers); break;
+	  case 6: out.append("%g\n", s.receiverLossFraction); break;
+	  case 7: out.append("%g\n", s.receiverJitterUS/1000000.0); break;
+	  case 8: out.append("%g\n", s.roundTripDelayUS/1000000.0); break;
+	  default: out.append("%u\n", s.numRTCPMembers); break;
+	}
+      }
+    }
+  }
+
+  return out.takeResult();
+}
+
+// RTPStatsCollector //
+
+class RTPStatsCollector::Stream {
+public:
+  Stream(char const* label, RTPSource* source, RTPSink* sink, RTCPInstance* rtcpInstance)
+    : fLabel(strDup(label)), fSource(source), fSink(sink), fRTCPInstance(rtcpInstance), fIndex(0),
+      fHavePrevious(False), fPrevKBytesReceived(0.0), fPrevNumPacketsExpected(0), fPrevNumPacketsReceived(0) {
+  }
+  ~Stream() { delete[] fLabel; }
+
+  char* fLabel;
+  RTPSource* fSource;
+  RTPSink* fSink;
+  RTCPInstance* fRTCPInstance;
+  unsigned fIndex; // in the collector's "fStreams" array
+
+  // Values from the previous snapshot (used to compute rates):
+  Boolean fHavePrevious;
+  struct timeval fPrevTime;
+  double fPrevKBytesReceived;
+  unsigned fPrevNumPacketsExpected, fPrevNumPacketsReceived;
+};
+
+inline RTPStatsCollector* RTPStatsCollector::createNew(UsageEnvironment& env, unsigned snapshotIntervalMS,
+							unsigned numStreamsPerStep) {
+  return new RTPStatsCollector(env, snapshotIntervalMS, numStreamsPerStep);
+}
+
+inline RTPStatsCollector::RTPStatsCollector(UsageEnvironment& env, unsigned snapshotIntervalMS, unsigned numStreamsPerStep)
+  : Medium(env), fSnapshotIntervalMS(snapshotIntervalMS), fNumStreamsPerStep(numStreamsPerStep == 0 ? 1 : numStreamsPerStep),
+    fStreams(NULL), fNumStreams(0), fStreamsArraySize(0),
+    fBuilding(NULL), fBuildPosition(0), fNextSnapshotNumber(0), fBuildTask(NULL),
+    fCurrentSnapshot(NULL), fNumReaders(0), fRetiredSnapshots(NULL) {
+  gettimeofday(&fLastBuildStartTime, NULL);
+  fBuildTask = envir().taskScheduler().scheduleDelayedTask(0, buildStep, this);
+}
+
+inline RTPStatsCollector::~RTPStatsCollector() {
+  envir().taskScheduler().unscheduleDelayedTask(fBuildTask);
+
+  // (There must no longer be any readers in "acquireSnapshot()".)
+  if (fBuilding != NULL) fBuilding->release();
+  RTPStatsSnapshot* current = (RTPStatsSnapshot*)RTP_STATS_ATOMIC_EXCHANGE_PTR(fCurrentSnapshot, (RTPStatsSnapshot*)NULL);
+  if (current != NULL) current->release();
+  while (fRetiredSnapshots != NULL) {
+    RTPStatsSnapshot* next = fRetiredSnapshots->fNextRetired;
+    fRetiredSnapshots->release();
+    fRetiredSnapshots = next;
+  }
+
+  for (unsigned i = 0; i < fNumStreams; ++i) delete fStreams[i];
+  delete[] fStreams;
+}
+
+inline RTPStatsCollector::Stream* RTPStatsCollector::addStream(char const* label, RTPSource* source, RTPSink* sink,
+								RTCPInstance* rtcpInstance) {
+  if (fNumStreams == fStreamsArraySize) {
+    unsigned newSize = fStreamsArraySize == 0 ? 16 : 2*fStreamsArraySize;
+    Stream** newStreams = new Stream*[newSize];
+    for (unsigned i = 0; i < fNumStreams; ++i) newStreams[i] = fStreams[i];
+    delete[] fStreams; fStreams = newStreams;
+    fStreamsArraySize = newSize;
+  }
+
+  Stream* stream = new Stream(label, source, sink, rtcpInstance);
+  stream->fIndex = fNumStreams;
+  fStreams[fNumStreams++] = stream;
+  return stream;
+}
+
+inline void RTPStatsCollector::moveStream(unsigned from, unsigned to) {
+  fStreams[to] = fStreams[from];
+  fStreams[to]->fIndex = to;
+}
+
+inline void RTPStatsCollector::removeStream(Stream* stream) {
+  if (stream == NULL) return;
+  unsigned i = stream->fIndex;
+  unsigned last = fNumStreams - 1;
+
+  if (fBuilding != NULL && i < fBuildPosition) {
+    // Keep the streams that we've already collected (for this snapshot) below "fBuildPosition", and the rest above it:
+    unsigned j = fBuildPosition - 1;
+    if (i != j) moveStream(j, i);
+    if (last != j) moveStream(last, j);
+    --fBuildPosition;
+  } else if (i != last) {
+    moveStream(last, i);
+  }
+  --fNumStreams;
+  delete stream;
+}
+
+inline void RTPStatsCollector::collectStream(Stream& stream, RTPStatsSnapshot& snapshot, struct timeval const& timeNow) {
+  RTPStreamStats& s = snapshot.addStream();
+  s.label = strDup(stream.fLabel);
+  if (stream.fRTCPInstance != NULL) s.numRTCPMembers = stream.fRTCPInstance->numMembers();
+
+  if (stream.fSource != NULL) {
+    unsigned numPacketsExpected = 0;
+    unsigned timestampFrequency = stream.fSource->timestampFrequency();
+    RTPReceptionStatsDB::Iterator iter(stream.fSource->receptionStatsDB());
+    RTPReceptionStats* stats;
+    while ((stats = iter.next(True)) != NULL) {
+      ++s.numSSRCs;
+      s.totNumPacketsReceived += stats->totNumPacketsReceived();
+      numPacketsExpected += stats->totNumPacketsExpected();
+      s.totNumKBytesReceived += stats->totNumKBytesReceived();
+      if (timestampFrequency > 0) {
+	unsigned jitterUS = (unsigned)((stats->jitter()*1000000.0)/timestampFrequency);
+	if (jitterUS > s.jitterUS) s.jitterUS = jitterUS;
+      }
+    }
+    if (numPacketsExpected > s.totNumPacketsReceived) s.totNumPacketsLost = numPacketsExpected - s.totNumPacketsReceived;
+
+    if (stream.fHavePrevious) {
+      double secondsSincePrevious = (timeNow.tv_sec - stream.fPrevTime.tv_sec) + (timeNow.tv_usec - stream.fPrevTime.tv_usec)/1000000.0;
+      double kBytesSincePrevious = s.totNumKBytesReceived - stream.fPrevKBytesReceived;
+      if (secondsSincePrevious > 0.0 && kBytesSincePrevious > 0.0) {
+	s.receiveBitrate = (unsigned)((kBytesSincePrevious*8000.0)/secondsSincePrevious);
+      }
+
+      // (Counts can go backwards, if a SSRC has gone away.)
+      int expectedSincePrevious = (int)(numPacketsExpected - stream.fPrevNumPacketsExpected);
+      int receivedSincePrevious = (int)(s.totNumPacketsReceived - stream.fPrevNumPacketsReceived);
+      if (expectedSincePrevious > 0 && receivedSincePrevious < expectedSincePrevious) {
+	s.lossFraction = receivedSincePrevious <= 0 ? 1.0
+	  : (double)(expectedSincePrevious - receivedSincePrevious)/expectedSincePrevious;
+      }
+    }
+    stream.fHavePrevious = True;
+    stream.fPrevTime = timeNow;
+    stream.fPrevKBytesReceived = s.totNumKBytesReceived;
+    stream.fPrevNumPacketsExpected = numPacketsExpected;
+    stream.fPrevNumPacketsReceived = s.totNumPacketsReceived;
+
+    snapshot.fTotNumPacketsReceived += s.totNumPacketsReceived;
+    snapshot.fTotNumPacketsLost += s.totNumPacketsLost;
+    snapshot.fTotNumKBytesReceived += s.totNumKBytesReceived;
+    snapshot.fTotReceiveBitrate += s.receiveBitrate;
+    if (s.numSSRCs > 0) {
+      snapshot.fJitterHistogram.addSample(s.jitterUS/1000000.0);
+      snapshot.fLossHistogram.addSample(s.lossFraction);
+    }
+  }
+
+  if (stream.fSink != NULL) {
+    unsigned timestampFrequency = stream.fSink->rtpTimestampFrequency();
+    RTPTransmissionStatsDB::Iterator iter(stream.fSink->transmissionStatsDB());
+    RTPTransmissionStats* stats;
+    while ((stats = iter.next()) != NULL) {
+      ++s.numReceivers;
+      unsigned rttUS = (unsigned)((stats->roundTripDelay()*1000000.0)/65536);
+      if (rttUS > s.roundTripDelayUS) s.roundTripDelayUS = rttUS;
+      double lossFraction = stats->packetLossRatio()/256.0;
+      if (lossFraction > s.receiverLossFraction) s.receiverLossFraction = lossFraction;
+      if (timestampFrequency > 0) {
+	unsigned jitterUS = (unsigned)((stats->jitter()*1000000.0)/timestampFrequency);
+	if (jitterUS > s.receiverJitterUS) s.receiverJitterUS = jitterUS;
+      }
+    }
+    if (s.numReceivers > 0) snapshot.fRTTHistogram.addSample(s.roundTripDelayUS/1000000.0);
+  }
+}
+
+inline void RTPStatsCollector::publish(RTPStatsSnapshot* snapshot) {
+  RTPStatsSnapshot* old = (RTPStatsSnapshot*)RTP_STATS_ATOMIC_EXCHANGE_PTR(fCurrentSnapshot, snapshot);
+  if (old != NULL) {
+    // A reader might have loaded "old" (but not yet referenced it), so we can't release it yet:
+    old->fNextRetired = fRetiredSnapshots;
+    fRetiredSnapshots = old;
+  }
+  freeRetiredSnapshots();
+}
+
+inline void RTPStatsCollector::freeRetiredSnapshots() {
+  // Any reader that's in "acquireSnapshot()" now might still be about to reference a retired snapshot.  But if there
+  // are none, then later readers can see only the current snapshot:
+  if (fRetiredSnapshots == NULL || RTP_STATS_ATOMIC_LOAD(fNumReaders) != 0) return;
+
+  while (fRetiredSnapshots != NULL) {
+    RTPStatsSnapshot* next = fRetiredSnapshots->fNextRetired;
+    fRetiredSnapshots->release();
+    fRetiredSnapshots = next;
+  }
+}
+
+inline RTPStatsSnapshot* RTPStatsCollector::acquireSnapshot() {
+  RTP_STATS_ATOMIC_INCREMENT(fNumReaders);
+  RTPStatsSnapshot* snapshot = (RTPStatsSnapshot*)RTP_STATS_ATOMIC_LOAD_PTR(fCurrentSnapshot);
+  if (snapshot != NULL) snapshot->reference();
+  RTP_STATS_ATOMIC_DECREMENT(fNumReaders);
+
+  return snapshot;
+}
+
+inline void RTPStatsCollector::buildStep(void* clientData) {
+  ((RTPStatsCollector*)clientData)->buildStep();
+}
+
+inline void RTPStatsCollector::buildStep() {
+  fBuildTask = NULL;
+  struct timeval timeNow;
+  gettimeofday(&timeNow, NULL);
+
+  if (fBuilding == NULL) {
+    fBuilding = new RTPStatsSnapshot(fNextSnapshotNumber++, fNumStreams);
+    fBuildPosition = 0;
+    fLastBuildStartTime = timeNow;
+  }
+
+  unsigned numThisStep = 0;
+  while (fBuildPosition < fNumStreams && numThisStep < fNumStreamsPerStep) {
+    collectStream(*fStreams[fBuildPosition++], *fBuilding, timeNow);
+    ++numThisStep;
+  }
+
+  int64_t delay;
+  if (fBuildPosition < fNumStreams) {
+    // Let the event loop handle other events, then continue:
+    delay = 0;
+  } else {
+    fBuilding->fTimeCreated = timeNow;
+    publish(fBuilding);
+    fBuilding = NULL;
+
+    int64_t usSinceBuildStart = (int64_t)(timeNow.tv_sec - fLastBuildStartTime.tv_sec)*1000000
+      + (timeNow.tv_usec - fLastBuildStartTime.tv_usec);
+    delay = (int64_t)fSnapshotIntervalMS*1000 - usSinceBuildStart;
+    if (delay < 0) delay = 0;
+  }
+  fBuildTask = envir().taskScheduler().scheduleDelayedTask(delay, buildStep, this);
+}
+
+#endif
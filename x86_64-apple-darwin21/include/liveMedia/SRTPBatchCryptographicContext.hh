@@ -0,0 +1,756 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// The SRTP 'Cryptographic Context', for processing many SRTP/SRTCP packets at a time.
+// Like "SRTPCryptographicContext", this supports the "SRTP_AES128_CM_HMAC_SHA1_80" ciphersuite (producing the same
+// packets), but it also supports "AEAD_AES_128_GCM" (RFC 7714), and has functions that process a whole batch of packets.
+// For a batch, the AES-CM key streams of all of the packets are generated by a single AES call (which OpenSSL pipelines,
+// using AES-NI where available), and each HMAC starts from precomputed inner and outer hash states, rather than
+// re-keying for each packet.
+// Definition
+
+#ifndef _SRTP_BATCH_CRYPTOGRAPHIC_CONTEXT_HH
+#define _SRTP_BATCH_CRYPTOGRAPHIC_CONTEXT_HH
+
+#ifndef _SRTP_CRYPTOGRAPHIC_CONTEXT_HH
+#include "SRTPCryptographicContext.hh"
+#endif
+#ifndef _HMAC_SHA1_HH
+#include "HMAC_SHA1.hh"
+#endif
+
+#ifndef NO_OPENSSL
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+#include <string.h>
+
+// Definitions specific to the "AEAD_AES_128_GCM" ciphersuite:
+#define SRTP_GCM_CIPHER_KEY_LENGTH (128/8) // in bytes
+#define SRTP_GCM_CIPHER_SALT_LENGTH (96/8) // in bytes
+#define SRTP_GCM_AUTH_TAG_LENGTH (128/8) // in bytes
+
+enum SRTPCipherSuite {
+  SRTP_SUITE_AES128_CM_HMAC_SHA1_80,
+  SRTP_SUITE_AEAD_AES_128_GCM
+};
+
+// A packet within a batch.  "size" is updated (if the packet is processed OK); there must be enough space at the end
+// of "buffer" for the extra bytes that an outgoing packet gets (as for "SRTPCryptographicContext", or 16+4 bytes
+// (SRTP) and 16+4+4 bytes (SRTCP) for "AEAD_AES_128_GCM").
+struct SRTPPacketBuffer {
+  u_int8_t* buffer;
+  unsigned size;
+  Boolean ok; // set by the batch functions
+};
+
+class SRTPBatchCryptographicContext {
+public:
+  static SRTPBatchCryptographicContext* createNew(MIKEYState const& mikeyState);
+      // uses the "SRTP_AES128_CM_HMAC_SHA1_80" ciphersuite (with a 4-byte MKI), like "SRTPCryptographicContext"
+  static SRTPBatchCryptographicContext* createNew(SRTPCipherSuite cipherSuite, u_int8_t const* masterKeyPlusSalt,
+						  Boolean encryptSRTP = True, Boolean encryptSRTCP = True,
+						  Boolean useMKI = False, u_int32_t MKI = 0);
+      // "masterKeyPlusSalt" is 16+14 bytes (for "SRTP_SUITE_AES128_CM_HMAC_SHA1_80") or 16+12 bytes (for
+      // "SRTP_SUITE_AEAD_AES_128_GCM").  (With AES-CM, packets are always authenticated.)
+      // Returns NULL if OpenSSL doesn't support the ciphersuite.
+  virtual ~SRTPBatchCryptographicContext();
+
+  // The same functions as "SRTPCryptographicContext":
+  Boolean processIncomingSRTPPacket(u_int8_t* buffer, unsigned inPacketSize, unsigned& outPacketSize);
+  Boolean processIncomingSRTCPPacket(u_int8_t* buffer, unsigned inPacketSize, unsigned& outPacketSize);
+  Boolean processOutgoingSRTPPacket(u_int8_t* buffer, unsigned inPacketSize, unsigned& outPacketSize);
+  Boolean processOutgoingSRTCPPacket(u_int8_t* buffer, unsigned inPacketSize, unsigned& outPacketSize);
+
+  // Process a batch of packets (in order).  Each returns the number of packets that were processed OK.
+  unsigned processIncomingSRTPPackets(SRTPPacketBuffer* packets, unsigned numPackets);
+  unsigned processIncomingSRTCPPackets(SRTPPacketBuffer* packets, unsigned numPackets);
+  unsigned processOutgoingSRTPPackets(SRTPPacketBuffer* packets, unsigned numPackets);
+  unsigned processOutgoingSRTCPPackets(SRTPPacketBuffer* packets, unsigned numPackets);
+
+  SRTPCipherSuite cipherSuite() const { return fCipherSuite; }
+  unsigned srtpOverhead() const { return fMKILength + fAuthTagLength; }
+  unsigned srtcpOverhead() const { return 4 + fMKILength + fAuthTagLength; }
+
+protected:
+  SRTPBatchCryptographicContext(SRTPCipherSuite cipherSuite, u_int8_t const* masterKeyPlusSalt,
+				Boolean encryptSRTP, Boolean encryptSRTCP, Boolean useMKI, u_int32_t MKI);
+      // called only by createNew()
+
+private:
+  struct SessionKeys {
+    u_int8_t cipherKey[SRTP_CIPHER_KEY_LENGTH];
+    u_int8_t salt[SRTP_CIPHER_SALT_LENGTH]; // only the first 12 bytes are used for AES-GCM
+    u_int8_t authKey[SRTP_AUTH_KEY_LENGTH]; // used only for AES-CM
+    EVP_CIPHER_CTX* encryptCtx; // AES-ECB (for AES-CM key streams), or AES-GCM
+    EVP_CIPHER_CTX* decryptCtx; // AES-GCM only
+    EVP_MD_CTX* innerHashCtx; // SHA-1 state after hashing (authKey ^ ipad)
+    EVP_MD_CTX* outerHashCtx; // SHA-1 state after hashing (authKey ^ opad)
+  };
+
+  struct CryptJob { // a region of a packet, to be XORed with a AES-CM key stream
+    u_int8_t* data;
+    unsigned numBytes;
+    u_int8_t iv[16];
+  };
+
+  Boolean initialize();
+  Boolean initializeSessionKeys(SessionKeys& keys, u_int8_t labelBase);
+  static void freeSessionKeys(SessionKeys& keys);
+  void deriveSingleKey(EVP_CIPHER_CTX* masterCtx, u_int8_t label, unsigned resultKeyLength, u_int8_t* resultKey) const;
+
+  static unsigned rtpHeaderSize(u_int8_t const* buffer, unsigned packetSize);
+      // returns 0 if the packet is malformed
+  static u_int32_t getU32(u_int8_t const* p) { return (p[0]<<24)|(p[1]<<16)|(p[2]<<8)|p[3]; }
+  static void putU32(u_int8_t* p, u_int32_t v) { p[0] = v>>24; p[1] = v>>16; p[2] = v>>8; p[3] = v; }
+
+  // AES-CM:
+  CryptJob* addCryptJob(SessionKeys const& keys, u_int32_t ssrc, u_int64_t index, u_int8_t* data, unsigned numBytes);
+  Boolean runCryptJobs(SessionKeys& keys);
+  Boolean generateAuthenticationTag(SessionKeys& keys, u_int8_t const* data, unsigned numBytes,
+				    u_int8_t const* roc, u_int8_t* resultTag);
+      // "roc" (4 bytes) may be NULL.  "resultTag" must have space for SHA1_DIGEST_LEN bytes.
+  Boolean verifyAuthenticationTag(SessionKeys& keys, u_int8_t const* data, unsigned numBytes,
+				  u_int8_t const* roc, u_int8_t const* tag);
+
+  // AES-GCM:
+  Boolean gcmSeal(SessionKeys& keys, u_int8_t const* iv, u_int8_t const* aad, unsigned aadSize,
+		  u_int8_t const* aad2, unsigned aad2Size, u_int8_t* data, unsigned numDataBytes, u_int8_t* resultTag);
+  Boolean gcmOpen(SessionKeys& keys, u_int8_t const* iv, u_int8_t const* aad, unsigned aadSize,
+		  u_int8_t const* aad2, unsigned aad2Size, u_int8_t* data, unsigned numDataBytes, u_int8_t const* tag);
+  void gcmSRTPIV(u_int32_t ssrc, u_int32_t roc, u_int16_t seqNum, u_int8_t* iv) const;
+  void gcmSRTCPIV(u_int32_t ssrc, u_int32_t srtcpIndex, u_int8_t* iv) const;
+
+  u_int32_t estimateReceptionROC(u_int16_t seqNum) const;
+  void updateReceptionState(u_int16_t seqNum, u_int32_t roc);
+  u_int32_t nextSendingROC(u_int16_t seqNum);
+
+  Boolean outgoingSRTP(SRTPPacketBuffer& packet, Boolean deferEncryption);
+  Boolean outgoingSRTCP(SRTPPacketBuffer& packet, Boolean deferEncryption);
+  Boolean incomingSRTP(SRTPPacketBuffer& packet, Boolean deferDecryption);
+  Boolean incomingSRTCP(SRTPPacketBuffer& packet, Boolean deferDecryption);
+  Boolean finishOutgoingSRTP(SRTPPacketBuffer& packet);
+  Boolean finishOutgoingSRTCP(SRTPPacketBuffer& packet);
+
+private:
+  SRTPCipherSuite fCipherSuite;
+  u_int8_t fMasterKeyPlusSalt[SRTP_CIPHER_KEY_LENGTH + SRTP_CIPHER_SALT_LENGTH];
+  Boolean fEncryptSRTP, fEncryptSRTCP, fAuthenticate;
+  unsigned fMKILength, fAuthTagLength;
+  u_int32_t fMKI;
+
+  SessionKeys fSRTPKeys, fSRTCPKeys;
+  EVP_MD_CTX* fHashCtx; // scratch
+
+  // Pending AES-CM work (within a batch):
+  CryptJob* fCryptJobs;
+  unsigned fNumCryptJobs, fMaxNumCryptJobs;
+  u_int8_t* fKeyStream; // counter blocks, encrypted in place
+  unsigned fKeyStreamSize;
+
+  // State used for handling the reception of SRTP packets:
+  Boolean fHaveReceivedSRTPPackets;
+  u_int16_t fPreviousHighRTPSeqNum;
+  u_int32_t fReceptionROC; // rollover counter
+
+  // State used for handling the sending of SRTP packets:
+  Boolean fHaveSentSRTPPackets;
+  u_int16_t fPreviousSentRTPSeqNum;
+  u_int32_t fSendingROC;
+
+  // State used for handling the sending of SRTCP packets:
+  u_int32_t fSRTCPIndex;
+};
+
+
+////////// Implementation //////////
+
+inline SRTPBatchCryptographicContext* SRTPBatchCryptographicContext::createNew(MIKEYState const& mikeyState) {
+  SRTPBatchCryptographicContext* context
+    = new SRTPBatchCryptographicContext(SRTP_SUITE_AES128_CM_HMAC_SHA1_80, mikeyState.keyData(),
+					mikeyState.encryptSRTP(), mikeyState.encryptSRTCP(), True, mikeyState.MKI());
+  context->fAuthenticate = mikeyState.useAuthentication();
+  if (!context->fAuthenticate) context->fMKILength = context->fAuthTagLength = 0;
+  if (!context->initialize()) {
+    delete context;
+    return NULL;
+  }
+  return context;
+}
+
+inline SRTPBatchCryptographicContext*
+SRTPBatchCryptographicContext::createNew(SRTPCipherSuite cipherSuite, u_int8_t const* masterKeyPlusSalt,
+					 Boolean encryptSRTP, Boolean encryptSRTCP, Boolean useMKI, u_int32_t MKI) {
+  SRTPBatchCryptographicContext* context
+    = new SRTPBatchCryptographicContext(cipherSuite, masterKeyPlusSalt, encryptSRTP, encryptSRTCP, useMKI, MKI);
+  if (!context->initialize()) {
+    delete context;
+    return NULL;
+  }
+  return context;
+}
+
+inline SRTPBatchCryptographicContext
+::SRTPBatchCryptographicContext(SRTPCipherSuite cipherSuite, u_int8_t const* masterKeyPlusSalt,
+				Boolean encryptSRTP, Boolean encryptSRTCP, Boolean useMKI, u_int32_t MKI)
+  : fCipherSuite(cipherSuite), fEncryptSRTP(encryptSRTP), fEncryptSRTCP(encryptSRTCP), fAuthenticate(True),
+    fMKILength(useMKI ? SRTP_MKI_LENGTH : 0),
+    fAuthTagLength(cipherSuite == SRTP_SUITE_AEAD_AES_128_GCM ? SRTP_GCM_AUTH_TAG_LENGTH : SRTP_AUTH_TAG_LENGTH),
+    fMKI(MKI), fHashCtx(NULL),
+    fCryptJobs(NULL), fNumCryptJobs(0), fMaxNumCryptJobs(0), fKeyStream(NULL), fKeyStreamSize(0),
+    fHaveReceivedSRTPPackets(False), fPreviousHighRTPSeqNum(0), fReceptionROC(0),
+    fHaveSentSRTPPackets(False), fPreviousSentRTPSeqNum(0), fSendingROC(0), fSRTCPIndex(0) {
+  // For AES-GCM, the (96-bit) master salt is followed by zero bits, to make a 112-bit salt for key derivation:
+  memset(fMasterKeyPlusSalt, 0, sizeof fMasterKeyPlusSalt);
+  unsigned saltLength = cipherSuite == SRTP_SUITE_AEAD_AES_128_GCM ? SRTP_GCM_CIPHER_SALT_LENGTH : SRTP_CIPHER_SALT_LENGTH;
+  memmove(fMasterKeyPlusSalt, masterKeyPlusSalt, SRTP_CIPHER_KEY_LENGTH + saltLength);
+
+  memset(&fSRTPKeys, 0, sizeof fSRTPKeys);
+  memset(&fSRTCPKeys, 0, sizeof fSRTCPKeys);
+}
+
+inline SRTPBatchCryptographicContext::~SRTPBatchCryptographicContext() {
+  freeSessionKeys(fSRTPKeys);
+  freeSessionKeys(fSRTCPKeys);
+  EVP_MD_CTX_free(fHashCtx);
+  delete[] fCryptJobs;
+  delete[] fKeyStream;
+  OPENSSL_cleanse(fMasterKeyPlusSalt, sizeof fMasterKeyPlusSalt);
+}
+
+inline void SRTPBatchCryptographicContext::freeSessionKeys(SessionKeys& keys) {
+  EVP_CIPHER_CTX_free(keys.encryptCtx);
+  EVP_CIPHER_CTX_free(keys.decryptCtx);
+  EVP_MD_CTX_free(keys.innerHashCtx);
+  EVP_MD_CTX_free(keys.outerHashCtx);
+  OPENSSL_cleanse(&keys, sizeof keys);
+}
+
+inline Boolean SRTPBatchCryptographicContext::initialize() {
+  fHashCtx = EVP_MD_CTX_new();
+  if (fHashCtx == NULL) return False;
+
+  // Key derivation labels (RFC 3711, section 4.3.1): 0,1,2 for SRTP; 3,4,5 for SRTCP:
+  return initializeSessionKeys(fSRTPKeys, 0x00) && initializeSessionKeys(fSRTCPKeys, 0x03);
+}
+
+inline void SRTPBatchCryptographicContext
+::deriveSingleKey(EVP_CIPHER_CTX* masterCtx, u_int8_t label, unsigned resultKeyLength, u_int8_t* resultKey) const {
+  // The AES-CM PRF (RFC 3711, section 4.3.3), with a key derivation rate of 0: the key stream, for
+  // IV = (master salt XOR (label << 48)) << 16:
+  u_int8_t counterBlocks[3*16]; // enough for a 160-bit key
+  unsigned numBlocks = (resultKeyLength + 15)/16;
+  for (unsigned i = 0; i < numBlocks; ++i) {
+    u_int8_t* block = &counterBlocks[16*i];
+    memmove(block, &fMasterKeyPlusSalt[SRTP_CIPHER_KEY_LENGTH], SRTP_CIPHER_SALT_LENGTH);
+    block[7] ^= label;
+    block[14] = 0; block[15] = (u_int8_t)i;
+  }
+
+  int len;
+  EVP_EncryptUpdate(masterCtx, counterBlocks, &len, counterBlocks, 16*numBlocks);
+  memmove(resultKey, counterBlocks, resultKeyLength);
+  OPENSSL_cleanse(counterBlocks, sizeof counterBlocks);
+}
+
+inline Boolean SRTPBatchCryptographicContext::initializeSessionKeys(SessionKeys& keys, u_int8_t labelBase) {
+  EVP_CIPHER_CTX* masterCtx = EVP_CIPHER_CTX_new();
+  if (masterCtx == NULL) return False;
+  if (EVP_EncryptInit_ex(masterCtx, EVP_aes_128_ecb(), NULL, fMasterKeyPlusSalt, NULL) != 1) {
+    EVP_CIPHER_CTX_free(masterCtx);
+    return False;
+  }
+  EVP_CIPHER_CTX_set_padding(masterCtx, 0);
+
+  deriveSingleKey(masterCtx, labelBase, SRTP_CIPHER_KEY_LENGTH, keys.cipherKey);
+  deriveSingleKey(masterCtx, labelBase + 2, SRTP_CIPHER_SALT_LENGTH, keys.salt);
+  deriveSingleKey(masterCtx, labelBase + 1, SRTP_AUTH_KEY_LENGTH, keys.authKey);
+  EVP_CIPHER_CTX_free(masterCtx);
+
+  keys.encryptCtx = EVP_CIPHER_CTX_new();
+  if (keys.encryptCtx == NULL) return False;
+
+  if (fCipherSuite == SRTP_SUITE_AEAD_AES_128_GCM) {
+    // We set the key here (once); each packet sets just its IV:
+    keys.decryptCtx = EVP_CIPHER_CTX_new();
+    return keys.decryptCtx != NULL
+      && EVP_EncryptInit_ex(keys.encryptCtx, EVP_aes_128_gcm(), NULL, keys.cipherKey, NULL) == 1
+      && EVP_DecryptInit_ex(keys.decryptCtx, EVP_aes_128_gcm(), NULL, keys.cipherKey, NULL) == 1;
+  }
+
+  // AES-CM key streams are made by encrypting (with AES-ECB) a sequence of counter blocks:
+  if (EVP_EncryptInit_ex(keys.encryptCtx, EVP_aes_128_ecb(), NULL, keys.cipherKey, NULL) != 1) return False;
+  EVP_CIPHER_CTX_set_padding(keys.encryptCtx, 0);
+
+  // HMAC-SHA1 (RFC 2104): precompute the hash states after the (padded) key has been hashed:
+  u_int8_t pad[HMAC_BLOCK_SIZE];
+  keys.innerHashCtx = EVP_MD_CTX_new();
+  keys.outerHashCtx = EVP_MD_CTX_new();
+  if (keys.innerHashCtx == NULL || keys.outerHashCtx == NULL) return False;
+
+  memset(pad, 0x36, sizeof pad);
+  for (unsigned i = 0; i < SRTP_AUTH_KEY_LENGTH; ++i) pad[i] ^= keys.authKey[i];
+  if (EVP_DigestInit_ex(keys.innerHashCtx, EVP_sha1(), NULL) != 1
+      || EVP_DigestUpdate(keys.innerHashCtx, pad, sizeof pad) != 1) return False;
+
+  memset(pad, 0x5C, sizeof pad);
+  for (unsigned i = 0; i < SRTP_AUTH_KEY_LENGTH; ++i) pad[i] ^= keys.authKey[i];
+  if (EVP_DigestInit_ex(keys.outerHashCtx, EVP_sha1(), NULL) != 1
+      || EVP_DigestUpdate(keys.outerHashCtx, pad, sizeof pad) != 1) return False;
+
+  OPENSSL_cleanse(pad, sizeof pad);
+  return True;
+}
+
+inline unsigned SRTPBatchCryptographicContext::rtpHeaderSize(u_int8_t const* buffer, unsigned packetSize) {
+  if (packetSize < 12) return 0; // For SRTP, 12 is the minimum size
+
+  unsigned headerSize = 12 + (buffer[0]&0x0F)*4; // # CSRC identifiers
+  if ((buffer[0]&0x10) != 0) {
+    // There's a RTP extension header.  Add its size:
+    if (packetSize < headerSize + 4) return 0;
+    u_int16_t hdrExtLength = (buffer[headerSize+2]<<8)|buffer[headerSize+3];
+    headerSize += 4 + hdrExtLength*4;
+  }
+  return headerSize <= packetSize ? headerSize : 0;
+}
+
+// AES-CM //
+
+inline SRTPBatchCryptographicContext::CryptJob*
+SRTPBatchCryptographicContext::addCryptJob(SessionKeys const& keys, u_int32_t ssrc, u_int64_t index,
+					   u_int8_t* data, unsigned numBytes) {
+  if (fNumCryptJobs == fMaxNumCryptJobs) {
+    unsigned newMax = fMaxNumCryptJobs == 0 ? 32 : 2*fMaxNumCryptJobs;
+    CryptJob* newJobs = new CryptJob[newMax];
+    if (fNumCryptJobs > 0) memmove(newJobs, fCryptJobs, fNumCryptJobs*sizeof (CryptJob));
+    delete[] fCryptJobs;
+    fCryptJobs = newJobs;
+    fMaxNumCryptJobs = newMax;
+  }
+
+  // The IV (RFC 3711, section 4.1.1) is (salt << 16) XOR (SSRC << 64) XOR (index << 16):
+  CryptJob* job = &fCryptJobs[fNumCryptJobs++];
+  job->data = data;
+  job->numBytes = numBytes;
+  memmove(job->iv, keys.salt, SRTP_CIPHER_SALT_LENGTH);
+  job->iv[14] = job->iv[15] = 0;
+  job->iv[4] ^= ssrc>>24; job->iv[5] ^= ssrc>>16; job->iv[6] ^= ssrc>>8; job->iv[7] ^= ssrc;
+  for (unsigned i = 0; i < 6; ++i) job->iv[13-i] ^= (u_int8_t)(index>>(8*i));
+  return job;
+}
+
+inline Boolean SRTPBatchCryptographicContext::runCryptJobs(SessionKeys& keys) {
+  if (fNumCryptJobs == 0) return True;
+
+  // Lay out every job's counter blocks, one after another:
+  unsigned totalSize = 0;
+  for (unsigned j = 0; j < fNumCryptJobs; ++j) totalSize += (fCryptJobs[j].numBytes + 15)&~15u;
+  if (totalSize > fKeyStreamSize) {
+    delete[] fKeyStream;
+    fKeyStream = new u_int8_t[totalSize];
+    fKeyStreamSize = totalSize;
+  }
+
+  u_int8_t* block = fKeyStream;
+  for (unsigned j = 0; j < fNumCryptJobs; ++j) {
+    CryptJob const& job = fCryptJobs[j];
+    unsigned numBlocks = (job.numBytes + 15)/16;
+    for (unsigned i = 0; i < numBlocks; ++i, block += 16) {
+      memmove(block, job.iv, 14);
+      block[14] = (u_int8_t)(i>>8); block[15] = (u_int8_t)i;
+    }
+  }
+
+  // Encrypt all of the counter blocks at once:
+  int len;
+  Boolean success = EVP_EncryptUpdate(keys.encryptCtx, fKeyStream, &len, fKeyStream, (int)totalSize) == 1;
+
+  // Then XOR the key streams into the data:
+  u_int8_t const* keyStream = fKeyStream;
+  for (unsigned j = 0; success && j < fNumCryptJobs; ++j) {
+    CryptJob const& job = fCryptJobs[j];
+    for (unsigned i = 0; i < job.numBytes; ++i) job.data[i] ^= keyStream[i];
+    keyStream += (job.numBytes + 15)&~15u;
+  }
+
+  fNumCryptJobs = 0;
+  return success;
+}
+
+inline Boolean SRTPBatchCryptographicContext
+::generateAuthenticationTag(SessionKeys& keys, u_int8_t const* data, unsigned numBytes,
+			    u_int8_t const* roc, u_int8_t* resultTag) {
+  u_int8_t innerDigest[SHA1_DIGEST_LEN];
+  unsigned digestLen;
+  return EVP_MD_CTX_copy_ex(fHashCtx, keys.innerHashCtx) == 1
+    && EVP_DigestUpdate(fHashCtx, data, numBytes) == 1
+    && (roc == NULL || EVP_DigestUpdate(fHashCtx, roc, 4) == 1)
+    && EVP_DigestFinal_ex(fHashCtx, innerDigest, &digestLen) == 1
+    && EVP_MD_CTX_copy_ex(fHashCtx, keys.outerHashCtx) == 1
+    && EVP_DigestUpdate(fHashCtx, innerDigest, sizeof innerDigest) == 1
+    && EVP_DigestFinal_ex(fHashCtx, resultTag, &digestLen) == 1;
+}
+
+inline Boolean SRTPBatchCryptographicContext
+::verifyAuthenticationTag(SessionKeys& keys, u_int8_t const* data, unsigned numBytes,
+			  u_int8_t const* roc, u_int8_t const* tag) {
+  u_int8_t computedTag[SHA1_DIGEST_LEN];
+  return generateAuthenticationTag(keys, data, numBytes, roc, computedTag)
+    && CRYPTO_memcmp(computedTag, tag, SRTP_AUTH_TAG_LENGTH) == 0;
+}
+
+// AES-GCM (RFC 7714) //
+
+inline void SRTPBatchCryptographicContext::gcmSRTPIV(u_int32_t ssrc, u_int32_t roc, u_int16_t seqNum, u_int8_t* iv) const {
+  // IV = (00 00 || SSRC || ROC || SEQ) XOR salt:
+  iv[0] = iv[1] = 0;
+  putU32(&iv[2], ssrc);
+  putU32(&iv[6], roc);
+  iv[10] = seqNum>>8; iv[11] = (u_int8_t)seqNum;
+  for (unsigned i = 0; i < SRTP_GCM_CIPHER_SALT_LENGTH; ++i) iv[i] ^= fSRTPKeys.salt[i];
+}
+
+inline void SRTPBatchCryptographicContext::gcmSRTCPIV(u_int32_t ssrc, u_int32_t srtcpIndex, u_int8_t* iv) const {
+  // IV = (00 00 || SSRC || 00 00 || 0 || SRTCP index) XOR salt:
+  iv[0] = iv[1] = 0;
+  putU32(&iv[2], ssrc);
+  iv[6] = iv[7] = 0;
+  putU32(&iv[8], srtcpIndex&0x7FFFFFFF);
+  for (unsigned i = 0; i < SRTP_GCM_CIPHER_SALT_LENGTH; ++i) iv[i] ^= fSRTCPKeys.salt[i];
+}
+
+inline Boolean SRTPBatchCryptographicContext
+::gcmSeal(SessionKeys& keys, u_int8_t const* iv, u_int8_t const* aad, unsigned aadSize,
+	  u_int8_t const* aad2, unsigned aad2Size, u_int8_t* data, unsigned numDataBytes, u_int8_t* resultTag) {
+  EVP_CIPHER_CTX* ctx = keys.encryptCtx;
+  int len;
+  return EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv) == 1
+    && EVP_EncryptUpdate(ctx, NULL, &len, aad, (int)aadSize) == 1
+    && (aad2Size == 0 || EVP_EncryptUpdate(ctx, NULL, &len, aad2, (int)aad2Size) == 1)
+    && (numDataBytes == 0 || EVP_EncryptUpdate(ctx, data, &len, data, (int)numDataBytes) == 1)
+    && EVP_EncryptFinal_ex(ctx, data + numDataBytes, &len) == 1
+    && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, SRTP_GCM_AUTH_TAG_LENGTH, resultTag) == 1;
+}
+
+inline Boolean SRTPBatchCryptographicContext
+::gcmOpen(SessionKeys& keys, u_int8_t const* iv, u_int8_t const* aad, unsigned aadSize,
+	  u_int8_t const* aad2, unsigned aad2Size, u_int8_t* data, unsigned numDataBytes, u_int8_t const* tag) {
+  EVP_CIPHER_CTX* ctx = keys.decryptCtx;
+  int len;
+  return EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, iv) == 1
+    && EVP_DecryptUpdate(ctx, NULL, &len, aad, (int)aadSize) == 1
+    && (aad2Size == 0 || EVP_DecryptUpdate(ctx, NULL, &len, aad2, (int)aad2Size) == 1)
+    && (numDataBytes == 0 || EVP_DecryptUpdate(ctx, data, &len, data, (int)numDataBytes) == 1)
+    && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, SRTP_GCM_AUTH_TAG_LENGTH, (void*)tag) == 1
+    && EVP_DecryptFinal_ex(ctx, data + numDataBytes, &len) == 1;
+}
+
+// Rollover counters //
+
+inline u_int32_t SRTPBatchCryptographicContext::estimateReceptionROC(u_int16_t seqNum) const {
+  // RFC 3711, section 3.3.1:
+  if (!fHaveReceivedSRTPPackets) return 0;
+
+  if (fPreviousHighRTPSeqNum < 0x8000) {
+    return seqNum > fPreviousHighRTPSeqNum && seqNum - fPreviousHighRTPSeqNum > 0x8000 ? fReceptionROC - 1 : fReceptionROC;
+  } else {
+    return fPreviousHighRTPSeqNum - 0x8000 > seqNum ? fReceptionROC + 1 : fReceptionROC;
+  }
+}
+
+inline void SRTPBatchCryptographicContext::updateReceptionState(u_int16_t seqNum, u_int32_t roc) {
+  // (called only after the packet has been authenticated)
+  if (!fHaveReceivedSRTPPackets) {
+    fHaveReceivedSRTPPackets = True;
+    fPreviousHighRTPSeqNum = seqNum;
+    fReceptionROC = roc;
+  } else if (roc == fReceptionROC + 1 || (roc == fReceptionROC && seqNum > fPreviousHighRTPSeqNum)) {
+    fPreviousHighRTPSeqNum = seqNum;
+    fReceptionROC = roc;
+  }
+}
+
+inline u_int32_t SRTPBatchCryptographicContext::nextSendingROC(u_int16_t seqNum) {
+  if (!fHaveSentSRTPPackets) {
+    fHaveSentSRTPPackets = True;
+  } else if (seqNum < fPreviousSentRTPSeqNum && fPreviousSentRTPSeqNum - seqNum > 0x8000) {
+    ++fSendingROC; // the sequence number has wrapped around
+  }
+  fPreviousSentRTPSeqNum = seqNum;
+  return fSendingROC;
+}
+
+// Per-packet processing //
+
+inline Boolean SRTPBatchCryptographicContext::outgoingSRTP(SRTPPacketBuffer& packet, Boolean deferEncryption) {
+  u_int8_t* buffer = packet.buffer;
+  unsigned headerSize = rtpHeaderSize(buffer, packet.size);
+  if (headerSize == 0) return False;
+
+  u_int16_t seqNum = (buffer[2]<<8)|buffer[3];
+  u_int32_t ssrc = getU32(&buffer[8]);
+  u_int32_t roc = nextSendingROC(seqNum);
+
+  if (fCipherSuite == SRTP_SUITE_AEAD_AES_128_GCM) {
+    // The whole packet is done here.  (The RTP header, and any unencrypted payload, are 'associated data'.)
+    u_int8_t iv[SRTP_GCM_CIPHER_SALT_LENGTH];
+    gcmSRTPIV(ssrc, roc, seqNum, iv);
+    unsigned numPayloadBytes = packet.size - headerSize;
+    Boolean ok = fEncryptSRTP
+      ? gcmSeal(fSRTPKeys, iv, buffer, headerSize, NULL, 0, &buffer[headerSize], numPayloadBytes, &buffer[packet.size])
+      : gcmSeal(fSRTPKeys, iv, buffer, packet.size, NULL, 0, NULL, 0, &buffer[packet.size]);
+    if (!ok) return False;
+    packet.size += SRTP_GCM_AUTH_TAG_LENGTH;
+    if (fMKILength > 0) { putU32(&buffer[packet.size], fMKI); packet.size += fMKILength; }
+    return True;
+  }
+
+  if (fEncryptSRTP) {
+    addCryptJob(fSRTPKeys, ssrc, ((u_int64_t)roc<<16)|seqNum, &buffer[headerSize], packet.size - headerSize);
+    if (!deferEncryption && !runCryptJobs(fSRTPKeys)) return False;
+  }
+  if (fAuthenticate) putU32(&buffer[packet.size], roc); // for now; used by "finishOutgoingSRTP()"
+  return True;
+}
+
+inline Boolean SRTPBatchCryptographicContext::finishOutgoingSRTP(SRTPPacketBuffer& packet) {
+  // For AES-CM (once the packet has been encrypted): append the MKI and authentication tag.  The tag covers the packet,
+  // followed by the ROC (which we put just past the end of the packet, and which the MKI then replaces):
+  if (fCipherSuite == SRTP_SUITE_AEAD_AES_128_GCM || !fAuthenticate) return True;
+
+  u_int8_t* buffer = packet.buffer;
+  u_int8_t tag[SHA1_DIGEST_LEN];
+  if (!generateAuthenticationTag(fSRTPKeys, buffer, packet.size, &buffer[packet.size], tag)) return False;
+
+  if (fMKILength > 0) { putU32(&buffer[packet.size], fMKI); packet.size += fMKILength; }
+  memmove(&buffer[packet.size], tag, SRTP_AUTH_TAG_LENGTH);
+  packet.size += SRTP_AUTH_TAG_LENGTH;
+  return True;
+}
+
+inline Boolean SRTPBatchCryptographicContext::outgoingSRTCP(SRTPPacketBuffer& packet, Boolean deferEncryption) {
+  u_int8_t* buffer = packet.buffer;
+  if (packet.size < 8) return False; // For SRTCP, 8 is the minimum size
+
+  u_int32_t ssrc = getU32(&buffer[4]);
+  u_int32_t srtcpIndex = fSRTCPIndex;
+  fSRTCPIndex = (fSRTCPIndex + 1)&0x7FFFFFFF;
+  u_int32_t eBitPlusIndex = (fEncryptSRTCP ? 0x80000000 : 0) | srtcpIndex;
+
+  if (fCipherSuite == SRTP_SUITE_AEAD_AES_128_GCM) {
+    // The 'associated data' is the RTCP header (plus any unencrypted payload), then the E-bit and SRTCP index.
+    // The output is: header, encrypted payload, tag, E-bit and SRTCP index, then (optionally) the MKI:
+    u_int8_t iv[SRTP_GCM_CIPHER_SALT_LENGTH];
+    gcmSRTCPIV(ssrc, srtcpIndex, iv);
+    u_int8_t indexBytes[4];
+    putU32(indexBytes, eBitPlusIndex);
+    Boolean ok = fEncryptSRTCP
+      ? gcmSeal(fSRTCPKeys, iv, buffer, 8, indexBytes, 4, &buffer[8], packet.size - 8, &buffer[packet.size])
+      : gcmSeal(fSRTCPKeys, iv, buffer, packet.size, indexBytes, 4, NULL, 0, &buffer[packet.size]);
+    if (!ok) return False;
+    packet.size += SRTP_GCM_AUTH_TAG_LENGTH;
+    putU32(&buffer[packet.size], eBitPlusIndex); packet.size += 4;
+    if (fMKILength > 0) { putU32(&buffer[packet.size], fMKI); packet.size += fMKILength; }
+    return True;
+  }
+
+  if (fEncryptSRTCP) {
+    addCryptJob(fSRTCPKeys, ssrc, srtcpIndex, &buffer[8], packet.size - 8);
+    if (!deferEncryption && !runCryptJobs(fSRTCPKeys)) return False;
+  }
+  putU32(&buffer[packet.size], eBitPlusIndex);
+  packet.size += 4;
+  return True;
+}
+
+inline Boolean SRTPBatchCryptographicContext::finishOutgoingSRTCP(SRTPPacketBuffer& packet) {
+  // For AES-CM: the tag covers the packet up to (and including) the E-bit and SRTCP index, but not the MKI:
+  if (fCipherSuite == SRTP_SUITE_AEAD_AES_128_GCM) return True;
+
+  u_int8_t* buffer = packet.buffer;
+  u_int8_t tag[SHA1_DIGEST_LEN];
+  if (fAuthenticate && !generateAuthenticationTag(fSRTCPKeys, buffer, packet.size, NULL, tag)) return False;
+
+  if (fMKILength > 0) { putU32(&buffer[packet.size], fMKI); packet.size += fMKILength; }
+  if (fAuthenticate) {
+    memmove(&buffer[packet.size], tag, SRTP_AUTH_TAG_LENGTH);
+    packet.size += SRTP_AUTH_TAG_LENGTH;
+  }
+  return True;
+}
+
+inline Boolean SRTPBatchCryptographicContext::incomingSRTP(SRTPPacketBuffer& packet, Boolean deferDecryption) {
+  u_int8_t* buffer = packet.buffer;
+  unsigned trailerSize = fMKILength + fAuthTagLength;
+  if (packet.size < 12 + trailerSize) return False;
+
+  unsigned size = packet.size - trailerSize; // the size of the RTP packet, once the MKI and tag are removed
+  unsigned headerSize = rtpHeaderSize(buffer, size);
+  if (headerSize == 0) return False;
+
+  u_int16_t seqNum = (buffer[2]<<8)|buffer[3];
+  u_int32_t ssrc = getU32(&buffer[8]);
+  u_int32_t roc = estimateReceptionROC(seqNum);
+
+  if (fCipherSuite == SRTP_SUITE_AEAD_AES_128_GCM) {
+    u_int8_t iv[SRTP_GCM_CIPHER_SALT_LENGTH];
+    gcmSRTPIV(ssrc, roc, seqNum, iv);
+    u_int8_t const* tag = &buffer[size];
+    Boolean ok = fEncryptSRTP
+      ? gcmOpen(fSRTPKeys, iv, buffer, headerSize, NULL, 0, &buffer[headerSize], size - headerSize, tag)
+      : gcmOpen(fSRTPKeys, iv, buffer, size, NULL, 0, NULL, 0, tag);
+    if (!ok) return False;
+  } else {
+    if (fAuthenticate) {
+      u_int8_t rocBytes[4];
+      putU32(rocBytes, roc);
+      if (!verifyAuthenticationTag(fSRTPKeys, buffer, size, rocBytes, &buffer[size + fMKILength])) return False;
+    }
+    if (fEncryptSRTP) {
+      addCryptJob(fSRTPKeys, ssrc, ((u_int64_t)roc<<16)|seqNum, &buffer[headerSize], size - headerSize);
+      if (!deferDecryption && !runCryptJobs(fSRTPKeys)) return False;
+    }
+  }
+
+  updateReceptionState(seqNum, roc);
+  packet.size = size;
+  return True;
+}
+
+inline Boolean SRTPBatchCryptographicContext::incomingSRTCP(SRTPPacketBuffer& packet, Boolean deferDecryption) {
+  u_int8_t* buffer = packet.buffer;
+  unsigned trailerSize = 4 + fMKILength + (fAuthenticate ? fAuthTagLength : 0);
+  if (packet.size < 8 + trailerSize) return False;
+
+  u_int8_t const* indexBytes = &buffer[packet.size - trailerSize + (fCipherSuite == SRTP_SUITE_AEAD_AES_128_GCM ? fAuthTagLength : 0)];
+  u_int32_t eBitPlusIndex = getU32(indexBytes);
+  Boolean isEncrypted = (eBitPlusIndex&0x80000000) != 0;
+  u_int32_t srtcpIndex = eBitPlusIndex&0x7FFFFFFF;
+  u_int32_t ssrc = getU32(&buffer[4]);
+  unsigned size = packet.size - trailerSize; // the size of the RTCP packet, once the trailer is removed
+
+  if (fCipherSuite == SRTP_SUITE_AEAD_AES_128_GCM) {
+    u_int8_t iv[SRTP_GCM_CIPHER_SALT_LENGTH];
+    gcmSRTCPIV(ssrc, srtcpIndex, iv);
+    u_int8_t const* tag = &buffer[size];
+    Boolean ok = isEncrypted
+      ? gcmOpen(fSRTCPKeys, iv, buffer, 8, indexBytes, 4, &buffer[8], size - 8, tag)
+      : gcmOpen(fSRTCPKeys, iv, buffer, size, indexBytes, 4, NULL, 0, tag);
+    if (!ok) return False;
+  } else {
+    if (fAuthenticate
+	&& !verifyAuthenticationTag(fSRTCPKeys, buffer, size + 4, NULL, &buffer[size + 4 + fMKILength])) return False;
+    if (isEncrypted) {
+      addCryptJob(fSRTCPKeys, ssrc, srtcpIndex, &buffer[8], size - 8);
+      if (!deferDecryption && !runCryptJobs(fSRTCPKeys)) return False;
+    }
+  }
+
+  packet.size = size;
+  return True;
+}
+
+inline Boolean SRTPBatchCryptographicContext
+::processIncomingSRTPPacket(u_int8_t* buffer, unsigned inPacketSize, unsigned& outPacketSize) {
+  SRTPPacketBuffer packet = { buffer, inPacketSize, False };
+  if (!incomingSRTP(packet, False)) return False;
+  outPacketSize = packet.size;
+  return True;
+}
+
+inline Boolean SRTPBatchCryptographicContext
+::processIncomingSRTCPPacket(u_int8_t* buffer, unsigned inPacketSize, unsigned& outPacketSize) {
+  SRTPPacketBuffer packet = { buffer, inPacketSize, False };
+  if (!incomingSRTCP(packet, False)) return False;
+  outPacketSize = packet.size;
+  return True;
+}
+
+inline Boolean SRTPBatchCryptographicContext
+::processOutgoingSRTPPacket(u_int8_t* buffer, unsigned inPacketSize, unsigned& outPacketSize) {
+  SRTPPacketBuffer packet = { buffer, inPacketSize, False };
+  if (!outgoingSRTP(packet, False) || !finishOutgoingSRTP(packet)) return False;
+  outPacketSize = packet.size;
+  return True;
+}
+
+inline Boolean SRTPBatchCryptographicContext
+::processOutgoingSRTCPPacket(u_int8_t* buffer, unsigned inPacketSize, unsigned& outPacketSize) {
+  SRTPPacketBuffer packet = { buffer, inPacketSize, False };
+  if (!outgoingSRTCP(packet, False) || !finishOutgoingSRTCP(packet)) return False;
+  outPacketSize = packet.size;
+  return True;
+}
+
+// Batch processing //
+
+inline unsigned SRTPBatchCryptographicContext::processOutgoingSRTPPackets(SRTPPacketBuffer* packets, unsigned numPackets) {
+  // First, work out each packet's key stream (doing AES-GCM packets completely); then encrypt them all at once;
+  // then add the authentication tags:
+  for (unsigned i = 0; i < numPackets; ++i) packets[i].ok = outgoingSRTP(packets[i], True);
+  Boolean cryptOK = runCryptJobs(fSRTPKeys);
+
+  unsigned numOK = 0;
+  for (unsigned i = 0; i < numPackets; ++i) {
+    if (packets[i].ok) packets[i].ok = cryptOK && finishOutgoingSRTP(packets[i]);
+    if (packets[i].ok) ++numOK;
+  }
+  return numOK;
+}
+
+inline unsigned SRTPBatchCryptographicContext::processOutgoingSRTCPPackets(SRTPPacketBuffer* packets, unsigned numPackets) {
+  for (unsigned i = 0; i < numPackets; ++i) packets[i].ok = outgoingSRTCP(packets[i], True);
+  Boolean cryptOK = runCryptJobs(fSRTCPKeys);
+
+  unsigned numOK = 0;
+  for (unsigned i = 0; i < numPackets; ++i) {
+    if (packets[i].ok) packets[i].ok = cryptOK && finishOutgoingSRTCP(packets[i]);
+    if (packets[i].ok) ++numOK;
+  }
+  return numOK;
+}
+
+inline unsigned SRTPBatchCryptographicContext::processIncomingSRTPPackets(SRTPPacketBuffer* packets, unsigned numPackets) {
+  // Authenticate each packet (in order, because this updates our rollover counter), then decrypt them all at once:
+  unsigned numOK = 0;
+  for (unsigned i = 0; i < numPackets; ++i) {
+    packets[i].ok = incomingSRTP(packets[i], True);
+    if (packets[i].ok) ++numOK;
+  }
+  if (!runCryptJobs(fSRTPKeys)) {
+    for (unsigned i = 0; i < numPackets; ++i) packets[i].ok = False;
+    return 0;
+  }
+  return numOK;
+}
+
+inline unsigned SRTPBatchCryptographicContext::processIncomingSRTCPPackets(SRTPPacketBuffer* packets, unsigned numPackets) {
+  unsigned numOK = 0;
+  for (unsigned i = 0; i < numPackets; ++i) {
+    packets[i].ok = incomingSRTCP(packets[i], True);
+    if (packets[i].ok) ++numOK;
+  }
+  if (!runCryptJobs(fSRTCPKeys)) {
+    for (unsigned i = 0; i < numPackets; ++i) packets[i].ok = False;
+    return 0;
+  }
+  return numOK;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,391 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A sink that relays the frames of a (live) source - running in one thread (e.g., a "ShardedRTSPServer" shard) -
+// to "ShardFrameRelaySource"s running in other threads.  Each frame is read once into a "SharedFrame", which is then
+// handed (by reference) to every relay source, rather than being copied once per thread.  Consumers that use
+// "getNextSharedFrame()" read the frame in place; only consumers that use "getNextFrame()" get their own copy.
+// Within each thread, a relay source would typically feed a "ShardFrameRelayReplicator": a "SharedFrameReplicator"
+// that takes each frame from the relay source by reference, so that the frame is not copied at all until (and unless)
+// a replica's consumer needs its own copy.
+// C++ header
+
+#ifndef _SHARD_FRAME_RELAY_HH
+#define _SHARD_FRAME_RELAY_HH
+
+#ifndef _MEDIA_SINK_HH
+#include "MediaSink.hh"
+#endif
+#ifndef _SHARED_FRAME_REPLICATOR_HH
+#include "SharedFrameReplicator.hh"
+#endif
+
+#if !defined(__WIN32__) && !defined(_WIN32)
+#include <pthread.h>
+
+class ShardFrameRelaySource; // forward
+
+class ShardFrameRelay: public MediaSink {
+public:
+  static ShardFrameRelay* createNew(UsageEnvironment& env, unsigned maxFrameSize);
+      // "env" is the environment (thread) of the upstream source; start relaying by calling "startPlaying()" on it.
+      // Note: The relay must outlive all of the relay sources that were created from it.
+
+  ShardFrameRelaySource* createRelaySource(UsageEnvironment& consumerEnv, unsigned maxQueuedFrames = 8);
+      // Creates a "FramedSource" (in "consumerEnv") that delivers each frame that we receive from now on.
+      // If more than "maxQueuedFrames" frames are waiting to be read by a relay source, the oldest one is dropped.
+      // This may be called from the consumer's thread.
+
+  unsigned numRelaySources() const;
+
+protected:
+  ShardFrameRelay(UsageEnvironment& env, unsigned maxFrameSize);
+      // called only by createNew()
+  virtual ~ShardFrameRelay();
+
+protected: // redefined virtual functions:
+  virtual Boolean continuePlaying();
+  virtual void stopPlaying();
+
+private:
+  friend class ShardFrameRelaySource;
+  void removeRelaySource(ShardFrameRelaySource* relaySource); // called from the relay source's thread
+
+  static void afterGettingFrame(void* clientData, unsigned frameSize,
+				unsigned numTruncatedBytes,
+				struct timeval presentationTime,
+				unsigned durationInMicroseconds);
+  void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes,
+			 struct timeval presentationTime, unsigned durationInMicroseconds);
+  static void onSourceClosure(void* clientData);
+  void onSourceClosure();
+
+private:
+  unsigned fMaxFrameSize;
+  SharedFramePool* fFramePool;
+  SharedFrame* fCurrentFrame; // the frame currently being read from our source
+  mutable pthread_mutex_t fLock; // protects "fRelaySources" (and each relay source's frame queue)
+  ShardFrameRelaySource* fRelaySources;
+  unsigned fNumRelaySources;
+};
+
+class ShardFrameRelaySource: public FramedSource {
+public:
+  typedef void (afterGettingSharedFrameFunc)(void* clientData, SharedFrame* frame);
+  void getNextSharedFrame(afterGettingSharedFrameFunc* afterGettingFunc, void* afterGettingClientData,
+			  onCloseFunc* onCloseFunc, void* onCloseClientData);
+      // An alternative to "getNextFrame()", for consumers that can read the frame in place (i.e., without copying it).
+      // The frame is passed to "afterGettingFunc" along with a reference; the consumer must call "release()" on it
+      // when it has finished with it.
+
+  unsigned numFramesDropped() const { return fNumFramesDropped; }
+
+protected:
+  ShardFrameRelaySource(UsageEnvironment& env, ShardFrameRelay& relay, unsigned maxQueuedFrames);
+      // called only by "ShardFrameRelay::createRelaySource()"
+  virtual ~ShardFrameRelaySource();
+
+protected: // redefined virtual functions:
+  virtual void doGetNextFrame();
+  virtual void doStopGettingFrames();
+
+private:
+  friend class ShardFrameRelay;
+  Boolean isAwaitingFrame() const { return isCurrentlyAwaitingData() || fAfterGettingSharedFunc != NULL; }
+  void enqueueFrame(SharedFrame* frame); // called from the relay's thread, with the relay's lock held
+  void noteRelayClosure(); // ditto
+
+  static void deliverFrame0(void* clientData);
+  void deliverFrame();
+
+private:
+  ShardFrameRelay& fRelay;
+  ShardFrameRelaySource* fNext; // in the relay's list of relay sources
+  EventTriggerId fEventTriggerId;
+  SharedFrame** fQueue; // a circular buffer of "fMaxQueuedFrames" frames
+  unsigned fMaxQueuedFrames, fQueueHead, fNumQueuedFrames;
+  unsigned fNumFramesDropped;
+  Boolean fRelayHasClosed;
+  afterGettingSharedFrameFunc* fAfterGettingSharedFunc; // non-NULL iff a "getNextSharedFrame()" request is pending
+  void* fAfterGettingSharedClientData;
+  onCloseFunc* fSharedOnCloseFunc;
+  void* fSharedOnCloseClientData;
+};
+
+class ShardFrameRelayReplicator: public SharedFrameReplicator {
+public:
+  static ShardFrameRelayReplicator* createNew(UsageEnvironment& env, ShardFrameRelaySource* inputSource,
+					      Boolean deleteWhenLastReplicaDies = True);
+      // "env" must be the relay source's environment (thread).
+
+protected:
+  ShardFrameRelayReplicator(UsageEnvironment& env, ShardFrameRelaySource* inputSource,
+			    Boolean deleteWhenLastReplicaDies);
+      // called only by createNew()
+
+protected: // redefined virtual functions:
+  virtual Boolean getNextInputFrame();
+};
+
+
+////////// Implementation //////////
+
+inline ShardFrameRelay* ShardFrameRelay::createNew(UsageEnvironment& env, unsigned maxFrameSize) {
+  return new ShardFrameRelay(env, maxFrameSize);
+}
+
+inline ShardFrameRelay::ShardFrameRelay(UsageEnvironment& env, unsigned maxFrameSize)
+  : MediaSink(env), fMaxFrameSize(maxFrameSize), fFramePool(SharedFramePool::createNew(maxFrameSize)),
+    fCurrentFrame(NULL),
+    fRelaySources(NULL), fNumRelaySources(0) {
+  pthread_mutex_init(&fLock, NULL);
+}
+
+inline ShardFrameRelay::~ShardFrameRelay() {
+  stopPlaying();
+  fFramePool->close(); // (relay sources in other threads may still hold some of its frames)
+  pthread_mutex_destroy(&fLock);
+}
+
+inline ShardFrameRelaySource* ShardFrameRelay
+::createRelaySource(UsageEnvironment& consumerEnv, unsigned maxQueuedFrames) {
+  if (maxQueuedFrames == 0) maxQueuedFrames = 1;
+  ShardFrameRelaySource* relaySource = new ShardFrameRelaySource(consumerEnv, *this, maxQueuedFrames);
+  if (relaySource->fEventTriggerId == 0) {
+    Medium::close(relaySource);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&fLock);
+  relaySource->fNext = fRelaySources;
+  fRelaySources = relaySource;
+  ++fNumRelaySources;
+  pthread_mutex_unlock(&fLock);
+
+  return relaySource;
+}
+
+inline unsigned ShardFrameRelay::numRelaySources() const {
+  pthread_mutex_lock(&fLock);
+  unsigned result = fNumRelaySources;
+  pthread_mutex_unlock(&fLock);
+
+  return result;
+}
+
+inline void ShardFrameRelay::removeRelaySource(ShardFrameRelaySource* relaySource) {
+  pthread_mutex_lock(&fLock);
+  for (ShardFrameRelaySource** ptr = &fRelaySources; *ptr != NULL; ptr = &(*ptr)->fNext) {
+    if (*ptr == relaySource) {
+      *ptr = relaySource->fNext;
+      --fNumRelaySources;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&fLock);
+}
+
+inline Boolean ShardFrameRelay::continuePlaying() {
+  if (fSource == NULL) return False;
+
+  if (fCurrentFrame == NULL) {
+    fCurrentFrame = fFramePool->getFrame();
+    if (fCurrentFrame == NULL) return False;
+  }
+  fSource->getNextFrame(fCurrentFrame->writableData(), fMaxFrameSize,
+			afterGettingFrame, this,
+			onSourceClosure, this);
+  return True;
+}
+
+inline void ShardFrameRelay::stopPlaying() {
+  MediaSink::stopPlaying();
+  if (fCurrentFrame != NULL) {
+    fCurrentFrame->release();
+    fCurrentFrame = NULL;
+  }
+}
+
+inline void ShardFrameRelay::afterGettingFrame(void* clientData, unsigned frameSize,
+					       unsigned numTruncatedBytes,
+					       struct timeval presentationTime,
+					       unsigned durationInMicroseconds) {
+  ((ShardFrameRelay*)clientData)->afterGettingFrame(frameSize, numTruncatedBytes,
+						    presentationTime, durationInMicroseconds);
+}
+
+inline void ShardFrameRelay::afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes,
+					       struct timeval presentationTime, unsigned durationInMicroseconds) {
+  SharedFrame* frame = fCurrentFrame;
+  fCurrentFrame = NULL; // we'll use another buffer for the next frame, because relay sources may still be reading this one
+  frame->setFrameParams(frameSize, numTruncatedBytes, presentationTime, durationInMicroseconds);
+
+  pthread_mutex_lock(&fLock);
+  for (ShardFrameRelaySource* relaySource = fRelaySources; relaySource != NULL; relaySource = relaySource->fNext) {
+    relaySource->enqueueFrame(frame);
+  }
+  pthread_mutex_unlock(&fLock);
+  frame->release(); // our own reference
+
+  continuePlaying();
+}
+
+inline void ShardFrameRelay::onSourceClosure(void* clientData) {
+  ((ShardFrameRelay*)clientData)->onSourceClosure();
+}
+
+inline void ShardFrameRelay::onSourceClosure() {
+  pthread_mutex_lock(&fLock);
+  for (ShardFrameRelaySource* relaySource = fRelaySources; relaySource != NULL; relaySource = relaySource->fNext) {
+    relaySource->noteRelayClosure();
+  }
+  pthread_mutex_unlock(&fLock);
+
+  MediaSink::onSourceClosure();
+}
+
+inline ShardFrameRelaySource
+::ShardFrameRelaySource(UsageEnvironment& env, ShardFrameRelay& relay, unsigned maxQueuedFrames)
+  : FramedSource(env), fRelay(relay), fNext(NULL),
+    fEventTriggerId(env.taskScheduler().createEventTrigger(deliverFrame0)),
+    fQueue(new SharedFrame*[maxQueuedFrames]), fMaxQueuedFrames(maxQueuedFrames), fQueueHead(0), fNumQueuedFrames(0),
+    fNumFramesDropped(0), fRelayHasClosed(False),
+    fAfterGettingSharedFunc(NULL), fAfterGettingSharedClientData(NULL),
+    fSharedOnCloseFunc(NULL), fSharedOnCloseClientData(NULL) {
+}
+
+inline ShardFrameRelaySource::~ShardFrameRelaySource() {
+  fRelay.removeRelaySource(this); // after this, the relay's thread will no longer trigger us
+
+  if (fEventTriggerId != 0) envir().taskScheduler().deleteEventTrigger(fEventTriggerId);
+  for (unsigned i = 0; i < fNumQueuedFrames; ++i) {
+    fQueue[(fQueueHead + i)%fMaxQueuedFrames]->release();
+  }
+  delete[] fQueue;
+}
+
+inline void ShardFrameRelaySource::enqueueFrame(SharedFrame* frame) {
+  if (fNumQueuedFrames == fMaxQueuedFrames) {
+    // We're too far behind; drop our oldest frame:
+    fQueue[fQueueHead]->release();
+    fQueueHead = (fQueueHead + 1)%fMaxQueuedFrames;
+    --fNumQueuedFrames;
+    ++fNumFramesDropped;
+  }
+
+  frame->addRef();
+  fQueue[(fQueueHead + fNumQueuedFrames)%fMaxQueuedFrames] = frame;
+  ++fNumQueuedFrames;
+
+  envir().taskScheduler().triggerEvent(fEventTriggerId, this);
+}
+
+inline void ShardFrameRelaySource::noteRelayClosure() {
+  fRelayHasClosed = True;
+  envir().taskScheduler().triggerEvent(fEventTriggerId, this);
+}
+
+inline void ShardFrameRelaySource
+::getNextSharedFrame(afterGettingSharedFrameFunc* afterGettingFunc, void* afterGettingClientData,
+		     onCloseFunc* onCloseFunc, void* onCloseClientData) {
+  if (isAwaitingFrame()) {
+    envir() << "ShardFrameRelaySource[" << this << "]::getNextSharedFrame(): attempting to read more than once at the same time!\n";
+    envir().internalError();
+  }
+
+  fAfterGettingSharedFunc = afterGettingFunc;
+  fAfterGettingSharedClientData = afterGettingClientData;
+  fSharedOnCloseFunc = onCloseFunc;
+  fSharedOnCloseClientData = onCloseClientData;
+  deliverFrame();
+}
+
+inline void ShardFrameRelaySource::doGetNextFrame() {
+  deliverFrame();
+}
+
+inline void ShardFrameRelaySource::doStopGettingFrames() {
+  fAfterGettingSharedFunc = NULL;
+}
+
+inline void ShardFrameRelaySource::deliverFrame0(void* clientData) {
+  ((ShardFrameRelaySource*)clientData)->deliverFrame();
+}
+
+inline void ShardFrameRelaySource::deliverFrame() {
+  if (!isAwaitingFrame()) return; // we're not ready for the frame yet; it stays queued
+
+  pthread_mutex_lock(&fRelay.fLock);
+  SharedFrame* frame = NULL;
+  if (fNumQueuedFrames > 0) {
+    frame = fQueue[fQueueHead];
+    fQueueHead = (fQueueHead + 1)%fMaxQueuedFrames;
+    --fNumQueuedFrames;
+  }
+  Boolean relayHasClosed = fRelayHasClosed;
+  pthread_mutex_unlock(&fRelay.fLock);
+
+  if (frame == NULL) {
+    if (relayHasClosed) {
+      if (fAfterGettingSharedFunc != NULL) {
+	fAfterGettingSharedFunc = NULL;
+	if (fSharedOnCloseFunc != NULL) (*fSharedOnCloseFunc)(fSharedOnCloseClientData);
+      } else {
+	handleClosure();
+      }
+    }
+    return; // we'll get triggered again when a frame arrives
+  }
+
+  if (fAfterGettingSharedFunc != NULL) {
+    // Hand our reference to the consumer, which reads the frame in place:
+    afterGettingSharedFrameFunc* afterGettingFunc = fAfterGettingSharedFunc;
+    fAfterGettingSharedFunc = NULL; // in case the consumer asks for another frame from within its callback
+    (*afterGettingFunc)(fAfterGettingSharedClientData, frame);
+  } else {
+    // Our downstream object needs the frame in its own buffer (at "fTo"):
+    fFrameSize = frame->copyTo(fTo, fMaxSize, fNumTruncatedBytes);
+    fPresentationTime = frame->presentationTime();
+    fDurationInMicroseconds = 0; // this is a live source
+    frame->release();
+
+    FramedSource::afterGetting(this);
+  }
+}
+
+// ShardFrameRelayReplicator //
+
+inline ShardFrameRelayReplicator* ShardFrameRelayReplicator
+::createNew(UsageEnvironment& env, ShardFrameRelaySource* inputSource, Boolean deleteWhenLastReplicaDies) {
+  return new ShardFrameRelayReplicator(env, inputSource, deleteWhenLastReplicaDies);
+}
+
+inline ShardFrameRelayReplicator
+::ShardFrameRelayReplicator(UsageEnvironment& env, ShardFrameRelaySource* inputSource,
+			    Boolean deleteWhenLastReplicaDies)
+  : SharedFrameReplicator(env, inputSource, 0/*we don't allocate frame buffers*/, deleteWhenLastReplicaDies) {
+}
+
+inline Boolean ShardFrameRelayReplicator::getNextInputFrame() {
+  ((ShardFrameRelaySource*)inputSource())->getNextSharedFrame(afterGettingSharedFrame, this,
+							       onSourceClosure, this);
+  return True;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,677 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A RTSP server that is 'sharded' across several threads.  Each shard is a complete "RTSPServer", with its own
+// "TaskScheduler" (and thus its own delay queue and socket handlers), running in its own thread.  All shards accept
+// connections from the same listening socket, so each new client connection is handled by exactly one shard.
+// A RTSP client session belongs to the shard that handled its "SETUP" command.  Clients normally send all of a
+// session's commands on the same TCP connection, but a command that arrives for the session on a different connection
+// (which may have been given to another shard) is rejected, with "454 Session Not Found", unless the kernel happened to
+// give that connection to the same shard.  RTSP-over-HTTP tunneling, however, is supported: see "HTTPTunnelingDirectory".
+// C++ header
+
+#ifndef _SHARDED_RTSP_SERVER_HH
+#define _SHARDED_RTSP_SERVER_HH
+
+#ifndef _RTSP_SERVER_HH
+#include "RTSPServer.hh"
+#endif
+#ifndef _BASIC_USAGE_ENVIRONMENT_HH
+#include "BasicUsageEnvironment.hh"
+#endif
+#ifndef _STRDUP_HH
+#include "strDup.hh"
+#endif
+
+#if !defined(__WIN32__) && !defined(_WIN32)
+#include <pthread.h>
+
+////////// ServerMediaSessionCatalog //////////
+
+// Because a "ServerMediaSession" (like any "Medium") belongs to a single "UsageEnvironment", shards cannot share
+// "ServerMediaSession" objects.  Instead, they share a (read-mostly, thread-safe) catalog of stream names, each with a
+// function that creates the corresponding "ServerMediaSession" in a given shard's environment, on first lookup.
+
+typedef ServerMediaSession* serverMediaSessionCreationFunc(UsageEnvironment& env, char const* streamName,
+							    void* clientData);
+
+class ServerMediaSessionCatalog {
+public:
+  ServerMediaSessionCatalog();
+  virtual ~ServerMediaSessionCatalog();
+
+  // These may be called from any thread:
+  void addStream(char const* streamName, serverMediaSessionCreationFunc* creationFunc, void* clientData);
+      // (Replaces any existing entry with the same name.)
+  Boolean removeStream(char const* streamName);
+      // Removes the entry, so that it can no longer be accessed by new clients.  (Existing client sessions continue.)
+  Boolean lookupStream(char const* streamName,
+		       serverMediaSessionCreationFunc*& creationFunc, void*& clientData) const;
+  unsigned numStreams() const;
+
+private:
+  struct Entry {
+    serverMediaSessionCreationFunc* creationFunc;
+    void* clientData;
+  };
+
+  HashTable* fEntries; // maps 'stream name' strings to "Entry"s
+  mutable pthread_rwlock_t fLock;
+};
+
+
+////////// HTTPTunnelingDirectory //////////
+
+// RTSP-over-HTTP tunneling uses two TCP connections - a HTTP "GET" and a HTTP "POST" - that are matched by their
+// "x-sessioncookie" header, and must be handled by the same "RTSPServer".  Because the kernel gives each connection to
+// an arbitrary shard, each shard records here (under the cookie) each tunneling "GET" connection that it handles.
+// A shard that then receives a "POST" with the same cookie hands the "POST"s socket over to the shard that owns the "GET".
+// (If the "GET" has not been recorded yet - because the client didn't wait for its response - the "POST" is held for up
+//  to SHARDED_RTSP_SERVER_POST_MATCH_RETRIES*SHARDED_RTSP_SERVER_POST_MATCH_INTERVAL microseconds, and then closed.)
+
+#define SHARDED_RTSP_SERVER_POST_MATCH_RETRIES 50
+#define SHARDED_RTSP_SERVER_POST_MATCH_INTERVAL 20000/*microseconds*/
+
+class RTSPServerShard; // forward
+
+class HTTPTunnelingDirectory {
+public:
+  HTTPTunnelingDirectory();
+  virtual ~HTTPTunnelingDirectory();
+
+  // These may be called from any thread:
+  void addCookie(char const* sessionCookie, RTSPServerShard* shard);
+  void removeCookie(char const* sessionCookie, RTSPServerShard* shard);
+      // (Does nothing if the cookie has since been added by another shard.)
+  RTSPServerShard* lookupCookie(char const* sessionCookie) const;
+
+private:
+  HashTable* fShards; // maps 'session cookie' strings to "RTSPServerShard"s
+  mutable pthread_rwlock_t fLock;
+};
+
+
+////////// RTSPServerShard //////////
+
+class RTSPServerShard: public RTSPServer {
+public:
+  static RTSPServerShard* createNew(UsageEnvironment& env, int ourSocketIPv4, int ourSocketIPv6, Port ourPort,
+				    ServerMediaSessionCatalog& catalog,
+				    UserAuthenticationDatabase* authDatabase = NULL,
+				    unsigned reclamationSeconds = 65,
+				    HTTPTunnelingDirectory* tunnelingDirectory = NULL);
+      // "ourSocketIPv4" and "ourSocketIPv6" are (already listening) sockets; they are closed when the shard is closed.
+      // "tunnelingDirectory" (if not NULL) is shared by all shards that accept connections from the same sockets.
+      // Note: Client connections do not use TLS.
+
+  static int setUpListeningSocket(UsageEnvironment& env, Port& ourPort, int domain) {
+    return setUpOurSocket(env, ourPort, domain);
+  }
+
+  void handOverTunnelingPOST(char const* sessionCookie, int socketNum,
+			     unsigned char const* extraData, unsigned extraDataSize);
+      // Called (from another shard's thread) to give us the socket of a RTSP-over-HTTP "POST" connection whose cookie
+      // matches one of our "GET" connections, along with the data (if any) that followed the "POST" request.
+
+protected:
+  RTSPServerShard(UsageEnvironment& env, int ourSocketIPv4, int ourSocketIPv6, Port ourPort,
+		  ServerMediaSessionCatalog& catalog,
+		  UserAuthenticationDatabase* authDatabase, unsigned reclamationSeconds,
+		  HTTPTunnelingDirectory* tunnelingDirectory);
+      // called only by createNew();
+  virtual ~RTSPServerShard();
+
+protected: // redefined virtual functions
+  virtual void lookupServerMediaSession(char const* streamName,
+					lookupServerMediaSessionCompletionFunc* completionFunc,
+					void* completionClientData,
+					Boolean isFirstLookupInSession);
+  virtual ClientConnection* createNewClientConnection(int clientSocket, struct sockaddr_storage const& clientAddr);
+
+public: // should be protected, but some old compilers complain otherwise
+  class ShardClientConnection: public RTSPServer::RTSPClientConnection {
+  protected:
+    ShardClientConnection(RTSPServerShard& ourShard, int clientSocket, struct sockaddr_storage const& clientAddr);
+    virtual ~ShardClientConnection();
+
+    friend class RTSPServerShard;
+    void takeOverPOSTSocket(int socketNum, unsigned char const* extraData, unsigned extraDataSize);
+
+  protected: // redefined virtual functions:
+    virtual void handleHTTPCmd_TunnelingGET(char const* sessionCookie);
+    virtual Boolean handleHTTPCmd_TunnelingPOST(char const* sessionCookie,
+						unsigned char const* extraData, unsigned extraDataSize);
+
+  private:
+    RTSPServerShard* fTunnelingShard; // set while we're in that shard's "fTunnelingConnections" table
+    char* fTunnelingCookie;
+  };
+
+private:
+  void noteTunnelingGET(char const* sessionCookie, ShardClientConnection* connection);
+  void forgetTunnelingGET(char const* sessionCookie, ShardClientConnection* connection);
+  static void handOverTriggerHandler(void* clientData);
+  static void unmatchedPOSTsRetryTask(void* clientData);
+  struct HandedOverPOST;
+  void handleHandedOverPOSTs(HandedOverPOST* handedOverPOSTs);
+  static void deleteHandedOverPOSTs(HandedOverPOST* handedOverPOSTs);
+
+private:
+  struct HandedOverPOST {
+    char* sessionCookie;
+    int socketNum;
+    unsigned char* extraData;
+    unsigned extraDataSize;
+    unsigned numRetries;
+    HandedOverPOST* next;
+  };
+
+  ServerMediaSessionCatalog& fCatalog;
+  HTTPTunnelingDirectory* fTunnelingDirectory;
+  HashTable* fTunnelingConnections; // maps 'session cookie' strings to our tunneling "GET" connections
+  EventTriggerId fHandOverTrigger;
+  pthread_mutex_t fHandedOverPOSTsLock;
+  HandedOverPOST* fHandedOverPOSTs; // protected by "fHandedOverPOSTsLock"
+  HandedOverPOST* fUnmatchedPOSTs; // "POST"s whose "GET" connection has not been recorded yet
+  TaskToken fUnmatchedPOSTsRetryTask;
+};
+
+
+////////// ShardedRTSPServer //////////
+
+class ShardedRTSPServer {
+public:
+  static ShardedRTSPServer* createNew(UsageEnvironment& env, unsigned numShards, Port ourPort = 554,
+				      UserAuthenticationDatabase* authDatabase = NULL,
+				      unsigned reclamationSeconds = 65);
+      // "env" is used only for setting up the listening sockets (and reporting errors).
+      // If ourPort.num() == 0, we'll choose the port number.
+      // Note: The caller is responsible for reclaiming "authDatabase" (which must not be changed once we're running).
+  virtual ~ShardedRTSPServer(); // calls "stop()" first, if necessary
+
+  ServerMediaSessionCatalog& catalog() { return fCatalog; }
+      // Streams are made available to clients (of all shards) by adding them here.
+
+  Boolean start();
+      // Starts each shard's event loop in its own thread.  Returns False if a thread could not be created.
+  void stop();
+      // Stops each shard's event loop, and waits for its thread to finish.
+
+  unsigned numShards() const { return fNumShards; }
+  UsageEnvironment& shardEnvir(unsigned shardIndex) const { return *fShards[shardIndex].env; }
+  RTSPServerShard* shard(unsigned shardIndex) const { return fShards[shardIndex].server; }
+      // Note: Once we've been started, a shard's objects must be accessed only from within its own thread
+      // (e.g., from an 'event trigger' handler created in that shard's "TaskScheduler").
+  Port port() const { return fPort; }
+
+protected:
+  ShardedRTSPServer(unsigned numShards, Port ourPort);
+      // called only by createNew();
+
+private:
+  static void* shardThreadMain(void* shardPtr);
+  static void stopTriggerHandler(void* shardPtr);
+
+private:
+  struct Shard {
+    TaskScheduler* scheduler;
+    UsageEnvironment* env;
+    RTSPServerShard* server;
+    EventTriggerId stopTrigger;
+    char volatile stopFlag;
+    pthread_t thread;
+    Boolean threadIsRunning;
+  };
+
+  ServerMediaSessionCatalog fCatalog;
+  HTTPTunnelingDirectory fTunnelingDirectory;
+  unsigned fNumShards;
+  Shard* fShards;
+  Port fPort;
+};
+
+
+////////// Implementation //////////
+
+inline ServerMediaSessionCatalog::ServerMediaSessionCatalog()
+  : fEntries(HashTable::create(STRING_HASH_KEYS)) {
+  pthread_rwlock_init(&fLock, NULL);
+}
+
+inline ServerMediaSessionCatalog::~ServerMediaSessionCatalog() {
+  Entry* entry;
+  while ((entry = (Entry*)fEntries->RemoveNext()) != NULL) delete entry;
+  delete fEntries;
+  pthread_rwlock_destroy(&fLock);
+}
+
+inline void ServerMediaSessionCatalog
+::addStream(char const* streamName, serverMediaSessionCreationFunc* creationFunc, void* clientData) {
+  if (streamName == NULL || creationFunc == NULL) return;
+
+  Entry* newEntry = new Entry;
+  newEntry->creationFunc = creationFunc;
+  newEntry->clientData = clientData;
+
+  pthread_rwlock_wrlock(&fLock);
+  Entry* oldEntry = (Entry*)fEntries->Add(streamName, newEntry);
+  pthread_rwlock_unlock(&fLock);
+
+  delete oldEntry;
+}
+
+inline Boolean ServerMediaSessionCatalog::removeStream(char const* streamName) {
+  if (streamName == NULL) return False;
+
+  pthread_rwlock_wrlock(&fLock);
+  Entry* entry = (Entry*)fEntries->Lookup(streamName);
+  if (entry != NULL) fEntries->Remove(streamName);
+  pthread_rwlock_unlock(&fLock);
+
+  if (entry == NULL) return False;
+  delete entry;
+  return True;
+}
+
+inline Boolean ServerMediaSessionCatalog
+::lookupStream(char const* streamName, serverMediaSessionCreationFunc*& creationFunc, void*& clientData) const {
+  if (streamName == NULL) return False;
+
+  pthread_rwlock_rdlock(&fLock);
+  Entry* entry = (Entry*)fEntries->Lookup(streamName);
+  if (entry != NULL) {
+    creationFunc = entry->creationFunc;
+    clientData = entry->clientData;
+  }
+  pthread_rwlock_unlock(&fLock);
+
+  return entry != NULL;
+}
+
+inline unsigned ServerMediaSessionCatalog::numStreams() const {
+  pthread_rwlock_rdlock(&fLock);
+  unsigned result = fEntries->numEntries();
+  pthread_rwlock_unlock(&fLock);
+
+  return result;
+}
+
+inline HTTPTunnelingDirectory::HTTPTunnelingDirectory()
+  : fShards(HashTable::create(STRING_HASH_KEYS)) {
+  pthread_rwlock_init(&fLock, NULL);
+}
+
+inline HTTPTunnelingDirectory::~HTTPTunnelingDirectory() {
+  delete fShards;
+  pthread_rwlock_destroy(&fLock);
+}
+
+inline void HTTPTunnelingDirectory::addCookie(char const* sessionCookie, RTSPServerShard* shard) {
+  pthread_rwlock_wrlock(&fLock);
+  fShards->Add(sessionCookie, shard);
+  pthread_rwlock_unlock(&fLock);
+}
+
+inline void HTTPTunnelingDirectory::removeCookie(char const* sessionCookie, RTSPServerShard* shard) {
+  pthread_rwlock_wrlock(&fLock);
+  if (fShards->Lookup(sessionCookie) == shard) fShards->Remove(sessionCookie);
+  pthread_rwlock_unlock(&fLock);
+}
+
+inline RTSPServerShard* HTTPTunnelingDirectory::lookupCookie(char const* sessionCookie) const {
+  pthread_rwlock_rdlock(&fLock);
+  RTSPServerShard* shard = (RTSPServerShard*)fShards->Lookup(sessionCookie);
+  pthread_rwlock_unlock(&fLock);
+
+  return shard;
+}
+
+inline RTSPServerShard*
+RTSPServerShard::createNew(UsageEnvironment& env, int ourSocketIPv4, int ourSocketIPv6, Port ourPort,
+			   ServerMediaSessionCatalog& catalog,
+			   UserAuthenticationDatabase* authDatabase, unsigned reclamationSeconds,
+			   HTTPTunnelingDirectory* tunnelingDirectory) {
+  if (ourSocketIPv4 < 0 && ourSocketIPv6 < 0) return NULL;
+
+  return new RTSPServerShard(env, ourSocketIPv4, ourSocketIPv6, ourPort, catalog, authDatabase, reclamationSeconds,
+			     tunnelingDirectory);
+}
+
+inline RTSPServerShard
+::RTSPServerShard(UsageEnvironment& env, int ourSocketIPv4, int ourSocketIPv6, Port ourPort,
+		  ServerMediaSessionCatalog& catalog,
+		  UserAuthenticationDatabase* authDatabase, unsigned reclamationSeconds,
+		  HTTPTunnelingDirectory* tunnelingDirectory)
+  : RTSPServer(env, ourSocketIPv4, ourSocketIPv6, ourPort, authDatabase, reclamationSeconds),
+    fCatalog(catalog), fTunnelingDirectory(tunnelingDirectory),
+    fTunnelingConnections(HashTable::create(STRING_HASH_KEYS)), fHandedOverPOSTs(NULL),
+    fUnmatchedPOSTs(NULL), fUnmatchedPOSTsRetryTask(NULL) {
+  fHandOverTrigger = envir().taskScheduler().createEventTrigger(handOverTriggerHandler);
+  pthread_mutex_init(&fHandedOverPOSTsLock, NULL);
+}
+
+inline RTSPServerShard::~RTSPServerShard() {
+  // Our client connections get deleted later (by "RTSPServer"s destructor), so tell our tunneling "GET" connections
+  // to no longer refer to us:
+  ShardClientConnection* connection;
+  while ((connection = (ShardClientConnection*)fTunnelingConnections->RemoveNext()) != NULL) {
+    if (fTunnelingDirectory != NULL) fTunnelingDirectory->removeCookie(connection->fTunnelingCookie, this);
+    connection->fTunnelingShard = NULL;
+  }
+  delete fTunnelingConnections;
+
+  envir().taskScheduler().deleteEventTrigger(fHandOverTrigger);
+  envir().taskScheduler().unscheduleDelayedTask(fUnmatchedPOSTsRetryTask);
+  deleteHandedOverPOSTs(fHandedOverPOSTs);
+  deleteHandedOverPOSTs(fUnmatchedPOSTs);
+  pthread_mutex_destroy(&fHandedOverPOSTsLock);
+}
+
+inline void RTSPServerShard::deleteHandedOverPOSTs(HandedOverPOST* handedOverPOSTs) {
+  while (handedOverPOSTs != NULL) {
+    HandedOverPOST* next = handedOverPOSTs->next;
+    if (handedOverPOSTs->socketNum >= 0) ::closeSocket(handedOverPOSTs->socketNum);
+    delete[] handedOverPOSTs->sessionCookie;
+    delete[] handedOverPOSTs->extraData;
+    delete handedOverPOSTs;
+    handedOverPOSTs = next;
+  }
+}
+
+inline void RTSPServerShard
+::handOverTunnelingPOST(char const* sessionCookie, int socketNum,
+			unsigned char const* extraData, unsigned extraDataSize) {
+  HandedOverPOST* handedOverPOST = new HandedOverPOST;
+  handedOverPOST->sessionCookie = strDup(sessionCookie);
+  handedOverPOST->socketNum = socketNum;
+  handedOverPOST->extraData = extraDataSize == 0 ? NULL : new unsigned char[extraDataSize];
+  if (extraDataSize > 0) memmove(handedOverPOST->extraData, extraData, extraDataSize);
+  handedOverPOST->extraDataSize = extraDataSize;
+  handedOverPOST->numRetries = 0;
+
+  pthread_mutex_lock(&fHandedOverPOSTsLock);
+  handedOverPOST->next = fHandedOverPOSTs;
+  fHandedOverPOSTs = handedOverPOST;
+  pthread_mutex_unlock(&fHandedOverPOSTsLock);
+
+  envir().taskScheduler().triggerEvent(fHandOverTrigger, this);
+}
+
+inline void RTSPServerShard::handOverTriggerHandler(void* clientData) {
+  RTSPServerShard* shard = (RTSPServerShard*)clientData;
+
+  pthread_mutex_lock(&shard->fHandedOverPOSTsLock);
+  HandedOverPOST* handedOverPOSTs = shard->fHandedOverPOSTs;
+  shard->fHandedOverPOSTs = NULL;
+  pthread_mutex_unlock(&shard->fHandedOverPOSTsLock);
+
+  shard->handleHandedOverPOSTs(handedOverPOSTs);
+}
+
+inline void RTSPServerShard::unmatchedPOSTsRetryTask(void* clientData) {
+  RTSPServerShard* shard = (RTSPServerShard*)clientData;
+  shard->fUnmatchedPOSTsRetryTask = NULL;
+
+  HandedOverPOST* unmatchedPOSTs = shard->fUnmatchedPOSTs;
+  shard->fUnmatchedPOSTs = NULL;
+  shard->handleHandedOverPOSTs(unmatchedPOSTs);
+}
+
+inline void RTSPServerShard::handleHandedOverPOSTs(HandedOverPOST* handedOverPOSTs) {
+  while (handedOverPOSTs != NULL) {
+    HandedOverPOST* handedOverPOST = handedOverPOSTs;
+    handedOverPOSTs = handedOverPOST->next;
+    handedOverPOST->next = NULL;
+
+    ShardClientConnection* connection
+      = (ShardClientConnection*)fTunnelingConnections->Lookup(handedOverPOST->sessionCookie);
+    RTSPServerShard* owningShard = fTunnelingDirectory == NULL ? NULL
+      : fTunnelingDirectory->lookupCookie(handedOverPOST->sessionCookie);
+    if (connection != NULL) {
+      connection->takeOverPOSTSocket(handedOverPOST->socketNum,
+				     handedOverPOST->extraData, handedOverPOST->extraDataSize);
+      handedOverPOST->socketNum = -1;
+    } else if (owningShard != NULL && owningShard != this) {
+      // The "GET" connection belongs to another shard (e.g., ours has gone away, and the client has reused the cookie):
+      owningShard->handOverTunnelingPOST(handedOverPOST->sessionCookie, handedOverPOST->socketNum,
+					 handedOverPOST->extraData, handedOverPOST->extraDataSize);
+      handedOverPOST->socketNum = -1;
+    } else if (handedOverPOST->numRetries++ < SHARDED_RTSP_SERVER_POST_MATCH_RETRIES) {
+      // No shard has (yet) recorded a "GET" connection with this cookie; try again later:
+      handedOverPOST->next = fUnmatchedPOSTs;
+      fUnmatchedPOSTs = handedOverPOST;
+      continue;
+    }
+    deleteHandedOverPOSTs(handedOverPOST); // closes the socket, if we didn't hand it on
+  }
+
+  if (fUnmatchedPOSTs != NULL && fUnmatchedPOSTsRetryTask == NULL) {
+    fUnmatchedPOSTsRetryTask
+      = envir().taskScheduler().scheduleDelayedTask(SHARDED_RTSP_SERVER_POST_MATCH_INTERVAL,
+						    unmatchedPOSTsRetryTask, this);
+  }
+}
+
+inline void RTSPServerShard::noteTunnelingGET(char const* sessionCookie, ShardClientConnection* connection) {
+  ShardClientConnection* oldConnection = (ShardClientConnection*)fTunnelingConnections->Add(sessionCookie, connection);
+  if (oldConnection != NULL && oldConnection != connection) oldConnection->fTunnelingShard = NULL;
+  if (fTunnelingDirectory != NULL) fTunnelingDirectory->addCookie(sessionCookie, this);
+}
+
+inline void RTSPServerShard::forgetTunnelingGET(char const* sessionCookie, ShardClientConnection* connection) {
+  if (fTunnelingConnections->Lookup(sessionCookie) != connection) return;
+
+  fTunnelingConnections->Remove(sessionCookie);
+  if (fTunnelingDirectory != NULL) fTunnelingDirectory->removeCookie(sessionCookie, this);
+}
+
+inline GenericMediaServer::ClientConnection*
+RTSPServerShard::createNewClientConnection(int clientSocket, struct sockaddr_storage const& clientAddr) {
+  return new ShardClientConnection(*this, clientSocket, clientAddr);
+}
+
+inline RTSPServerShard::ShardClientConnection
+::ShardClientConnection(RTSPServerShard& ourShard, int clientSocket, struct sockaddr_storage const& clientAddr)
+  : RTSPClientConnection(ourShard, clientSocket, clientAddr),
+    fTunnelingShard(NULL), fTunnelingCookie(NULL) {
+}
+
+inline RTSPServerShard::ShardClientConnection::~ShardClientConnection() {
+  if (fTunnelingShard != NULL) fTunnelingShard->forgetTunnelingGET(fTunnelingCookie, this);
+  delete[] fTunnelingCookie;
+}
+
+inline void RTSPServerShard::ShardClientConnection
+::takeOverPOSTSocket(int socketNum, unsigned char const* extraData, unsigned extraDataSize) {
+  // This is what "RTSPClientConnection::handleHTTPCmd_TunnelingPOST()" does - from now on, the "POST" socket is our
+  // input socket - except that the "POST" was received by another shard:
+  ServerTLSState noTLSState(envir());
+  changeClientInputSocket(socketNum, &noTLSState, extraData, extraDataSize);
+}
+
+inline void RTSPServerShard::ShardClientConnection::handleHTTPCmd_TunnelingGET(char const* sessionCookie) {
+  RTSPClientConnection::handleHTTPCmd_TunnelingGET(sessionCookie);
+
+  RTSPServerShard& ourShard = (RTSPServerShard&)fOurRTSPServer;
+  if (fTunnelingShard != NULL) fTunnelingShard->forgetTunnelingGET(fTunnelingCookie, this);
+  delete[] fTunnelingCookie;
+  fTunnelingCookie = strDup(sessionCookie);
+  fTunnelingShard = &ourShard;
+  ourShard.noteTunnelingGET(sessionCookie, this);
+}
+
+inline Boolean RTSPServerShard::ShardClientConnection
+::handleHTTPCmd_TunnelingPOST(char const* sessionCookie, unsigned char const* extraData, unsigned extraDataSize) {
+  RTSPServerShard& ourShard = (RTSPServerShard&)fOurRTSPServer;
+  if (ourShard.fTunnelingDirectory == NULL || ourShard.fTunnelingConnections->Lookup(sessionCookie) != NULL) {
+    // We're not sharing connections with other shards, or the "GET" connection is one of ours; handle the "POST" normally:
+    return RTSPClientConnection::handleHTTPCmd_TunnelingPOST(sessionCookie, extraData, extraDataSize);
+  }
+
+  // Hand our socket over to the shard that has the "GET" connection - or, if none has recorded it yet, to ourself, to
+  // wait for it.  As when the "POST" is handled normally, we don't respond to it, and we then go away (without closing
+  // the socket):
+  RTSPServerShard* owningShard = ourShard.fTunnelingDirectory->lookupCookie(sessionCookie);
+  if (owningShard == NULL) owningShard = &ourShard;
+  envir().taskScheduler().disableBackgroundHandling(fClientInputSocket);
+  owningShard->handOverTunnelingPOST(sessionCookie, fClientInputSocket, extraData, extraDataSize);
+  fClientInputSocket = fClientOutputSocket = -1;
+  return True;
+}
+
+inline void RTSPServerShard
+::lookupServerMediaSession(char const* streamName,
+			   lookupServerMediaSessionCompletionFunc* completionFunc,
+			   void* completionClientData,
+			   Boolean /*isFirstLookupInSession*/) {
+  ServerMediaSession* sms = getServerMediaSession(streamName);
+
+  serverMediaSessionCreationFunc* creationFunc;
+  void* creationClientData;
+  if (!fCatalog.lookupStream(streamName, creationFunc, creationClientData)) {
+    // The stream has been removed from the catalog (or was never there).  Make sure that new clients can't
+    // access our local copy (if any).  Existing client sessions that use it continue streaming:
+    if (sms != NULL) {
+      removeServerMediaSession(sms);
+      sms = NULL;
+    }
+  } else if (sms == NULL) {
+    // This is the first time that this shard has been asked for this stream; create it in our environment:
+    sms = (*creationFunc)(envir(), streamName, creationClientData);
+    if (sms != NULL) addServerMediaSession(sms);
+  }
+
+  if (completionFunc != NULL) {
+    (*completionFunc)(completionClientData, sms);
+  }
+}
+
+inline ShardedRTSPServer*
+ShardedRTSPServer::createNew(UsageEnvironment& env, unsigned numShards, Port ourPort,
+			     UserAuthenticationDatabase* authDatabase, unsigned reclamationSeconds) {
+  if (numShards == 0) return NULL;
+
+  int ourSocketIPv4 = RTSPServerShard::setUpListeningSocket(env, ourPort, AF_INET);
+  int ourSocketIPv6 = RTSPServerShard::setUpListeningSocket(env, ourPort, AF_INET6);
+  if (ourSocketIPv4 < 0 && ourSocketIPv6 < 0) return NULL;
+
+  ShardedRTSPServer* server = new ShardedRTSPServer(numShards, ourPort);
+  for (unsigned i = 0; i < numShards; ++i) {
+    Shard& shard = server->fShards[i];
+    shard.scheduler = BasicTaskScheduler::createNew();
+    shard.env = BasicUsageEnvironment::createNew(*shard.scheduler);
+
+    // Each shard gets its own descriptor for the (shared) listening socket(s), because each one closes its sockets
+    // when it's closed.  The kernel hands each incoming connection to just one of the shards' "accept()" calls;
+    // the others see EWOULDBLOCK, which "GenericMediaServer" ignores.
+    int shardSocketIPv4 = ourSocketIPv4 < 0 ? -1 : dup(ourSocketIPv4);
+    int shardSocketIPv6 = ourSocketIPv6 < 0 ? -1 : dup(ourSocketIPv6);
+    shard.server = RTSPServerShard::createNew(*shard.env, shardSocketIPv4, shardSocketIPv6,
+					      ourPort, server->fCatalog, authDatabase, reclamationSeconds,
+					      &server->fTunnelingDirectory);
+    shard.stopTrigger = shard.scheduler->createEventTrigger(stopTriggerHandler);
+    if (shard.server == NULL) {
+      env.setResultErrMsg("Failed to create a RTSP server shard: ");
+      if (shardSocketIPv4 >= 0) ::closeSocket(shardSocketIPv4);
+      if (shardSocketIPv6 >= 0) ::closeSocket(shardSocketIPv6);
+      if (ourSocketIPv4 >= 0) ::closeSocket(ourSocketIPv4);
+      if (ourSocketIPv6 >= 0) ::closeSocket(ourSocketIPv6);
+      delete server;
+      return NULL;
+    }
+  }
+
+  if (ourSocketIPv4 >= 0) ::closeSocket(ourSocketIPv4);
+  if (ourSocketIPv6 >= 0) ::closeSocket(ourSocketIPv6);
+  return server;
+}
+
+inline ShardedRTSPServer::ShardedRTSPServer(unsigned numShards, Port ourPort)
+  : fNumShards(numShards), fShards(new Shard[numShards]), fPort(ourPort) {
+  for (unsigned i = 0; i < numShards; ++i) {
+    Shard& shard = fShards[i];
+    shard.scheduler = NULL;
+    shard.env = NULL;
+    shard.server = NULL;
+    shard.stopTrigger = 0;
+    shard.stopFlag = 0;
+    shard.threadIsRunning = False;
+  }
+}
+
+inline ShardedRTSPServer::~ShardedRTSPServer() {
+  stop();
+
+  // The shards' threads have all finished, so it's now safe to reclaim their objects from this thread:
+  for (unsigned i = 0; i < fNumShards; ++i) {
+    Shard& shard = fShards[i];
+    Medium::close(shard.server);
+    if (shard.scheduler != NULL && shard.stopTrigger != 0) shard.scheduler->deleteEventTrigger(shard.stopTrigger);
+    if (shard.env != NULL) shard.env->reclaim();
+    delete shard.scheduler;
+  }
+  delete[] fShards;
+}
+
+inline Boolean ShardedRTSPServer::start() {
+  for (unsigned i = 0; i < fNumShards; ++i) {
+    Shard& shard = fShards[i];
+    if (shard.threadIsRunning) continue;
+
+    shard.stopFlag = 0;
+    if (pthread_create(&shard.thread, NULL, shardThreadMain, &shard) != 0) {
+      stop();
+      return False;
+    }
+    shard.threadIsRunning = True;
+  }
+
+  return True;
+}
+
+inline void ShardedRTSPServer::stop() {
+  for (unsigned i = 0; i < fNumShards; ++i) {
+    Shard& shard = fShards[i];
+    if (!shard.threadIsRunning) continue;
+
+    // Wake up the shard's event loop, so that it notices (promptly) that it's being stopped:
+    shard.scheduler->triggerEvent(shard.stopTrigger, &shard);
+  }
+  for (unsigned i = 0; i < fNumShards; ++i) {
+    Shard& shard = fShards[i];
+    if (!shard.threadIsRunning) continue;
+
+    pthread_join(shard.thread, NULL);
+    shard.threadIsRunning = False;
+  }
+}
+
+inline void* ShardedRTSPServer::shardThreadMain(void* shardPtr) {
+  Shard* shard = (Shard*)shardPtr;
+  shard->scheduler->doEventLoop(&shard->stopFlag);
+
+  return NULL;
+}
+
+inline void ShardedRTSPServer::stopTriggerHandler(void* shardPtr) {
+  // Called within the shard's own thread:
+  ((Shard*)shardPtr)->stopFlag = 1;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,274 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A reference-counted frame buffer, that can be read in place by several consumers
+// (possibly running in different threads), rather than being copied to each of them.
+// Frames can be taken from a "SharedFramePool", which reuses the buffers of frames once they've been released.
+// C++ header
+
+#ifndef _SHARED_FRAME_HH
+#define _SHARED_FRAME_HH
+
+#ifndef _NET_COMMON_H
+#include "NetCommon.h"
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SHARED_FRAME_ATOMIC_INCREMENT(var) ((unsigned)_InterlockedIncrement((long volatile*)&(var)))
+#define SHARED_FRAME_ATOMIC_DECREMENT(var) ((unsigned)_InterlockedDecrement((long volatile*)&(var)))
+#define SHARED_FRAME_ATOMIC_ADD(var, n) ((void)_InterlockedExchangeAdd64((__int64 volatile*)&(var), (__int64)(n)))
+#define SHARED_FRAME_ATOMIC_LOAD(var) (var)
+#define SHARED_FRAME_ATOMIC_EXCHANGE_PTR(var, value) _InterlockedExchangePointer((void* volatile*)&(var), (value))
+#define SHARED_FRAME_ATOMIC_CAS_PTR(var, expected, desired) \
+  _InterlockedCompareExchangePointer((void* volatile*)&(var), (desired), (expected))
+#else
+#define SHARED_FRAME_ATOMIC_INCREMENT(var) __atomic_add_fetch(&(var), 1, __ATOMIC_RELAXED)
+#define SHARED_FRAME_ATOMIC_DECREMENT(var) __atomic_sub_fetch(&(var), 1, __ATOMIC_ACQ_REL)
+#define SHARED_FRAME_ATOMIC_ADD(var, n) ((void)__atomic_add_fetch(&(var), (n), __ATOMIC_RELAXED))
+#define SHARED_FRAME_ATOMIC_LOAD(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#define SHARED_FRAME_ATOMIC_EXCHANGE_PTR(var, value) __atomic_exchange_n(&(var), (value), __ATOMIC_ACQ_REL)
+#define SHARED_FRAME_ATOMIC_CAS_PTR(var, expected, desired) __sync_val_compare_and_swap(&(var), (expected), (desired))
+      // (returns the previous value)
+#endif
+
+// The default number of released frames that a "SharedFramePool" keeps for reuse:
+#define SHARED_FRAME_POOL_DEFAULT_MAX_FREE_FRAMES 32
+
+class SharedFramePool; // forward
+
+class SharedFrame {
+public:
+  static SharedFrame* createNew(unsigned maxSize);
+      // Creates a (writable) frame buffer, with a reference count of 1.
+      // The creator fills it in (using "writableData()" and "setFrameParams()") *before* sharing it;
+      // after that, the frame must be treated as immutable.
+
+  void addRef() { SHARED_FRAME_ATOMIC_INCREMENT(fRefCount); }
+  void release();
+      // (These may be called from any thread.)  When the last reference is released, the frame is deleted - or, if it
+      // came from a "SharedFramePool", given back to the pool.
+
+  unsigned char const* data() const { return fData; }
+  unsigned frameSize() const { return fFrameSize; }
+  unsigned maxSize() const { return fMaxSize; }
+  unsigned numTruncatedBytes() const { return fNumTruncatedBytes; }
+  struct timeval const& presentationTime() const { return fPresentationTime; }
+  unsigned durationInMicroseconds() const { return fDurationInMicroseconds; }
+
+  unsigned char* writableData() { return fData; }
+  void setFrameParams(unsigned frameSize, unsigned numTruncatedBytes,
+		      struct timeval presentationTime, unsigned durationInMicroseconds) {
+    fFrameSize = frameSize; fNumTruncatedBytes = numTruncatedBytes;
+    fPresentationTime = presentationTime; fDurationInMicroseconds = durationInMicroseconds;
+  }
+
+  unsigned copyTo(unsigned char* to, unsigned maxSize, unsigned& numTruncatedBytes) const;
+      // For consumers that need their own copy of the frame (e.g., a downstream "FramedSource" delivering into "fTo").
+      // Returns the number of bytes copied; "numTruncatedBytes" is set to the number of bytes that didn't fit
+      // (plus any bytes that were already truncated when the frame was received).
+
+  static u_int64_t totalBytesAllocated() { return SHARED_FRAME_ATOMIC_LOAD(allocatedBytes()); }
+      // The total size of all frame buffers that currently exist (i.e., memory held by still-referenced frames)
+
+private:
+  SharedFrame(unsigned char* data, unsigned maxSize);
+      // called only by "createNew()"
+  ~SharedFrame();
+      // called only by "release()", or by our pool
+
+private:
+  friend class SharedFramePool;
+  unsigned fRefCount;
+  unsigned char* fData;
+  unsigned fMaxSize;
+  unsigned fFrameSize;
+  unsigned fNumTruncatedBytes;
+  struct timeval fPresentationTime;
+  unsigned fDurationInMicroseconds;
+  SharedFramePool* fPool; // the pool that we came from (if any)
+  SharedFrame* fNextFree; // used by our pool to link together frames that are not in use
+
+  static u_int64_t& allocatedBytes() { static u_int64_t numBytes = 0; return numBytes; }
+};
+
+
+class SharedFramePool {
+public:
+  static SharedFramePool* createNew(unsigned frameSize,
+				    unsigned maxFreeFrames = SHARED_FRAME_POOL_DEFAULT_MAX_FREE_FRAMES);
+      // Creates a pool of frames whose buffers are "frameSize" bytes.
+
+  SharedFrame* getFrame();
+      // Returns a (writable) frame with a reference count of 1, as "SharedFrame::createNew(frameSize)" does, but reuses
+      // the buffer of a released frame if there is one.  This must be called only from the pool creator's thread;
+      // the frames themselves may be released from any thread.
+  void close();
+      // Called (instead of deleting the pool) when its creator has finished with it.  The pool is deleted once all of
+      // the frames that it handed out have been released.
+
+  unsigned frameSize() const { return fFrameSize; }
+
+private:
+  SharedFramePool(unsigned frameSize, unsigned maxFreeFrames);
+      // called only by "createNew()"
+  ~SharedFramePool();
+      // called only by "unref()"
+
+  friend class SharedFrame;
+  void recycle(SharedFrame* frame); // called (from any thread) when the last reference to one of our frames is released
+  void unref();
+  static void deleteFrames(SharedFrame* frames);
+
+private:
+  unsigned fRefCount; // 1 for our creator (until "close()"), plus 1 for each of our frames that's currently in use
+  unsigned fFrameSize, fMaxFreeFrames;
+  SharedFrame* fReturnedFrames; // pushed (atomically) by "recycle()"; taken all at once by "getFrame()"
+  SharedFrame* fFreeFrames; // used only from our creator's thread
+  unsigned fNumFreeFrames; // the length of "fFreeFrames"
+};
+
+
+////////// Implementation //////////
+
+inline SharedFrame* SharedFrame::createNew(unsigned maxSize) {
+  unsigned char* data = new unsigned char[maxSize == 0 ? 1 : maxSize];
+  if (data == NULL) return NULL;
+
+  return new SharedFrame(data, maxSize);
+}
+
+inline SharedFrame::SharedFrame(unsigned char* data, unsigned maxSize)
+  : fRefCount(1), fData(data), fMaxSize(maxSize),
+    fFrameSize(0), fNumTruncatedBytes(0), fDurationInMicroseconds(0), fPool(NULL), fNextFree(NULL) {
+  fPresentationTime.tv_sec = fPresentationTime.tv_usec = 0;
+  SHARED_FRAME_ATOMIC_ADD(allocatedBytes(), maxSize);
+}
+
+inline SharedFrame::~SharedFrame() {
+  SHARED_FRAME_ATOMIC_ADD(allocatedBytes(), -(int64_t)fMaxSize);
+  delete[] fData;
+}
+
+inline void SharedFrame::release() {
+  if (SHARED_FRAME_ATOMIC_DECREMENT(fRefCount) != 0) return;
+
+  if (fPool != NULL) {
+    fPool->recycle(this);
+  } else {
+    delete this;
+  }
+}
+
+inline unsigned SharedFrame::copyTo(unsigned char* to, unsigned maxSize, unsigned& numTruncatedBytes) const {
+  unsigned numBytesToCopy = fFrameSize;
+  numTruncatedBytes = fNumTruncatedBytes;
+  if (numBytesToCopy > maxSize) {
+    numTruncatedBytes += numBytesToCopy - maxSize;
+    numBytesToCopy = maxSize;
+  }
+  memmove(to, fData, numBytesToCopy);
+
+  return numBytesToCopy;
+}
+
+inline SharedFramePool* SharedFramePool::createNew(unsigned frameSize, unsigned maxFreeFrames) {
+  return new SharedFramePool(frameSize, maxFreeFrames);
+}
+
+inline SharedFramePool::SharedFramePool(unsigned frameSize, unsigned maxFreeFrames)
+  : fRefCount(1), fFrameSize(frameSize), fMaxFreeFrames(maxFreeFrames),
+    fReturnedFrames(NULL), fFreeFrames(NULL), fNumFreeFrames(0) {
+}
+
+inline SharedFramePool::~SharedFramePool() {
+  deleteFrames(fFreeFrames);
+  deleteFrames((SharedFrame*)SHARED_FRAME_ATOMIC_EXCHANGE_PTR(fReturnedFrames, (SharedFrame*)NULL));
+}
+
+inline void SharedFramePool::deleteFrames(SharedFrame* frames) {
+  while (frames != NULL) {
+    SharedFrame* next = frames->fNextFree;
+    delete frames;
+    frames = next;
+  }
+}
+
+inline SharedFrame* SharedFramePool::getFrame() {
+  if (fFreeFrames == NULL) {
+    // Take the frames that have been released (by any thread) since we last looked, keeping no more than
+    // "fMaxFreeFrames" of them:
+    SharedFrame* returnedFrames = (SharedFrame*)SHARED_FRAME_ATOMIC_EXCHANGE_PTR(fReturnedFrames, (SharedFrame*)NULL);
+    while (returnedFrames != NULL) {
+      SharedFrame* next = returnedFrames->fNextFree;
+      if (fNumFreeFrames < fMaxFreeFrames) {
+	returnedFrames->fNextFree = fFreeFrames;
+	fFreeFrames = returnedFrames;
+	++fNumFreeFrames;
+      } else {
+	delete returnedFrames;
+      }
+      returnedFrames = next;
+    }
+  }
+
+  SharedFrame* frame = fFreeFrames;
+  if (frame != NULL) {
+    fFreeFrames = frame->fNextFree;
+    --fNumFreeFrames;
+    frame->fRefCount = 1;
+    frame->fNextFree = NULL;
+    frame->fFrameSize = frame->fNumTruncatedBytes = frame->fDurationInMicroseconds = 0;
+    frame->fPresentationTime.tv_sec = frame->fPresentationTime.tv_usec = 0;
+  } else {
+    frame = SharedFrame::createNew(fFrameSize);
+    if (frame == NULL) return NULL;
+    frame->fPool = this;
+  }
+
+  SHARED_FRAME_ATOMIC_INCREMENT(fRefCount);
+  return frame;
+}
+
+inline void SharedFramePool::close() {
+  deleteFrames(fFreeFrames);
+  fFreeFrames = NULL;
+  fNumFreeFrames = 0;
+  deleteFrames((SharedFrame*)SHARED_FRAME_ATOMIC_EXCHANGE_PTR(fReturnedFrames, (SharedFrame*)NULL));
+
+  unref(); // our creator's reference
+}
+
+inline void SharedFramePool::recycle(SharedFrame* frame) {
+  // Push the frame onto "fReturnedFrames".  (Only "getFrame()" and "close()" - in our creator's thread - take frames
+  // from it, and they take them all at once, so this simple lock-free stack isn't subject to the 'ABA' problem.)
+  SharedFrame* head = fReturnedFrames;
+  while (1) {
+    frame->fNextFree = head;
+    SharedFrame* previousHead = (SharedFrame*)SHARED_FRAME_ATOMIC_CAS_PTR(fReturnedFrames, head, frame);
+    if (previousHead == head) break;
+    head = previousHead;
+  }
+
+  unref(); // the frame's reference
+}
+
+inline void SharedFramePool::unref() {
+  if (SHARED_FRAME_ATOMIC_DECREMENT(fRefCount) == 0) delete this;
+}
+
+#endif
@@ -0,0 +1,474 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A variant of "StreamReplicator" that reads each incoming frame once, into a (reference-counted, immutable)
+// "SharedFrame", and queues a reference to it for each replica - rather than copying the frame into each replica's
+// buffer as it arrives.  Replicas that use "getNextSharedFrame()" read the frame in place; replicas that are used as
+// ordinary "FramedSource"s make their (single) copy only when their downstream object asks for the frame.
+// Because each replica has its own queue, a slow replica no longer holds back the others.
+// C++ header
+
+#ifndef _SHARED_FRAME_REPLICATOR_HH
+#define _SHARED_FRAME_REPLICATOR_HH
+
+#ifndef _FRAMED_SOURCE_HH
+#include "FramedSource.hh"
+#endif
+#ifndef _SHARED_FRAME_HH
+#include "SharedFrame.hh"
+#endif
+
+// What a replica does with a new frame when it already has "maxQueuedFrames" frames waiting to be read:
+enum SlowReplicaPolicy {
+  SLOW_REPLICA_DROP_OLDEST, // discard the oldest queued frame (the default; best for live viewers)
+  SLOW_REPLICA_DROP_NEWEST, // discard the new frame
+  SLOW_REPLICA_COPY // keep the new frame, but as a private copy of just "frameSize()" bytes, so that the replica no longer
+                    // holds a full-size shared buffer.  Up to SHARED_FRAME_REPLICA_COPY_QUEUE_FACTOR*"maxQueuedFrames" frames
+                    // can then be queued, before the oldest is dropped.
+};
+
+#define SHARED_FRAME_REPLICA_COPY_QUEUE_FACTOR 4
+
+class SharedFrameReplica; // forward
+
+class SharedFrameReplicator: public Medium {
+public:
+  static SharedFrameReplicator* createNew(UsageEnvironment& env, FramedSource* inputSource, unsigned maxFrameSize,
+					  Boolean deleteWhenLastReplicaDies = True);
+    // "maxFrameSize" is the size of the buffer into which each incoming frame is read.
+    // "deleteWhenLastReplicaDies" has the same meaning as for "StreamReplicator".
+
+  SharedFrameReplica* createStreamReplica(unsigned maxQueuedFrames = 8,
+					  SlowReplicaPolicy slowReplicaPolicy = SLOW_REPLICA_DROP_OLDEST);
+
+  unsigned numReplicas() const { return fNumReplicas; }
+
+  FramedSource* inputSource() const { return fInputSource; }
+
+  // Call before destruction if you want to prevent the destructor from closing the input source
+  void detachInputSource() { fInputSource = NULL; }
+
+  // Statistics:
+  unsigned numFramesReceived() const { return fNumFramesReceived; }
+  unsigned maxReplicaLag() const;
+      // the largest number of frames that any replica has queued (i.e., received, but not yet read)
+  u_int64_t numBytesHeldByReplicas() const;
+      // the total size of the frames queued by replicas (a frame that's queued by several replicas is counted once for
+      // each of them).  Use "SharedFrame::totalBytesAllocated()" for the memory that's actually allocated for frame buffers.
+
+protected:
+  SharedFrameReplicator(UsageEnvironment& env, FramedSource* inputSource, unsigned maxFrameSize,
+			Boolean deleteWhenLastReplicaDies);
+    // called only by "createNew()"
+  virtual ~SharedFrameReplicator();
+
+  virtual Boolean getNextInputFrame();
+      // Starts reading the next frame from our input source.  By default, the frame is read into a "SharedFrame" from
+      // our pool (whose buffers are reused once every replica has released them).
+      // A subclass whose input source can hand over "SharedFrame"s (by reference) can redefine this to request one,
+      // and then pass it to "afterGettingSharedFrame()" - or call "onSourceClosure()".
+  void afterGettingSharedFrame(SharedFrame* frame); // takes over the caller's reference to "frame"
+  static void afterGettingSharedFrame(void* clientData, SharedFrame* frame);
+  static void onSourceClosure(void* clientData);
+  void onSourceClosure();
+
+private:
+  // Routines called by replicas:
+  friend class SharedFrameReplica;
+  void requestFrame(); // called by a replica that has nothing queued
+  void noteReplicaDeactivation();
+  void removeStreamReplica(SharedFrameReplica* replica);
+
+private:
+  static void afterGettingFrame(void* clientData, unsigned frameSize,
+                                unsigned numTruncatedBytes,
+                                struct timeval presentationTime,
+                                unsigned durationInMicroseconds);
+  void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes,
+			 struct timeval presentationTime, unsigned durationInMicroseconds);
+
+private:
+  FramedSource* fInputSource;
+  unsigned fMaxFrameSize;
+  Boolean fDeleteWhenLastReplicaDies, fInputSourceHasClosed;
+  Boolean fIsReadingInput;
+  SharedFramePool* fFramePool; // used only by the default "getNextInputFrame()"
+  SharedFrame* fCurrentFrame; // the frame that we're currently reading into (if we use the default "getNextInputFrame()")
+  SharedFrameReplica* fReplicas;
+  unsigned fNumReplicas;
+  unsigned fNumFramesReceived;
+};
+
+class SharedFrameReplica: public FramedSource {
+public:
+  typedef void (afterGettingSharedFrameFunc)(void* clientData, SharedFrame* frame);
+  void getNextSharedFrame(afterGettingSharedFrameFunc* afterGettingFunc, void* afterGettingClientData,
+			  onCloseFunc* onCloseFunc, void* onCloseClientData);
+      // An alternative to "getNextFrame()", for consumers that can read the frame in place (i.e., without copying it).
+      // The frame is passed to "afterGettingFunc" along with a reference; the consumer must call "release()" on it
+      // when it has finished with it.
+
+  // Statistics:
+  unsigned lag() const { return fNumQueuedFrames; }
+  u_int64_t numBytesHeld() const { return fNumBytesHeld; }
+  unsigned numFramesDelivered() const { return fNumFramesDelivered; }
+  unsigned numFramesDropped() const { return fNumFramesDropped; }
+  unsigned numFramesCopied() const { return fNumFramesCopied; } // because of SLOW_REPLICA_COPY
+
+protected:
+  SharedFrameReplica(SharedFrameReplicator& ourReplicator, unsigned maxQueuedFrames,
+		     SlowReplicaPolicy slowReplicaPolicy);
+    // called only by "SharedFrameReplicator::createStreamReplica()"
+  virtual ~SharedFrameReplica();
+
+protected: // redefined virtual functions:
+  virtual void doGetNextFrame();
+  virtual void doStopGettingFrames();
+
+private:
+  friend class SharedFrameReplicator;
+  Boolean isActive() const { return fIsActive; }
+  Boolean isAwaitingFrame() const { return isCurrentlyAwaitingData() || fAfterGettingSharedFunc != NULL; }
+  void enqueueFrame(SharedFrame* frame); // called by our replicator
+  void flushQueue();
+  void requestOrDeliver();
+  void scheduleDelivery();
+  static void deliverFrame0(void* clientData);
+  void deliverFrame();
+
+private:
+  SharedFrameReplicator& fOurReplicator;
+  SharedFrameReplica* fNext; // in our replicator's list of replicas
+  SlowReplicaPolicy fSlowReplicaPolicy;
+  SharedFrame** fQueue; // a circular buffer of "fQueueCapacity" frames
+  unsigned fMaxQueuedFrames, fQueueCapacity, fQueueHead, fNumQueuedFrames;
+  Boolean fIsActive; // True iff our consumer has asked for a frame (and has not since stopped)
+  afterGettingSharedFrameFunc* fAfterGettingSharedFunc; // non-NULL iff a "getNextSharedFrame()" request is pending
+  void* fAfterGettingSharedClientData;
+  onCloseFunc* fSharedOnCloseFunc;
+  void* fSharedOnCloseClientData;
+  u_int64_t fNumBytesHeld;
+  unsigned fNumFramesDelivered, fNumFramesDropped, fNumFramesCopied;
+};
+
+
+////////// Implementation //////////
+
+inline SharedFrameReplicator* SharedFrameReplicator
+::createNew(UsageEnvironment& env, FramedSource* inputSource, unsigned maxFrameSize, Boolean deleteWhenLastReplicaDies) {
+  return new SharedFrameReplicator(env, inputSource, maxFrameSize, deleteWhenLastReplicaDies);
+}
+
+inline SharedFrameReplicator
+::SharedFrameReplicator(UsageEnvironment& env, FramedSource* inputSource, unsigned maxFrameSize,
+			Boolean deleteWhenLastReplicaDies)
+  : Medium(env), fInputSource(inputSource), fMaxFrameSize(maxFrameSize),
+    fDeleteWhenLastReplicaDies(deleteWhenLastReplicaDies), fInputSourceHasClosed(False),
+    fIsReadingInput(False), fFramePool(NULL), fCurrentFrame(NULL), fReplicas(NULL), fNumReplicas(0), fNumFramesReceived(0) {
+}
+
+inline SharedFrameReplicator::~SharedFrameReplicator() {
+  if (fIsReadingInput && fInputSource != NULL) fInputSource->stopGettingFrames();
+  if (fCurrentFrame != NULL) fCurrentFrame->release();
+  if (fFramePool != NULL) fFramePool->close();
+  Medium::close(fInputSource);
+}
+
+inline SharedFrameReplica* SharedFrameReplicator
+::createStreamReplica(unsigned maxQueuedFrames, SlowReplicaPolicy slowReplicaPolicy) {
+  SharedFrameReplica* replica = new SharedFrameReplica(*this, maxQueuedFrames, slowReplicaPolicy);
+  replica->fNext = fReplicas;
+  fReplicas = replica;
+  ++fNumReplicas;
+
+  return replica;
+}
+
+inline unsigned SharedFrameReplicator::maxReplicaLag() const {
+  unsigned result = 0;
+  for (SharedFrameReplica* replica = fReplicas; replica != NULL; replica = replica->fNext) {
+    if (replica->lag() > result) result = replica->lag();
+  }
+
+  return result;
+}
+
+inline u_int64_t SharedFrameReplicator::numBytesHeldByReplicas() const {
+  u_int64_t result = 0;
+  for (SharedFrameReplica* replica = fReplicas; replica != NULL; replica = replica->fNext) {
+    result += replica->numBytesHeld();
+  }
+
+  return result;
+}
+
+inline void SharedFrameReplicator::requestFrame() {
+  if (fIsReadingInput) return; // we're already reading a frame; the replica will get it when it arrives
+  if (fInputSource == NULL || fInputSourceHasClosed) return;
+
+  fIsReadingInput = True;
+  if (!getNextInputFrame()) fIsReadingInput = False;
+}
+
+inline Boolean SharedFrameReplicator::getNextInputFrame() {
+  if (fFramePool == NULL) fFramePool = SharedFramePool::createNew(fMaxFrameSize);
+  fCurrentFrame = fFramePool->getFrame();
+  if (fCurrentFrame == NULL) return False;
+
+  fInputSource->getNextFrame(fCurrentFrame->writableData(), fMaxFrameSize,
+			     afterGettingFrame, this,
+			     onSourceClosure, this);
+  return True;
+}
+
+inline void SharedFrameReplicator::noteReplicaDeactivation() {
+  // If no replica is active any more, then stop reading from our input source:
+  for (SharedFrameReplica* replica = fReplicas; replica != NULL; replica = replica->fNext) {
+    if (replica->isActive()) return;
+  }
+
+  if (fIsReadingInput) {
+    if (fInputSource != NULL) fInputSource->stopGettingFrames();
+    fIsReadingInput = False;
+  }
+  if (fCurrentFrame != NULL) {
+    fCurrentFrame->release();
+    fCurrentFrame = NULL;
+  }
+}
+
+inline void SharedFrameReplicator::removeStreamReplica(SharedFrameReplica* replica) {
+  for (SharedFrameReplica** ptr = &fReplicas; *ptr != NULL; ptr = &(*ptr)->fNext) {
+    if (*ptr == replica) {
+      *ptr = replica->fNext;
+      --fNumReplicas;
+      break;
+    }
+  }
+
+  if (fNumReplicas == 0 && fDeleteWhenLastReplicaDies) {
+    Medium::close(this);
+    return;
+  }
+  noteReplicaDeactivation();
+}
+
+inline void SharedFrameReplicator::afterGettingFrame(void* clientData, unsigned frameSize,
+						     unsigned numTruncatedBytes,
+						     struct timeval presentationTime,
+						     unsigned durationInMicroseconds) {
+  ((SharedFrameReplicator*)clientData)->afterGettingFrame(frameSize, numTruncatedBytes,
+							  presentationTime, durationInMicroseconds);
+}
+
+inline void SharedFrameReplicator::afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes,
+						     struct timeval presentationTime, unsigned durationInMicroseconds) {
+  SharedFrame* frame = fCurrentFrame;
+  fCurrentFrame = NULL;
+  frame->setFrameParams(frameSize, numTruncatedBytes, presentationTime, durationInMicroseconds);
+  afterGettingSharedFrame(frame);
+}
+
+inline void SharedFrameReplicator::afterGettingSharedFrame(void* clientData, SharedFrame* frame) {
+  ((SharedFrameReplicator*)clientData)->afterGettingSharedFrame(frame);
+}
+
+inline void SharedFrameReplicator::afterGettingSharedFrame(SharedFrame* frame) {
+  fIsReadingInput = False;
+  ++fNumFramesReceived;
+
+  // Give each active replica a reference to the frame.  (Delivery to each replica's consumer is done later,
+  // from the event loop, so that replicas can safely be closed or stopped from within their consumer's callback.)
+  for (SharedFrameReplica* replica = fReplicas; replica != NULL; replica = replica->fNext) {
+    if (replica->isActive()) replica->enqueueFrame(frame);
+  }
+  frame->release(); // our own reference
+}
+
+inline void SharedFrameReplicator::onSourceClosure(void* clientData) {
+  ((SharedFrameReplicator*)clientData)->onSourceClosure();
+}
+
+inline void SharedFrameReplicator::onSourceClosure() {
+  fInputSourceHasClosed = True;
+  fIsReadingInput = False;
+  if (fCurrentFrame != NULL) {
+    fCurrentFrame->release();
+    fCurrentFrame = NULL;
+  }
+
+  // Each replica will signal closure once it has delivered the frames that it has queued:
+  for (SharedFrameReplica* replica = fReplicas; replica != NULL; replica = replica->fNext) {
+    if (replica->isAwaitingFrame()) replica->scheduleDelivery();
+  }
+}
+
+inline SharedFrameReplica::SharedFrameReplica(SharedFrameReplicator& ourReplicator, unsigned maxQueuedFrames,
+					      SlowReplicaPolicy slowReplicaPolicy)
+  : FramedSource(ourReplicator.envir()), fOurReplicator(ourReplicator), fNext(NULL),
+    fSlowReplicaPolicy(slowReplicaPolicy),
+    fMaxQueuedFrames(maxQueuedFrames == 0 ? 1 : maxQueuedFrames), fQueueHead(0), fNumQueuedFrames(0),
+    fIsActive(False),
+    fAfterGettingSharedFunc(NULL), fAfterGettingSharedClientData(NULL),
+    fSharedOnCloseFunc(NULL), fSharedOnCloseClientData(NULL),
+    fNumBytesHeld(0), fNumFramesDelivered(0), fNumFramesDropped(0), fNumFramesCopied(0) {
+  fQueueCapacity = fMaxQueuedFrames;
+  if (fSlowReplicaPolicy == SLOW_REPLICA_COPY) fQueueCapacity *= SHARED_FRAME_REPLICA_COPY_QUEUE_FACTOR;
+  fQueue = new SharedFrame*[fQueueCapacity];
+}
+
+inline SharedFrameReplica::~SharedFrameReplica() {
+  envir().taskScheduler().unscheduleDelayedTask(nextTask());
+  flushQueue();
+  delete[] fQueue;
+  fOurReplicator.removeStreamReplica(this);
+}
+
+inline void SharedFrameReplica
+::getNextSharedFrame(afterGettingSharedFrameFunc* afterGettingFunc, void* afterGettingClientData,
+		     onCloseFunc* onCloseFunc, void* onCloseClientData) {
+  if (isAwaitingFrame()) {
+    envir() << "SharedFrameReplica[" << this << "]::getNextSharedFrame(): attempting to read more than once at the same time!\n";
+    envir().internalError();
+  }
+
+  fAfterGettingSharedFunc = afterGettingFunc;
+  fAfterGettingSharedClientData = afterGettingClientData;
+  fSharedOnCloseFunc = onCloseFunc;
+  fSharedOnCloseClientData = onCloseClientData;
+  requestOrDeliver();
+}
+
+inline void SharedFrameReplica::doGetNextFrame() {
+  requestOrDeliver();
+}
+
+inline void SharedFrameReplica::doStopGettingFrames() {
+  envir().taskScheduler().unscheduleDelayedTask(nextTask());
+  fAfterGettingSharedFunc = NULL;
+  fIsActive = False;
+  flushQueue();
+  fOurReplicator.noteReplicaDeactivation();
+}
+
+inline void SharedFrameReplica::enqueueFrame(SharedFrame* frame) {
+  Boolean makeCopy = False;
+  if (fNumQueuedFrames >= fMaxQueuedFrames) {
+    // We're too far behind:
+    if (fSlowReplicaPolicy == SLOW_REPLICA_DROP_NEWEST) {
+      ++fNumFramesDropped;
+      return;
+    }
+    if (fSlowReplicaPolicy == SLOW_REPLICA_COPY) makeCopy = True;
+    if (fNumQueuedFrames == fQueueCapacity) {
+      SharedFrame* oldestFrame = fQueue[fQueueHead];
+      fNumBytesHeld -= oldestFrame->frameSize();
+      oldestFrame->release();
+      fQueueHead = (fQueueHead + 1)%fQueueCapacity;
+      --fNumQueuedFrames;
+      ++fNumFramesDropped;
+    }
+  }
+
+  if (makeCopy) {
+    SharedFrame* copy = SharedFrame::createNew(frame->frameSize());
+    if (copy == NULL) {
+      ++fNumFramesDropped;
+      return;
+    }
+    memmove(copy->writableData(), frame->data(), frame->frameSize());
+    copy->setFrameParams(frame->frameSize(), frame->numTruncatedBytes(),
+			 frame->presentationTime(), frame->durationInMicroseconds());
+    frame = copy; // we hold the only reference to this
+    ++fNumFramesCopied;
+  } else {
+    frame->addRef();
+  }
+  fQueue[(fQueueHead + fNumQueuedFrames)%fQueueCapacity] = frame;
+  ++fNumQueuedFrames;
+  fNumBytesHeld += frame->frameSize();
+
+  if (isAwaitingFrame()) scheduleDelivery();
+}
+
+inline void SharedFrameReplica::flushQueue() {
+  for (unsigned i = 0; i < fNumQueuedFrames; ++i) {
+    fQueue[(fQueueHead + i)%fQueueCapacity]->release();
+  }
+  fQueueHead = fNumQueuedFrames = 0;
+  fNumBytesHeld = 0;
+}
+
+inline void SharedFrameReplica::requestOrDeliver() {
+  fIsActive = True;
+  if (fNumQueuedFrames > 0 || fOurReplicator.fInputSourceHasClosed) {
+    scheduleDelivery();
+  } else {
+    fOurReplicator.requestFrame(); // we'll be given the frame when it arrives
+  }
+}
+
+inline void SharedFrameReplica::scheduleDelivery() {
+  if (nextTask() != NULL) return; // a delivery is already pending
+  nextTask() = envir().taskScheduler().scheduleDelayedTask(0, deliverFrame0, this);
+}
+
+inline void SharedFrameReplica::deliverFrame0(void* clientData) {
+  ((SharedFrameReplica*)clientData)->deliverFrame();
+}
+
+inline void SharedFrameReplica::deliverFrame() {
+  nextTask() = NULL;
+  if (!isAwaitingFrame()) return; // we're not ready for the frame yet; it stays queued
+
+  if (fNumQueuedFrames == 0) {
+    if (fOurReplicator.fInputSourceHasClosed) {
+      if (fAfterGettingSharedFunc != NULL) {
+	fAfterGettingSharedFunc = NULL;
+	if (fSharedOnCloseFunc != NULL) (*fSharedOnCloseFunc)(fSharedOnCloseClientData);
+      } else {
+	handleClosure();
+      }
+    } else {
+      fOurReplicator.requestFrame();
+    }
+    return;
+  }
+
+  SharedFrame* frame = fQueue[fQueueHead];
+  fQueueHead = (fQueueHead + 1)%fQueueCapacity;
+  --fNumQueuedFrames;
+  fNumBytesHeld -= frame->frameSize();
+  ++fNumFramesDelivered;
+
+  if (fAfterGettingSharedFunc != NULL) {
+    // Hand our reference to the consumer, which reads the frame in place:
+    afterGettingSharedFrameFunc* afterGettingFunc = fAfterGettingSharedFunc;
+    fAfterGettingSharedFunc = NULL; // in case the consumer asks for another frame from within its callback
+    (*afterGettingFunc)(fAfterGettingSharedClientData, frame);
+  } else {
+    // Our downstream object needs the frame in its own buffer (at "fTo"):
+    fFrameSize = frame->copyTo(fTo, fMaxSize, fNumTruncatedBytes);
+    fPresentationTime = frame->presentationTime();
+    fDurationInMicroseconds = frame->durationInMicroseconds();
+    frame->release();
+
+    FramedSource::afterGetting(this);
+  }
+}
+
+#endif
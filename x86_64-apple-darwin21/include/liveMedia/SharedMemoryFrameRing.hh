@@ -0,0 +1,529 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A fixed-size ring buffer of frames, in (POSIX) shared memory, that's written by one process, and read - in place -
+// by any number of other processes.  This lets one "RTSPClient" (e.g.) receive a stream, and several local consumers
+// (recording, analytics, live view) read its frames, without each of them having its own connection to the server.
+// Also, a "MediaSink" that writes a stream into a ring, and a "FramedSource" that reads a stream from a ring.
+// C++ header
+
+#ifndef _SHARED_MEMORY_FRAME_RING_HH
+#define _SHARED_MEMORY_FRAME_RING_HH
+
+#ifndef _MEDIA_SINK_HH
+#include "MediaSink.hh"
+#endif
+
+#if !defined(__WIN32__) && !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SHARED_MEMORY_FRAME_RING_DESCRIPTION_SIZE 1024
+
+// A frame, as read from a ring:
+struct SharedMemoryFrame {
+  u_int64_t seqNum;
+  unsigned char const* data; // points into the shared memory (valid only while "frameIsStillValid()")
+  unsigned size;
+  unsigned numTruncatedBytes;
+  struct timeval presentationTime;
+  unsigned durationInMicroseconds;
+  u_int64_t dataPosition; // (used to check validity)
+};
+
+class SharedMemoryFrameRing {
+public:
+  static SharedMemoryFrameRing* createNew(UsageEnvironment& env, char const* name,
+					  unsigned dataSize, unsigned numSlots, char const* description = NULL,
+					  mode_t mode = 0600, Boolean replaceExisting = False);
+      // Creates the ring named "name" (a POSIX shared memory object name, e.g. "/camera1"), for writing, with
+      // permissions "mode" (by default, only our own user can attach to it).
+      // The ring holds at most "numSlots" frames, and "dataSize" bytes of frame data; older frames are overwritten.
+      // "description" (optional) is a string - e.g., the stream's MIME type and SDP 'fmtp' parameters - for readers.
+      // If a ring named "name" already exists, then this fails (with "errno" EEXIST) - unless "replaceExisting" is True
+      // (e.g., to recover from a writer that crashed), in which case the old ring's name is removed first.  (Don't do
+      // this if another writer might still be using it.)
+  static SharedMemoryFrameRing* attach(UsageEnvironment& env, char const* name);
+      // Opens an existing ring, for reading.  Returns NULL (and sets "env"s result message) if there's none.
+  ~SharedMemoryFrameRing(); // if we're the writer, this also removes the ring's name
+
+  Boolean isWriter() const { return fIsWriter; }
+  char const* description() const;
+  unsigned dataSize() const;
+  unsigned numSlots() const;
+
+  // Writing (by the one writer):
+  unsigned char* beginFrame(unsigned maxFrameSize);
+      // Returns where the next frame (of up to "maxFrameSize" bytes) should be written.
+      // ("maxFrameSize" must be no more than half of the ring's "dataSize".)
+  void endFrame(unsigned frameSize, unsigned numTruncatedBytes,
+		struct timeval presentationTime, unsigned durationInMicroseconds);
+      // Makes the frame that was written at "beginFrame()" visible to readers.
+  void markAsClosed(); // tells readers that no more frames will be written
+
+  // Reading (by any number of readers):
+  u_int64_t nextSeqNum() const; // the sequence number that the next frame to be written will have
+  u_int64_t oldestSeqNum() const; // the sequence number of the oldest frame that's (probably) still in the ring
+  Boolean isClosed() const;
+  Boolean readFrame(u_int64_t seqNum, SharedMemoryFrame& frame) const;
+      // Returns False if frame "seqNum" hasn't been written yet, or has already been overwritten.
+  Boolean frameIsStillValid(SharedMemoryFrame const& frame) const;
+      // Returns True iff "frame.data" has not (yet) been overwritten.  Call this *after* using the data.
+
+private:
+  struct Header;
+  struct Slot;
+  SharedMemoryFrameRing(char const* name, Boolean isWriter, void* mapping, size_t mappingSize);
+
+  Header& header() const { return *(Header*)fMapping; }
+  Slot& slot(u_int64_t seqNum) const;
+  unsigned char* data() const;
+
+private:
+  char* fName;
+  Boolean fIsWriter;
+  void* fMapping;
+  size_t fMappingSize;
+  u_int64_t fCurrentFramePosition; // used by the writer
+};
+
+// A sink that writes each frame from its source (e.g., a "MediaSubsession"s "readSource()") into a ring, without
+// copying (because the source delivers directly into the ring):
+
+class SharedMemoryFrameRingSink: public MediaSink {
+public:
+  static SharedMemoryFrameRingSink* createNew(UsageEnvironment& env, char const* ringName,
+					      unsigned dataSize = 8000000, unsigned numSlots = 1024,
+					      unsigned maxFrameSize = 1000000, char const* description = NULL,
+					      mode_t mode = 0600, Boolean replaceExisting = False);
+      // (See "SharedMemoryFrameRing::createNew()".)
+
+  SharedMemoryFrameRing& ring() const { return *fRing; }
+
+protected:
+  SharedMemoryFrameRingSink(UsageEnvironment& env, SharedMemoryFrameRing* ring, unsigned maxFrameSize);
+      // called only by createNew()
+  virtual ~SharedMemoryFrameRingSink();
+
+protected: // redefined virtual functions:
+  virtual Boolean continuePlaying();
+
+private:
+  static void afterGettingFrame(void* clientData, unsigned frameSize, unsigned numTruncatedBytes,
+				struct timeval presentationTime, unsigned durationInMicroseconds);
+  static void onRingSourceClosure(void* clientData);
+
+private:
+  SharedMemoryFrameRing* fRing;
+  unsigned fMaxFrameSize;
+};
+
+// A source that reads frames from a ring (written by another process).  It never falls more than "maxLatencyUS"
+// (of presentation time) behind the newest frame; if it does, it skips ahead.
+
+class SharedMemoryFrameRingSource: public FramedSource {
+public:
+  static SharedMemoryFrameRingSource* createNew(UsageEnvironment& env, char const* ringName,
+						unsigned maxLatencyUS = 500000, unsigned pollIntervalUS = 5000,
+						Boolean startWithNewestFrame = True);
+      // Returns NULL if the ring doesn't exist.
+      // (Because readers are in other processes, we find new frames by checking the ring every "pollIntervalUS".)
+
+  SharedMemoryFrameRing& ring() const { return *fRing; }
+  u_int64_t numFramesSkipped() const { return fNumFramesSkipped; }
+
+protected:
+  SharedMemoryFrameRingSource(UsageEnvironment& env, SharedMemoryFrameRing* ring,
+			      unsigned maxLatencyUS, unsigned pollIntervalUS, Boolean startWithNewestFrame);
+      // called only by createNew()
+  virtual ~SharedMemoryFrameRingSource();
+
+private:
+  // redefined virtual functions:
+  virtual void doGetNextFrame();
+  virtual void doStopGettingFrames();
+
+private:
+  static void checkRing(void* clientData);
+  Boolean deliverFrame(); // returns False if no frame is available yet
+  void skipToLatencyLimit();
+
+private:
+  SharedMemoryFrameRing* fRing;
+  unsigned fMaxLatencyUS, fPollIntervalUS;
+  u_int64_t fNextSeqNum;
+  u_int64_t fNumFramesSkipped;
+  TaskToken fPollTask;
+};
+
+
+////////// Implementation //////////
+
+#define SHARED_MEMORY_FRAME_RING_MAGIC "LMFRING1"
+#define SHARED_MEMORY_FRAME_RING_ALIGNMENT 16
+
+struct SharedMemoryFrameRing::Header {
+  char magic[8];
+  u_int32_t dataSize, numSlots;
+  u_int64_t nextSeqNum; // written with 'release' semantics after each frame
+  u_int64_t reservedPosition; // data (at positions < this) may be being overwritten
+  u_int32_t isClosed;
+  u_int32_t unused;
+  char description[SHARED_MEMORY_FRAME_RING_DESCRIPTION_SIZE];
+};
+
+struct SharedMemoryFrameRing::Slot {
+  u_int64_t seqNumPlus1; // 0 while the slot is being (re)written
+  u_int64_t dataPosition; // (monotonic; the frame's data is at "dataPosition" % "dataSize")
+  u_int32_t size, numTruncatedBytes;
+  int64_t presentationTimeUS;
+  u_int32_t durationInMicroseconds;
+  u_int32_t unused;
+};
+
+inline SharedMemoryFrameRing* SharedMemoryFrameRing::createNew(UsageEnvironment& env, char const* name,
+							       unsigned dataSize, unsigned numSlots, char const* description,
+							       mode_t mode, Boolean replaceExisting) {
+  if (name == NULL || dataSize == 0 || numSlots == 0) return NULL;
+  dataSize = (dataSize + SHARED_MEMORY_FRAME_RING_ALIGNMENT-1)&~(SHARED_MEMORY_FRAME_RING_ALIGNMENT-1);
+
+  if (replaceExisting) shm_unlink(name);
+  int fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, mode);
+  if (fd < 0) {
+    env.setResultErrMsg("shm_open() failed: ");
+    return NULL;
+  }
+  size_t mappingSize = sizeof (Header) + (size_t)numSlots*sizeof (Slot) + dataSize;
+  if (ftruncate(fd, (off_t)mappingSize) != 0) {
+    env.setResultErrMsg("ftruncate() failed: ");
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+  void* mapping = mmap(NULL, mappingSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    env.setResultErrMsg("mmap() failed: ");
+    shm_unlink(name);
+    return NULL;
+  }
+
+  // (The new memory is all zero, so the slots are all empty.)
+  Header& header = *(Header*)mapping;
+  header.dataSize = dataSize;
+  header.numSlots = numSlots;
+  if (description != NULL) {
+    strncpy(header.description, description, sizeof header.description - 1);
+  }
+  __atomic_store_n(&header.nextSeqNum, 0, __ATOMIC_RELEASE);
+  memcpy(header.magic, SHARED_MEMORY_FRAME_RING_MAGIC, sizeof header.magic); // last, so readers see a complete header
+
+  return new SharedMemoryFrameRing(name, True, mapping, mappingSize);
+}
+
+inline SharedMemoryFrameRing* SharedMemoryFrameRing::attach(UsageEnvironment& env, char const* name) {
+  if (name == NULL) return NULL;
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    env.setResultMsg("no shared memory frame ring named \"", name, "\"");
+    return NULL;
+  }
+
+  struct stat sb;
+  void* mapping = MAP_FAILED;
+  size_t mappingSize = 0;
+  if (fstat(fd, &sb) == 0 && (size_t)sb.st_size >= sizeof (Header)) {
+    mappingSize = (size_t)sb.st_size;
+    mapping = mmap(NULL, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    env.setResultMsg("unable to map shared memory frame ring \"", name, "\"");
+    return NULL;
+  }
+
+  Header const& header = *(Header const*)mapping;
+  if (memcmp(header.magic, SHARED_MEMORY_FRAME_RING_MAGIC, sizeof header.magic) != 0
+      || sizeof (Header) + (size_t)header.numSlots*sizeof (Slot) + header.dataSize > mappingSize) {
+    env.setResultMsg("\"", name, "\" is not a (complete) shared memory frame ring");
+    munmap(mapping, mappingSize);
+    return NULL;
+  }
+
+  return new SharedMemoryFrameRing(name, False, mapping, mappingSize);
+}
+
+inline SharedMemoryFrameRing::SharedMemoryFrameRing(char const* name, Boolean isWriter, void* mapping, size_t mappingSize)
+  : fName(strDup(name)), fIsWriter(isWriter), fMapping(mapping), fMappingSize(mappingSize), fCurrentFramePosition(0) {
+}
+
+inline SharedMemoryFrameRing::~SharedMemoryFrameRing() {
+  if (fIsWriter) {
+    markAsClosed();
+    shm_unlink(fName); // readers that have already attached keep their mapping
+  }
+  munmap(fMapping, fMappingSize);
+  delete[] fName;
+}
+
+inline char const* SharedMemoryFrameRing::description() const { return header().description; }
+inline unsigned SharedMemoryFrameRing::dataSize() const { return header().dataSize; }
+inline unsigned SharedMemoryFrameRing::numSlots() const { return header().numSlots; }
+
+inline SharedMemoryFrameRing::Slot& SharedMemoryFrameRing::slot(u_int64_t seqNum) const {
+  return ((Slot*)((char*)fMapping + sizeof (Header)))[seqNum%header().numSlots];
+}
+
+inline unsigned char* SharedMemoryFrameRing::data() const {
+  return (unsigned char*)fMapping + sizeof (Header) + (size_t)header().numSlots*sizeof (Slot);
+}
+
+inline unsigned char* SharedMemoryFrameRing::beginFrame(unsigned maxFrameSize) {
+  Header& h = header();
+  if (maxFrameSize > h.dataSize/2) maxFrameSize = h.dataSize/2;
+
+  // Frames are kept contiguous, so if this one might not fit before the end of the data area, start it at the beginning:
+  u_int64_t position = fCurrentFramePosition;
+  if (position%h.dataSize + maxFrameSize > h.dataSize) position += h.dataSize - position%h.dataSize;
+  fCurrentFramePosition = position;
+
+  // Tell readers that the data that we might now overwrite is no longer valid - before we write it:
+  u_int64_t reservedPosition = position + maxFrameSize;
+  if (reservedPosition > __atomic_load_n(&h.reservedPosition, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&h.reservedPosition, reservedPosition, __ATOMIC_RELAXED);
+  }
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  return data() + position%h.dataSize;
+}
+
+inline void SharedMemoryFrameRing::endFrame(unsigned frameSize, unsigned numTruncatedBytes,
+					    struct timeval presentationTime, unsigned durationInMicroseconds) {
+  Header& h = header();
+  u_int64_t seqNum = __atomic_load_n(&h.nextSeqNum, __ATOMIC_RELAXED);
+  Slot& s = slot(seqNum);
+
+  __atomic_store_n(&s.seqNumPlus1, 0, __ATOMIC_RELAXED); // the slot's previous frame is gone
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  s.dataPosition = fCurrentFramePosition;
+  s.size = frameSize;
+  s.numTruncatedBytes = numTruncatedBytes;
+  s.presentationTimeUS = (int64_t)presentationTime.tv_sec*1000000 + presentationTime.tv_usec;
+  s.durationInMicroseconds = durationInMicroseconds;
+  __atomic_store_n(&s.seqNumPlus1, seqNum + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&h.nextSeqNum, seqNum + 1, __ATOMIC_RELEASE);
+
+  fCurrentFramePosition += (frameSize + SHARED_MEMORY_FRAME_RING_ALIGNMENT-1)&~(SHARED_MEMORY_FRAME_RING_ALIGNMENT-1);
+}
+
+inline void SharedMemoryFrameRing::markAsClosed() {
+  __atomic_store_n(&header().isClosed, 1, __ATOMIC_RELEASE);
+}
+
+inline u_int64_t SharedMemoryFrameRing::nextSeqNum() const {
+  return __atomic_load_n(&header().nextSeqNum, __ATOMIC_ACQUIRE);
+}
+
+inline u_int64_t SharedMemoryFrameRing::oldestSeqNum() const {
+  u_int64_t next = nextSeqNum();
+  return next > header().numSlots ? next - header().numSlots : 0;
+}
+
+inline Boolean SharedMemoryFrameRing::isClosed() const {
+  return __atomic_load_n(&header().isClosed, __ATOMIC_ACQUIRE) != 0;
+}
+
+inline Boolean SharedMemoryFrameRing::readFrame(u_int64_t seqNum, SharedMemoryFrame& frame) const {
+  Slot const& s = slot(seqNum);
+  if (__atomic_load_n(&s.seqNumPlus1, __ATOMIC_ACQUIRE) != seqNum + 1) return False;
+
+  frame.seqNum = seqNum;
+  frame.dataPosition = s.dataPosition;
+  frame.size = s.size;
+  frame.numTruncatedBytes = s.numTruncatedBytes;
+  int64_t presentationTimeUS = s.presentationTimeUS;
+  frame.presentationTime.tv_sec = (long)(presentationTimeUS/1000000);
+  frame.presentationTime.tv_usec = (long)(presentationTimeUS%1000000);
+  frame.durationInMicroseconds = s.durationInMicroseconds;
+  frame.data = data() + frame.dataPosition%header().dataSize;
+
+  // Check that the slot wasn't rewritten while we were reading it, and that the data is still there:
+  return frameIsStillValid(frame);
+}
+
+inline Boolean SharedMemoryFrameRing::frameIsStillValid(SharedMemoryFrame const& frame) const {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  Header const& h = header();
+  if (__atomic_load_n(&slot(frame.seqNum).seqNumPlus1, __ATOMIC_ACQUIRE) != frame.seqNum + 1) return False;
+
+  // The data has been overwritten once the writer has reserved data past the frame's position plus a full ring:
+  return __atomic_load_n(&h.reservedPosition, __ATOMIC_ACQUIRE) <= frame.dataPosition + h.dataSize;
+}
+
+// SharedMemoryFrameRingSink //
+
+inline SharedMemoryFrameRingSink* SharedMemoryFrameRingSink::createNew(UsageEnvironment& env, char const* ringName,
+								       unsigned dataSize, unsigned numSlots,
+								       unsigned maxFrameSize, char const* description,
+								       mode_t mode, Boolean replaceExisting) {
+  SharedMemoryFrameRing* ring
+    = SharedMemoryFrameRing::createNew(env, ringName, dataSize, numSlots, description, mode, replaceExisting);
+  if (ring == NULL) return NULL;
+
+  return new SharedMemoryFrameRingSink(env, ring, maxFrameSize);
+}
+
+inline SharedMemoryFrameRingSink::SharedMemoryFrameRingSink(UsageEnvironment& env, SharedMemoryFrameRing* ring,
+							     unsigned maxFrameSize)
+  : MediaSink(env), fRing(ring), fMaxFrameSize(maxFrameSize > ring->dataSize()/2 ? ring->dataSize()/2 : maxFrameSize) {
+}
+
+inline SharedMemoryFrameRingSink::~SharedMemoryFrameRingSink() {
+  delete fRing;
+}
+
+inline Boolean SharedMemoryFrameRingSink::continuePlaying() {
+  if (fSource == NULL) return False;
+
+  fSource->getNextFrame(fRing->beginFrame(fMaxFrameSize), fMaxFrameSize,
+			afterGettingFrame, this, onRingSourceClosure, this);
+  return True;
+}
+
+inline void SharedMemoryFrameRingSink::afterGettingFrame(void* clientData, unsigned frameSize, unsigned numTruncatedBytes,
+							 struct timeval presentationTime, unsigned durationInMicroseconds) {
+  SharedMemoryFrameRingSink* sink = (SharedMemoryFrameRingSink*)clientData;
+  sink->fRing->endFrame(frameSize, numTruncatedBytes, presentationTime, durationInMicroseconds);
+  sink->continuePlaying();
+}
+
+inline void SharedMemoryFrameRingSink::onRingSourceClosure(void* clientData) {
+  SharedMemoryFrameRingSink* sink = (SharedMemoryFrameRingSink*)clientData;
+  sink->fRing->markAsClosed();
+  sink->onSourceClosure();
+}
+
+// SharedMemoryFrameRingSource //
+
+inline SharedMemoryFrameRingSource* SharedMemoryFrameRingSource::createNew(UsageEnvironment& env, char const* ringName,
+									   unsigned maxLatencyUS, unsigned pollIntervalUS,
+									   Boolean startWithNewestFrame) {
+  SharedMemoryFrameRing* ring = SharedMemoryFrameRing::attach(env, ringName);
+  if (ring == NULL) return NULL;
+
+  return new SharedMemoryFrameRingSource(env, ring, maxLatencyUS, pollIntervalUS, startWithNewestFrame);
+}
+
+inline SharedMemoryFrameRingSource::SharedMemoryFrameRingSource(UsageEnvironment& env, SharedMemoryFrameRing* ring,
+								 unsigned maxLatencyUS, unsigned pollIntervalUS,
+								 Boolean startWithNewestFrame)
+  : FramedSource(env), fRing(ring), fMaxLatencyUS(maxLatencyUS), fPollIntervalUS(pollIntervalUS),
+    fNumFramesSkipped(0), fPollTask(NULL) {
+  u_int64_t next = ring->nextSeqNum();
+  fNextSeqNum = startWithNewestFrame && next > 0 ? next - 1 : ring->oldestSeqNum();
+}
+
+inline SharedMemoryFrameRingSource::~SharedMemoryFrameRingSource() {
+  envir().taskScheduler().unscheduleDelayedTask(fPollTask);
+  delete fRing;
+}
+
+inline void SharedMemoryFrameRingSource::doGetNextFrame() {
+  if (deliverFrame()) return;
+
+  if (fRing->isClosed() && fNextSeqNum >= fRing->nextSeqNum()) {
+    handleClosure();
+    return;
+  }
+  fPollTask = envir().taskScheduler().scheduleDelayedTask(fPollIntervalUS, checkRing, this);
+}
+
+inline void SharedMemoryFrameRingSource::doStopGettingFrames() {
+  envir().taskScheduler().unscheduleDelayedTask(fPollTask);
+}
+
+inline void SharedMemoryFrameRingSource::checkRing(void* clientData) {
+  SharedMemoryFrameRingSource* source = (SharedMemoryFrameRingSource*)clientData;
+  source->fPollTask = NULL;
+  source->doGetNextFrame();
+}
+
+inline void SharedMemoryFrameRingSource::skipToLatencyLimit() {
+  // If we've been lapped, start again at the oldest frame that's still there:
+  u_int64_t oldest = fRing->oldestSeqNum();
+  if (fNextSeqNum < oldest) {
+    fNumFramesSkipped += oldest - fNextSeqNum;
+    fNextSeqNum = oldest;
+  }
+
+  // Then, skip frames that are more than "fMaxLatencyUS" older than the newest frame:
+  u_int64_t next = fRing->nextSeqNum();
+  SharedMemoryFrame newest, frame;
+  if (fMaxLatencyUS == 0 || next == 0 || !fRing->readFrame(next - 1, newest)) return;
+  int64_t newestUS = (int64_t)newest.presentationTime.tv_sec*1000000 + newest.presentationTime.tv_usec;
+  while (fNextSeqNum + 1 < next && fRing->readFrame(fNextSeqNum, frame)) {
+    int64_t frameUS = (int64_t)frame.presentationTime.tv_sec*1000000 + frame.presentationTime.tv_usec;
+    if (newestUS - frameUS <= (int64_t)fMaxLatencyUS) break;
+    ++fNextSeqNum;
+    ++fNumFramesSkipped;
+  }
+}
+
+inline Boolean SharedMemoryFrameRingSource::deliverFrame() {
+  while (fNextSeqNum < fRing->nextSeqNum()) {
+    skipToLatencyLimit();
+
+    SharedMemoryFrame frame;
+    if (!fRing->readFrame(fNextSeqNum, frame)) {
+      // The frame was overwritten before we could read it:
+      ++fNextSeqNum;
+      ++fNumFramesSkipped;
+      continue;
+    }
+
+    // Copy the frame to our reader's buffer, then check that the writer hadn't overwritten it in the meantime:
+    unsigned size = frame.size;
+    if (size > fMaxSize) {
+      fNumTruncatedBytes = frame.numTruncatedBytes + (size - fMaxSize);
+      size = fMaxSize;
+    } else {
+      fNumTruncatedBytes = frame.numTruncatedBytes;
+    }
+    memcpy(fTo, frame.data, size);
+    if (!fRing->frameIsStillValid(frame)) {
+      ++fNextSeqNum;
+      ++fNumFramesSkipped;
+      continue;
+    }
+
+    fFrameSize = size;
+    fPresentationTime = frame.presentationTime;
+    fDurationInMicroseconds = frame.durationInMicroseconds;
+    ++fNextSeqNum;
+
+    nextTask() = envir().taskScheduler().scheduleDelayedTask(0, (TaskFunc*)FramedSource::afterGetting, this);
+    return True;
+  }
+
+  return False;
+}
+
+#endif
+
+#endif
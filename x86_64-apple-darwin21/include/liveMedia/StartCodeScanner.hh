@@ -0,0 +1,149 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A routine that finds the next 'start code' (0x000001) - as used by MPEG-1, 2 and 4 video, and by H.264 and H.265
+// 'byte streams' - in a buffer.  It looks at 16 (SSE2 or NEON) or 32 (AVX2, if the CPU has it) bytes at a time,
+// falling back to a (byte skipping) scalar search on other CPUs, and for the last few bytes of a buffer.
+// C++ header
+
+#ifndef _START_CODE_SCANNER_HH
+#define _START_CODE_SCANNER_HH
+
+#ifndef _NET_COMMON_H
+#include "NetCommon.h"
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define START_CODE_SCANNER_USE_SSE2 1
+#include <emmintrin.h>
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define START_CODE_SCANNER_USE_AVX2 1 // if the CPU has it (checked at run time)
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define START_CODE_SCANNER_USE_NEON 1
+#include <arm_neon.h>
+#endif
+
+u_int8_t const* findStartCode(u_int8_t const* from, u_int8_t const* to);
+    // Returns a pointer to the first byte of the first start code that lies entirely within [from,to),
+    // or "to" if there's none.  (Note that a start code that's preceded by another 0x00 byte - i.e., a 4-byte H.264
+    // or H.265 start code - is found at its last 3 bytes.)
+
+
+////////// Implementation //////////
+
+inline u_int8_t const* findStartCodeScalar(u_int8_t const* from, u_int8_t const* to) {
+  // Look at every third byte, because a start code's last byte is 0x01, and the two bytes before it are 0x00:
+  u_int8_t const* p = from;
+  while (p + 3 <= to) {
+    if (p[2] > 1) {
+      p += 3;
+    } else if (p[2] == 0) {
+      ++p;
+    } else if (p[0] == 0 && p[1] == 0) {
+      return p;
+    } else {
+      p += 3;
+    }
+  }
+  return to;
+}
+
+#ifdef START_CODE_SCANNER_USE_SSE2
+inline u_int8_t const* findStartCodeSSE2(u_int8_t const* from, u_int8_t const* to) {
+  __m128i const zero = _mm_setzero_si128();
+  __m128i const one = _mm_set1_epi8(1);
+
+  // Test 16 positions at a time: each needs bytes p[i], p[i+1] and p[i+2]:
+  u_int8_t const* p = from;
+  for (; p + 16 + 2 <= to; p += 16) {
+    __m128i b0 = _mm_loadu_si128((__m128i const*)p);
+    __m128i b1 = _mm_loadu_si128((__m128i const*)(p+1));
+    __m128i b2 = _mm_loadu_si128((__m128i const*)(p+2));
+    __m128i match = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+				  _mm_cmpeq_epi8(b2, one));
+    int mask = _mm_movemask_epi8(match);
+    if (mask != 0) {
+#if defined(__GNUC__) || defined(__clang__)
+      return p + __builtin_ctz((unsigned)mask);
+#else
+      unsigned i = 0;
+      while ((mask&(1<<i)) == 0) ++i;
+      return p + i;
+#endif
+    }
+  }
+  return findStartCodeScalar(p, to);
+}
+#endif
+
+#ifdef START_CODE_SCANNER_USE_AVX2
+__attribute__((target("avx2")))
+inline u_int8_t const* findStartCodeAVX2(u_int8_t const* from, u_int8_t const* to) {
+  __m256i const zero = _mm256_setzero_si256();
+  __m256i const one = _mm256_set1_epi8(1);
+
+  u_int8_t const* p = from;
+  for (; p + 32 + 2 <= to; p += 32) {
+    __m256i b0 = _mm256_loadu_si256((__m256i const*)p);
+    __m256i b1 = _mm256_loadu_si256((__m256i const*)(p+1));
+    __m256i b2 = _mm256_loadu_si256((__m256i const*)(p+2));
+    __m256i match = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(b0, zero), _mm256_cmpeq_epi8(b1, zero)),
+				     _mm256_cmpeq_epi8(b2, one));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(match);
+    if (mask != 0) return p + __builtin_ctz(mask);
+  }
+  return findStartCodeSSE2(p, to);
+}
+#endif
+
+#ifdef START_CODE_SCANNER_USE_NEON
+inline u_int8_t const* findStartCodeNEON(u_int8_t const* from, u_int8_t const* to) {
+  uint8x16_t const zero = vdupq_n_u8(0);
+  uint8x16_t const one = vdupq_n_u8(1);
+
+  u_int8_t const* p = from;
+  for (; p + 16 + 2 <= to; p += 16) {
+    uint8x16_t match = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(p), zero), vceqq_u8(vld1q_u8(p+1), zero)),
+				vceqq_u8(vld1q_u8(p+2), one));
+    uint64x2_t halves = vreinterpretq_u64_u8(match);
+    if ((vgetq_lane_u64(halves, 0) | vgetq_lane_u64(halves, 1)) != 0) {
+      // There's a start code in these 16 positions; find exactly where:
+      return findStartCodeScalar(p, p + 16 + 2);
+    }
+  }
+  return findStartCodeScalar(p, to);
+}
+#endif
+
+inline u_int8_t const* findStartCode(u_int8_t const* from, u_int8_t const* to) {
+  if (from >= to) return to;
+
+#if defined(START_CODE_SCANNER_USE_AVX2)
+  static int const cpuHasAVX2 = __builtin_cpu_supports("avx2");
+  return cpuHasAVX2 ? findStartCodeAVX2(from, to) : findStartCodeSSE2(from, to);
+#elif defined(START_CODE_SCANNER_USE_SSE2)
+  return findStartCodeSSE2(from, to);
+#elif defined(START_CODE_SCANNER_USE_NEON)
+  return findStartCodeNEON(from, to);
+#else
+  return findStartCodeScalar(from, to);
+#endif
+}
+
+#endif
@@ -0,0 +1,378 @@
+/**********
+This library is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the
+Free Software Foundation; either version 3 of the License, or (at your
+option) any later version. (See <http://www.gnu.org/copyleft/lesser.html>.)
+
+This library is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this library; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+**********/
+// "liveMedia"
+// Copyright (c) 1996-2022 Live Networks, Inc.  All rights reserved.
+// A filter that splits a video elementary 'byte stream' (e.g., from a "ByteStreamFileSource") into discrete units,
+// by searching (with "findStartCode()") for start codes in large blocks of input data, rather than by parsing the
+// stream a byte at a time.  Its output is intended to be fed into a 'discrete' framer:
+//   - H.264 or H.265: each NAL unit (without its start code) => "H264VideoStreamDiscreteFramer" or
+//     "H265VideoStreamDiscreteFramer".  Because these framers don't compute presentation times, we do, given the
+//     stream's frame rate.
+//   - MPEG-1 or 2 video: each picture (with any preceding sequence and GOP headers, and including start codes)
+//     => "MPEG1or2VideoStreamDiscreteFramer"
+//   - MPEG-4 video: each VOP (with any preceding VOS, VO, VOL and GOV headers, and including start codes)
+//     => "MPEG4VideoStreamDiscreteFramer"
+// C++ header
+
+#ifndef _START_CODE_SPLITTER_HH
+#define _START_CODE_SPLITTER_HH
+
+#ifndef _FRAMED_FILTER_HH
+#include "FramedFilter.hh"
+#endif
+#ifndef _START_CODE_SCANNER_HH
+#include "StartCodeScanner.hh"
+#endif
+#include <string.h>
+
+#define START_CODE_SPLITTER_DEFAULT_BUFFER_SIZE (1024*1024)
+#define START_CODE_SPLITTER_MAX_BUFFER_SIZE (64*1024*1024) // the largest unit that we deliver without truncation
+
+class StartCodeSplitter: public FramedFilter {
+public:
+  enum StreamType { H264_VIDEO, H265_VIDEO, MPEG1or2_VIDEO, MPEG4_VIDEO };
+
+  static StartCodeSplitter* createNew(UsageEnvironment& env, FramedSource* inputSource, StreamType streamType,
+				      double frameRate = 30.0,
+				      unsigned bufferSize = START_CODE_SPLITTER_DEFAULT_BUFFER_SIZE);
+      // "frameRate" is used (only for H.264 and H.265) to compute the presentation time of each access unit.
+      // "bufferSize" is the size of each read from "inputSource"; it grows (as far as
+      // START_CODE_SPLITTER_MAX_BUFFER_SIZE) if a unit is larger.
+
+  StreamType streamType() const { return fStreamType; }
+
+protected:
+  StartCodeSplitter(UsageEnvironment& env, FramedSource* inputSource, StreamType streamType,
+		    double frameRate, unsigned bufferSize);
+      // called only by createNew()
+  virtual ~StartCodeSplitter();
+
+private:
+  // redefined virtual functions:
+  virtual void doGetNextFrame();
+  virtual void doStopGettingFrames();
+
+private:
+  static void afterGettingInput(void* clientData, unsigned frameSize, unsigned numTruncatedBytes,
+				struct timeval presentationTime, unsigned durationInMicroseconds);
+  static void handleInputClosure(void* clientData);
+  void readMoreInput();
+  Boolean deliverUnit(Boolean calledFromDoGetNextFrame);
+      // returns False iff we need more input data first
+
+  Boolean unitEndsAt(unsigned startCodePos, Boolean& needMoreData);
+      // Does the start code at "startCodePos" begin a new unit (for our "fStreamType")?
+  void noteUnitStart(unsigned startCodePos);
+  Boolean nalUnitBeginsAccessUnit(unsigned startCodePos) const;
+  Boolean isVCLNALUnit(unsigned startCodePos) const;
+  static Boolean isPictureStartCode(StreamType streamType, u_int8_t code);
+
+private:
+  StreamType fStreamType;
+  unsigned fFrameDuration; // in microseconds (H.264 and H.265 only)
+  u_int8_t* fBuffer;
+  unsigned fBufferSize, fReadSize;
+  unsigned fDataEnd; // the amount of valid data in "fBuffer"
+  Boolean fHaveUnitStart;
+  unsigned fUnitStart; // the position (in "fBuffer") of the current unit's start code (if "fHaveUnitStart")
+  unsigned fScanPos; // where to continue searching for the next start code
+  Boolean fInputIsClosed;
+  Boolean fSkippingOversizedUnit;
+
+  // Per-unit state:
+  Boolean fSeenPictureInUnit; // MPEG video only
+  Boolean fSeenVCLInAccessUnit; // H.264 and H.265 only
+  Boolean fHaveStarted;
+  struct timeval fAccessUnitPresentationTime;
+};
+
+
+////////// Implementation //////////
+
+inline StartCodeSplitter* StartCodeSplitter::createNew(UsageEnvironment& env, FramedSource* inputSource,
+						       StreamType streamType, double frameRate, unsigned bufferSize) {
+  if (inputSource == NULL) return NULL;
+
+  return new StartCodeSplitter(env, inputSource, streamType, frameRate, bufferSize);
+}
+
+inline StartCodeSplitter::StartCodeSplitter(UsageEnvironment& env, FramedSource* inputSource, StreamType streamType,
+					    double frameRate, unsigned bufferSize)
+  : FramedFilter(env, inputSource), fStreamType(streamType),
+    fFrameDuration(frameRate > 0.0 ? (unsigned)(1000000/frameRate) : 0),
+    fBufferSize(bufferSize < 1024 ? 1024 : bufferSize), fReadSize(fBufferSize), fDataEnd(0),
+    fHaveUnitStart(False), fUnitStart(0), fScanPos(0), fInputIsClosed(False), fSkippingOversizedUnit(False),
+    fSeenPictureInUnit(False), fSeenVCLInAccessUnit(False), fHaveStarted(False) {
+  fBuffer = new u_int8_t[fBufferSize];
+  fAccessUnitPresentationTime.tv_sec = fAccessUnitPresentationTime.tv_usec = 0;
+}
+
+inline StartCodeSplitter::~StartCodeSplitter() {
+  delete[] fBuffer;
+}
+
+inline Boolean StartCodeSplitter::isPictureStartCode(StreamType streamType, u_int8_t code) {
+  return streamType == MPEG1or2_VIDEO ? code == 0x00 : code == 0xB6; // picture_start_code, or vop_start_code
+}
+
+inline Boolean StartCodeSplitter::isVCLNALUnit(unsigned startCodePos) const {
+  u_int8_t const* nal = &fBuffer[startCodePos + 3];
+  if (fStreamType == H264_VIDEO) {
+    u_int8_t nal_unit_type = nal[0]&0x1F;
+    return nal_unit_type >= 1 && nal_unit_type <= 5;
+  } else {
+    u_int8_t nal_unit_type = (nal[0]&0x7E)>>1;
+    return nal_unit_type <= 31;
+  }
+}
+
+inline Boolean StartCodeSplitter::nalUnitBeginsAccessUnit(unsigned startCodePos) const {
+  // (Requires that the NAL unit header, and the byte following it, be in "fBuffer".)
+  // See the H.264 and H.265 specs, sections 7.4.1.2.3 and 7.4.2.4.4:
+  if (!fSeenVCLInAccessUnit) return False;
+  if (startCodePos + 3 + (fStreamType == H264_VIDEO ? 2 : 3) > fDataEnd) return True; // at the end of the stream
+
+  u_int8_t const* nal = &fBuffer[startCodePos + 3];
+  if (fStreamType == H264_VIDEO) {
+    u_int8_t nal_unit_type = nal[0]&0x1F;
+    if (nal_unit_type >= 1 && nal_unit_type <= 5) return (nal[1]&0x80) != 0; // first_mb_in_slice == 0
+    return (nal_unit_type >= 6 && nal_unit_type <= 9) || (nal_unit_type >= 14 && nal_unit_type <= 18);
+  } else {
+    u_int8_t nal_unit_type = (nal[0]&0x7E)>>1;
+    if (nal_unit_type <= 31) return (nal[2]&0x80) != 0; // first_slice_segment_in_pic_flag
+    return (nal_unit_type >= 32 && nal_unit_type <= 35) || nal_unit_type == 39
+      || (nal_unit_type >= 41 && nal_unit_type <= 44) || (nal_unit_type >= 48 && nal_unit_type <= 55);
+  }
+}
+
+inline void StartCodeSplitter::noteUnitStart(unsigned startCodePos) {
+  fHaveUnitStart = True;
+  fUnitStart = startCodePos;
+  fScanPos = startCodePos + 3;
+  if ((fStreamType == MPEG1or2_VIDEO || fStreamType == MPEG4_VIDEO) && startCodePos + 3 < fDataEnd) {
+    fSeenPictureInUnit = isPictureStartCode(fStreamType, fBuffer[startCodePos + 3]);
+  }
+}
+
+inline Boolean StartCodeSplitter::unitEndsAt(unsigned startCodePos, Boolean& needMoreData) {
+  // Check that we have enough of the next unit to tell:
+  unsigned numHeaderBytes = fStreamType == H264_VIDEO ? 2 : fStreamType == H265_VIDEO ? 3 : 1;
+  needMoreData = startCodePos + 3 + numHeaderBytes > fDataEnd && !fInputIsClosed;
+  if (needMoreData) return False;
+  if (startCodePos + 3 + numHeaderBytes > fDataEnd) return True; // a truncated unit at the end of the stream
+
+  if (fStreamType == H264_VIDEO || fStreamType == H265_VIDEO) return True; // every NAL unit is delivered separately
+
+  // For MPEG video, a unit ends (once it has a picture) at the next picture, or the next header that precedes one:
+  u_int8_t code = fBuffer[startCodePos + 3];
+  Boolean isHeaderOrPicture = fStreamType == MPEG1or2_VIDEO
+    ? code == 0x00 || code == 0xB3 || code == 0xB8 // picture, sequence header, GOP
+    : code <= 0x2F || code == 0xB0 || code == 0xB3 || code == 0xB5 || code == 0xB6; // VO, VOL, VOS, GOV, VO, VOP
+  if (fSeenPictureInUnit && isHeaderOrPicture) return True;
+
+  if (isPictureStartCode(fStreamType, code)) fSeenPictureInUnit = True;
+  return False;
+}
+
+inline void StartCodeSplitter::doGetNextFrame() {
+  if (!deliverUnit(True)) readMoreInput();
+}
+
+inline void StartCodeSplitter::readMoreInput() {
+  if (fInputIsClosed) {
+    handleClosure();
+    return;
+  }
+
+  // Move any data that we still need to the start of the buffer, and make room (if we can) for a full read:
+  unsigned keepFrom = fHaveUnitStart ? fUnitStart : (fScanPos < fDataEnd ? fScanPos : fDataEnd);
+  if (keepFrom > 0) {
+    memmove(fBuffer, &fBuffer[keepFrom], fDataEnd - keepFrom);
+    fDataEnd -= keepFrom;
+    fScanPos -= keepFrom;
+    if (fHaveUnitStart) fUnitStart -= keepFrom;
+  }
+  if (fBufferSize - fDataEnd < fReadSize && fBufferSize < START_CODE_SPLITTER_MAX_BUFFER_SIZE) {
+    unsigned newBufferSize = 2*fBufferSize;
+    if (newBufferSize > START_CODE_SPLITTER_MAX_BUFFER_SIZE) newBufferSize = START_CODE_SPLITTER_MAX_BUFFER_SIZE;
+    u_int8_t* newBuffer = new u_int8_t[newBufferSize];
+    memmove(newBuffer, fBuffer, fDataEnd);
+    delete[] fBuffer;
+    fBuffer = newBuffer;
+    fBufferSize = newBufferSize;
+  }
+  if (fDataEnd == fBufferSize) {
+    // The current unit is too large for our buffer.  Deliver what we have of it (truncated), and skip the rest:
+    fSkippingOversizedUnit = True;
+    deliverUnit(False);
+    return;
+  }
+
+  unsigned readSize = fBufferSize - fDataEnd;
+  if (readSize > fReadSize) readSize = fReadSize;
+  fInputSource->getNextFrame(&fBuffer[fDataEnd], readSize, afterGettingInput, this, handleInputClosure, this);
+}
+
+inline void StartCodeSplitter::afterGettingInput(void* clientData, unsigned frameSize, unsigned /*numTruncatedBytes*/,
+						 struct timeval /*presentationTime*/, unsigned /*durationInMicroseconds*/) {
+  StartCodeSplitter* splitter = (StartCodeSplitter*)clientData;
+  splitter->fDataEnd += frameSize;
+  if (!splitter->deliverUnit(False)) splitter->readMoreInput();
+}
+
+inline void StartCodeSplitter::handleInputClosure(void* clientData) {
+  StartCodeSplitter* splitter = (StartCodeSplitter*)clientData;
+  splitter->fInputIsClosed = True;
+  if (!splitter->deliverUnit(False)) splitter->handleClosure();
+}
+
+inline Boolean StartCodeSplitter::deliverUnit(Boolean calledFromDoGetNextFrame) {
+  unsigned from, to, unitEnd;
+  Boolean haveNextUnit;
+  while (1) {
+    // First, find the start of a unit (discarding anything before it):
+    while (!fHaveUnitStart) {
+      u_int8_t const* startCode = findStartCode(&fBuffer[fScanPos], &fBuffer[fDataEnd]);
+      unsigned pos = (unsigned)(startCode - fBuffer);
+      if (pos + 3 >= fDataEnd) {
+        if (fInputIsClosed) {
+	  fScanPos = fDataEnd;
+	  return False;
+        }
+        fScanPos = pos < fDataEnd ? pos : fDataEnd >= 2 ? fDataEnd - 2 : 0; // we might have a partial start code
+        return False;
+      }
+      if (!fSkippingOversizedUnit || fStreamType == H264_VIDEO || fStreamType == H265_VIDEO) {
+        noteUnitStart(pos);
+        fSkippingOversizedUnit = False;
+      } else {
+        // Skip to a start code that begins a new MPEG video unit:
+        fSeenPictureInUnit = True;
+        Boolean needMoreData;
+        if (unitEndsAt(pos, needMoreData)) {
+	  noteUnitStart(pos);
+	  fSkippingOversizedUnit = False;
+        } else {
+	  if (needMoreData) { fScanPos = pos; return False; }
+	  fScanPos = pos + 3;
+        }
+      }
+    }
+
+    // Then, find where it ends:
+    haveNextUnit = False;
+    if (fSkippingOversizedUnit) {
+      unitEnd = fDataEnd;
+    } else {
+      while (1) {
+        u_int8_t const* startCode = findStartCode(&fBuffer[fScanPos], &fBuffer[fDataEnd]);
+        unsigned pos = (unsigned)(startCode - fBuffer);
+        if (pos + 3 > fDataEnd) {
+	  // There's no more start code in the data that we have:
+	  if (!fInputIsClosed) {
+	    fScanPos = fDataEnd >= fUnitStart + 5 ? fDataEnd - 2 : fUnitStart + 3; // we might have a partial start code
+	    return False;
+	  }
+	  unitEnd = fDataEnd;
+	  break;
+        }
+
+        Boolean needMoreData;
+        if (unitEndsAt(pos, needMoreData)) {
+	  unitEnd = pos;
+	  haveNextUnit = True;
+	  break;
+        }
+        if (needMoreData) {
+	  fScanPos = pos;
+	  return False;
+        }
+        fScanPos = pos + 3;
+      }
+    }
+
+    // Deliver the unit.  (For H.264 and H.265, the start code is omitted.)  Trailing zero bytes (e.g., the first byte
+    // of a 4-byte start code) are not part of it:
+    from = fUnitStart;
+    if (fStreamType == H264_VIDEO || fStreamType == H265_VIDEO) from += 3;
+    to = unitEnd;
+    while (to > from && fBuffer[to-1] == 0) --to;
+    if (to > from) break;
+
+    // The unit is empty; skip it:
+    if (haveNextUnit) {
+      noteUnitStart(unitEnd);
+    } else {
+      fHaveUnitStart = False;
+      fScanPos = fDataEnd;
+      return False;
+    }
+  }
+
+  fFrameSize = to - from;
+  fNumTruncatedBytes = 0;
+  if (fFrameSize > fMaxSize) {
+    fNumTruncatedBytes = fFrameSize - fMaxSize;
+    fFrameSize = fMaxSize;
+  }
+  memmove(fTo, &fBuffer[from], fFrameSize);
+
+  if (fStreamType == H264_VIDEO || fStreamType == H265_VIDEO) {
+    // All NAL units of an access unit get the same presentation time; the last one gets its duration:
+    if (!fHaveStarted) {
+      gettimeofday(&fAccessUnitPresentationTime, NULL);
+      fHaveStarted = True;
+    }
+    fPresentationTime = fAccessUnitPresentationTime;
+    if (isVCLNALUnit(fUnitStart)) fSeenVCLInAccessUnit = True;
+
+    if (haveNextUnit && !nalUnitBeginsAccessUnit(unitEnd)) {
+      fDurationInMicroseconds = 0;
+    } else {
+      fDurationInMicroseconds = fFrameDuration;
+      unsigned uSeconds = fAccessUnitPresentationTime.tv_usec + fFrameDuration;
+      fAccessUnitPresentationTime.tv_sec += uSeconds/1000000;
+      fAccessUnitPresentationTime.tv_usec = uSeconds%1000000;
+      fSeenVCLInAccessUnit = False;
+    }
+  } else {
+    gettimeofday(&fPresentationTime, NULL); // the discrete framer computes the actual presentation time
+    fDurationInMicroseconds = 0;
+  }
+
+  // Move on to the next unit:
+  if (haveNextUnit) {
+    noteUnitStart(unitEnd);
+  } else {
+    fHaveUnitStart = False;
+    fScanPos = fDataEnd;
+  }
+
+  if (calledFromDoGetNextFrame) {
+    // Because we didn't wait for the data, complete delivery via the event loop, to avoid unbounded recursion:
+    nextTask() = envir().taskScheduler().scheduleDelayedTask(0, (TaskFunc*)FramedSource::afterGetting, this);
+  } else {
+    afterGetting(this);
+  }
+  return True;
+}
+
+inline void StartCodeSplitter::doStopGettingFrames() {
+  envir().taskScheduler().unscheduleDelayedTask(nextTask());
+  FramedFilter::doStopGettingFrames();
+}
+
+#endif
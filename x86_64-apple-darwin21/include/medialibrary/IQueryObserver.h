@@ -0,0 +1,150 @@
+/*****************************************************************************
+ * Media Library
+ *****************************************************************************
+ * Copyright (C) 2026 VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "IQuery.h"
+
+namespace medialibrary
+{
+
+enum class QueryOperation : uint8_t
+{
+    Count,
+    Items,
+    All,
+};
+
+struct QueryTiming
+{
+    /*
+     * The query type, as provided to observeQuery(), for instance
+     * "Media::history" or "Album::tracks". This points to a static string.
+     */
+    const char* queryType;
+    QueryOperation operation;
+    /* The number of items that were fetched, or the count for Count */
+    uint32_t nbRows;
+    /* The time spent running the operation, in microseconds */
+    uint64_t executionTime;
+};
+
+class IQueryObserver
+{
+public:
+    virtual ~IQueryObserver() = default;
+    /**
+     * @brief onQueryExecuted Invoked after each operation on an observed query
+     *
+     * This is invoked synchronously from the thread which ran the query,
+     * which can be any thread, so implementations must be thread-safe and
+     * return quickly.
+     */
+    virtual void onQueryExecuted( const QueryTiming& timing ) = 0;
+};
+
+/**
+ * @brief ObservedQuery wraps a query and reports the latency of each of its
+ *        operations to an IQueryObserver
+ *
+ * Use observeQuery() to create one. Only the operations invoked through the
+ * returned query are reported: the queries which the media library runs
+ * internally aren't observed.
+ */
+template <typename T>
+class ObservedQuery : public IQuery<T>
+{
+public:
+    using Result = typename IQuery<T>::Result;
+
+    ObservedQuery( Query<T> query, const char* queryType,
+                   std::shared_ptr<IQueryObserver> observer )
+        : m_query( std::move( query ) )
+        , m_queryType( queryType )
+        , m_observer( std::move( observer ) )
+    {
+    }
+
+    virtual size_t count() override
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto res = m_query->count();
+        notify( QueryOperation::Count, res, start );
+        return res;
+    }
+
+    virtual Result items( uint32_t nbItems, uint32_t offset ) override
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto res = m_query->items( nbItems, offset );
+        notify( QueryOperation::Items, res.size(), start );
+        return res;
+    }
+
+    virtual Result all() override
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto res = m_query->all();
+        notify( QueryOperation::All, res.size(), start );
+        return res;
+    }
+
+private:
+    void notify( QueryOperation operation, size_t nbRows,
+                 std::chrono::steady_clock::time_point start )
+    {
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start );
+        QueryTiming timing;
+        timing.queryType = m_queryType;
+        timing.operation = operation;
+        timing.nbRows = static_cast<uint32_t>( nbRows );
+        timing.executionTime = static_cast<uint64_t>( duration.count() );
+        m_observer->onQueryExecuted( timing );
+    }
+
+private:
+    Query<T> m_query;
+    const char* m_queryType;
+    std::shared_ptr<IQueryObserver> m_observer;
+};
+
+/**
+ * @brief observeQuery Wraps a query so that its operations get reported to
+ *                     an observer
+ * @param query The query to observe. If nullptr, nullptr is returned.
+ * @param queryType A static string which identifies the query
+ * @param observer The observer. If nullptr, the query is returned as is.
+ */
+template <typename T>
+Query<T> observeQuery( Query<T> query, const char* queryType,
+                       std::shared_ptr<IQueryObserver> observer )
+{
+    if ( query == nullptr || observer == nullptr )
+        return query;
+    return Query<T>{ new ObservedQuery<T>( std::move( query ), queryType,
+                                           std::move( observer ) ) };
+}
+
+}